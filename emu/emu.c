@@ -0,0 +1,544 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* emu.c - emulated instrument core */
+
+/* Each device has one mutex protecting its buffers and status, and a
+ * condition variable signalled whenever output is queued, the device
+ * stops being busy, or it is aborted.  A device is 'busy' while a model
+ * callback runs; the callback may drop the mutex in emu_sleep (), so
+ * other front end calls wait for !busy rather than for the mutex alone.
+ * Clear bumps 'gen', and a blocked call that sees 'gen' change gives up
+ * with VXI11_ERR_ABORT.  A blocked call is also on the 'waiters' list
+ * under the owner (e.g. VXI-11 link) it was made for, so that an abort
+ * for one owner interrupts only that owner's calls.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <rpc/rpc.h>
+
+#include "libvxi11/vxi11.h"
+#include "libutil/util.h"
+#include "emu.h"
+#include "rpcserve.h"
+
+#define EMU_MAGIC       0x656d7531
+
+struct emu_waiter {
+    long                owner;
+    unsigned long       gen;
+    int                 aborted;
+    struct emu_waiter  *next;
+};
+
+extern struct emu_model emu_model_generic;
+extern struct emu_model emu_model_scpi;
+extern struct emu_model emu_model_hp3488;
+
+static struct emu_model *models[] = {
+    &emu_model_generic,
+    &emu_model_scpi,
+    &emu_model_hp3488,
+    NULL,
+};
+
+struct emu_dev_struct {
+    int                 magic;
+    char               *name;
+    struct emu_model   *model;
+    void               *data;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    int                 busy;
+    long                owner;      /* whose call made the device busy */
+    unsigned long       gen;        /* bumped by clear */
+    struct emu_waiter  *waiters;    /* blocked calls, for emu_abort () */
+    char               *in;         /* message being received */
+    int                 inlen;
+    int                 insize;
+    char               *out;        /* queued output */
+    int                 outlen;
+    int                 outsize;
+    unsigned long       responses;  /* count of emu_respond () calls */
+    struct timespec     ready;      /* output held back until then */
+    unsigned char       stb;        /* model's status bits */
+    struct emu_dev_struct *next;
+};
+
+static struct emu_dev_struct *devices = NULL;
+static pthread_mutex_t devices_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Grow a buffer to hold at least 'need' bytes.
+ */
+static void
+_reserve(char **bufp, int *sizep, int need)
+{
+    if (need > *sizep) {
+        int size = *sizep > 0 ? *sizep : 256;
+
+        while (size < need)
+            size *= 2;
+        *bufp = xrealloc(*bufp, size);
+        *sizep = size;
+    }
+}
+
+/* Register a call for 'owner' that may block.  Call with the lock held
+ * and _wait_end () before dropping it for good.
+ */
+static void
+_wait_begin(emu_dev_t d, struct emu_waiter *w, long owner)
+{
+    w->owner = owner;
+    w->gen = d->gen;
+    w->aborted = 0;
+    w->next = d->waiters;
+    d->waiters = w;
+}
+
+static void
+_wait_end(emu_dev_t d, struct emu_waiter *w)
+{
+    struct emu_waiter **wp;
+
+    for (wp = &d->waiters; *wp != NULL; wp = &(*wp)->next) {
+        if (*wp == w) {
+            *wp = w->next;
+            break;
+        }
+    }
+}
+
+static int
+_aborted(emu_dev_t d, struct emu_waiter *w)
+{
+    return (d->gen != w->gen || w->aborted);
+}
+
+/* Wait for the device to be idle, or until 'expire' or an abort.
+ * Call with the lock held.
+ */
+static int
+_wait_idle(emu_dev_t d, struct emu_waiter *w, struct timespec *expire)
+{
+    while (d->busy) {
+        if (pthread_cond_timedwait(&d->cond, &d->lock, expire) == ETIMEDOUT
+                && d->busy)
+            return VXI11_ERR_IOTIMEOUT;
+        if (_aborted(d, w))
+            return VXI11_ERR_ABORT;
+    }
+    return 0;
+}
+
+static void
+_busy(emu_dev_t d, long owner)
+{
+    d->busy = 1;
+    d->owner = owner;
+}
+
+static void
+_idle(emu_dev_t d)
+{
+    d->busy = 0;
+    d->owner = 0;
+    pthread_cond_broadcast(&d->cond);
+}
+
+emu_dev_t
+emu_create(char *spec)
+{
+    char *cpy = xstrdup(spec);
+    char *model, *args = NULL;
+    emu_dev_t d;
+    int i;
+
+    if (!(model = strchr(cpy, '=')) || model == cpy) {
+        fprintf(stderr, "device spec should be name=model[:args]: %s\n", spec);
+        free(cpy);
+        return NULL;
+    }
+    *model++ = '\0';
+    if ((args = strchr(model, ':')))
+        *args++ = '\0';
+    if (emu_find(cpy)) {
+        fprintf(stderr, "%s: device already exists\n", cpy);
+        free(cpy);
+        return NULL;
+    }
+    d = xzmalloc(sizeof(struct emu_dev_struct));
+    d->magic = EMU_MAGIC;
+    d->name = xstrdup(cpy);
+    for (i = 0; models[i] != NULL; i++)
+        if (!strcmp(models[i]->name, model))
+            d->model = models[i];
+    if (!d->model) {
+        fprintf(stderr, "%s: unknown model: %s\n", d->name, model);
+        goto error;
+    }
+    pthread_mutex_init(&d->lock, NULL);
+    rpcserve_cond_init(&d->cond);
+    if (d->model->create(d, args) < 0) {
+        pthread_cond_destroy(&d->cond);
+        pthread_mutex_destroy(&d->lock);
+        goto error;
+    }
+    free(cpy);
+    pthread_mutex_lock(&devices_lock);
+    d->next = devices;
+    devices = d;
+    pthread_mutex_unlock(&devices_lock);
+    return d;
+error:
+    free(d->name);
+    free(d);
+    free(cpy);
+    return NULL;
+}
+
+void
+emu_destroy(emu_dev_t d)
+{
+    emu_dev_t *dp;
+
+    assert(d->magic == EMU_MAGIC);
+    pthread_mutex_lock(&devices_lock);
+    for (dp = &devices; *dp != NULL; dp = &(*dp)->next) {
+        if (*dp == d) {
+            *dp = d->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&devices_lock);
+    if (d->model->destroy)
+        d->model->destroy(d);
+    pthread_cond_destroy(&d->cond);
+    pthread_mutex_destroy(&d->lock);
+    free(d->in);
+    free(d->out);
+    free(d->name);
+    d->magic = 0;
+    free(d);
+}
+
+emu_dev_t
+emu_find(char *name)
+{
+    emu_dev_t d;
+
+    pthread_mutex_lock(&devices_lock);
+    for (d = devices; d != NULL; d = d->next)
+        if (!strcasecmp(d->name, name))
+            break;
+    pthread_mutex_unlock(&devices_lock);
+    return d;
+}
+
+emu_dev_t
+emu_next(emu_dev_t d)
+{
+    emu_dev_t next;
+
+    pthread_mutex_lock(&devices_lock);
+    next = d ? d->next : devices;
+    pthread_mutex_unlock(&devices_lock);
+    return next;
+}
+
+char *
+emu_name(emu_dev_t d)
+{
+    assert(d->magic == EMU_MAGIC);
+    return d->name;
+}
+
+void
+emu_list_models(FILE *f)
+{
+    int i;
+
+    for (i = 0; models[i] != NULL; i++)
+        fprintf(f, "%-12s %s\n", models[i]->name, models[i]->desc);
+}
+
+int
+emu_write(emu_dev_t d, long owner, char *buf, int len, int end,
+          unsigned long timeout, int *respondedp)
+{
+    struct emu_waiter w;
+    struct timespec expire;
+    unsigned long responses;
+    int res, responded = 0;
+
+    assert(d->magic == EMU_MAGIC);
+    rpcserve_deadline(&expire, timeout);
+    pthread_mutex_lock(&d->lock);
+    _wait_begin(d, &w, owner);
+    if ((res = _wait_idle(d, &w, &expire)) != 0)
+        goto done;
+    _reserve(&d->in, &d->insize, d->inlen + len);
+    memcpy(d->in + d->inlen, buf, len);
+    d->inlen += len;
+    if (end) {
+        _busy(d, owner);
+        responses = d->responses;
+        res = d->model->message(d, d->in, d->inlen);
+        responded = (d->responses != responses);
+        d->inlen = 0;
+        _idle(d);
+    }
+done:
+    _wait_end(d, &w);
+    pthread_mutex_unlock(&d->lock);
+    if (respondedp)
+        *respondedp = responded;
+    return res;
+}
+
+int
+emu_read(emu_dev_t d, long owner, char *buf, int size, int termchar,
+         unsigned long timeout, int *lenp, int *reasonp)
+{
+    struct emu_waiter w;
+    struct timespec expire, *until;
+    int n = 0, reason = 0, res = 0;
+
+    assert(d->magic == EMU_MAGIC);
+    rpcserve_deadline(&expire, timeout);
+    pthread_mutex_lock(&d->lock);
+    _wait_begin(d, &w, owner);
+    while (d->outlen == 0 || !rpcserve_expired(&d->ready)) {
+        if (rpcserve_expired(&expire)) {
+            res = VXI11_ERR_IOTIMEOUT;
+            goto done;
+        }
+        until = d->outlen > 0 && rpcserve_before(&d->ready, &expire)
+                ? &d->ready : &expire;
+        pthread_cond_timedwait(&d->cond, &d->lock, until);
+        if (_aborted(d, &w)) {
+            res = VXI11_ERR_ABORT;
+            goto done;
+        }
+    }
+    while (n < size && n < d->outlen) {
+        buf[n] = d->out[n];
+        n++;
+        if (termchar >= 0 && (unsigned char)buf[n - 1] == termchar) {
+            reason |= VXI11_REASON_CHR;
+            break;
+        }
+    }
+    memmove(d->out, d->out + n, d->outlen - n);
+    d->outlen -= n;
+    if (d->outlen == 0)
+        reason |= VXI11_REASON_END;
+    else if (n == size)
+        reason |= VXI11_REASON_REQCNT;
+done:
+    _wait_end(d, &w);
+    pthread_mutex_unlock(&d->lock);
+    if (lenp)
+        *lenp = n;
+    if (reasonp)
+        *reasonp = reason;
+    return res;
+}
+
+unsigned char
+emu_readstb(emu_dev_t d)
+{
+    unsigned char stb;
+
+    assert(d->magic == EMU_MAGIC);
+    pthread_mutex_lock(&d->lock);
+    stb = emu_get_stb(d);
+    pthread_mutex_unlock(&d->lock);
+    return stb;
+}
+
+int
+emu_clear(emu_dev_t d)
+{
+    assert(d->magic == EMU_MAGIC);
+    pthread_mutex_lock(&d->lock);
+    d->gen++;
+    pthread_cond_broadcast(&d->cond);
+    while (d->busy)
+        pthread_cond_wait(&d->cond, &d->lock);
+    d->inlen = 0;
+    d->outlen = 0;
+    if (d->model->clear) {
+        _busy(d, 0);
+        d->model->clear(d);
+        _idle(d);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+int
+emu_trigger(emu_dev_t d, long owner)
+{
+    assert(d->magic == EMU_MAGIC);
+    pthread_mutex_lock(&d->lock);
+    while (d->busy)
+        pthread_cond_wait(&d->cond, &d->lock);
+    if (d->model->trigger) {
+        _busy(d, owner);
+        d->model->trigger(d);
+        _idle(d);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+void
+emu_abort(emu_dev_t d, long owner)
+{
+    struct emu_waiter *w;
+
+    assert(d->magic == EMU_MAGIC);
+    pthread_mutex_lock(&d->lock);
+    for (w = d->waiters; w != NULL; w = w->next)
+        if (w->owner == owner)
+            w->aborted = 1;
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+}
+
+/* Sleep for 'msec' on behalf of 'owner'.  Call with the lock held.
+ */
+static int
+_sleep(emu_dev_t d, long owner, unsigned long msec)
+{
+    struct emu_waiter w;
+    struct timespec expire;
+    int res = 0;
+
+    rpcserve_deadline(&expire, msec);
+    _wait_begin(d, &w, owner);
+    while (!rpcserve_expired(&expire)) {
+        pthread_cond_timedwait(&d->cond, &d->lock, &expire);
+        if (_aborted(d, &w)) {
+            res = VXI11_ERR_ABORT;
+            break;
+        }
+    }
+    _wait_end(d, &w);
+    return res;
+}
+
+int
+emu_stall(emu_dev_t d, long owner, unsigned long msec)
+{
+    int res;
+
+    assert(d->magic == EMU_MAGIC);
+    pthread_mutex_lock(&d->lock);
+    res = _sleep(d, owner, msec);
+    pthread_mutex_unlock(&d->lock);
+    return res;
+}
+
+void
+emu_set_data(emu_dev_t d, void *data)
+{
+    d->data = data;
+}
+
+void *
+emu_get_data(emu_dev_t d)
+{
+    return d->data;
+}
+
+void
+emu_respond(emu_dev_t d, char *buf, int len)
+{
+    _reserve(&d->out, &d->outsize, d->outlen + len);
+    memcpy(d->out + d->outlen, buf, len);
+    d->outlen += len;
+    d->responses++;
+    pthread_cond_broadcast(&d->cond);
+}
+
+void
+emu_printf(emu_dev_t d, const char *fmt, ...)
+{
+    va_list ap;
+    char buf[256], *s = buf;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len >= sizeof(buf)) {
+        s = xmalloc(len + 1);
+        va_start(ap, fmt);
+        (void)vsnprintf(s, len + 1, fmt, ap);
+        va_end(ap);
+    }
+    emu_respond(d, s, len);
+    if (s != buf)
+        free(s);
+}
+
+void
+emu_delay_response(emu_dev_t d, unsigned long msec)
+{
+    rpcserve_deadline(&d->ready, msec);
+}
+
+int
+emu_sleep(emu_dev_t d, unsigned long msec)
+{
+    return _sleep(d, d->owner, msec);
+}
+
+void
+emu_set_stb(emu_dev_t d, unsigned char set, unsigned char clear)
+{
+    d->stb = (d->stb | set) & ~clear;
+}
+
+unsigned char
+emu_get_stb(emu_dev_t d)
+{
+    unsigned char stb = d->model->status ? d->model->status(d) : d->stb;
+
+    if (d->outlen > 0 && rpcserve_expired(&d->ready))
+        stb |= d->model->mav ? d->model->mav : EMU_STB_MAV;
+    return stb;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
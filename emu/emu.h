@@ -0,0 +1,171 @@
+#ifndef _EMU_H
+#define _EMU_H
+
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* Emulated instruments.
+ *
+ * An emulated device pairs a name such as "inst0" or "gpib0,5" with an
+ * instance of a device model.  A front end (e.g. vxi11d) moves bytes in
+ * and out with emu_write () and emu_read (), and passes on serial polls,
+ * device clear, trigger, and abort.  Input is buffered until END, then
+ * the whole message is handed to the model, which queues any response
+ * with emu_respond ().  Model callbacks for a device run one at a time
+ * and may call emu_sleep () to take time like the real instrument would,
+ * during which other front end threads wait.
+ *
+ * Errors are VXI-11 error codes (VXI11_ERR_* in vxi11.h) whatever the
+ * front end, so that the same model can be used behind any transport.
+ */
+
+#include <stdio.h>
+
+typedef struct emu_dev_struct *emu_dev_t;
+
+/* Status byte bits maintained by the core */
+#define EMU_STB_MAV     0x10    /* message available */
+#define EMU_STB_RQS     0x40    /* requesting service */
+
+struct emu_model {
+    char    *name;
+    char    *desc;              /* one line, for vxi11d --list */
+    /* Create model state for 'd' from the 'args' part of the device spec
+     * (NULL if none) and save it with emu_set_data ().
+     * Return 0 on success, -1 on error (reported on stderr).
+     */
+    int     (*create)(emu_dev_t d, char *args);
+    void    (*destroy)(emu_dev_t d);
+    /* A complete message of 'len' bytes has been received (not NUL
+     * terminated).  Return 0 or a VXI-11 error code.
+     */
+    int     (*message)(emu_dev_t d, char *buf, int len);
+    /* Optional: device clear (after buffers are emptied) and trigger. */
+    void    (*clear)(emu_dev_t d);
+    void    (*trigger)(emu_dev_t d);
+    /* Optional: return the model's status bits at the time of a serial
+     * poll, for bits that change on their own, e.g. a ready bit that sets
+     * once relays have settled.  Default: the bits from emu_set_stb ().
+     */
+    unsigned char (*status)(emu_dev_t d);
+    unsigned char mav;          /* status bit for output available,
+                                   0 for EMU_STB_MAV */
+};
+
+/* Create a device from 'spec', "name=model[:args]", and add it to the
+ * device list.  Returns NULL on error (reported on stderr).
+ */
+emu_dev_t emu_create(char *spec);
+
+/* Destroy a device and remove it from the device list.
+ */
+void emu_destroy(emu_dev_t d);
+
+/* Find a device by name (case insensitive).  Returns NULL if not found.
+ */
+emu_dev_t emu_find(char *name);
+
+/* Iterate over the device list: emu_next (NULL) returns the first one.
+ */
+emu_dev_t emu_next(emu_dev_t d);
+
+char *emu_name(emu_dev_t d);
+
+/* Print the available models.
+ */
+void emu_list_models(FILE *f);
+
+/* Front end interface.
+ */
+
+/* The front end calls below take an 'owner', e.g. the VXI-11 link id,
+ * that emu_abort () uses to pick the calls to interrupt; 0 is no owner.
+ */
+
+/* Send 'len' bytes to the device; 'end' marks the end of a message.
+ * Waits at most 'timeout' msec for the device to accept them.  If
+ * 'respondedp' is not NULL, it is set to whether the message queued a
+ * response.
+ */
+int emu_write(emu_dev_t d, long owner, char *buf, int len, int end,
+              unsigned long timeout, int *respondedp);
+
+/* Read up to 'size' bytes from the device, waiting at most 'timeout' msec
+ * for a response.  If 'termchar' is >= 0, stop after that character.
+ * The count is returned in 'lenp' and the VXI11_REASON_* bits for why the
+ * read stopped in 'reasonp'.  Returns VXI11_ERR_IOTIMEOUT if nothing was
+ * available in time, or VXI11_ERR_ABORT if interrupted by emu_abort ().
+ */
+int emu_read(emu_dev_t d, long owner, char *buf, int size, int termchar,
+             unsigned long timeout, int *lenp, int *reasonp);
+
+unsigned char emu_readstb(emu_dev_t d);
+
+/* Device clear: empty input and output buffers, then call the model.
+ */
+int emu_clear(emu_dev_t d);
+
+int emu_trigger(emu_dev_t d, long owner);
+
+/* Interrupt the calls of 'owner' blocked on the device, including a model
+ * emu_sleep () during its write or trigger.  Calls of other owners go on.
+ */
+void emu_abort(emu_dev_t d, long owner);
+
+/* Hold up the calling front end for 'msec' without making the device
+ * busy, e.g. to inject a fault.  Returns 0, or VXI11_ERR_ABORT if
+ * 'owner' was aborted or the device cleared meanwhile.
+ */
+int emu_stall(emu_dev_t d, long owner, unsigned long msec);
+
+/* Model interface (call from model callbacks only).
+ */
+
+void emu_set_data(emu_dev_t d, void *data);
+void *emu_get_data(emu_dev_t d);
+
+/* Queue a response.  The device asserts END after the last byte.
+ */
+void emu_respond(emu_dev_t d, char *buf, int len);
+void emu_printf(emu_dev_t d, const char *fmt, ...)
+        __attribute__ ((format (printf, 2, 3)));
+
+/* Hold queued output back until 'msec' from now, e.g. to model the time
+ * a query takes without making the write that sent it wait.
+ */
+void emu_delay_response(emu_dev_t d, unsigned long msec);
+
+/* Take 'msec' to do something.  Returns 0, or VXI11_ERR_ABORT if the
+ * device was aborted or cleared meanwhile.
+ */
+int emu_sleep(emu_dev_t d, unsigned long msec);
+
+/* Set then clear bits in the model's part of the status byte.
+ */
+void emu_set_stb(emu_dev_t d, unsigned char set, unsigned char clear);
+
+/* Return the status byte as emu_readstb () would.
+ */
+unsigned char emu_get_stb(emu_dev_t d);
+
+#endif /* _EMU_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
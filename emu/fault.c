@@ -0,0 +1,393 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* fault.c - fault and latency injection for emulated devices */
+
+/* The rule sets are configured before any front end starts serving, so
+ * the list of them is not locked.  The rules for a device share one mutex
+ * for their counters and random number generator.  It is dropped before
+ * sleeping, so a stalled call does
+ * not hold up calls from other links, and the sleep is done with
+ * emu_stall () so that device_abort or device_clear cut it short as they
+ * would a real slow instrument.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <rpc/rpc.h>
+
+#include "libvxi11/vxi11.h"
+#include "libutil/util.h"
+#include "emu.h"
+#include "fault.h"
+
+#define FAULT_MAGIC     0x666c7431
+
+#define OP_ANY          (-1)
+
+typedef enum {
+    ACT_DELAY, ACT_STALL, ACT_TIMEOUT, ACT_LOCKED, ACT_DROP
+} action_t;
+
+typedef enum {
+    TRIG_ALWAYS,            /* every matching call */
+    TRIG_PROB,              /* with probability 'prob' */
+    TRIG_EVERY,             /* every nth matching call */
+    TRIG_ONCE,              /* nth matching call only */
+} trigger_t;
+
+struct rule {
+    int                 op;
+    action_t            action;
+    unsigned long       msec;
+    trigger_t           trigger;
+    double              prob;
+    unsigned long       n;
+    unsigned long       calls;      /* matching calls so far */
+    unsigned long       fired;
+};
+
+typedef struct fault_struct *fault_t;
+
+struct fault_struct {
+    int                 magic;
+    emu_dev_t           dev;
+    pthread_mutex_t     lock;
+    unsigned short      xsubi[3];   /* erand48 () state */
+    FILE               *log;
+    struct rule        *rules;
+    int                 nrules;
+    struct fault_struct *next;
+};
+
+static fault_t faults = NULL;
+
+static char *opnames[] = {
+    [FAULT_OP_WRITE]    = "write",
+    [FAULT_OP_READ]     = "read",
+    [FAULT_OP_READSTB]  = "readstb",
+    [FAULT_OP_TRIGGER]  = "trigger",
+    [FAULT_OP_CLEAR]    = "clear",
+    [FAULT_OP_OTHER]    = "other",
+};
+
+static struct {
+    char       *name;
+    action_t    action;
+    int         needmsec;
+} acttab[] = {
+    { "delay",      ACT_DELAY,      1 },
+    { "stall",      ACT_STALL,      1 },
+    { "timeout",    ACT_TIMEOUT,    0 },
+    { "locked",     ACT_LOCKED,     0 },
+    { "drop",       ACT_DROP,       0 },
+    { NULL,         0,              0 },
+};
+
+static char *
+_actname(action_t action)
+{
+    int i;
+
+    for (i = 0; acttab[i].name != NULL; i++)
+        if (acttab[i].action == action)
+            return acttab[i].name;
+    return "?";
+}
+
+/* Parse one rule, [OP:]ACTION[=MSEC][@PROB|/N|#N], into 'r'.
+ */
+static int
+_parse_rule(char *s, struct rule *r)
+{
+    char *p, *end;
+    int i, len;
+
+    memset(r, 0, sizeof(*r));
+    r->op = OP_ANY;
+    if ((p = strchr(s, ':'))) {
+        *p++ = '\0';
+        for (i = 0; i < FAULT_NOPS; i++)
+            if (!strcmp(s, opnames[i]))
+                r->op = i;
+        if (r->op == OP_ANY && strcmp(s, "any") != 0)
+            return -1;
+        s = p;
+    }
+    len = strcspn(s, "=@/#");
+    for (i = 0; acttab[i].name != NULL; i++)
+        if (strlen(acttab[i].name) == len && !strncmp(s, acttab[i].name, len))
+            break;
+    if (acttab[i].name == NULL)
+        return -1;
+    r->action = acttab[i].action;
+    s += len;
+    if (*s == '=') {
+        r->msec = strtoul(s + 1, &end, 10);
+        if (end == s + 1)
+            return -1;
+        s = end;
+    } else if (acttab[i].needmsec)
+        return -1;
+    switch (*s) {
+        case '\0':
+            r->trigger = TRIG_ALWAYS;
+            return 0;
+        case '@':
+            r->trigger = TRIG_PROB;
+            r->prob = strtod(s + 1, &end);
+            if (r->prob <= 0 || r->prob > 1)
+                return -1;
+            break;
+        case '/':
+        case '#':
+            r->trigger = *s == '/' ? TRIG_EVERY : TRIG_ONCE;
+            r->n = strtoul(s + 1, &end, 10);
+            if (r->n == 0)
+                return -1;
+            break;
+        default:
+            return -1;
+    }
+    return (end == s + 1 || *end != '\0') ? -1 : 0;
+}
+
+static void _destroy(fault_t f);
+
+/* Parse rules for device 'd' from 'spec'.
+ */
+static fault_t
+_create(emu_dev_t d, char *spec, unsigned int seed, FILE *log)
+{
+    fault_t f = xzmalloc(sizeof(struct fault_struct));
+    char *cpy = xstrdup(spec);
+    char *tok, *saveptr = NULL;
+    char *name = emu_name(d);
+    unsigned int hash = seed;
+
+    f->magic = FAULT_MAGIC;
+    f->dev = d;
+    f->log = log;
+    /* same seed, different sequence per device (as srand48 () would) */
+    while (*name)
+        hash = hash * 31 + *name++;
+    f->xsubi[0] = 0x330e;
+    f->xsubi[1] = hash & 0xffff;
+    f->xsubi[2] = hash >> 16;
+    pthread_mutex_init(&f->lock, NULL);
+    for (tok = strtok_r(cpy, ",", &saveptr); tok != NULL;
+                                tok = strtok_r(NULL, ",", &saveptr)) {
+        f->rules = xrealloc(f->rules, (f->nrules + 1) * sizeof(struct rule));
+        if (_parse_rule(tok, &f->rules[f->nrules]) < 0) {
+            fprintf(stderr, "%s: bad fault rule: %s\n", emu_name(d), tok);
+            free(cpy);
+            _destroy(f);
+            return NULL;
+        }
+        f->nrules++;
+    }
+    free(cpy);
+    return f;
+}
+
+static void
+_destroy(fault_t f)
+{
+    assert(f->magic == FAULT_MAGIC);
+    pthread_mutex_destroy(&f->lock);
+    free(f->rules);
+    f->magic = 0;
+    free(f);
+}
+
+static fault_t
+_find(emu_dev_t d)
+{
+    fault_t f;
+
+    for (f = faults; f != NULL; f = f->next)
+        if (f->dev == d)
+            break;
+    return f;
+}
+
+int
+fault_config(char *spec, unsigned int seed, FILE *log)
+{
+    char *rules = strchr(spec, '=');
+    int namelen = rules ? rules++ - spec : 0;
+    emu_dev_t d;
+    fault_t f, *fp;
+    int found = 0;
+
+    if (namelen == 0) {
+        fprintf(stderr, "fault spec should be name=rule[,rule]...: %s\n",
+                spec);
+        return -1;
+    }
+    for (d = emu_next(NULL); d != NULL; d = emu_next(d)) {
+        if (!(namelen == 1 && spec[0] == '*')
+                && (strlen(emu_name(d)) != namelen
+                    || strncasecmp(spec, emu_name(d), namelen) != 0))
+            continue;
+        if (!(f = _create(d, rules, seed, log)))
+            return -1;
+        for (fp = &faults; *fp != NULL; fp = &(*fp)->next)
+            if ((*fp)->dev == d)
+                break;
+        if (*fp) {      /* a later spec for the device replaces it */
+            f->next = (*fp)->next;
+            _destroy(*fp);
+        }
+        *fp = f;
+        found = 1;
+    }
+    if (!found) {
+        fprintf(stderr, "%.*s: no such device\n", namelen, spec);
+        return -1;
+    }
+    return 0;
+}
+
+/* Count a matching call and decide whether rule 'r' fires on it.
+ * Call with the lock held.
+ */
+static int
+_fires(fault_t f, struct rule *r)
+{
+    r->calls++;
+    switch (r->trigger) {
+        case TRIG_ALWAYS:
+            return 1;
+        case TRIG_PROB:
+            return erand48(f->xsubi) < r->prob;
+        case TRIG_EVERY:
+            return r->calls % r->n == 0;
+        case TRIG_ONCE:
+            return r->calls == r->n;
+    }
+    return 0;
+}
+
+static void
+_log(fault_t f, int op, long lid, int i, unsigned long call,
+     unsigned long msec, int res)
+{
+    struct timespec ts;
+
+    if (!f->log)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    fprintf(f->log, "%ld.%06ld %s lid=%ld %s rule=%d %s",
+            (long)ts.tv_sec, ts.tv_nsec / 1000, emu_name(f->dev), lid,
+            opnames[op], i + 1, _actname(f->rules[i].action));
+    if (msec > 0)
+        fprintf(f->log, " %lums", msec);
+    if (res != 0)
+        fprintf(f->log, " = %d", res);
+    fprintf(f->log, " call=%lu\n", call);
+    fflush(f->log);
+}
+
+int
+fault_inject(emu_dev_t d, int op, long lid, unsigned long timeout)
+{
+    fault_t f = _find(d);
+    struct rule *r;
+    unsigned long msec, call;
+    int i, fire, res = 0;
+
+    if (!f)
+        return 0;
+    assert(f->magic == FAULT_MAGIC);
+    assert(op >= 0 && op < FAULT_NOPS);
+    for (i = 0; i < f->nrules && res == 0; i++) {
+        r = &f->rules[i];
+        if (r->op != OP_ANY && r->op != op)
+            continue;
+        pthread_mutex_lock(&f->lock);
+        if ((fire = _fires(f, r)))
+            r->fired++;
+        call = r->calls;
+        pthread_mutex_unlock(&f->lock);
+        if (!fire)
+            continue;
+        msec = 0;
+        switch (r->action) {
+            case ACT_DELAY:
+                msec = r->msec;
+                break;
+            case ACT_STALL:
+                msec = r->msec < timeout ? r->msec : timeout;
+                if (r->msec >= timeout)
+                    res = VXI11_ERR_IOTIMEOUT;
+                break;
+            case ACT_TIMEOUT:
+                msec = timeout;
+                res = VXI11_ERR_IOTIMEOUT;
+                break;
+            case ACT_LOCKED:
+                res = VXI11_ERR_LOCKED;
+                break;
+            case ACT_DROP:
+                res = FAULT_DROP;
+                break;
+        }
+        _log(f, op, lid, i, call, msec, res);
+        if (msec > 0 && emu_stall(f->dev, lid, msec) != 0)
+            res = VXI11_ERR_ABORT;
+    }
+    return res;
+}
+
+void
+fault_summary(void)
+{
+    struct rule *r;
+    fault_t f;
+    int i;
+
+    for (f = faults; f != NULL; f = f->next) {
+        assert(f->magic == FAULT_MAGIC);
+        if (!f->log)
+            continue;
+        pthread_mutex_lock(&f->lock);
+        for (i = 0; i < f->nrules; i++) {
+            r = &f->rules[i];
+            fprintf(f->log, "%s rule=%d %s:%s fired %lu of %lu\n",
+                    emu_name(f->dev), i + 1, r->op == OP_ANY ? "any"
+                    : opnames[r->op], _actname(r->action), r->fired,
+                    r->calls);
+        }
+        pthread_mutex_unlock(&f->lock);
+        fflush(f->log);
+    }
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
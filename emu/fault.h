@@ -0,0 +1,91 @@
+#ifndef _FAULT_H
+#define _FAULT_H
+
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* Fault injection in front of emulated devices.
+ *
+ * A front end calls fault_inject () before each operation on a device
+ * and does as it says.  Rules for a device are given as "name=rules",
+ * where name may be "*" for all devices, and rules is a comma separated
+ * list of
+ *
+ *   [OP:]ACTION[=MSEC][@PROB | /N | #N]
+ *
+ * OP is write, read, readstb, trigger, clear, other or any (the default).
+ * ACTION is one of
+ *   delay=MSEC   wait MSEC, then carry on
+ *   stall=MSEC   wait MSEC, or the call's I/O timeout if shorter, then
+ *                fail with VXI11_ERR_IOTIMEOUT if that ran out
+ *   timeout      wait the call's I/O timeout and fail with IOTIMEOUT
+ *   locked       fail at once with VXI11_ERR_LOCKED
+ *   drop         do the operation, then drop the connection unanswered
+ * and fires on every matching call, with probability PROB, on every Nth
+ * matching call, or on the Nth matching call only.  Rules are tried in
+ * order; delays add up and the first failure wins.
+ *
+ * Each injected fault is logged with the CLOCK_MONOTONIC time it was
+ * injected, so that runs can be lined up against libvxi11 traces taken
+ * on the same host.
+ */
+
+#include <stdio.h>
+
+#include "emu.h"
+
+enum {
+    FAULT_OP_WRITE,
+    FAULT_OP_READ,
+    FAULT_OP_READSTB,
+    FAULT_OP_TRIGGER,
+    FAULT_OP_CLEAR,
+    FAULT_OP_OTHER,
+    FAULT_NOPS
+};
+
+/* Returned by fault_inject (): do the operation, then drop the connection
+ * without replying.
+ */
+#define FAULT_DROP      (-1)
+
+/* Set the rules for the devices named in 'spec', replacing any set before.
+ * Call after the devices are created and before serving them.
+ * Probabilities are drawn from a generator seeded with 'seed', and
+ * injected faults are logged to 'log'.  Returns 0, or -1 on error
+ * (reported on stderr).
+ */
+int fault_config(char *spec, unsigned int seed, FILE *log);
+
+/* Apply the rules for device 'd' to operation 'op' by link 'lid' (for the
+ * log) with an I/O timeout of 'timeout' msec, sleeping here for delays and
+ * stalls.  Returns 0 to carry on, a VXI-11 error code to fail the call
+ * with, or FAULT_DROP.
+ */
+int fault_inject(emu_dev_t d, int op, long lid, unsigned long timeout);
+
+/* Log how many times each rule has fired.
+ */
+void fault_summary(void);
+
+#endif /* _FAULT_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
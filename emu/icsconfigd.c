@@ -0,0 +1,885 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* icsconfigd - ICS 8000 series configuration server for emulated gateways */
+
+/* Serves the ICSCONFIG program from libics/ics8000.x for one or more
+ * gateways.  Gateway n listens on the bind address plus n (127.0.0.1,
+ * 127.0.0.2, ...) on a common port, so that hundreds can run on one host
+ * and be told apart by address.  Each gateway has a running and a flash
+ * configuration: set operations change the running one, commit_config
+ * copies it to flash and saves the flash configuration of every gateway
+ * to the --state file, and reload_config and reboot copy flash back.
+ *
+ * The rpcgen dispatch in ics8000_svc.c is not reentrant (results are
+ * returned by reference), so the results below are thread-local, and each
+ * connection is served by its own thread (see rpcserve.h) so that the
+ * configured latency of one call does not hold up other clients.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#if HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+#include <rpc/rpc.h>
+#include <rpc/pmap_clnt.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+
+#include "libics/ics8000.h"
+#include "libics/ics.h"
+#include "libini/ini.h"
+#include "libutil/util.h"
+#include "rpcserve.h"
+
+/* dispatch routine from ics8000_svc.c */
+void icsconfig_1 (struct svc_req *rqstp, SVCXPRT *transp);
+
+#define MAX_NAME        32
+#define MAX_ERRLOG      100
+
+/* Fields are prefixed since ics8000.h defines the procedure names as macros.
+ */
+struct ics_config {
+    char            cf_interface_name[MAX_NAME];
+    unsigned int    cf_rpc_port;
+    unsigned int    cf_core_port;
+    unsigned int    cf_abort_port;
+    unsigned int    cf_config_port;
+    unsigned int    cf_comm_timeout;
+    char            cf_hostname[MAX_NAME];
+    unsigned int    cf_static_ip_mode;
+    unsigned int    cf_ip_number;   /* IP-note format, as on the wire */
+    unsigned int    cf_netmask;
+    unsigned int    cf_gateway;
+    unsigned int    cf_keepalive;
+    unsigned int    cf_gpib_address;
+    unsigned int    cf_system_controller;
+    unsigned int    cf_ren_mode;
+    unsigned int    cf_eos_8_bit_mode;
+    unsigned int    cf_auto_eos_mode;
+    unsigned int    cf_eos_active;
+    unsigned int    cf_eos_char;
+};
+
+struct ics_gateway {
+    struct in_addr      addr;
+    struct ics_config   running;
+    struct ics_config   flash;
+    unsigned int        errlog[MAX_ERRLOG];
+    int                 nerr;
+};
+
+typedef enum { ATTR_UINT, ATTR_BOOL, ATTR_STR, ATTR_IP } attrtype_t;
+
+/* Configuration attributes, as named in the --state file.
+ */
+static struct attr {
+    char           *name;
+    attrtype_t      type;
+    size_t          offset;
+    unsigned int    max;
+} attrtab[] = {
+#define CFG(x) offsetof (struct ics_config, x)
+    { "interface_name",     ATTR_STR,  CFG(cf_interface_name),      0 },
+    { "rpc_port",           ATTR_UINT, CFG(cf_rpc_port),            65535 },
+    { "core_port",          ATTR_UINT, CFG(cf_core_port),           65535 },
+    { "abort_port",         ATTR_UINT, CFG(cf_abort_port),          65535 },
+    { "config_port",        ATTR_UINT, CFG(cf_config_port),         65535 },
+    { "comm_timeout",       ATTR_UINT, CFG(cf_comm_timeout),        UINT_MAX },
+    { "hostname",           ATTR_STR,  CFG(cf_hostname),            0 },
+    { "static_ip_mode",     ATTR_BOOL, CFG(cf_static_ip_mode),      1 },
+    { "ip_number",          ATTR_IP,   CFG(cf_ip_number),           UINT_MAX },
+    { "netmask",            ATTR_IP,   CFG(cf_netmask),             UINT_MAX },
+    { "gateway",            ATTR_IP,   CFG(cf_gateway),             UINT_MAX },
+    { "keepalive",          ATTR_UINT, CFG(cf_keepalive),           UINT_MAX },
+    { "gpib_address",       ATTR_UINT, CFG(cf_gpib_address),        30 },
+    { "system_controller",  ATTR_BOOL, CFG(cf_system_controller),   1 },
+    { "ren_mode",           ATTR_BOOL, CFG(cf_ren_mode),            1 },
+    { "eos_8_bit_mode",     ATTR_BOOL, CFG(cf_eos_8_bit_mode),      1 },
+    { "auto_eos_mode",      ATTR_BOOL, CFG(cf_auto_eos_mode),       1 },
+    { "eos_active",         ATTR_BOOL, CFG(cf_eos_active),          1 },
+    { "eos_char",           ATTR_UINT, CFG(cf_eos_char),            255 },
+    { NULL, 0, 0, 0 },
+};
+
+#define OPTIONS "n:b:p:L:F:s:rv"
+#if HAVE_GETOPT_LONG
+#define GETOPT(ac,av,opt,lopt) getopt_long (ac,av,opt,lopt,NULL)
+static const struct option longopts[] = {
+    {"count",           required_argument, 0, 'n'},
+    {"bind",            required_argument, 0, 'b'},
+    {"port",            required_argument, 0, 'p'},
+    {"latency",         required_argument, 0, 'L'},
+    {"flash-latency",   required_argument, 0, 'F'},
+    {"state",           required_argument, 0, 's'},
+    {"register",        no_argument,       0, 'r'},
+    {"verbose",         no_argument,       0, 'v'},
+    {0, 0, 0, 0},
+};
+#else
+#define GETOPT(ac,av,opt,lopt) getopt (ac,av,opt)
+#endif
+
+char *prog = "";
+
+static struct ics_gateway *gateways = NULL;
+static int ngateways = 1;
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *statefile = NULL;
+static unsigned long latency = 0;       /* msec per call */
+static unsigned long flash_latency = 0; /* msec more to write flash */
+static bool verbose = false;
+static volatile sig_atomic_t done = 0;
+
+static struct rpcserve_prog progs[] = {
+    { ICSCONFIG, ICSCONFIG_VERSION, icsconfig_1 },
+    { 0, 0, NULL },
+};
+
+static void
+usage (void)
+{
+    fprintf (stderr,
+  "Usage: %s [OPTIONS]\n"
+  "  -n,--count N          number of gateways (default 1)\n"
+  "  -b,--bind ADDR        address of the first gateway (default 127.0.0.1)\n"
+  "  -p,--port PORT        port to serve on (default any)\n"
+  "  -L,--latency MSEC     delay every call this long\n"
+  "  -F,--flash-latency MSEC  delay commit, factory reload and reboot more\n"
+  "  -s,--state FILE       load flash configuration from, and commit to FILE\n"
+  "  -r,--register         register ICSCONFIG with the portmapper\n"
+  "  -v,--verbose          log each call on stderr\n"
+               , prog);
+    exit (1);
+}
+
+/* IP-note: 4-byte IP's are packed into a 32 bit unsigned integer in
+ * reverse network byte order (see libics/ics.c).
+ */
+static unsigned int
+_reverse (unsigned int i)
+{
+    return (((i & 0xff000000) >> 24) | ((i & 0x00ff0000) >>  8) |
+            ((i & 0x0000ff00) <<  8) | ((i & 0x000000ff) << 24));
+}
+
+static void
+_ip2str (unsigned int ip, char *buf, int len)
+{
+    struct in_addr in;
+
+    in.s_addr = _reverse (htonl (ip));
+    snprintf (buf, len, "%s", inet_ntoa (in));
+}
+
+static int
+_str2ip (const char *str, unsigned int *ipp)
+{
+    struct in_addr in;
+
+    if (inet_aton (str, &in) == 0)
+        return -1;
+    *ipp = ntohl (_reverse (in.s_addr));
+    return 0;
+}
+
+static void
+_factory (struct ics_config *cfg, int n)
+{
+    memset (cfg, 0, sizeof (*cfg));
+    snprintf (cfg->cf_interface_name, MAX_NAME, "gpib0");
+    snprintf (cfg->cf_hostname, MAX_NAME, "ics%d", n);
+    cfg->cf_rpc_port = 111;
+    cfg->cf_core_port = 1024;
+    cfg->cf_abort_port = 1025;
+    cfg->cf_config_port = 1026;
+    cfg->cf_static_ip_mode = 1;
+    (void)_str2ip ("192.168.0.254", &cfg->cf_ip_number);
+    (void)_str2ip ("255.255.255.0", &cfg->cf_netmask);
+    (void)_str2ip ("0.0.0.0", &cfg->cf_gateway);
+    cfg->cf_keepalive = 7200;
+    cfg->cf_gpib_address = 21;
+    cfg->cf_system_controller = 1;
+    cfg->cf_ren_mode = 1;
+    cfg->cf_auto_eos_mode = 1;
+    cfg->cf_eos_char = '\n';
+}
+
+static struct attr *
+_attr_find (const char *name)
+{
+    struct attr *a;
+
+    for (a = &attrtab[0]; a->name != NULL; a++)
+        if (!strcmp (a->name, name))
+            return a;
+    return NULL;
+}
+
+static struct ics_gateway *
+_gateway_byaddr (struct in_addr *addr)
+{
+    unsigned long i = ntohl (addr->s_addr) - ntohl (gateways[0].addr.s_addr);
+
+    return i < ngateways ? &gateways[i] : NULL;
+}
+
+/* The gateway a call was made to, by the address it was made to.
+ */
+static struct ics_gateway *
+_gateway (struct svc_req *rq)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof (sin);
+
+    if (getsockname (rq->rq_xprt->xp_fd, (struct sockaddr *)&sin, &len) < 0)
+        return NULL;
+    return _gateway_byaddr (&sin.sin_addr);
+}
+
+static int
+_state_cb (void *user, const char *section, const char *name,
+           const char *value)
+{
+    struct in_addr addr;
+    struct ics_gateway *gw;
+    struct attr *a;
+    char *p, *end;
+    unsigned long n;
+
+    if (!inet_aton (section, &addr) || !(gw = _gateway_byaddr (&addr)))
+        return 1; /* not one of ours */
+    if (!(a = _attr_find (name))) {
+        fprintf (stderr, "%s: [%s] unknown attribute '%s'\n", statefile,
+                 section, name);
+        return 0;
+    }
+    p = (char *)&gw->flash + a->offset;
+    switch (a->type) {
+        case ATTR_STR:
+            snprintf (p, MAX_NAME, "%s", value);
+            break;
+        case ATTR_IP:
+            if (_str2ip (value, (unsigned int *)p) < 0)
+                goto badval;
+            break;
+        case ATTR_UINT:
+        case ATTR_BOOL:
+            n = strtoul (value, &end, 10);
+            if (end == value || *end != '\0' || n > a->max)
+                goto badval;
+            *(unsigned int *)p = n;
+            break;
+    }
+    return 1;
+badval:
+    fprintf (stderr, "%s: [%s] %s: bad value '%s'\n", statefile, section,
+             name, value);
+    return 0;
+}
+
+static int
+_state_load (void)
+{
+    int rc = ini_parse (statefile, _state_cb, NULL);
+
+    if (rc == -1 && errno == ENOENT)
+        return 0;
+    if (rc == -1) {
+        fprintf (stderr, "%s: %s: %s\n", prog, statefile, strerror (errno));
+        return -1;
+    }
+    if (rc != 0) {
+        fprintf (stderr, "%s line %d: parse error\n", statefile, rc);
+        return -1;
+    }
+    return 0;
+}
+
+/* Write the flash configuration of every gateway to the state file.
+ * Call with state_lock held.
+ */
+static int
+_state_save (void)
+{
+    char tmp[PATH_MAX], buf[64];
+    struct attr *a;
+    FILE *f;
+    char *p;
+    int i;
+
+    snprintf (tmp, sizeof (tmp), "%s.tmp", statefile);
+    if (!(f = fopen (tmp, "w")))
+        goto error;
+    for (i = 0; i < ngateways; i++) {
+        fprintf (f, "[%s]\n", inet_ntoa (gateways[i].addr));
+        for (a = &attrtab[0]; a->name != NULL; a++) {
+            p = (char *)&gateways[i].flash + a->offset;
+            switch (a->type) {
+                case ATTR_STR:
+                    fprintf (f, "%s = %s\n", a->name, p);
+                    break;
+                case ATTR_IP:
+                    _ip2str (*(unsigned int *)p, buf, sizeof (buf));
+                    fprintf (f, "%s = %s\n", a->name, buf);
+                    break;
+                case ATTR_UINT:
+                case ATTR_BOOL:
+                    fprintf (f, "%s = %u\n", a->name, *(unsigned int *)p);
+                    break;
+            }
+        }
+    }
+    if (fclose (f) != 0 || rename (tmp, statefile) < 0)
+        goto error;
+    return 0;
+error:
+    fprintf (stderr, "%s: %s: %s\n", prog, statefile, strerror (errno));
+    return -1;
+}
+
+static void
+_errlog (struct ics_gateway *gw, unsigned int err)
+{
+    if (gw->nerr == MAX_ERRLOG)
+        memmove (&gw->errlog[0], &gw->errlog[1],
+                 --gw->nerr * sizeof (gw->errlog[0]));
+    gw->errlog[gw->nerr++] = err;
+}
+
+static void
+_delay (unsigned long msec)
+{
+    if (msec > 0)
+        usleep (msec * 1000);
+}
+
+static void
+_vlog (struct ics_gateway *gw, const char *proc, unsigned int error)
+{
+    if (verbose)
+        fprintf (stderr, "%s: %s %s = %u\n", prog,
+                 gw ? inet_ntoa (gw->addr) : "?", proc, error);
+}
+
+/* Read or write an integer attribute.  Returns an ICS error code.
+ */
+static unsigned int
+_uint_attr (struct svc_req *rq, const char *proc, unsigned int action,
+            unsigned int value, unsigned int *resultp)
+{
+    struct ics_gateway *gw = _gateway (rq);
+    struct attr *a = _attr_find (proc);
+    unsigned int *p, error = ICS_SUCCESS;
+
+    _delay (latency);
+    if (!gw || !a)
+        return ICS_ERROR_UNSUPPORTED;
+    pthread_mutex_lock (&state_lock);
+    p = (unsigned int *)((char *)&gw->running + a->offset);
+    if (action == ICS_READ)
+        *resultp = *p;
+    else if (action != ICS_WRITE)
+        error = ICS_ERROR_SYNTAX;
+    else if (value > a->max)
+        error = ICS_ERROR_PARAMETER;
+    else
+        *resultp = *p = value;
+    if (error)
+        _errlog (gw, error);
+    pthread_mutex_unlock (&state_lock);
+    _vlog (gw, proc, error);
+    return error;
+}
+
+/* Read or write a string attribute into 'buf' (MAX_NAME bytes).
+ */
+static unsigned int
+_str_attr (struct svc_req *rq, const char *proc, unsigned int action,
+           char *val, u_int len, char *buf, u_int *lenp)
+{
+    struct ics_gateway *gw = _gateway (rq);
+    struct attr *a = _attr_find (proc);
+    unsigned int error = ICS_SUCCESS;
+    char *p;
+
+    *lenp = 0;
+    _delay (latency);
+    if (!gw || !a)
+        return ICS_ERROR_UNSUPPORTED;
+    pthread_mutex_lock (&state_lock);
+    p = (char *)&gw->running + a->offset;
+    if (action == ICS_READ) {
+        *lenp = strlen (p);
+        memcpy (buf, p, *lenp);
+    } else if (action != ICS_WRITE)
+        error = ICS_ERROR_SYNTAX;
+    else if (len == 0 || len >= MAX_NAME || memchr (val, '\0', len))
+        error = ICS_ERROR_PARAMETER;
+    else {
+        memcpy (p, val, len);
+        p[len] = '\0';
+    }
+    if (error)
+        _errlog (gw, error);
+    pthread_mutex_unlock (&state_lock);
+    _vlog (gw, proc, error);
+    return error;
+}
+
+Int_Name_Resp *
+interface_name_1_svc (Int_Name_Parms *p, struct svc_req *rq)
+{
+    static __thread Int_Name_Resp r;
+    static __thread char buf[MAX_NAME];
+
+    r.name.name_val = buf;
+    r.error = _str_attr (rq, "interface_name", p->action, p->name.name_val,
+                         p->name.name_len, buf, &r.name.name_len);
+    return &r;
+}
+
+Rpc_Port_Resp *
+rpc_port_number_1_svc (Rpc_Port_Parms *p, struct svc_req *rq)
+{
+    static __thread Rpc_Port_Resp r;
+
+    r.error = _uint_attr (rq, "rpc_port", p->action, p->port, &r.port);
+    return &r;
+}
+
+Core_Port_Resp *
+core_port_number_1_svc (Core_Port_Parms *p, struct svc_req *rq)
+{
+    static __thread Core_Port_Resp r;
+
+    r.error = _uint_attr (rq, "core_port", p->action, p->port, &r.port);
+    return &r;
+}
+
+Abort_Port_Resp *
+abort_port_number_1_svc (Abort_Port_Parms *p, struct svc_req *rq)
+{
+    static __thread Abort_Port_Resp r;
+
+    r.error = _uint_attr (rq, "abort_port", p->action, p->port, &r.port);
+    return &r;
+}
+
+Config_Port_Resp *
+config_port_number_1_svc (Config_Port_Parms *p, struct svc_req *rq)
+{
+    static __thread Config_Port_Resp r;
+
+    r.error = _uint_attr (rq, "config_port", p->action, p->port, &r.port);
+    return &r;
+}
+
+Comm_Timeout_Resp *
+comm_timeout_1_svc (Comm_Timeout_Parms *p, struct svc_req *rq)
+{
+    static __thread Comm_Timeout_Resp r;
+
+    r.error = _uint_attr (rq, "comm_timeout", p->action, p->timeout,
+                          &r.timeout);
+    return &r;
+}
+
+Hostname_Resp *
+hostname_1_svc (Hostname_Parms *p, struct svc_req *rq)
+{
+    static __thread Hostname_Resp r;
+    static __thread char buf[MAX_NAME];
+
+    r.name.name_val = buf;
+    r.error = _str_attr (rq, "hostname", p->action, p->name.name_val,
+                         p->name.name_len, buf, &r.name.name_len);
+    return &r;
+}
+
+Static_IP_Resp *
+static_ip_mode_1_svc (Static_IP_Parms *p, struct svc_req *rq)
+{
+    static __thread Static_IP_Resp r;
+
+    r.error = _uint_attr (rq, "static_ip_mode", p->action, p->mode, &r.mode);
+    return &r;
+}
+
+IP_Number_Resp *
+ip_number_1_svc (IP_Number_Parms *p, struct svc_req *rq)
+{
+    static __thread IP_Number_Resp r;
+
+    r.error = _uint_attr (rq, "ip_number", p->action, p->ip, &r.ip);
+    return &r;
+}
+
+Netmask_Resp *
+netmask_1_svc (Netmask_Parms *p, struct svc_req *rq)
+{
+    static __thread Netmask_Resp r;
+
+    r.error = _uint_attr (rq, "netmask", p->action, p->ip, &r.ip);
+    return &r;
+}
+
+Gateway_Resp *
+gateway_1_svc (Gateway_Parms *p, struct svc_req *rq)
+{
+    static __thread Gateway_Resp r;
+
+    r.error = _uint_attr (rq, "gateway", p->action, p->ip, &r.ip);
+    return &r;
+}
+
+Keepalive_Resp *
+keepalive_1_svc (Keepalive_Parms *p, struct svc_req *rq)
+{
+    static __thread Keepalive_Resp r;
+
+    r.error = _uint_attr (rq, "keepalive", p->action, p->time, &r.time);
+    return &r;
+}
+
+Gpib_Addr_Resp *
+gpib_address_1_svc (Gpib_Addr_Parms *p, struct svc_req *rq)
+{
+    static __thread Gpib_Addr_Resp r;
+
+    r.error = _uint_attr (rq, "gpib_address", p->action, p->address,
+                          &r.address);
+    return &r;
+}
+
+Sys_Control_Resp *
+system_controller_1_svc (Sys_Control_Parms *p, struct svc_req *rq)
+{
+    static __thread Sys_Control_Resp r;
+
+    r.error = _uint_attr (rq, "system_controller", p->action, p->controller,
+                          &r.controller);
+    return &r;
+}
+
+Ren_Resp *
+ren_mode_1_svc (Ren_Parms *p, struct svc_req *rq)
+{
+    static __thread Ren_Resp r;
+
+    r.error = _uint_attr (rq, "ren_mode", p->action, p->ren, &r.ren);
+    return &r;
+}
+
+Eos_8bit_Resp *
+eos_8_bit_mode_1_svc (Eos_8bit_Parms *p, struct svc_req *rq)
+{
+    static __thread Eos_8bit_Resp r;
+
+    r.error = _uint_attr (rq, "eos_8_bit_mode", p->action, p->eos8bit,
+                          &r.eos8bit);
+    return &r;
+}
+
+Auto_Eos_Resp *
+auto_eos_mode_1_svc (Auto_Eos_Parms *p, struct svc_req *rq)
+{
+    static __thread Auto_Eos_Resp r;
+
+    r.error = _uint_attr (rq, "auto_eos_mode", p->action, p->autoEos,
+                          &r.autoEos);
+    return &r;
+}
+
+Eos_Active_Resp *
+eos_active_1_svc (Eos_Active_Parms *p, struct svc_req *rq)
+{
+    static __thread Eos_Active_Resp r;
+
+    r.error = _uint_attr (rq, "eos_active", p->action, p->eosActive,
+                          &r.eosActive);
+    return &r;
+}
+
+Eos_Char_Resp *
+eos_char_1_svc (Eos_Char_Parms *p, struct svc_req *rq)
+{
+    static __thread Eos_Char_Resp r;
+
+    r.error = _uint_attr (rq, "eos_char", p->action, p->eos, &r.eos);
+    return &r;
+}
+
+/* Running configuration from flash.
+ */
+Reload_Config_Resp *
+reload_config_1_svc (void *p, struct svc_req *rq)
+{
+    static __thread Reload_Config_Resp r;
+    struct ics_gateway *gw = _gateway (rq);
+
+    _delay (latency);
+    r.error = ICS_SUCCESS;
+    if (gw) {
+        pthread_mutex_lock (&state_lock);
+        gw->running = gw->flash;
+        pthread_mutex_unlock (&state_lock);
+    } else
+        r.error = ICS_ERROR_UNSUPPORTED;
+    _vlog (gw, "reload_config", r.error);
+    return &r;
+}
+
+/* Flash from factory defaults.  The running configuration is unchanged.
+ */
+Reload_Factory_Resp *
+reload_factory_1_svc (void *p, struct svc_req *rq)
+{
+    static __thread Reload_Factory_Resp r;
+    struct ics_gateway *gw = _gateway (rq);
+
+    _delay (latency + flash_latency);
+    r.error = ICS_SUCCESS;
+    if (gw) {
+        pthread_mutex_lock (&state_lock);
+        _factory (&gw->flash, gw - gateways + 1);
+        if (statefile)
+            (void)_state_save ();
+        pthread_mutex_unlock (&state_lock);
+    } else
+        r.error = ICS_ERROR_UNSUPPORTED;
+    _vlog (gw, "reload_factory", r.error);
+    return &r;
+}
+
+/* Flash from running configuration.
+ */
+Commit_Config_Resp *
+commit_config_1_svc (void *p, struct svc_req *rq)
+{
+    static __thread Commit_Config_Resp r;
+    struct ics_gateway *gw = _gateway (rq);
+
+    _delay (latency + flash_latency);
+    r.error = ICS_SUCCESS;
+    if (gw) {
+        pthread_mutex_lock (&state_lock);
+        gw->flash = gw->running;
+        if (statefile)
+            (void)_state_save ();
+        pthread_mutex_unlock (&state_lock);
+    } else
+        r.error = ICS_ERROR_UNSUPPORTED;
+    _vlog (gw, "commit_config", r.error);
+    return &r;
+}
+
+/* Reboot clears the error log and comes up with the flash configuration.
+ */
+Reboot_Resp *
+reboot_1_svc (void *p, struct svc_req *rq)
+{
+    static __thread Reboot_Resp r;
+    struct ics_gateway *gw = _gateway (rq);
+
+    _delay (latency + flash_latency);
+    r.error = ICS_SUCCESS;
+    if (gw) {
+        pthread_mutex_lock (&state_lock);
+        gw->running = gw->flash;
+        gw->nerr = 0;
+        pthread_mutex_unlock (&state_lock);
+    } else
+        r.error = ICS_ERROR_UNSUPPORTED;
+    _vlog (gw, "reboot", r.error);
+    return &r;
+}
+
+Idn_Resp *
+idn_string_1_svc (void *p, struct svc_req *rq)
+{
+    static __thread Idn_Resp r;
+    static __thread char buf[64];
+    struct ics_gateway *gw = _gateway (rq);
+
+    _delay (latency);
+    r.error = ICS_SUCCESS;
+    snprintf (buf, sizeof (buf), "ICS Electronics,8065,%d,emulated",
+              gw ? (int)(gw - gateways + 1) : 0);
+    r.idn.idn_val = buf;
+    r.idn.idn_len = strlen (buf);
+    _vlog (gw, "idn_string", r.error);
+    return &r;
+}
+
+/* Return and clear the error log.
+ */
+Error_Log_Resp *
+error_logger_1_svc (void *p, struct svc_req *rq)
+{
+    static __thread Error_Log_Resp r;
+    struct ics_gateway *gw = _gateway (rq);
+
+    _delay (latency);
+    memset (&r, 0, sizeof (r));
+    if (gw) {
+        pthread_mutex_lock (&state_lock);
+        r.count = gw->nerr;
+        memcpy (r.errors, gw->errlog, gw->nerr * sizeof (gw->errlog[0]));
+        gw->nerr = 0;
+        pthread_mutex_unlock (&state_lock);
+    } else
+        r.error = ICS_ERROR_UNSUPPORTED;
+    _vlog (gw, "error_logger", r.error);
+    return &r;
+}
+
+static void
+sigterm (int sig)
+{
+    done = 1;
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct in_addr addr = { .s_addr = htonl (INADDR_LOOPBACK) };
+    unsigned short port = 0;
+    bool doRegister = false;
+    struct pollfd *pfd;
+    struct sigaction sa;
+    int c, i, fd;
+
+    prog = basename (argv[0]);
+    while ((c = GETOPT (argc, argv, OPTIONS, longopts)) != EOF) {
+        switch (c) {
+            case 'n':
+                if ((ngateways = strtoul (optarg, NULL, 10)) == 0)
+                    usage ();
+                break;
+            case 'b':
+                if (!inet_aton (optarg, &addr)) {
+                    fprintf (stderr, "%s: bad address: %s\n", prog, optarg);
+                    exit (1);
+                }
+                break;
+            case 'p':
+                port = strtoul (optarg, NULL, 10);
+                break;
+            case 'L':
+                latency = strtoul (optarg, NULL, 10);
+                break;
+            case 'F':
+                flash_latency = strtoul (optarg, NULL, 10);
+                break;
+            case 's':
+                statefile = optarg;
+                break;
+            case 'r':
+                doRegister = true;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage ();
+        }
+    }
+    if (optind < argc)
+        usage ();
+
+    gateways = xzmalloc (ngateways * sizeof (struct ics_gateway));
+    pfd = xzmalloc (ngateways * sizeof (struct pollfd));
+    for (i = 0; i < ngateways; i++) {
+        gateways[i].addr.s_addr = htonl (ntohl (addr.s_addr) + i);
+        _factory (&gateways[i].flash, i + 1);
+    }
+    if (statefile && _state_load () < 0)
+        exit (1);
+    for (i = 0; i < ngateways; i++) {
+        gateways[i].running = gateways[i].flash;
+        if ((pfd[i].fd = rpcserve_listen (&gateways[i].addr, &port)) < 0) {
+            fprintf (stderr, "%s: %s: %s\n", prog,
+                     inet_ntoa (gateways[i].addr), strerror (errno));
+            exit (1);
+        }
+        pfd[i].events = POLLIN;
+    }
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction (SIGPIPE, &sa, NULL);
+    sa.sa_handler = sigterm;
+    sigaction (SIGINT, &sa, NULL);
+    sigaction (SIGTERM, &sa, NULL);
+
+    if (doRegister) {
+        pmap_unset (ICSCONFIG, ICSCONFIG_VERSION);
+        if (!pmap_set (ICSCONFIG, ICSCONFIG_VERSION, IPPROTO_TCP, port)) {
+            fprintf (stderr, "%s: could not register with portmapper\n", prog);
+            exit (1);
+        }
+    }
+    printf ("port %hu\n", port);
+    fflush (stdout);
+
+    while (!done) {
+        if (poll (pfd, ngateways, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror ("icsconfigd: poll");
+            break;
+        }
+        for (i = 0; i < ngateways; i++) {
+            if ((pfd[i].revents & POLLIN)
+                    && (fd = accept (pfd[i].fd, NULL, NULL)) >= 0
+                    && rpcserve_spawn (fd, progs, NULL) < 0)
+                fprintf (stderr, "%s: could not serve connection\n", prog);
+        }
+    }
+    if (doRegister)
+        pmap_unset (ICSCONFIG, ICSCONFIG_VERSION);
+    free (pfd);
+    free (gateways);
+    exit (0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
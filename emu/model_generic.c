@@ -0,0 +1,142 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* model_generic.c - minimal IEEE 488.2 instrument */
+
+/* Answers the common queries (*IDN? *OPC? *ESR? *STB? *TST?), accepts
+ * *RST *CLS *TRG *WAI, and echoes any other query back, so it is enough
+ * to benchmark the transport without modelling a real instrument.
+ * Commands in one message may be separated by ';', and the responses to
+ * several queries are joined with ';'.  The optional model argument is
+ * the *IDN? response.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <rpc/rpc.h>
+
+#include "libvxi11/vxi11.h"
+#include "libutil/util.h"
+#include "emu.h"
+
+#define DFLT_IDN    "GPIB-UTILS,EMU-GENERIC,0,1.0"
+
+struct generic {
+    char           *idn;
+    unsigned char   esr;
+    int             triggers;
+};
+
+static int
+_create(emu_dev_t d, char *args)
+{
+    struct generic *g = xzmalloc(sizeof(struct generic));
+
+    g->idn = xstrdup(args && *args ? args : DFLT_IDN);
+    emu_set_data(d, g);
+    return 0;
+}
+
+static void
+_destroy(emu_dev_t d)
+{
+    struct generic *g = emu_get_data(d);
+
+    free(g->idn);
+    free(g);
+}
+
+/* Handle one command, appending any query response to 'resp'.
+ */
+static void
+_command(struct generic *g, char *cmd, char *resp, int len)
+{
+    int n = strlen(resp);
+    char *sep = n > 0 ? ";" : "";
+
+    if (!strcasecmp(cmd, "*IDN?"))
+        snprintf(resp + n, len - n, "%s%s", sep, g->idn);
+    else if (!strcasecmp(cmd, "*OPC?"))
+        snprintf(resp + n, len - n, "%s1", sep);
+    else if (!strcasecmp(cmd, "*TST?"))
+        snprintf(resp + n, len - n, "%s0", sep);
+    else if (!strcasecmp(cmd, "*ESR?")) {
+        snprintf(resp + n, len - n, "%s%d", sep, g->esr);
+        g->esr = 0;
+    } else if (!strcasecmp(cmd, "*RST") || !strcasecmp(cmd, "*CLS"))
+        g->esr = 0;
+    else if (!strcasecmp(cmd, "*TRG"))
+        g->triggers++;
+    else if (strchr(cmd, '?'))
+        snprintf(resp + n, len - n, "%s%s", sep, cmd);
+}
+
+static int
+_message(emu_dev_t d, char *buf, int len)
+{
+    struct generic *g = emu_get_data(d);
+    char *msg, *cmd, *saveptr = NULL;
+    char resp[1024] = "";
+
+    msg = xmalloc(len + 1);
+    memcpy(msg, buf, len);
+    msg[len] = '\0';
+    for (cmd = strtok_r(msg, ";\r\n", &saveptr); cmd != NULL;
+                                cmd = strtok_r(NULL, ";\r\n", &saveptr)) {
+        while (*cmd == ' ')
+            cmd++;
+        if (!strcasecmp(cmd, "*STB?")) {
+            int n = strlen(resp);
+
+            snprintf(resp + n, sizeof(resp) - n, "%s%d", n > 0 ? ";" : "",
+                     emu_get_stb(d));
+        } else
+            _command(g, cmd, resp, sizeof(resp));
+    }
+    if (*resp)
+        emu_printf(d, "%s\n", resp);
+    free(msg);
+    return 0;
+}
+
+static void
+_trigger(emu_dev_t d)
+{
+    struct generic *g = emu_get_data(d);
+
+    g->triggers++;
+}
+
+struct emu_model emu_model_generic = {
+    .name       = "generic",
+    .desc       = "IEEE 488.2 common commands, echoes other queries",
+    .create     = _create,
+    .destroy    = _destroy,
+    .message    = _message,
+    .trigger    = _trigger,
+};
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
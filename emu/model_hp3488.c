@@ -0,0 +1,373 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* model_hp3488.c - HP 3488A switch/control unit */
+
+/* References:
+ * "HP 3488A Switch/Control Unit: Operating, Programming, and
+ *   Configuration Manual", Sept 1, 1995.
+ *
+ * Enough of the 3488A for src/hp3488.c: CLOSE, OPEN, CRESET, CTYPE, VIEW,
+ * ERROR, ID?, TEST, RESET, STATUS, MASK, DON and DOFF.  The model argument
+ * lists the cards in slots 1-5 as for hp3488 -C, each optionally followed
+ * by /msec to override the card's relay operate time, e.g.
+ * "hp3488:44471,44477/30,0,44476,44474".
+ *
+ * Like the real unit, CTYPE reports 44476 and 44477 cards as 44471, and
+ * closing a channel the card doesn't have is a logic error, which is what
+ * hp3488's _disambiguate_ctype () relies on.  A command that operates
+ * relays returns at once with READY clear in the status byte; READY sets
+ * again when the last relay has settled, and the next command waits for
+ * it, so throughput and polling behave as they do on the bench.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <rpc/rpc.h>
+
+#include "libvxi11/vxi11.h"
+#include "libutil/util.h"
+#include "emu.h"
+
+#define DFLT_SLOTS          "44470,44471,44472,44473,44474"
+
+#define NSLOTS              5
+#define NCHANS              100     /* channel address <slot><00-99> */
+
+#define CMD_MSEC            2       /* command parse and dispatch */
+#define TEST_MSEC           1000    /* self test */
+
+/* Status byte (see src/hp3488.c) */
+#define STATUS_OUTPUT_AVAIL 0x02
+#define STATUS_READY        0x10
+#define STATUS_ERROR        0x20
+#define STATUS_RQS          0x40
+
+/* Error register */
+#define ERROR_SYNTAX        0x1
+#define ERROR_EXEC          0x2
+#define ERROR_LOGIC         0x8
+
+typedef struct {
+    int model;
+    int ctype;                      /* what CTYPE reports */
+    int msec;                       /* relay operate and settle time */
+    char *chans;                    /* valid channels as lo-hi pairs */
+} cardtab_t;
+
+static cardtab_t cardtab[] = {
+    { 0,     0,     0,  "" },
+    { 44470, 44470, 15, "0-9" },
+    { 44471, 44471, 15, "0-9" },
+    { 44472, 44472, 15, "0-3,10-13" },
+    { 44473, 44473, 15, "0-3,10-13,20-23,30-33" },
+    { 44474, 44474, 1,  "0-15" },
+    { 44475, 44475, 0,  "" },
+    { 44476, 44471, 30, "0-3" },
+    { 44477, 44471, 15, "0-6" },
+    { 44478, 44478, 15, "0-3,10-13" },
+};
+
+struct slot {
+    cardtab_t      *card;
+    int             msec;
+    unsigned char   valid[NCHANS];
+    unsigned char   closed[NCHANS];
+};
+
+struct hp3488 {
+    struct slot     slot[NSLOTS];
+    unsigned char   error;          /* error register */
+    unsigned char   mask;           /* SRQ mask */
+    double          busy_until;     /* relays settling until then */
+};
+
+static cardtab_t *
+_card_find(int model)
+{
+    int i;
+
+    for (i = 0; i < sizeof(cardtab)/sizeof(cardtab[0]); i++)
+        if (cardtab[i].model == model)
+            return &cardtab[i];
+    return NULL;
+}
+
+static int
+_slot_init(struct slot *sp, char *spec)
+{
+    char *p, *cpy;
+    int lo, hi, n;
+
+    if (!(sp->card = _card_find(strtoul(spec, &p, 10))) || p == spec)
+        return -1;
+    sp->msec = sp->card->msec;
+    if (*p == '/')
+        sp->msec = strtoul(p + 1, &p, 10);
+    if (*p != '\0')
+        return -1;
+    cpy = xstrdup(sp->card->chans);
+    for (p = strtok(cpy, ","); p != NULL; p = strtok(NULL, ",")) {
+        if (sscanf(p, "%d-%d", &lo, &hi) == 2) {
+            for (n = lo; n <= hi && n < NCHANS; n++)
+                sp->valid[n] = 1;
+        }
+    }
+    free(cpy);
+    return 0;
+}
+
+static int
+_create(emu_dev_t d, char *args)
+{
+    struct hp3488 *h = xzmalloc(sizeof(struct hp3488));
+    char *cpy = xstrdup(args && *args ? args : DFLT_SLOTS);
+    char *spec, *saveptr = NULL;
+    int i;
+
+    for (i = 0; i < NSLOTS; i++) {
+        spec = strtok_r(i == 0 ? cpy : NULL, ",", &saveptr);
+        if (!spec || _slot_init(&h->slot[i], spec) < 0) {
+            fprintf(stderr, "hp3488 model: specify five cards (0=empty) "
+                    "as model[/msec],...\n");
+            free(cpy);
+            free(h);
+            return -1;
+        }
+    }
+    free(cpy);
+    emu_set_data(d, h);
+    return 0;
+}
+
+static void
+_destroy(emu_dev_t d)
+{
+    free(emu_get_data(d));
+}
+
+static unsigned char
+_status(emu_dev_t d)
+{
+    struct hp3488 *h = emu_get_data(d);
+    unsigned char stb = 0;
+
+    if (gettime() >= h->busy_until)
+        stb |= STATUS_READY;
+    if (h->error)
+        stb |= STATUS_ERROR;
+    if (stb & h->mask)
+        stb |= STATUS_RQS;
+    return stb;
+}
+
+/* Wait for relays still settling from an earlier command.
+ */
+static int
+_wait_ready(emu_dev_t d, struct hp3488 *h)
+{
+    double now = gettime();
+
+    if (h->busy_until <= now)
+        return 0;
+    return emu_sleep(d, (unsigned long)((h->busy_until - now) * 1000) + 1);
+}
+
+/* Operate a relay in slot 'sp', extending the time until READY.
+ */
+static void
+_operate(struct hp3488 *h, struct slot *sp, int chan, int close)
+{
+    double now = gettime();
+
+    if (sp->closed[chan] == close)
+        return;
+    sp->closed[chan] = close;
+    if (h->busy_until < now)
+        h->busy_until = now;
+    h->busy_until += sp->msec / 1000.0;
+}
+
+static void
+_reset(struct hp3488 *h, int slot)
+{
+    struct slot *sp = &h->slot[slot];
+    int chan;
+
+    for (chan = 0; chan < NCHANS; chan++)
+        _operate(h, sp, chan, 0);
+}
+
+/* Parse a channel address <slot><chan>.
+ */
+static struct slot *
+_caddr(struct hp3488 *h, char *s, int *chanp)
+{
+    char *end;
+    int n = strtoul(s, &end, 10);
+
+    if (end == s || *end != '\0' || n < 100 || n > 599) {
+        h->error |= ERROR_EXEC;
+        return NULL;
+    }
+    *chanp = n % 100;
+    return &h->slot[n / 100 - 1];
+}
+
+static int
+_slotnum(struct hp3488 *h, char *s)
+{
+    char *end;
+    int n = s ? strtoul(s, &end, 10) : 0;
+
+    if (!s || end == s || *end != '\0' || n < 1 || n > NSLOTS) {
+        h->error |= ERROR_EXEC;
+        return -1;
+    }
+    return n - 1;
+}
+
+static void
+_command(emu_dev_t d, struct hp3488 *h, char *cmd, char *args)
+{
+    char *arg, *saveptr = NULL;
+    struct slot *sp;
+    int chan, slot;
+
+    arg = strtok_r(args, ", ", &saveptr);
+    if (!strcasecmp(cmd, "CLOSE") || !strcasecmp(cmd, "OPEN")) {
+        int close = !strcasecmp(cmd, "CLOSE");
+
+        if (!arg)
+            h->error |= ERROR_EXEC;
+        for (; arg != NULL; arg = strtok_r(NULL, ", ", &saveptr)) {
+            if (!(sp = _caddr(h, arg, &chan)))
+                break;
+            if (!sp->valid[chan]) {
+                h->error |= ERROR_LOGIC;
+                break;
+            }
+            _operate(h, sp, chan, close);
+        }
+    } else if (!strcasecmp(cmd, "CRESET")) {
+        if (!arg)
+            h->error |= ERROR_EXEC;
+        for (; arg != NULL; arg = strtok_r(NULL, ", ", &saveptr)) {
+            if ((slot = _slotnum(h, arg)) < 0)
+                break;
+            _reset(h, slot);
+        }
+    } else if (!strcasecmp(cmd, "CTYPE")) {
+        /* src/hp3488.c reads the model number from column 11 */
+        if ((slot = _slotnum(h, arg)) >= 0)
+            emu_printf(d, "CARD TYPE: %05d\r\n", h->slot[slot].card->ctype);
+    } else if (!strcasecmp(cmd, "VIEW")) {
+        if ((sp = arg ? _caddr(h, arg, &chan) : NULL)) {
+            if (!sp->valid[chan])
+                h->error |= ERROR_EXEC;
+            else
+                emu_printf(d, "%s\r\n", sp->closed[chan] ? "CLOSED 0"
+                                                         : "OPEN   1");
+        } else
+            h->error |= ERROR_EXEC;
+    } else if (!strcasecmp(cmd, "ERROR")) {
+        emu_printf(d, "%d\r\n", h->error);
+        h->error = 0;
+    } else if (!strcasecmp(cmd, "STATUS")) {
+        emu_printf(d, "%d\r\n", _status(d));
+    } else if (!strcasecmp(cmd, "MASK")) {
+        h->mask = arg ? strtoul(arg, NULL, 10) & ~STATUS_RQS : 0;
+    } else if (!strcasecmp(cmd, "ID?")) {
+        emu_printf(d, "HP3488A\r\n");
+    } else if (!strcasecmp(cmd, "TEST")) {
+        for (slot = 0; slot < NSLOTS; slot++)
+            _reset(h, slot);
+        h->busy_until = gettime() + TEST_MSEC / 1000.0;
+    } else if (!strcasecmp(cmd, "RESET")) {
+        for (slot = 0; slot < NSLOTS; slot++)
+            _reset(h, slot);
+        h->mask = 0;
+    } else if (!strcasecmp(cmd, "DON") || !strcasecmp(cmd, "DOFF")) {
+        ;
+    } else
+        h->error |= ERROR_SYNTAX;
+}
+
+static int
+_message(emu_dev_t d, char *buf, int len)
+{
+    struct hp3488 *h = emu_get_data(d);
+    char *msg, *cmd, *args, *saveptr = NULL;
+    int res = 0;
+
+    msg = xmalloc(len + 1);
+    memcpy(msg, buf, len);
+    msg[len] = '\0';
+    for (cmd = strtok_r(msg, ";\r\n", &saveptr); cmd != NULL;
+                                cmd = strtok_r(NULL, ";\r\n", &saveptr)) {
+        while (isspace(*cmd))
+            cmd++;
+        if (*cmd == '\0')
+            continue;
+        if ((res = _wait_ready(d, h)) != 0
+                || (res = emu_sleep(d, CMD_MSEC)) != 0)
+            break;
+        args = cmd + strcspn(cmd, " \t");
+        if (*args)
+            *args++ = '\0';
+        _command(d, h, cmd, args);
+    }
+    free(msg);
+    return res;
+}
+
+/* Device clear opens all relays, as at power on.
+ */
+static void
+_clear(emu_dev_t d)
+{
+    struct hp3488 *h = emu_get_data(d);
+    int slot;
+
+    for (slot = 0; slot < NSLOTS; slot++)
+        _reset(h, slot);
+    h->error = 0;
+    h->mask = 0;
+}
+
+struct emu_model emu_model_hp3488 = {
+    .name       = "hp3488",
+    .desc       = "HP 3488A switch/control unit (hp3488:CARD,...)",
+    .create     = _create,
+    .destroy    = _destroy,
+    .message    = _message,
+    .clear      = _clear,
+    .status     = _status,
+    .mav        = STATUS_OUTPUT_AVAIL,
+};
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
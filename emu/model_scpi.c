@@ -0,0 +1,706 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* model_scpi.c - SCPI instrument described by an INI file */
+
+/* The model argument is the path of an INI file (see scpi-dmm.ini):
+ *
+ *   [instrument]   idn, and the default 'service' and 'latency' (msec)
+ *   [state]        name = initial value, one per state variable
+ *   [command]      pattern = SCPI header, e.g. MEASure:VOLTage[:DC]?
+ *                  followed by any of
+ *                    response = text, with $name replaced by a variable
+ *                    set = name        (variable takes the argument)
+ *                    set = name=value  (variable takes 'value')
+ *                    service = msec    (device busy this long)
+ *                    latency = msec    (response ready this long after)
+ *                    stb_set, stb_clear, esr_set = bits
+ *
+ * The section name can't hold a SCPI header (libini stops at ']' and ':')
+ * so each [command] starts with its pattern.  Patterns match the short or
+ * long form of each node case-insensitively, and [...] marks an optional
+ * node.  Commands in a message are separated by ';' (outside quoted
+ * strings, so DISPlay:TEXT "a;b" is one command) and each is matched
+ * from the root.  libini takes a ';' after whitespace for the start of a
+ * comment, so a value that needs " ;" writes it as " $;".  The first matching [command] wins; otherwise the 488.2
+ * common commands and SYSTem:ERRor? are handled here, and anything else
+ * queues -113 "Undefined header" and sets CME in the ESR.
+ *
+ * Service times are spent in emu_sleep () so a front end sees the device
+ * busy, as it would a real instrument working through its input buffer.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <rpc/rpc.h>
+
+#include "libvxi11/vxi11.h"
+#include "libutil/util.h"
+#include "libini/ini.h"
+#include "emu.h"
+
+#define DFLT_IDN        "GPIB-UTILS,EMU-SCPI,0,1.0"
+
+#define MAX_VARIANTS    16      /* patterns with up to 4 optional nodes */
+#define ERRQ_SIZE       16
+
+/* status byte */
+#define STB_EAV         0x04    /* error queue not empty */
+#define STB_ESB         0x20    /* event summary */
+#define STB_RQS         0x40
+
+/* standard event status register */
+#define ESR_CME         0x20    /* command error */
+
+struct var {
+    char           *name;
+    char           *init;
+    char           *value;
+    struct var     *next;
+};
+
+struct setop {
+    char           *name;
+    char           *value;      /* NULL means the command argument */
+    struct setop   *next;
+};
+
+struct command {
+    char           *pattern;
+    char           *variants[MAX_VARIANTS];
+    int             nvariants;
+    char           *response;
+    struct setop   *sets;
+    long            service;    /* -1 for the [instrument] default */
+    long            latency;
+    unsigned char   stb_set;
+    unsigned char   stb_clear;
+    unsigned char   esr_set;
+    struct command *next;
+};
+
+struct scpi {
+    char           *path;
+    char           *idn;
+    unsigned long   service;
+    unsigned long   latency;
+    struct var     *vars;
+    struct command *cmds;
+    struct command *last;
+    unsigned char   stb;        /* model bits, excluding ESB/EAV/RQS */
+    unsigned char   esr;
+    unsigned char   ese;
+    unsigned char   sre;
+    char           *errq[ERRQ_SIZE];
+    int             nerr;
+};
+
+/* Add every expansion of the optional [...] nodes in 'pat' to 'c'.
+ */
+static int
+_expand(struct command *c, char *pat)
+{
+    char *open, *close, *s;
+    int len = strlen(pat);
+
+    if (!(open = strchr(pat, '['))) {
+        if (c->nvariants == MAX_VARIANTS)
+            return -1;
+        c->variants[c->nvariants++] = xstrdup(pat);
+        return 0;
+    }
+    if (!(close = strchr(open, ']')))
+        return -1;
+    s = xmalloc(len + 1);
+    /* with the optional part */
+    snprintf(s, len + 1, "%.*s%.*s%s", (int)(open - pat), pat,
+             (int)(close - open - 1), open + 1, close + 1);
+    if (_expand(c, s) < 0)
+        goto error;
+    /* without it */
+    snprintf(s, len + 1, "%.*s%s", (int)(open - pat), pat, close + 1);
+    if (_expand(c, s) < 0)
+        goto error;
+    free(s);
+    return 0;
+error:
+    free(s);
+    return -1;
+}
+
+/* Match one command node against a pattern node such as "VOLTage",
+ * whose short form is the leading upper case part.  A query's '?' must
+ * be on both or neither.
+ */
+static int
+_match_node(char *pat, int patlen, char *node, int nodelen)
+{
+    int shortlen = 0;
+    int pq = (patlen > 0 && pat[patlen - 1] == '?');
+    int nq = (nodelen > 0 && node[nodelen - 1] == '?');
+
+    if (pq != nq)
+        return 0;
+    patlen -= pq;
+    nodelen -= nq;
+    while (shortlen < patlen && !islower(pat[shortlen]))
+        shortlen++;
+    if (nodelen == patlen && !strncasecmp(pat, node, nodelen))
+        return 1;
+    if (nodelen == shortlen && !strncasecmp(pat, node, nodelen))
+        return 1;
+    return 0;
+}
+
+static int
+_match_variant(char *pat, char *hdr)
+{
+    char *pe, *he;
+
+    if (*pat == ':')
+        pat++;
+    if (*hdr == ':')
+        hdr++;
+    for (;;) {
+        pe = pat + strcspn(pat, ":");
+        he = hdr + strcspn(hdr, ":");
+        if (!_match_node(pat, pe - pat, hdr, he - hdr))
+            return 0;
+        if (*pe == '\0' || *he == '\0')
+            return (*pe == *he);
+        pat = pe + 1;
+        hdr = he + 1;
+    }
+}
+
+/* Match a header against a pattern.
+ */
+static int
+_match(struct command *c, char *hdr)
+{
+    int i;
+
+    for (i = 0; i < c->nvariants; i++)
+        if (_match_variant(c->variants[i], hdr))
+            return 1;
+    return 0;
+}
+
+static int
+_builtin(char *pattern, char *hdr)
+{
+    struct command c;
+    int i, res;
+
+    memset(&c, 0, sizeof(c));
+    if (_expand(&c, pattern) < 0)
+        return 0;
+    res = _match(&c, hdr);
+    for (i = 0; i < c.nvariants; i++)
+        free(c.variants[i]);
+    return res;
+}
+
+static struct var *
+_var_find(struct scpi *s, const char *name, int len)
+{
+    struct var *v;
+
+    for (v = s->vars; v != NULL; v = v->next)
+        if (strlen(v->name) == len && !strncasecmp(v->name, name, len))
+            return v;
+    return NULL;
+}
+
+static void
+_var_set(struct var *v, char *value)
+{
+    free(v->value);
+    v->value = xstrdup(value);
+}
+
+static int
+_parse_num(const char *value, unsigned long *np)
+{
+    char *end;
+
+    errno = 0;
+    *np = strtoul(value, &end, 0);
+    if (errno != 0 || end == value || *end != '\0')
+        return -1;
+    return 0;
+}
+
+static int
+_parse_cb(void *user, const char *section, const char *name,
+          const char *value)
+{
+    struct scpi *s = user;
+    struct command *c = s->last;
+    unsigned long n;
+
+    if (!strcmp(section, "instrument")) {
+        if (!strcmp(name, "idn")) {
+            free(s->idn);
+            s->idn = xstrdup(value);
+        } else if (!strcmp(name, "service")) {
+            if (_parse_num(value, &s->service) < 0)
+                goto badnum;
+        } else if (!strcmp(name, "latency")) {
+            if (_parse_num(value, &s->latency) < 0)
+                goto badnum;
+        } else
+            goto badname;
+    } else if (!strcmp(section, "state")) {
+        struct var *v;
+
+        if (_var_find(s, name, strlen(name))) {
+            fprintf(stderr, "%s: %s: duplicate state variable\n",
+                    s->path, name);
+            return 0;
+        }
+        v = xzmalloc(sizeof(struct var));
+        v->name = xstrdup(name);
+        v->init = xstrdup(value);
+        v->value = xstrdup(value);
+        v->next = s->vars;
+        s->vars = v;
+    } else if (!strcmp(section, "command")) {
+        if (!strcmp(name, "pattern")) {
+            c = xzmalloc(sizeof(struct command));
+            c->pattern = xstrdup(value);
+            c->service = -1;
+            c->latency = -1;
+            if (s->last)
+                s->last->next = c;
+            else
+                s->cmds = c;
+            s->last = c;
+            if (_expand(c, c->pattern) < 0) {
+                fprintf(stderr, "%s: %s: bad pattern\n", s->path, value);
+                return 0;
+            }
+            return 1;
+        }
+        if (!c) {
+            fprintf(stderr, "%s: [command] must start with pattern\n",
+                    s->path);
+            return 0;
+        }
+        if (!strcmp(name, "response")) {
+            free(c->response);
+            c->response = xstrdup(value);
+        } else if (!strcmp(name, "set")) {
+            struct setop *op = xzmalloc(sizeof(struct setop)), **opp;
+            char *eq;
+
+            op->name = xstrdup(value);
+            if ((eq = strchr(op->name, '='))) {
+                *eq++ = '\0';
+                op->value = eq;
+            }
+            for (opp = &c->sets; *opp != NULL; opp = &(*opp)->next)
+                ;
+            *opp = op;
+        } else if (!strcmp(name, "service")) {
+            if (_parse_num(value, &n) < 0)
+                goto badnum;
+            c->service = n;
+        } else if (!strcmp(name, "latency")) {
+            if (_parse_num(value, &n) < 0)
+                goto badnum;
+            c->latency = n;
+        } else if (!strcmp(name, "stb_set")) {
+            if (_parse_num(value, &n) < 0 || n > 0xff)
+                goto badnum;
+            c->stb_set = n;
+        } else if (!strcmp(name, "stb_clear")) {
+            if (_parse_num(value, &n) < 0 || n > 0xff)
+                goto badnum;
+            c->stb_clear = n;
+        } else if (!strcmp(name, "esr_set")) {
+            if (_parse_num(value, &n) < 0 || n > 0xff)
+                goto badnum;
+            c->esr_set = n;
+        } else
+            goto badname;
+    } else {
+        fprintf(stderr, "%s: unknown section [%s]\n", s->path, section);
+        return 0;
+    }
+    return 1;
+badname:
+    fprintf(stderr, "%s: [%s] unknown attribute '%s'\n", s->path, section,
+            name);
+    return 0;
+badnum:
+    fprintf(stderr, "%s: [%s] %s: bad value '%s'\n", s->path, section,
+            name, value);
+    return 0;
+}
+
+static void
+_free(struct scpi *s)
+{
+    struct command *c;
+    struct setop *op;
+    struct var *v;
+    int i;
+
+    while ((c = s->cmds)) {
+        s->cmds = c->next;
+        while ((op = c->sets)) {
+            c->sets = op->next;
+            free(op->name);
+            free(op);
+        }
+        for (i = 0; i < c->nvariants; i++)
+            free(c->variants[i]);
+        free(c->response);
+        free(c->pattern);
+        free(c);
+    }
+    while ((v = s->vars)) {
+        s->vars = v->next;
+        free(v->name);
+        free(v->init);
+        free(v->value);
+        free(v);
+    }
+    for (i = 0; i < s->nerr; i++)
+        free(s->errq[i]);
+    free(s->idn);
+    free(s->path);
+    free(s);
+}
+
+static int
+_create(emu_dev_t d, char *args)
+{
+    struct scpi *s;
+    struct command *c;
+    struct setop *op;
+    int rc;
+
+    if (!args || !*args) {
+        fprintf(stderr, "scpi model needs an INI file: name=scpi:file\n");
+        return -1;
+    }
+    s = xzmalloc(sizeof(struct scpi));
+    s->path = xstrdup(args);
+    s->idn = xstrdup(DFLT_IDN);
+    rc = ini_parse(s->path, _parse_cb, s);
+    if (rc == -1) {
+        fprintf(stderr, "%s: %s\n", s->path, strerror(errno));
+        goto error;
+    } else if (rc == -2) {
+        fprintf(stderr, "%s: out of memory\n", s->path);
+        goto error;
+    } else if (rc > 0) {
+        fprintf(stderr, "%s line %d: parse error\n", s->path, rc);
+        goto error;
+    }
+    for (c = s->cmds; c != NULL; c = c->next) {
+        for (op = c->sets; op != NULL; op = op->next) {
+            if (!_var_find(s, op->name, strlen(op->name))) {
+                fprintf(stderr, "%s: %s: set of unknown variable %s\n",
+                        s->path, c->pattern, op->name);
+                goto error;
+            }
+        }
+    }
+    emu_set_data(d, s);
+    return 0;
+error:
+    _free(s);
+    return -1;
+}
+
+static void
+_destroy(emu_dev_t d)
+{
+    _free(emu_get_data(d));
+}
+
+/* Recompute the summary bits and pass the status byte to the core.
+ */
+static void
+_update_stb(emu_dev_t d, struct scpi *s)
+{
+    unsigned char stb = s->stb & ~(STB_EAV | STB_ESB | STB_RQS);
+
+    if (s->nerr > 0)
+        stb |= STB_EAV;
+    if (s->esr & s->ese)
+        stb |= STB_ESB;
+    if (stb & s->sre)
+        stb |= STB_RQS;
+    emu_set_stb(d, stb, ~stb);
+}
+
+static void
+_error_push(struct scpi *s, char *err)
+{
+    if (s->nerr == ERRQ_SIZE) {     /* last entry reports the overflow */
+        free(s->errq[ERRQ_SIZE - 1]);
+        s->errq[ERRQ_SIZE - 1] = xstrdup("-350,\"Queue overflow\"");
+        return;
+    }
+    s->errq[s->nerr++] = xstrdup(err);
+}
+
+static void
+_append(char *resp, int len, char *str)
+{
+    int n = strlen(resp);
+
+    snprintf(resp + n, len - n, "%s%s", n > 0 ? ";" : "", str);
+}
+
+/* Append 'tmpl' to 'resp', replacing $name with the value of a state
+ * variable, $$ with $ and $; with ;.
+ */
+static void
+_expand_response(struct scpi *s, char *tmpl, char *resp, int len)
+{
+    char *out = xzmalloc(len);
+    int n = 0;
+
+    while (*tmpl && n < len - 1) {
+        if (tmpl[0] == '$' && (tmpl[1] == '$' || tmpl[1] == ';')) {
+            out[n++] = tmpl[1];
+            tmpl += 2;
+        } else if (tmpl[0] == '$') {
+            int vlen = 0;
+            struct var *v;
+
+            while (isalnum(tmpl[1 + vlen]) || tmpl[1 + vlen] == '_')
+                vlen++;
+            if ((v = _var_find(s, tmpl + 1, vlen)))
+                n += snprintf(out + n, len - n, "%s", v->value);
+            if (n >= len)
+                n = len - 1;
+            tmpl += 1 + vlen;
+        } else
+            out[n++] = *tmpl++;
+    }
+    out[n] = '\0';
+    _append(resp, len, out);
+    free(out);
+}
+
+static void
+_run(emu_dev_t d, struct scpi *s, struct command *c, char *arg,
+     char *resp, int len)
+{
+    struct setop *op;
+
+    for (op = c->sets; op != NULL; op = op->next)
+        _var_set(_var_find(s, op->name, strlen(op->name)),
+                 op->value ? op->value : arg);
+    s->stb = (s->stb | c->stb_set) & ~c->stb_clear;
+    s->esr |= c->esr_set;
+    if (c->response)
+        _expand_response(s, c->response, resp, len);
+}
+
+/* The 488.2 common commands and the SCPI error queue, for headers the
+ * table doesn't handle.
+ */
+static void
+_common(emu_dev_t d, struct scpi *s, char *hdr, char *arg,
+        char *resp, int len)
+{
+    char buf[64];
+    struct var *v;
+    int i;
+
+    if (!strcasecmp(hdr, "*IDN?"))
+        _append(resp, len, s->idn);
+    else if (!strcasecmp(hdr, "*OPC?"))
+        _append(resp, len, "1");
+    else if (!strcasecmp(hdr, "*TST?"))
+        _append(resp, len, "0");
+    else if (!strcasecmp(hdr, "*STB?")) {
+        snprintf(buf, sizeof(buf), "%d", emu_get_stb(d));
+        _append(resp, len, buf);
+    } else if (!strcasecmp(hdr, "*ESR?")) {
+        snprintf(buf, sizeof(buf), "%d", s->esr);
+        _append(resp, len, buf);
+        s->esr = 0;
+    } else if (!strcasecmp(hdr, "*ESE?")) {
+        snprintf(buf, sizeof(buf), "%d", s->ese);
+        _append(resp, len, buf);
+    } else if (!strcasecmp(hdr, "*SRE?")) {
+        snprintf(buf, sizeof(buf), "%d", s->sre);
+        _append(resp, len, buf);
+    } else if (!strcasecmp(hdr, "*ESE"))
+        s->ese = strtoul(arg, NULL, 0);
+    else if (!strcasecmp(hdr, "*SRE"))
+        s->sre = strtoul(arg, NULL, 0) & ~STB_RQS;
+    else if (!strcasecmp(hdr, "*CLS")) {
+        s->esr = 0;
+        s->stb = 0;
+        for (i = 0; i < s->nerr; i++)
+            free(s->errq[i]);
+        s->nerr = 0;
+    } else if (!strcasecmp(hdr, "*RST")) {
+        for (v = s->vars; v != NULL; v = v->next)
+            _var_set(v, v->init);
+    } else if (!strcasecmp(hdr, "*OPC") || !strcasecmp(hdr, "*WAI")
+                                        || !strcasecmp(hdr, "*TRG"))
+        ;
+    else if (_builtin("SYSTem:ERRor[:NEXT]?", hdr)) {
+        if (s->nerr > 0) {
+            _append(resp, len, s->errq[0]);
+            free(s->errq[0]);
+            memmove(&s->errq[0], &s->errq[1],
+                    --s->nerr * sizeof(s->errq[0]));
+        } else
+            _append(resp, len, "+0,\"No error\"");
+    } else {
+        _error_push(s, "-113,\"Undefined header\"");
+        s->esr |= ESR_CME;
+    }
+}
+
+static struct command *
+_lookup(struct scpi *s, char *hdr)
+{
+    struct command *c;
+
+    for (c = s->cmds; c != NULL; c = c->next)
+        if (_match(c, hdr))
+            return c;
+    return NULL;
+}
+
+/* Split off the next command of a message at ';' or end of line, like
+ * strtok_r () but leaving separators inside "..." or '...' alone.
+ */
+static char *
+_next_cmd(char **sp)
+{
+    char *cmd = *sp, *p;
+    char quote = 0;
+
+    if (cmd == NULL)
+        return NULL;
+    for (p = cmd; *p; p++) {
+        if (quote) {
+            if (*p == quote)
+                quote = 0;
+        } else if (*p == '"' || *p == '\'')
+            quote = *p;
+        else if (*p == ';' || *p == '\r' || *p == '\n')
+            break;
+    }
+    if (*p) {
+        *p = '\0';
+        *sp = p + 1;
+    } else
+        *sp = NULL;
+    return cmd;
+}
+
+static int
+_message(emu_dev_t d, char *buf, int len)
+{
+    struct scpi *s = emu_get_data(d);
+    char *msg, *cmd, *arg, *next;
+    char resp[1024] = "";
+    unsigned long lat, latency = 0;
+    struct command *c;
+    int n, res = 0;
+
+    msg = xmalloc(len + 1);
+    memcpy(msg, buf, len);
+    msg[len] = '\0';
+    next = msg;
+    while ((cmd = _next_cmd(&next)) != NULL) {
+        while (isspace(*cmd))
+            cmd++;
+        if (*cmd == '\0')
+            continue;
+        arg = cmd + strcspn(cmd, " \t");
+        if (*arg) {
+            *arg++ = '\0';
+            while (isspace(*arg))
+                arg++;
+        }
+        c = _lookup(s, cmd);
+        if ((res = emu_sleep(d, c && c->service >= 0 ? c->service
+                                                     : s->service)) != 0)
+            break;
+        n = strlen(resp);
+        if (c)
+            _run(d, s, c, arg, resp, sizeof(resp));
+        else
+            _common(d, s, cmd, arg, resp, sizeof(resp));
+        lat = c && c->latency >= 0 ? c->latency : s->latency;
+        if (strlen(resp) > n && lat > latency)
+            latency = lat;
+        _update_stb(d, s);
+    }
+    if (*resp) {
+        emu_printf(d, "%s\n", resp);
+        emu_delay_response(d, latency);
+    }
+    free(msg);
+    return res;
+}
+
+/* Group execute trigger runs the *TRG entry, if any.
+ */
+static void
+_trigger(emu_dev_t d)
+{
+    struct scpi *s = emu_get_data(d);
+    char resp[1024] = "";
+    struct command *c;
+
+    if ((c = _lookup(s, "*TRG"))) {
+        if (emu_sleep(d, c->service >= 0 ? c->service : s->service) != 0)
+            return;
+        _run(d, s, c, "", resp, sizeof(resp));
+        if (*resp)
+            emu_printf(d, "%s\n", resp);
+        _update_stb(d, s);
+    }
+}
+
+struct emu_model emu_model_scpi = {
+    .name       = "scpi",
+    .desc       = "SCPI instrument described by an INI file (scpi:FILE)",
+    .create     = _create,
+    .destroy    = _destroy,
+    .message    = _message,
+    .trigger    = _trigger,
+};
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,355 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <rpc/rpc.h>
+#include <rpc/svc_auth.h>
+
+#include "libvxi11/vxi11.h"
+#include "libutil/util.h"
+#include "rpcserve.h"
+
+#ifndef RQCRED_SIZE
+#define RQCRED_SIZE 400     /* glibc rpc/svc.h, not in libtirpc */
+#endif
+
+struct conn {
+    int                     fd;
+    struct rpcserve_prog   *progs;
+    void                    (*disconnect)(SVCXPRT *xprt);
+};
+
+static void
+_dispatch(struct conn *c, struct svc_req *req, SVCXPRT *xprt)
+{
+    struct rpcserve_prog *p;
+
+    for (p = c->progs; p->prog != 0; p++) {
+        if (p->prog == req->rq_prog && p->vers == req->rq_vers) {
+            p->dispatch(req, xprt);
+            return;
+        }
+    }
+    svcerr_noprog(xprt);
+}
+
+static void *
+_conn_thread(void *arg)
+{
+    struct conn *c = arg;
+    char cred_area[2 * MAX_AUTH_BYTES + RQCRED_SIZE];
+    struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+    struct rpc_msg msg;
+    struct svc_req req;
+    enum xprt_stat stat;
+    enum auth_stat why;
+    SVCXPRT *xprt;
+
+    if (!(xprt = svc_fd_create(c->fd, 0, 0))) {
+        fprintf(stderr, "rpcserve: svc_fd_create failed\n");
+        close(c->fd);
+        free(c);
+        return NULL;
+    }
+    memset(&msg, 0, sizeof(msg));
+    memset(&req, 0, sizeof(req));
+    msg.rm_call.cb_cred.oa_base = cred_area;
+    msg.rm_call.cb_verf.oa_base = &cred_area[MAX_AUTH_BYTES];
+    req.rq_clntcred = &cred_area[2 * MAX_AUTH_BYTES];
+    for (;;) {
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        do {
+            if (SVC_RECV(xprt, &msg)) {
+                req.rq_xprt = xprt;
+                req.rq_prog = msg.rm_call.cb_prog;
+                req.rq_vers = msg.rm_call.cb_vers;
+                req.rq_proc = msg.rm_call.cb_proc;
+                req.rq_cred = msg.rm_call.cb_cred;
+                /* N.B. libtirpc svc_getargs () needs xp_auth set here */
+                if ((why = _authenticate(&req, &msg)) != AUTH_OK)
+                    svcerr_auth(xprt, why);
+                else
+                    _dispatch(c, &req, xprt);
+            }
+            stat = SVC_STAT(xprt);
+        } while (stat == XPRT_MOREREQS);
+        if (stat == XPRT_DIED)
+            break;
+    }
+    if (c->disconnect)
+        c->disconnect(xprt);
+    SVC_DESTROY(xprt);
+    free(c);
+    return NULL;
+}
+
+int
+rpcserve_listen(struct in_addr *addr, unsigned short *portp)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    int fd, saved_errno, one = 1;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr = *addr;
+    sin.sin_port = htons(*portp);
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+            || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0
+            || listen(fd, 64) < 0
+            || getsockname(fd, (struct sockaddr *)&sin, &len) < 0) {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    *portp = ntohs(sin.sin_port);
+    return fd;
+}
+
+int
+rpcserve_spawn(int fd, struct rpcserve_prog *progs,
+               void (*disconnect)(SVCXPRT *xprt))
+{
+    struct conn *c = xzmalloc(sizeof(struct conn));
+    pthread_attr_t attr;
+    pthread_t t;
+    int res = 0, one = 1;
+
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->fd = fd;
+    c->progs = progs;
+    c->disconnect = disconnect;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&t, &attr, _conn_thread, c) != 0) {
+        close(fd);
+        free(c);
+        res = -1;
+    }
+    pthread_attr_destroy(&attr);
+    return res;
+}
+
+void
+rpcserve_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+void
+rpcserve_deadline(struct timespec *ts, unsigned long msec)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += msec / 1000;
+    ts->tv_nsec += (msec % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+int
+rpcserve_expired(struct timespec *ts)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec > ts->tv_sec
+        || (now.tv_sec == ts->tv_sec && now.tv_nsec >= ts->tv_nsec));
+}
+
+int
+rpcserve_before(struct timespec *a, struct timespec *b)
+{
+    return (a->tv_sec < b->tv_sec
+        || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec));
+}
+
+void
+rpcserve_links_init(struct rpcserve_links *t, pthread_mutex_t *lock,
+                    void (*release)(struct rpcserve_link *l))
+{
+    memset(t, 0, sizeof(*t));
+    t->lock = lock;
+    rpcserve_cond_init(&t->lock_cond);
+    t->next_lid = 1;
+    t->release = release;
+}
+
+void
+rpcserve_link_init(struct rpcserve_links *t, struct rpcserve_link *l,
+                   long *locker, SVCXPRT *xprt)
+{
+    l->lid = t->next_lid++;
+    l->locker = locker;
+    l->xprt = xprt;
+    l->next = NULL;
+}
+
+void
+rpcserve_link_add(struct rpcserve_links *t, struct rpcserve_link *l)
+{
+    l->next = t->head;
+    t->head = l;
+}
+
+struct rpcserve_link *
+rpcserve_link_find(struct rpcserve_links *t, long lid, SVCXPRT *xprt)
+{
+    struct rpcserve_link *l;
+
+    for (l = t->head; l != NULL; l = l->next)
+        if (l->lid == lid)
+            break;
+    if (l && xprt && l->xprt != xprt)
+        l = NULL;
+    return l;
+}
+
+static int
+_locked_out(struct rpcserve_link *l)
+{
+    return (*l->locker != 0 && *l->locker != l->lid);
+}
+
+int
+rpcserve_lock_wait(struct rpcserve_links *t, struct rpcserve_link *l,
+                   long flags, unsigned long lock_timeout, int acquire)
+{
+    struct timespec expire;
+
+    rpcserve_deadline(&expire, lock_timeout);
+    while (_locked_out(l)) {
+        if (!(flags & VXI11_FLAG_WAITLOCK))
+            return VXI11_ERR_LOCKED;
+        if (pthread_cond_timedwait(&t->lock_cond, t->lock, &expire)
+                == ETIMEDOUT && _locked_out(l))
+            return VXI11_ERR_LOCKED;
+    }
+    if (acquire)
+        *l->locker = l->lid;
+    return 0;
+}
+
+int
+rpcserve_lock_release(struct rpcserve_links *t, struct rpcserve_link *l)
+{
+    if (*l->locker != l->lid)
+        return VXI11_ERR_NOLOCK;
+    *l->locker = 0;
+    pthread_cond_broadcast(&t->lock_cond);
+    return 0;
+}
+
+int
+rpcserve_link_begin(struct rpcserve_links *t, long lid, SVCXPRT *xprt,
+                    long flags, unsigned long lock_timeout,
+                    struct rpcserve_link **lp)
+{
+    struct rpcserve_link *l;
+    int err = VXI11_ERR_LINKINVAL;
+
+    pthread_mutex_lock(t->lock);
+    if ((l = rpcserve_link_find(t, lid, xprt)))
+        err = rpcserve_lock_wait(t, l, flags, lock_timeout, 0);
+    pthread_mutex_unlock(t->lock);
+    *lp = l;
+    return err;
+}
+
+void
+rpcserve_link_destroy(struct rpcserve_links *t, struct rpcserve_link *l)
+{
+    struct rpcserve_link **lp;
+
+    for (lp = &t->head; *lp != NULL; lp = &(*lp)->next) {
+        if (*lp == l) {
+            *lp = l->next;
+            break;
+        }
+    }
+    (void)rpcserve_lock_release(t, l);
+    if (t->release)
+        t->release(l);
+    free(l);
+}
+
+void
+rpcserve_link_cleanup(struct rpcserve_links *t, SVCXPRT *xprt,
+                      void (*log)(struct rpcserve_link *l))
+{
+    struct rpcserve_link *l, *next;
+
+    pthread_mutex_lock(t->lock);
+    for (l = t->head; l != NULL; l = next) {
+        next = l->next;
+        if (l->xprt == xprt) {
+            if (log)
+                log(l);
+            rpcserve_link_destroy(t, l);
+        }
+    }
+    pthread_mutex_unlock(t->lock);
+}
+
+/* The rpcgen dispatch routines free results with these.
+ */
+int
+device_core_1_freeresult(SVCXPRT *transp, xdrproc_t xdr_result,
+                         caddr_t result)
+{
+    xdr_free(xdr_result, result);
+    return 1;
+}
+
+int
+device_async_1_freeresult(SVCXPRT *transp, xdrproc_t xdr_result,
+                          caddr_t result)
+{
+    xdr_free(xdr_result, result);
+    return 1;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,146 @@
+#ifndef _RPCSERVE_H
+#define _RPCSERVE_H
+
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* Serve ONC RPC over TCP with a thread per connection.
+ *
+ * svc_run () serves all connections from one thread, so one slow call
+ * stalls every other client.  Here each accepted connection gets a thread
+ * of its own that polls its socket and feeds requests to the rpcgen
+ * dispatch routine, much as svc_getreq_common () would.  Service
+ * functions must therefore be reentrant: rpcgen -M, or results in
+ * thread-local storage.
+ */
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <time.h>
+#include <rpc/rpc.h>
+
+struct rpcserve_prog {
+    unsigned long   prog;
+    unsigned long   vers;
+    void            (*dispatch)(struct svc_req *rqstp, SVCXPRT *transp);
+};
+
+/* Listen on 'addr', port '*portp' or any port if zero.  The port is
+ * returned in '*portp'.  Returns the socket, or -1 on error (errno set).
+ */
+int rpcserve_listen(struct in_addr *addr, unsigned short *portp);
+
+/* Serve calls to 'progs', an array ending with a zero prog, on connected
+ * socket 'fd' from a new detached thread.  If 'disconnect' is not NULL it
+ * is called with the transport when the client goes away, before the
+ * transport is destroyed.  Returns 0, or -1 on error (fd is closed).
+ */
+int rpcserve_spawn(int fd, struct rpcserve_prog *progs,
+                   void (*disconnect)(SVCXPRT *xprt));
+
+/* Deadlines for timed waits on CLOCK_MONOTONIC, with condition variables
+ * set up by rpcserve_cond_init ().
+ */
+void rpcserve_cond_init(pthread_cond_t *cond);
+void rpcserve_deadline(struct timespec *ts, unsigned long msec);
+int rpcserve_expired(struct timespec *ts);
+int rpcserve_before(struct timespec *a, struct timespec *b);
+
+/* VXI-11 links, shared by vxi11d and vxi11proxy.  A server's link starts
+ * with a struct rpcserve_link, whose 'locker' points at the VXI-11 lock
+ * of the link's device (the lid holding it, or 0).  The table's mutex is
+ * the server's own, and guards the links and device locks.
+ *
+ * Calls on the core channel only find links their own connection
+ * created, so a link is only destroyed by the thread serving its
+ * connection (destroy_link or disconnect), and that thread may go on
+ * using a link it found after dropping the mutex.  device_abort, from
+ * the abort channel, finds any link but must not keep it.
+ */
+struct rpcserve_link {
+    long                    lid;
+    long                   *locker;
+    SVCXPRT                *xprt;       /* connection that created it */
+    struct rpcserve_link   *next;
+};
+
+struct rpcserve_links {
+    pthread_mutex_t        *lock;
+    pthread_cond_t          lock_cond;  /* signalled when a lock is freed */
+    struct rpcserve_link   *head;
+    long                    next_lid;
+    void                    (*release)(struct rpcserve_link *l);
+};
+
+/* Set up a table guarded by 'lock'.  'release', if not NULL, is called
+ * on a link being destroyed, before it is freed.
+ */
+void rpcserve_links_init(struct rpcserve_links *t, pthread_mutex_t *lock,
+                         void (*release)(struct rpcserve_link *l));
+
+/* Give a new link created on 'xprt' for a device with lock 'locker' its
+ * lid, and add it to the table once set up.  Call with the lock held.
+ */
+void rpcserve_link_init(struct rpcserve_links *t, struct rpcserve_link *l,
+                        long *locker, SVCXPRT *xprt);
+void rpcserve_link_add(struct rpcserve_links *t, struct rpcserve_link *l);
+
+/* Look up link 'lid' created on 'xprt' (any connection if NULL).
+ * Call with the lock held.
+ */
+struct rpcserve_link *rpcserve_link_find(struct rpcserve_links *t, long lid,
+                                         SVCXPRT *xprt);
+
+/* Wait until link 'l' may use its device, i.e. the device is not locked
+ * by another link, waiting up to 'lock_timeout' msec if VXI11_FLAG_WAITLOCK
+ * is set in 'flags'.  If 'acquire' is set, take the lock.  Returns 0 or
+ * VXI11_ERR_LOCKED.  Call with the lock held.
+ */
+int rpcserve_lock_wait(struct rpcserve_links *t, struct rpcserve_link *l,
+                       long flags, unsigned long lock_timeout, int acquire);
+
+/* Release the device lock held by 'l'.  Returns 0 or VXI11_ERR_NOLOCK.
+ * Call with the lock held.
+ */
+int rpcserve_lock_release(struct rpcserve_links *t, struct rpcserve_link *l);
+
+/* Look up link 'lid' for a call on 'xprt' and wait for its device as in
+ * rpcserve_lock_wait ().  The link is returned in 'lp', or NULL if there
+ * is none.  Returns 0, VXI11_ERR_LINKINVAL or VXI11_ERR_LOCKED.
+ */
+int rpcserve_link_begin(struct rpcserve_links *t, long lid, SVCXPRT *xprt,
+                        long flags, unsigned long lock_timeout,
+                        struct rpcserve_link **lp);
+
+/* Remove link 'l', releasing its device lock.  Call with the lock held.
+ */
+void rpcserve_link_destroy(struct rpcserve_links *t, struct rpcserve_link *l);
+
+/* Destroy the links 'xprt' created, as if its client had called
+ * destroy_link on each before it went away, first passing each to 'log'
+ * if not NULL.  For the rpcserve_spawn () disconnect callback.
+ */
+void rpcserve_link_cleanup(struct rpcserve_links *t, SVCXPRT *xprt,
+                           void (*log)(struct rpcserve_link *l));
+
+#endif /* _RPCSERVE_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,419 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* stream.c - raw socket and pty front ends for emulated devices */
+
+/* Each stream has an input thread that reads lines and writes them to
+ * the device, and an output thread that waits in emu_read () and copies
+ * whatever the device queues to the client, so a response goes out when
+ * the model makes it ready without the client having to ask for it.  The
+ * output thread wakes up every POLL_MSEC to see if the stream is done.
+ *
+ * The output queue belongs to the device, not the stream, so the output
+ * thread only takes from it while its client is owed a response: from
+ * when a line that queued one is sent until the queue is empty or
+ * IO_TIMEOUT has passed.  Otherwise a pty that nobody has open would take
+ * the responses meant for VXI-11 clients of the same device.
+ *
+ * When a socket client goes away, the input thread aborts the output
+ * thread's emu_read (), which is made under an owner of its own, so that
+ * it does not take the response to the next client's query on its way
+ * out.
+ *
+ * The pty front end keeps the slave open itself, so that reads on the
+ * master do not fail with EIO while no client has it open, and so that it
+ * can read back the line settings the client makes with tcsetattr ().
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#define _GNU_SOURCE         /* posix_openpt, cfmakeraw */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <rpc/rpc.h>
+
+#include "libvxi11/vxi11.h"
+#include "libutil/util.h"
+#include "emu.h"
+#include "fault.h"
+#include "rpcserve.h"
+#include "stream.h"
+
+#define IO_TIMEOUT      10000       /* msec, as a client might set */
+#define POLL_MSEC       250
+#define MAX_LINE        65536
+#define OUTBUF_SIZE     65536
+
+struct stream {
+    emu_dev_t           d;
+    int                 fd;         /* socket or pty master */
+    int                 slave;      /* pty slave, or -1 */
+    long                id;         /* connection number, for the log */
+    long                owner;      /* emu_read () owner: -id, not a lid */
+    volatile int        done;
+    pthread_mutex_t     lock;       /* protects the rest */
+    pthread_cond_t      cond;
+    unsigned long       sent;       /* lines sent that queued a response */
+    int                 owing;      /* a response is owed until 'owed' */
+    struct timespec     owed;
+};
+
+struct listener {
+    emu_dev_t           d;
+    int                 fd;
+};
+
+typedef struct {
+    speed_t speed;
+    int     baud;
+} baudmap_t;
+
+static baudmap_t baudmap[] = {
+    {B300,    300},
+    {B1200,   1200},
+    {B2400,   2400},
+    {B4800,   4800},
+    {B9600,   9600},
+    {B19200,  19200},
+    {B38400,  38400},
+#ifdef B57600
+    {B57600,  57600},
+#endif
+#ifdef B115200
+    {B115200, 115200},
+#endif
+#ifdef B230400
+    {B230400, 230400},
+#endif
+#ifdef B460800
+    {B460800, 460800},
+#endif
+};
+
+static struct stream *
+_stream_create(emu_dev_t d, int fd, int slave, long id)
+{
+    struct stream *s = xzmalloc(sizeof(struct stream));
+
+    s->d = d;
+    s->fd = fd;
+    s->slave = slave;
+    s->id = id;
+    s->owner = -id;
+    pthread_mutex_init(&s->lock, NULL);
+    rpcserve_cond_init(&s->cond);
+    return s;
+}
+
+/* Close and free 's'.
+ */
+static void
+_stream_destroy(struct stream *s)
+{
+    if (s->fd >= 0)
+        close(s->fd);
+    if (s->slave >= 0)
+        close(s->slave);
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+/* Wait up to POLL_MSEC for the client to be owed a response.  Returns the
+ * count of lines sent if it is, else 0.
+ */
+static unsigned long
+_owed(struct stream *s)
+{
+    struct timespec ts;
+    unsigned long sent = 0;
+
+    pthread_mutex_lock(&s->lock);
+    if (!s->owing) {
+        rpcserve_deadline(&ts, POLL_MSEC);
+        pthread_cond_timedwait(&s->cond, &s->lock, &ts);
+    }
+    if (s->owing && rpcserve_expired(&s->owed))
+        s->owing = 0;
+    if (s->owing)
+        sent = s->sent;
+    pthread_mutex_unlock(&s->lock);
+    return sent;
+}
+
+/* Take as long as 'len' characters would take on the serial line the
+ * client has set up on the pty slave.
+ */
+static void
+_pace(struct stream *s, int len)
+{
+    struct termios tio;
+    int i, bits;
+
+    if (s->slave < 0 || tcgetattr(s->slave, &tio) < 0)
+        return;
+    for (i = 0; i < sizeof(baudmap)/sizeof(baudmap[0]); i++) {
+        if (baudmap[i].speed == cfgetospeed(&tio))
+            break;
+    }
+    if (i == sizeof(baudmap)/sizeof(baudmap[0]))
+        return;
+    switch (tio.c_cflag & CSIZE) {
+        case CS5: bits = 5; break;
+        case CS6: bits = 6; break;
+        case CS7: bits = 7; break;
+        default:  bits = 8; break;
+    }
+    bits += 1 + ((tio.c_cflag & PARENB) ? 1 : 0)
+              + ((tio.c_cflag & CSTOPB) ? 2 : 1);
+    usleep((unsigned long)((double)len * bits * 1000000 / baudmap[i].baud));
+}
+
+/* Drop a socket connection in response to an injected fault.  A pty
+ * cannot be dropped, so there the fault has no effect.
+ */
+static void
+_drop(struct stream *s)
+{
+    if (s->slave < 0)
+        (void)shutdown(s->fd, SHUT_RDWR);
+}
+
+static void *
+_output_thread(void *arg)
+{
+    struct stream *s = arg;
+    char *buf = xmalloc(OUTBUF_SIZE);
+    unsigned long sent;
+    int len, reason, res;
+
+    while (!s->done) {
+        if (!(sent = _owed(s)) || s->done)
+            continue;
+        if (emu_read(s->d, s->owner, buf, OUTBUF_SIZE, -1, POLL_MSEC,
+                     &len, &reason) != 0 || len == 0)
+            continue;
+        if (reason & VXI11_REASON_END) {
+            pthread_mutex_lock(&s->lock);
+            if (s->sent == sent)    /* no line sent since */
+                s->owing = 0;
+            pthread_mutex_unlock(&s->lock);
+        }
+        res = fault_inject(s->d, FAULT_OP_READ, s->id, IO_TIMEOUT);
+        if (res != 0 && res != FAULT_DROP)
+            continue;
+        _pace(s, len);
+        if (write_all(s->fd, buf, len) < 0) {
+            s->done = 1;
+            break;
+        }
+        if (res == FAULT_DROP)
+            _drop(s);
+    }
+    free(buf);
+    return NULL;
+}
+
+/* Pass a line to the device.
+ */
+static void
+_message(struct stream *s, char *buf, int len)
+{
+    int res, responded;
+
+    _pace(s, len);
+    res = fault_inject(s->d, FAULT_OP_WRITE, s->id, IO_TIMEOUT);
+    if (res == 0 || res == FAULT_DROP) {
+        if (emu_write(s->d, s->owner, buf, len, 1, IO_TIMEOUT, &responded)
+                == 0 && responded) {
+            pthread_mutex_lock(&s->lock);
+            s->sent++;
+            s->owing = 1;
+            rpcserve_deadline(&s->owed, IO_TIMEOUT);
+            pthread_cond_signal(&s->cond);
+            pthread_mutex_unlock(&s->lock);
+        }
+    }
+    if (res == FAULT_DROP)
+        _drop(s);
+}
+
+/* Read lines until the client goes away (on a pty, forever).
+ */
+static void *
+_input_thread(void *arg)
+{
+    struct stream *s = arg;
+    char *line = xmalloc(MAX_LINE);
+    int n, len = 0;
+    char *nl;
+    pthread_t t;
+
+    if (pthread_create(&t, NULL, _output_thread, s) != 0) {
+        fprintf(stderr, "%s: could not start output thread\n",
+                emu_name(s->d));
+        goto done;
+    }
+    while (!s->done) {
+        do {
+            n = read(s->fd, line + len, MAX_LINE - len);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0)
+            break;
+        len += n;
+        while ((nl = memchr(line, '\n', len))) {
+            n = nl - line + 1;
+            _message(s, line, n);
+            memmove(line, line + n, len - n);
+            len -= n;
+        }
+        if (len == MAX_LINE) {      /* runaway line: pass it on as is */
+            _message(s, line, len);
+            len = 0;
+        }
+    }
+    s->done = 1;
+    emu_abort(s->d, s->owner);
+    pthread_join(t, NULL);
+done:
+    free(line);
+    _stream_destroy(s);
+    return NULL;
+}
+
+static int
+_spawn(void *(*fun)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    pthread_t t;
+    int res;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    res = pthread_create(&t, &attr, fun, arg);
+    pthread_attr_destroy(&attr);
+    if (res != 0) {
+        errno = res;
+        return -1;
+    }
+    return 0;
+}
+
+static void *
+_listen_thread(void *arg)
+{
+    struct listener *l = arg;
+    struct stream *s;
+    long id = 0;
+    int fd, one = 1;
+
+    for (;;) {
+        if ((fd = accept(l->fd, NULL, NULL)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("stream: accept");
+            break;
+        }
+        (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        s = _stream_create(l->d, fd, -1, ++id);
+        if (_spawn(_input_thread, s) < 0) {
+            fprintf(stderr, "%s: could not serve connection\n",
+                    emu_name(l->d));
+            _stream_destroy(s);
+        }
+    }
+    close(l->fd);
+    free(l);
+    return NULL;
+}
+
+int
+stream_socket(emu_dev_t d, struct in_addr *addr, unsigned short *portp)
+{
+    struct listener *l = xzmalloc(sizeof(struct listener));
+    int saved_errno;
+
+    l->d = d;
+    if ((l->fd = rpcserve_listen(addr, portp)) < 0)
+        goto error;
+    if (_spawn(_listen_thread, l) < 0) {
+        saved_errno = errno;
+        close(l->fd);
+        errno = saved_errno;
+        goto error;
+    }
+    return 0;
+error:
+    free(l);
+    return -1;
+}
+
+int
+stream_pty(emu_dev_t d, char *link, char *path, int len)
+{
+    struct stream *s = _stream_create(d, -1, -1, 0);
+    struct termios tio;
+    char *name;
+    int saved_errno;
+
+    if ((s->fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0)
+        goto error;
+    if (grantpt(s->fd) < 0 || unlockpt(s->fd) < 0
+            || !(name = ptsname(s->fd))
+            || (s->slave = open(name, O_RDWR | O_NOCTTY)) < 0)
+        goto error;
+    /* No echo until the client sets the line up, or our responses would
+     * come straight back as commands.
+     */
+    if (tcgetattr(s->slave, &tio) < 0)
+        goto error;
+    cfmakeraw(&tio);
+    if (tcsetattr(s->slave, TCSANOW, &tio) < 0)
+        goto error;
+    if (link) {
+        if (unlink(link) < 0 && errno != ENOENT)
+            goto error;
+        if (symlink(name, link) < 0)
+            goto error;
+    }
+    snprintf(path, len, "%s", name);
+    if (_spawn(_input_thread, s) < 0)
+        goto error;
+    return 0;
+error:
+    saved_errno = errno;
+    _stream_destroy(s);
+    errno = saved_errno;
+    return -1;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,60 @@
+#ifndef _STREAM_H
+#define _STREAM_H
+
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* Byte stream front ends for emulated devices: a raw TCP socket, as used
+ * by LAN instruments on e.g. port 5025, and a pty standing in for an
+ * RS-232 port.  Each newline terminated line received is passed to the
+ * device as one message, and responses are sent back as soon as the
+ * device makes them available.  There is no serial poll, device clear or
+ * error channel, so a write or read that fault injection fails is simply
+ * dropped, leaving the client to time out.
+ *
+ * A stream only takes responses from the device while its client is owed
+ * one, from when it sends a line until the device's output is empty, so
+ * it can share a device with VXI-11 clients that take turns with it.
+ * Two clients querying at once may still get each other's responses, as
+ * they would on a real instrument.
+ */
+
+#include <netinet/in.h>
+
+#include "emu.h"
+
+/* Serve 'd' on TCP 'addr', port '*portp' or any port if zero.  The port is
+ * returned in '*portp'.  Connections are accepted and served by threads
+ * of their own.  Returns 0, or -1 on error (errno set).
+ */
+int stream_socket(emu_dev_t d, struct in_addr *addr, unsigned short *portp);
+
+/* Serve 'd' on a new pty, and return the path of the slave side, which
+ * clients open as a serial device, in 'path'.  If 'link' is not NULL, it
+ * is made a symbolic link to the slave.  Traffic both ways is paced to the
+ * baud rate and character format the client sets on the slave.
+ * Returns 0, or -1 on error (errno set).
+ */
+int stream_pty(emu_dev_t d, char *link, char *path, int len);
+
+#endif /* _STREAM_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
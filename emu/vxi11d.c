@@ -0,0 +1,722 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* vxi11d - VXI-11 server for emulated instruments */
+
+/* Devices can also be served as raw socket or serial instruments with
+ * --socket and --pty (see stream.h), so that the same model can be
+ * measured over each transport.
+ */
+
+/* The rpcgen -M dispatch routines in vxi11_svc.c decode each call and
+ * call the *_1_svc () functions below with caller-owned results.  Each
+ * connection is served by a thread of its own (see rpcserve.h), so an
+ * abort arriving on the abort channel reaches a read blocked in another
+ * thread.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/param.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#if HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+#include <rpc/rpc.h>
+#include <rpc/pmap_clnt.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+
+#include "libvxi11/vxi11.h"
+#include "libvxi11/portcache.h"
+#include "libutil/util.h"
+#include "emu.h"
+#include "fault.h"
+#include "rpcserve.h"
+#include "stream.h"
+
+/* dispatch routines from vxi11_svc.c */
+void device_core_1 (struct svc_req *rqstp, SVCXPRT *transp);
+void device_async_1 (struct svc_req *rqstp, SVCXPRT *transp);
+
+static struct rpcserve_prog core_progs[] = {
+    { DEVICE_CORE, DEVICE_CORE_VERSION, device_core_1 },
+    { 0, 0, NULL },
+};
+static struct rpcserve_prog async_progs[] = {
+    { DEVICE_ASYNC, DEVICE_ASYNC_VERSION, device_async_1 },
+    { 0, 0, NULL },
+};
+
+#define DFLT_DEVICE     "inst0=generic"
+#define DFLT_MAXRECV    65536
+#define MAX_READ        (1024*1024)     /* largest read we will buffer */
+
+/* Per device VXI-11 lock state.
+ */
+struct vdev {
+    emu_dev_t       emu;
+    long            locker;         /* lid holding the lock, 0 = none */
+    struct vdev    *next;
+};
+
+struct link {
+    struct rpcserve_link rl;        /* lid, lock, connection */
+    struct vdev    *dev;
+};
+
+char *prog = "";
+const char *options = "d:p:a:b:m:c:s:t:f:F:S:rlv";
+
+#if HAVE_GETOPT_LONG
+#define GETOPT(ac,av,opt,lopt) getopt_long(ac,av,opt,lopt,NULL)
+static struct option longopts[] = {
+    {"device",          required_argument, 0, 'd'},
+    {"port",            required_argument, 0, 'p'},
+    {"abort-port",      required_argument, 0, 'a'},
+    {"bind",            required_argument, 0, 'b'},
+    {"max-recv",        required_argument, 0, 'm'},
+    {"portcache",       required_argument, 0, 'c'},
+    {"socket",          required_argument, 0, 's'},
+    {"pty",             required_argument, 0, 't'},
+    {"fault",           required_argument, 0, 'f'},
+    {"fault-log",       required_argument, 0, 'F'},
+    {"seed",            required_argument, 0, 'S'},
+    {"register",        no_argument,       0, 'r'},
+    {"list",            no_argument,       0, 'l'},
+    {"verbose",         no_argument,       0, 'v'},
+    {0, 0, 0, 0},
+};
+#else
+#define GETOPT(ac,av,opt,lopt) getopt(ac,av,opt)
+#endif
+
+static struct vdev *vdevs = NULL;
+static struct rpcserve_links links;
+static pthread_mutex_t vxi_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned short core_port = 0;
+static unsigned short abort_port = 0;
+static unsigned long max_recv = DFLT_MAXRECV;
+static bool verbose = false;
+static volatile sig_atomic_t done = 0;
+
+void usage (void)
+{
+    fprintf (stderr, "%s", "Usage: vxi11d [OPTIONS]\n"
+        "    -d,--device NAME=MODEL[:ARGS]  add a device (inst0=generic)\n"
+        "    -p,--port PORT        core channel port (any)\n"
+        "    -a,--abort-port PORT  abort channel port (any)\n"
+        "    -b,--bind ADDR        listen address (127.0.0.1)\n"
+        "    -m,--max-recv BYTES   maxRecvSize for create_link (65536)\n"
+        "    -c,--portcache HOST   record HOST as this server in the portcache\n"
+        "    -s,--socket NAME[=PORT]  also serve NAME on a raw TCP socket\n"
+        "    -t,--pty NAME[=LINK]  also serve NAME on a pty, LINK to the slave\n"
+        "    -f,--fault NAME=RULE[,RULE]...  inject faults (NAME may be *)\n"
+        "    -F,--fault-log FILE   log injected faults to FILE (stderr)\n"
+        "    -S,--seed N           seed fault probabilities (1)\n"
+        "    -r,--register         register DEVICE_CORE with the portmapper\n"
+        "    -l,--list             list device models\n"
+        "    -v,--verbose          log each call on stderr\n");
+    exit (1);
+}
+
+/* Log a call on link 'lid' of device 'dv' (NULL if the link was not
+ * found).  Devices live as long as the server, but a link may be
+ * destroyed once vxi_lock is dropped (by device_abort's caller, for
+ * one), so callers pass what they need rather than the link.
+ */
+static void
+vlog (struct vdev *dv, long lid, const char *op, int err)
+{
+    if (verbose)
+        fprintf (stderr, "%s: %s lid=%ld %s = %d\n", prog,
+                 dv ? emu_name (dv->emu) : "-", lid, op, err);
+}
+
+/* Apply the fault rules of 'dv' to 'op'.  Returns 0 or the error
+ * to fail the call with; if the connection should be dropped once the
+ * call is done, '*dropp' is set.
+ */
+static int
+inject (struct vdev *dv, int op, long lid, unsigned long timeout,
+        bool *dropp)
+{
+    int res;
+
+    if ((res = fault_inject (dv->emu, op, lid, timeout)) == 0)
+        return 0;
+    if (res == FAULT_DROP) {
+        *dropp = true;
+        return 0;
+    }
+    return res;
+}
+
+/* Return from a service function, or drop the connection unanswered
+ * so the client sees it go away in the middle of the RPC.
+ */
+static bool_t
+reply (struct svc_req *rq, bool drop)
+{
+    if (drop) {
+        (void)shutdown (rq->rq_xprt->xp_fd, SHUT_RDWR);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Look up link 'lid' for a call on 'rq' and wait for its device as in
+ * rpcserve_lock_wait ().  The device is returned in 'dvp', or NULL if
+ * there is no such link.
+ */
+static int
+link_begin (struct svc_req *rq, long lid, long flags,
+            unsigned long lock_timeout, struct vdev **dvp)
+{
+    struct rpcserve_link *rl;
+    int err;
+
+    err = rpcserve_link_begin (&links, lid, rq->rq_xprt, flags, lock_timeout,
+                               &rl);
+    *dvp = rl ? ((struct link *)rl)->dev : NULL;
+    return err;
+}
+
+bool_t
+create_link_1_svc (Create_LinkParms *p, Create_LinkResp *r,
+                   struct svc_req *rq)
+{
+    struct vdev *dv;
+    struct link *l = NULL;
+    emu_dev_t emu;
+
+    memset (r, 0, sizeof (*r));
+    emu = emu_find (p->device);
+    pthread_mutex_lock (&vxi_lock);
+    for (dv = vdevs; dv != NULL; dv = dv->next)
+        if (dv->emu == emu)
+            break;
+    if (!dv)
+        r->error = VXI11_ERR_NODEVICE;
+    else {
+        l = xzmalloc (sizeof (struct link));
+        rpcserve_link_init (&links, &l->rl, &dv->locker, rq->rq_xprt);
+        l->dev = dv;
+        if (p->lockDevice && (r->error = rpcserve_lock_wait (&links, &l->rl,
+                                                VXI11_FLAG_WAITLOCK,
+                                                p->lock_timeout, true))) {
+            free (l);
+            l = NULL;
+        } else {
+            rpcserve_link_add (&links, &l->rl);
+            r->lid = l->rl.lid;
+            r->abortPort = abort_port;
+            r->maxRecvSize = max_recv;
+        }
+    }
+    pthread_mutex_unlock (&vxi_lock);
+    if (verbose)
+        fprintf (stderr, "%s: %s lid=%ld create_link = %d\n", prog,
+                 p->device, (long)r->lid, (int)r->error);
+    return TRUE;
+}
+
+bool_t
+device_write_1_svc (Device_WriteParms *p, Device_WriteResp *r,
+                    struct svc_req *rq)
+{
+    struct vdev *dv;
+    bool drop = false;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &dv))
+            && !(r->error = inject (dv, FAULT_OP_WRITE, p->lid, p->io_timeout,
+                                    &drop))
+            && !(r->error = emu_write (dv->emu, p->lid, p->data.data_val,
+                                       p->data.data_len,
+                                       (p->flags & VXI11_FLAG_ENDW),
+                                       p->io_timeout, NULL)))
+        r->size = p->data.data_len;
+    vlog (dv, p->lid, "device_write", r->error);
+    return reply (rq, drop);
+}
+
+bool_t
+device_read_1_svc (Device_ReadParms *p, Device_ReadResp *r,
+                   struct svc_req *rq)
+{
+    struct vdev *dv;
+    int size = p->requestSize < MAX_READ ? p->requestSize : MAX_READ;
+    int len = 0, reason = 0;
+    bool drop = false;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &dv))
+            && !(r->error = inject (dv, FAULT_OP_READ, p->lid, p->io_timeout,
+                                    &drop))) {
+        r->data.data_val = xmalloc (size > 0 ? size : 1);
+        r->error = emu_read (dv->emu, p->lid, r->data.data_val, size,
+                             (p->flags & VXI11_FLAG_TERMCHRSET) ? p->termChar
+                                                                : -1,
+                             p->io_timeout, &len, &reason);
+        r->data.data_len = len;
+        r->reason = reason;
+    }
+    vlog (dv, p->lid, "device_read", r->error);
+    return reply (rq, drop);
+}
+
+bool_t
+device_readstb_1_svc (Device_GenericParms *p, Device_ReadStbResp *r,
+                      struct svc_req *rq)
+{
+    struct vdev *dv;
+    bool drop = false;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &dv))
+            && !(r->error = inject (dv, FAULT_OP_READSTB, p->lid, p->io_timeout,
+                                    &drop)))
+        r->stb = emu_readstb (dv->emu);
+    vlog (dv, p->lid, "device_readstb", r->error);
+    return reply (rq, drop);
+}
+
+bool_t
+device_trigger_1_svc (Device_GenericParms *p, Device_Error *r,
+                      struct svc_req *rq)
+{
+    struct vdev *dv;
+    bool drop = false;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &dv))
+            && !(r->error = inject (dv, FAULT_OP_TRIGGER, p->lid, p->io_timeout,
+                                    &drop)))
+        r->error = emu_trigger (dv->emu, p->lid);
+    vlog (dv, p->lid, "device_trigger", r->error);
+    return reply (rq, drop);
+}
+
+bool_t
+device_clear_1_svc (Device_GenericParms *p, Device_Error *r,
+                    struct svc_req *rq)
+{
+    struct vdev *dv;
+    bool drop = false;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &dv))
+            && !(r->error = inject (dv, FAULT_OP_CLEAR, p->lid, p->io_timeout,
+                                    &drop)))
+        r->error = emu_clear (dv->emu);
+    vlog (dv, p->lid, "device_clear", r->error);
+    return reply (rq, drop);
+}
+
+bool_t
+device_remote_1_svc (Device_GenericParms *p, Device_Error *r,
+                     struct svc_req *rq)
+{
+    struct vdev *dv;
+    bool drop = false;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &dv)))
+        r->error = inject (dv, FAULT_OP_OTHER, p->lid, p->io_timeout, &drop);
+    vlog (dv, p->lid, "device_remote", r->error);
+    return reply (rq, drop);
+}
+
+bool_t
+device_local_1_svc (Device_GenericParms *p, Device_Error *r,
+                    struct svc_req *rq)
+{
+    struct vdev *dv;
+    bool drop = false;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &dv)))
+        r->error = inject (dv, FAULT_OP_OTHER, p->lid, p->io_timeout, &drop);
+    vlog (dv, p->lid, "device_local", r->error);
+    return reply (rq, drop);
+}
+
+bool_t
+device_lock_1_svc (Device_LockParms *p, Device_Error *r, struct svc_req *rq)
+{
+    struct link *l;
+    struct vdev *dv = NULL;
+
+    memset (r, 0, sizeof (*r));
+    pthread_mutex_lock (&vxi_lock);
+    if (!(l = (struct link *)rpcserve_link_find (&links, p->lid, rq->rq_xprt)))
+        r->error = VXI11_ERR_LINKINVAL;
+    else {
+        dv = l->dev;
+        r->error = rpcserve_lock_wait (&links, &l->rl, p->flags,
+                                       p->lock_timeout, true);
+    }
+    pthread_mutex_unlock (&vxi_lock);
+    vlog (dv, p->lid, "device_lock", r->error);
+    return TRUE;
+}
+
+bool_t
+device_unlock_1_svc (Device_Link *lid, Device_Error *r, struct svc_req *rq)
+{
+    struct link *l;
+    struct vdev *dv = NULL;
+
+    memset (r, 0, sizeof (*r));
+    pthread_mutex_lock (&vxi_lock);
+    if (!(l = (struct link *)rpcserve_link_find (&links, *lid, rq->rq_xprt)))
+        r->error = VXI11_ERR_LINKINVAL;
+    else {
+        dv = l->dev;
+        r->error = rpcserve_lock_release (&links, &l->rl);
+    }
+    pthread_mutex_unlock (&vxi_lock);
+    vlog (dv, *lid, "device_unlock", r->error);
+    return TRUE;
+}
+
+/* Service requests need an interrupt channel, which we do not offer,
+ * so enabling them is accepted but has no effect.
+ */
+bool_t
+device_enable_srq_1_svc (Device_EnableSrqParms *p, Device_Error *r,
+                         struct svc_req *rq)
+{
+    struct link *l;
+    struct vdev *dv = NULL;
+
+    memset (r, 0, sizeof (*r));
+    pthread_mutex_lock (&vxi_lock);
+    if (!(l = (struct link *)rpcserve_link_find (&links, p->lid, rq->rq_xprt)))
+        r->error = VXI11_ERR_LINKINVAL;
+    else
+        dv = l->dev;
+    pthread_mutex_unlock (&vxi_lock);
+    vlog (dv, p->lid, "device_enable_srq", r->error);
+    return TRUE;
+}
+
+bool_t
+device_docmd_1_svc (Device_DocmdParms *p, Device_DocmdResp *r,
+                    struct svc_req *rq)
+{
+    memset (r, 0, sizeof (*r));
+    r->error = VXI11_ERR_NOTSUPP;
+    return TRUE;
+}
+
+bool_t
+destroy_link_1_svc (Device_Link *lid, Device_Error *r, struct svc_req *rq)
+{
+    struct rpcserve_link *l;
+
+    memset (r, 0, sizeof (*r));
+    pthread_mutex_lock (&vxi_lock);
+    if (!(l = rpcserve_link_find (&links, *lid, rq->rq_xprt)))
+        r->error = VXI11_ERR_LINKINVAL;
+    else
+        rpcserve_link_destroy (&links, l);
+    pthread_mutex_unlock (&vxi_lock);
+    if (verbose)
+        fprintf (stderr, "%s: lid=%ld destroy_link = %d\n", prog,
+                 (long)*lid, (int)r->error);
+    return TRUE;
+}
+
+bool_t
+create_intr_chan_1_svc (Device_RemoteFunc *p, Device_Error *r,
+                        struct svc_req *rq)
+{
+    memset (r, 0, sizeof (*r));
+    r->error = VXI11_ERR_NOTSUPP;
+    return TRUE;
+}
+
+bool_t
+destroy_intr_chan_1_svc (void *p, Device_Error *r, struct svc_req *rq)
+{
+    memset (r, 0, sizeof (*r));
+    r->error = VXI11_ERR_NOTSUPP;
+    return TRUE;
+}
+
+bool_t
+device_abort_1_svc (Device_Link *lid, Device_Error *r, struct svc_req *rq)
+{
+    struct link *l;
+    emu_dev_t emu = NULL;
+
+    memset (r, 0, sizeof (*r));
+    pthread_mutex_lock (&vxi_lock);
+    if (!(l = (struct link *)rpcserve_link_find (&links, *lid, NULL)))
+        r->error = VXI11_ERR_LINKINVAL;
+    else
+        emu = l->dev->emu;
+    pthread_mutex_unlock (&vxi_lock);
+    if (emu)
+        emu_abort (emu, *lid);
+    if (verbose)
+        fprintf (stderr, "%s: lid=%ld device_abort = %d\n", prog,
+                 (long)*lid, (int)r->error);
+    return TRUE;
+}
+
+static void
+log_disconnect (struct rpcserve_link *rl)
+{
+    vlog (((struct link *)rl)->dev, rl->lid, "disconnect", 0);
+}
+
+/* Destroy the links a connection created when it goes away.
+ */
+static void
+conn_cleanup (SVCXPRT *xprt)
+{
+    rpcserve_link_cleanup (&links, xprt, log_disconnect);
+}
+
+/* Serve a device named in 'spec', NAME[=PORT] or NAME[=LINK], on a raw
+ * socket or pty as well, and say where on stdout.
+ */
+static void
+start_stream (char *spec, bool pty, struct in_addr *addr)
+{
+    char *arg = strchr (spec, '=');
+    unsigned short port = 0;
+    char path[PATH_MAX];
+    emu_dev_t emu;
+
+    if (arg)
+        *arg++ = '\0';
+    if (!(emu = emu_find (spec))) {
+        fprintf (stderr, "%s: %s: no such device\n", prog, spec);
+        exit (1);
+    }
+    if (pty) {
+        if (stream_pty (emu, arg, path, sizeof (path)) < 0) {
+            fprintf (stderr, "%s: %s: pty: %s\n", prog, spec,
+                     strerror (errno));
+            exit (1);
+        }
+        printf ("pty %s %s\n", emu_name (emu), path);
+    } else {
+        if (arg)
+            port = strtoul (arg, NULL, 10);
+        if (stream_socket (emu, addr, &port) < 0) {
+            fprintf (stderr, "%s: %s: socket: %s\n", prog, spec,
+                     strerror (errno));
+            exit (1);
+        }
+        printf ("socket %s %hu\n", emu_name (emu), port);
+    }
+}
+
+static void
+sigterm (int sig)
+{
+    done = 1;
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct in_addr addr = { .s_addr = htonl (INADDR_LOOPBACK) };
+    struct pollfd pfd[2];
+    struct sigaction sa;
+    bool doRegister = false;
+    char *cachehost = NULL;
+    char **faults = NULL;
+    int nfaults = 0;
+    char **sockets = NULL, **ptys = NULL;
+    int nsockets = 0, nptys = 0;
+    FILE *faultlog = stderr;
+    unsigned int seed = 1;
+    struct vdev *dv;
+    emu_dev_t emu;
+    int c, i, fd;
+    int ndevices = 0;
+
+    prog = basename (argv[0]);
+    while ((c = GETOPT (argc, argv, options, longopts)) != EOF) {
+        switch (c) {
+            case 'd':
+                if (!emu_create (optarg))
+                    exit (1);
+                ndevices++;
+                break;
+            case 'p':
+                core_port = strtoul (optarg, NULL, 10);
+                break;
+            case 'a':
+                abort_port = strtoul (optarg, NULL, 10);
+                break;
+            case 'b':
+                if (!inet_aton (optarg, &addr)) {
+                    fprintf (stderr, "%s: bad address: %s\n", prog, optarg);
+                    exit (1);
+                }
+                break;
+            case 'm':
+                if ((max_recv = strtoul (optarg, NULL, 10)) == 0)
+                    usage ();
+                break;
+            case 'c':
+                cachehost = optarg;
+                break;
+            case 's':
+                sockets = xrealloc (sockets, (nsockets + 1) * sizeof (char *));
+                sockets[nsockets++] = optarg;
+                break;
+            case 't':
+                ptys = xrealloc (ptys, (nptys + 1) * sizeof (char *));
+                ptys[nptys++] = optarg;
+                break;
+            case 'f':
+                faults = xrealloc (faults, (nfaults + 1) * sizeof (char *));
+                faults[nfaults++] = optarg;
+                break;
+            case 'F':
+                if (!(faultlog = fopen (optarg, "a"))) {
+                    fprintf (stderr, "%s: %s: %s\n", prog, optarg,
+                             strerror (errno));
+                    exit (1);
+                }
+                break;
+            case 'S':
+                seed = strtoul (optarg, NULL, 10);
+                break;
+            case 'r':
+                doRegister = true;
+                break;
+            case 'l':
+                emu_list_models (stdout);
+                exit (0);
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage ();
+        }
+    }
+    if (optind < argc)
+        usage ();
+    if (cachehost && !portcache_enabled ()) {
+        fprintf (stderr, "%s: --portcache needs VXI11_PORTCACHE set\n", prog);
+        exit (1);
+    }
+    if (ndevices == 0 && !emu_create (DFLT_DEVICE))
+        exit (1);
+    for (emu = emu_next (NULL); emu != NULL; emu = emu_next (emu)) {
+        dv = xzmalloc (sizeof (struct vdev));
+        dv->emu = emu;
+        dv->next = vdevs;
+        vdevs = dv;
+    }
+    for (i = 0; i < nfaults; i++)
+        if (fault_config (faults[i], seed, faultlog) < 0)
+            exit (1);
+    rpcserve_links_init (&links, &vxi_lock, NULL);
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction (SIGPIPE, &sa, NULL);
+    sa.sa_handler = sigterm;
+    sigaction (SIGINT, &sa, NULL);
+    sigaction (SIGTERM, &sa, NULL);
+
+    if ((pfd[0].fd = rpcserve_listen (&addr, &core_port)) < 0
+            || (pfd[1].fd = rpcserve_listen (&addr, &abort_port)) < 0) {
+        perror ("vxi11d: listen");
+        exit (1);
+    }
+    pfd[0].events = pfd[1].events = POLLIN;
+    if (doRegister) {
+        pmap_unset (DEVICE_CORE, DEVICE_CORE_VERSION);
+        if (!pmap_set (DEVICE_CORE, DEVICE_CORE_VERSION, IPPROTO_TCP,
+                       core_port)) {
+            fprintf (stderr, "%s: could not register with portmapper\n", prog);
+            exit (1);
+        }
+    }
+    if (cachehost) {
+        struct portcache_entry e;
+        char name[MAXHOSTNAMELEN];
+
+        e.core_port = core_port;
+        e.mtime = time (NULL);
+        for (emu = emu_next (NULL); emu != NULL; emu = emu_next (emu)) {
+            snprintf (name, sizeof (name), "%s:%s", cachehost, emu_name (emu));
+            portcache_update (name, &e);
+        }
+    }
+    printf ("core %hu abort %hu\n", core_port, abort_port);
+    for (i = 0; i < nsockets; i++)
+        start_stream (sockets[i], false, &addr);
+    for (i = 0; i < nptys; i++)
+        start_stream (ptys[i], true, &addr);
+    fflush (stdout);
+
+    while (!done) {
+        if (poll (pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror ("vxi11d: poll");
+            break;
+        }
+        for (i = 0; i < 2; i++) {
+            if ((pfd[i].revents & POLLIN)
+                    && (fd = accept (pfd[i].fd, NULL, NULL)) >= 0
+                    && rpcserve_spawn (fd, i == 0 ? core_progs : async_progs,
+                                       conn_cleanup) < 0)
+                fprintf (stderr, "%s: could not serve connection\n", prog);
+        }
+    }
+    if (doRegister)
+        pmap_unset (DEVICE_CORE, DEVICE_CORE_VERSION);
+    fault_summary ();
+    exit (0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,1099 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* vxi11proxy - VXI-11 proxy sharing instrument links among clients */
+
+/* Clients create links to the proxy, which keeps one link of its own to
+ * each instrument upstream and takes the clients' calls to it in turns.
+ * A client's turn starts when it reaches the head of the device's queue
+ * and lasts from a write until the response is read, so that responses
+ * go to the client that asked, or until the client has been idle for the
+ * hold time.  Clients only wait for each other's turns, never for a lock
+ * on the instrument: VXI-11 locks are kept by the proxy, and the upstream
+ * link is never locked.
+ *
+ * A write that is a whole query (see is_query ()) is sent and its
+ * response read upstream in one transaction, and the response kept for
+ * the client's reads.  A client that sends the same query while one is
+ * waiting for or in its turn does not queue, but gets a copy of that
+ * query's response.
+ *
+ * Each upstream handle is only used by the client whose turn it is, so
+ * it is only used by one thread at a time as libvxi11 requires.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+#include <signal.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/param.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#if HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+#include <rpc/rpc.h>
+#include <rpc/pmap_clnt.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+
+#include "libvxi11/vxi11.h"
+#include "libvxi11/vxi11_device.h"
+#include "libvxi11/portcache.h"
+#include "libutil/util.h"
+#include "rpcserve.h"
+
+/* dispatch routines from vxi11_svc.c */
+void device_core_1 (struct svc_req *rqstp, SVCXPRT *transp);
+void device_async_1 (struct svc_req *rqstp, SVCXPRT *transp);
+
+static struct rpcserve_prog core_progs[] = {
+    { DEVICE_CORE, DEVICE_CORE_VERSION, device_core_1 },
+    { 0, 0, NULL },
+};
+static struct rpcserve_prog async_progs[] = {
+    { DEVICE_ASYNC, DEVICE_ASYNC_VERSION, device_async_1 },
+    { 0, 0, NULL },
+};
+
+#define DFLT_MAXRECV    65536
+#define DFLT_HOLD       1000            /* msec */
+#define MAX_QUERY       256             /* longest write coalesced */
+
+struct link;
+
+struct waiter {
+    struct link    *link;
+    struct waiter  *next;
+};
+
+/* A query being answered for one or more clients.
+ */
+struct query {
+    char           *data;
+    int             len;
+    bool            done;
+    int             werr;           /* error writing it */
+    int             rerr;           /* error reading the response */
+    char           *resp;
+    int             resplen;
+    int             refs;           /* clients waiting for it */
+    struct query   *next;
+};
+
+/* An instrument: the upstream link and the clients' turns at it.
+ */
+struct pdev {
+    char           *name;           /* device name clients link to */
+    char           *addr;           /* upstream HOST:DEVICE */
+    vxi11dev_t      v;              /* upstream link, NULL if not open */
+    long            locker;         /* lid holding the VXI-11 lock */
+    struct link    *owner;          /* link whose turn it is, or NULL */
+    bool            busy;           /* ...and is calling upstream */
+    struct timespec hold;           /* end of the owner's turn if idle */
+    struct waiter  *queue;          /* links waiting for a turn */
+    struct query   *queries;        /* queries not yet answered */
+    pthread_cond_t  cond;           /* signalled when any of that changes */
+    unsigned long   calls;          /* calls made upstream */
+    unsigned long   queried;        /* queries answered upstream */
+    unsigned long   coalesced;      /* ...and by copying another's */
+    struct pdev    *next;
+};
+
+struct link {
+    struct rpcserve_link rl;        /* lid, lock, connection */
+    struct pdev    *dev;
+    unsigned long   aborts;         /* device_abort calls on the link */
+    char           *resp;           /* response not yet read */
+    int             resplen;
+    int             respoff;
+    int             resperr;        /* error for the next read */
+};
+
+char *prog = "";
+const char *options = "d:p:a:b:m:c:H:q:onrv";
+
+#if HAVE_GETOPT_LONG
+#define GETOPT(ac,av,opt,lopt) getopt_long(ac,av,opt,lopt,NULL)
+static struct option longopts[] = {
+    {"device",          required_argument, 0, 'd'},
+    {"port",            required_argument, 0, 'p'},
+    {"abort-port",      required_argument, 0, 'a'},
+    {"bind",            required_argument, 0, 'b'},
+    {"max-recv",        required_argument, 0, 'm'},
+    {"portcache",       required_argument, 0, 'c'},
+    {"hold",            required_argument, 0, 'H'},
+    {"open",            no_argument,       0, 'o'},
+    {"coalesce",        required_argument, 0, 'q'},
+    {"no-coalesce",     no_argument,       0, 'n'},
+    {"register",        no_argument,       0, 'r'},
+    {"verbose",         no_argument,       0, 'v'},
+    {0, 0, 0, 0},
+};
+#else
+#define GETOPT(ac,av,opt,lopt) getopt(ac,av,opt)
+#endif
+
+static struct pdev *pdevs = NULL;
+static struct rpcserve_links links;
+static pthread_mutex_t proxy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned short core_port = 0;
+static unsigned short abort_port = 0;
+static unsigned long max_recv = DFLT_MAXRECV;
+static unsigned long hold_msec = DFLT_HOLD;
+static bool open_any = false;
+static char **coalesce = NULL;     /* queries that may be coalesced */
+static int coalesce_len = 0;
+static char *coalesce_dflt[] = { "*IDN?", "*OPT?", NULL };
+static bool verbose = false;
+static volatile sig_atomic_t done = 0;
+
+void usage (void)
+{
+    fprintf (stderr, "%s", "Usage: vxi11proxy [OPTIONS]\n"
+        "    -d,--device NAME=HOST:DEVICE  proxy NAME to HOST:DEVICE\n"
+        "    -o,--open             also proxy links to any HOST:DEVICE\n"
+        "    -p,--port PORT        core channel port (any)\n"
+        "    -a,--abort-port PORT  abort channel port (any)\n"
+        "    -b,--bind ADDR        listen address (127.0.0.1)\n"
+        "    -m,--max-recv BYTES   maxRecvSize for create_link (65536)\n"
+        "    -c,--portcache HOST   record HOST as this server in the portcache\n"
+        "    -H,--hold MSEC        end an idle client's turn after MSEC (1000)\n"
+        "    -q,--coalesce PATTERN answer queries matching PATTERN once for all\n"
+        "                          clients (*IDN? and *OPT?)\n"
+        "    -n,--no-coalesce      send every query upstream\n"
+        "    -r,--register         register DEVICE_CORE with the portmapper\n"
+        "    -v,--verbose          log each call on stderr\n");
+    exit (1);
+}
+
+static void
+vlog (struct link *l, const char *op, int err)
+{
+    if (verbose)
+        fprintf (stderr, "%s: %s lid=%ld %s = %d\n", prog,
+                 l ? l->dev->name : "-", l ? l->rl.lid : 0, op, err);
+}
+
+static struct pdev *
+pdev_create (char *name, char *addr)
+{
+    struct pdev *dv = xzmalloc (sizeof (struct pdev));
+
+    dv->name = xstrdup (name);
+    dv->addr = xstrdup (addr);
+    rpcserve_cond_init (&dv->cond);
+    dv->next = pdevs;
+    pdevs = dv;
+    return dv;
+}
+
+/* Look up a device by the name clients link to, or if --open was given,
+ * add one for a name of the form HOST:DEVICE.  Call with proxy_lock held.
+ */
+static struct pdev *
+pdev_find (char *name)
+{
+    struct pdev *dv;
+
+    for (dv = pdevs; dv != NULL; dv = dv->next)
+        if (!strcmp (dv->name, name))
+            return dv;
+    if (open_any && strchr (name, ':'))
+        return pdev_create (name, name);
+    return NULL;
+}
+
+/* Look up link 'lid' for a call on 'rq' and wait for its device as in
+ * rpcserve_lock_wait ().
+ */
+static int
+link_begin (struct svc_req *rq, long lid, long flags,
+            unsigned long lock_timeout, struct link **lp)
+{
+    return rpcserve_link_begin (&links, lid, rq->rq_xprt, flags, lock_timeout,
+                                (struct rpcserve_link **)lp);
+}
+
+/* Replace the response kept for link 'l'.  Only the link's connection
+ * thread touches it, so it needs no lock.
+ */
+static void
+link_set_resp (struct link *l, char *resp, int len, int err)
+{
+    if (l->resp)
+        free (l->resp);
+    l->resp = resp;
+    l->resplen = len;
+    l->respoff = 0;
+    l->resperr = err;
+}
+
+/* Wait up to 'timeout' msec for link 'l' to get its turn at its device.
+ * Turns are given in the order they were asked for.  Returns 0, or
+ * VXI11_ERR_IOTIMEOUT or VXI11_ERR_ABORT.  Call with proxy_lock held.
+ */
+static int
+turn_take (struct link *l, unsigned long timeout)
+{
+    struct pdev *dv = l->dev;
+    unsigned long aborts = l->aborts;
+    struct waiter w = { .link = l, .next = NULL }, **wp;
+    struct timespec expire;
+    int err = 0;
+
+    if (dv->owner == l) {
+        dv->busy = true;
+        return 0;
+    }
+    for (wp = &dv->queue; *wp != NULL; wp = &(*wp)->next)
+        ;
+    *wp = &w;
+    rpcserve_deadline (&expire, timeout);
+    for (;;) {
+        if (dv->queue == &w && dv->owner && !dv->busy
+                && rpcserve_expired (&dv->hold))
+            dv->owner = NULL;   /* owner's turn ran out */
+        if (dv->queue == &w && dv->owner == NULL)
+            break;
+        if (l->aborts != aborts) {
+            err = VXI11_ERR_ABORT;
+            break;
+        }
+        if (rpcserve_expired (&expire)) {
+            err = VXI11_ERR_IOTIMEOUT;
+            break;
+        }
+        pthread_cond_timedwait (&dv->cond, &proxy_lock,
+                                dv->owner && !dv->busy
+                                && rpcserve_before (&dv->hold, &expire)
+                                ? &dv->hold : &expire);
+    }
+    for (wp = &dv->queue; *wp != &w; wp = &(*wp)->next)
+        ;
+    *wp = w.next;
+    if (err == 0) {
+        dv->owner = l;
+        dv->busy = true;
+    }
+    pthread_cond_broadcast (&dv->cond);
+    return err;
+}
+
+/* End a call by the link whose turn it is.  If 'keep' is true, the turn
+ * lasts until the link's next call or the hold time, else it ends now.
+ * Call with proxy_lock held.
+ */
+static void
+turn_done (struct link *l, bool keep)
+{
+    struct pdev *dv = l->dev;
+
+    dv->busy = false;
+    dv->calls++;
+    if (keep)
+        rpcserve_deadline (&dv->hold, hold_msec);
+    else
+        dv->owner = NULL;
+    pthread_cond_broadcast (&dv->cond);
+}
+
+/* Open the upstream link if it is not open.  Call on your turn.
+ */
+static int
+upstream_open (struct pdev *dv)
+{
+    int err;
+
+    if (dv->v)
+        return 0;
+    if (!(dv->v = vxi11_create ()))
+        return VXI11_ERR_RESOURCES;
+    if ((err = vxi11_open (dv->v, dv->addr, false)) != 0) {
+        if (verbose)
+            vxi11_perror (dv->v, err, prog);
+        vxi11_destroy (dv->v);
+        dv->v = NULL;
+        return VXI11_ERR_NOCHAN;
+    }
+    return 0;
+}
+
+/* Sort out an error from an upstream call.  If the link was lost, close
+ * it so that the next turn reopens it.  RPC errors, which only libvxi11
+ * knows, are passed on as VXI11_ERR_IOERROR.  Call on your turn.
+ */
+static int
+upstream_error (struct pdev *dv, int err)
+{
+    if (err < 0 || err == VXI11_ERR_NOCHAN || err == VXI11_ERR_LINKINVAL) {
+        if (verbose)
+            vxi11_perror (dv->v, err, prog);
+        vxi11_close (dv->v);
+        vxi11_destroy (dv->v);
+        dv->v = NULL;
+        return err < 0 ? VXI11_ERR_IOERROR : VXI11_ERR_NOCHAN;
+    }
+    return err;
+}
+
+/* Read a whole response upstream.  Call on your turn.
+ */
+static int
+upstream_read (struct pdev *dv, unsigned long timeout, char **bufp, int *lenp)
+{
+    int err;
+
+    *bufp = NULL;
+    *lenp = 0;
+    if ((err = upstream_open (dv)) != 0)
+        return err;
+    vxi11_set_iotimeout (dv->v, timeout);
+    return upstream_error (dv, vxi11_read_alloc (dv->v, bufp, lenp));
+}
+
+static int
+upstream_write (struct pdev *dv, unsigned long timeout, bool endw,
+                char *buf, int len)
+{
+    int err;
+
+    if ((err = upstream_open (dv)) != 0)
+        return err;
+    vxi11_set_iotimeout (dv->v, timeout);
+    vxi11_set_endw (dv->v, endw);
+    return upstream_error (dv, vxi11_write (dv->v, buf, len));
+}
+
+/* Queries that read and clear device status, which each client must get
+ * from the device itself.  A --coalesce prefix never matches them.
+ */
+static char *clears_status[] = {
+    "*ESR?", "*STB?", "SYST:ERR", "SYSTEM:ERR", NULL
+};
+
+static void
+coalesce_add (char *pattern)
+{
+    coalesce = xrealloc (coalesce, (coalesce_len + 2) * sizeof (char *));
+    coalesce[coalesce_len++] = pattern;
+    coalesce[coalesce_len] = NULL;
+}
+
+/* Match query 'q' of 'len' characters against 'pattern': the same query,
+ * ignoring case, or if 'pattern' ends in '*', any query starting with the
+ * rest that does not clear status.
+ */
+static bool
+coalesce_match (char *pattern, char *q, int len)
+{
+    int plen = strlen (pattern);
+    int i;
+
+    if (plen > 0 && pattern[plen - 1] == '*') {
+        for (i = 0; clears_status[i] != NULL; i++)
+            if (!strncasecmp (q, clears_status[i], strlen (clears_status[i])))
+                return false;
+        return len >= plen - 1 && !strncasecmp (q, pattern, plen - 1);
+    }
+    return len == plen && !strncasecmp (q, pattern, plen);
+}
+
+/* A write that may be answered once for several clients: a whole message
+ * that is a single query, such as "*IDN?", allowed by --coalesce.
+ * Messages with several commands are not, since one might change the
+ * device.
+ */
+static bool
+is_query (char *data, int len, long flags)
+{
+    int i;
+
+    if (coalesce == NULL || !(flags & VXI11_FLAG_ENDW) || len > MAX_QUERY
+            || memchr (data, ';', len))
+        return false;
+    while (len > 0 && isspace ((unsigned char)data[len - 1]))
+        len--;
+    while (len > 0 && isspace ((unsigned char)*data)) {
+        data++;
+        len--;
+    }
+    if (len == 0 || data[len - 1] != '?')
+        return false;
+    for (i = 0; coalesce[i] != NULL; i++)
+        if (coalesce_match (coalesce[i], data, len))
+            return true;
+    return false;
+}
+
+/* Send query 'data', or join the same query from another client if it is
+ * not answered yet, and keep the response for link 'l'.  A client that
+ * joins waits no longer than its own 'timeout' msec, or until it is
+ * aborted, as if it had sent the query itself.
+ */
+static int
+do_query (struct link *l, char *data, int len, unsigned long timeout)
+{
+    struct pdev *dv = l->dev;
+    unsigned long aborts = l->aborts;
+    struct query *q, **qp;
+    struct timespec expire;
+    char *resp = NULL;
+    int err = 0;
+
+    pthread_mutex_lock (&proxy_lock);
+    for (q = dv->queries; q != NULL; q = q->next)
+        if (q->len == len && !memcmp (q->data, data, len))
+            break;
+    if (q && dv->owner != l) {
+        q->refs++;
+        rpcserve_deadline (&expire, timeout);
+        while (!q->done) {
+            if (l->aborts != aborts) {
+                err = VXI11_ERR_ABORT;
+                break;
+            }
+            if (rpcserve_expired (&expire)) {
+                err = VXI11_ERR_IOTIMEOUT;
+                break;
+            }
+            pthread_cond_timedwait (&dv->cond, &proxy_lock, &expire);
+        }
+        if (!err)
+            dv->coalesced++;
+    } else {
+        q = xzmalloc (sizeof (struct query));
+        q->data = xmalloc (len);
+        memcpy (q->data, data, len);
+        q->len = len;
+        q->refs = 1;
+        q->next = dv->queries;
+        dv->queries = q;
+        if (!(q->werr = turn_take (l, timeout))) {
+            pthread_mutex_unlock (&proxy_lock);
+            if (!(q->werr = upstream_write (dv, timeout, true, data, len)))
+                q->rerr = upstream_read (dv, timeout, &q->resp, &q->resplen);
+            pthread_mutex_lock (&proxy_lock);
+            turn_done (l, false);
+            dv->queried++;
+        }
+        for (qp = &dv->queries; *qp != q; qp = &(*qp)->next)
+            ;
+        *qp = q->next;
+        q->done = true;
+        pthread_cond_broadcast (&dv->cond);
+    }
+    if (!err && !(err = q->werr)) {
+        if (q->resplen > 0) {
+            resp = xmalloc (q->resplen);
+            memcpy (resp, q->resp, q->resplen);
+        }
+        link_set_resp (l, resp, q->resplen, q->rerr);
+    }
+    if (--q->refs == 0) {
+        if (q->resp)
+            free (q->resp);
+        free (q->data);
+        free (q);
+    }
+    pthread_mutex_unlock (&proxy_lock);
+    return err;
+}
+
+/* Pass a write upstream.  The link keeps its turn for the response.
+ */
+static int
+do_write (struct link *l, char *data, int len, long flags,
+          unsigned long timeout)
+{
+    int err;
+
+    pthread_mutex_lock (&proxy_lock);
+    if (!(err = turn_take (l, timeout))) {
+        pthread_mutex_unlock (&proxy_lock);
+        err = upstream_write (l->dev, timeout, (flags & VXI11_FLAG_ENDW),
+                              data, len);
+        pthread_mutex_lock (&proxy_lock);
+        turn_done (l, err == 0);
+    }
+    pthread_mutex_unlock (&proxy_lock);
+    return err;
+}
+
+enum { OP_READSTB, OP_TRIGGER, OP_CLEAR, OP_REMOTE, OP_LOCAL };
+
+/* Pass another call upstream.  A link in the middle of a write and read
+ * keeps its turn; device_clear ends it.
+ */
+static int
+do_generic (struct link *l, int op, unsigned long timeout,
+            unsigned char *stbp)
+{
+    struct pdev *dv = l->dev;
+    bool held;
+    int err;
+
+    pthread_mutex_lock (&proxy_lock);
+    held = (dv->owner == l);
+    if (!(err = turn_take (l, timeout))) {
+        pthread_mutex_unlock (&proxy_lock);
+        if (!(err = upstream_open (dv))) {
+            vxi11_set_iotimeout (dv->v, timeout);
+            switch (op) {
+                case OP_READSTB:
+                    err = vxi11_readstb (dv->v, stbp);
+                    break;
+                case OP_TRIGGER:
+                    err = vxi11_trigger (dv->v);
+                    break;
+                case OP_CLEAR:
+                    err = vxi11_clear (dv->v);
+                    break;
+                case OP_REMOTE:
+                    err = vxi11_remote (dv->v);
+                    break;
+                case OP_LOCAL:
+                    err = vxi11_local (dv->v);
+                    break;
+            }
+            err = upstream_error (dv, err);
+        }
+        pthread_mutex_lock (&proxy_lock);
+        turn_done (l, held && err == 0 && op != OP_CLEAR);
+    }
+    pthread_mutex_unlock (&proxy_lock);
+    return err;
+}
+
+/* Release the turn and response of a link being destroyed.
+ * Called with proxy_lock held.
+ */
+static void
+link_release (struct rpcserve_link *rl)
+{
+    struct link *l = (struct link *)rl;
+
+    if (l->dev->owner == l) {
+        l->dev->owner = NULL;
+        pthread_cond_broadcast (&l->dev->cond);
+    }
+    link_set_resp (l, NULL, 0, 0);
+}
+
+bool_t
+create_link_1_svc (Create_LinkParms *p, Create_LinkResp *r,
+                   struct svc_req *rq)
+{
+    struct pdev *dv;
+    struct link *l;
+
+    memset (r, 0, sizeof (*r));
+    pthread_mutex_lock (&proxy_lock);
+    if (!(dv = pdev_find (p->device))) {
+        r->error = VXI11_ERR_NODEVICE;
+        goto done;
+    }
+    l = xzmalloc (sizeof (struct link));
+    rpcserve_link_init (&links, &l->rl, &dv->locker, rq->rq_xprt);
+    l->dev = dv;
+    /* make sure the instrument is there before handing out a link */
+    if (!(r->error = turn_take (l, p->lock_timeout))) {
+        pthread_mutex_unlock (&proxy_lock);
+        r->error = upstream_open (dv);
+        pthread_mutex_lock (&proxy_lock);
+        turn_done (l, false);
+        if (r->error)
+            r->error = VXI11_ERR_NODEVICE;
+    }
+    if (!r->error && p->lockDevice)
+        r->error = rpcserve_lock_wait (&links, &l->rl, VXI11_FLAG_WAITLOCK,
+                                       p->lock_timeout, true);
+    if (r->error) {
+        free (l);
+        goto done;
+    }
+    rpcserve_link_add (&links, &l->rl);
+    r->lid = l->rl.lid;
+    r->abortPort = abort_port;
+    r->maxRecvSize = max_recv;
+done:
+    pthread_mutex_unlock (&proxy_lock);
+    if (verbose)
+        fprintf (stderr, "%s: %s lid=%ld create_link = %d\n", prog,
+                 p->device, (long)r->lid, (int)r->error);
+    return TRUE;
+}
+
+bool_t
+device_write_1_svc (Device_WriteParms *p, Device_WriteResp *r,
+                    struct svc_req *rq)
+{
+    struct link *l;
+    char *data = p->data.data_val;
+    int len = p->data.data_len;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &l))) {
+        link_set_resp (l, NULL, 0, 0);  /* a new message discards it */
+        if (is_query (data, len, p->flags))
+            r->error = do_query (l, data, len, p->io_timeout);
+        else
+            r->error = do_write (l, data, len, p->flags, p->io_timeout);
+        if (!r->error)
+            r->size = len;
+    }
+    vlog (l, "device_write", r->error);
+    return TRUE;
+}
+
+/* Reads are answered from the response kept for the link, which is read
+ * upstream in full if there is none, so that the turn can end and the
+ * termination the client asked for is applied here.
+ */
+bool_t
+device_read_1_svc (Device_ReadParms *p, Device_ReadResp *r,
+                   struct svc_req *rq)
+{
+    struct link *l;
+    char *buf, *t;
+    int n, len, err;
+
+    memset (r, 0, sizeof (*r));
+    if ((r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &l)))
+        goto done;
+    if (l->resp == NULL && l->resperr == 0) {
+        pthread_mutex_lock (&proxy_lock);
+        if (!(err = turn_take (l, p->io_timeout))) {
+            pthread_mutex_unlock (&proxy_lock);
+            err = upstream_read (l->dev, p->io_timeout, &buf, &len);
+            pthread_mutex_lock (&proxy_lock);
+            turn_done (l, false);
+        }
+        pthread_mutex_unlock (&proxy_lock);
+        if (err) {
+            r->error = err;
+            goto done;
+        }
+        link_set_resp (l, buf, len, 0);
+    }
+    if (l->resperr) {
+        r->error = l->resperr;
+        link_set_resp (l, NULL, 0, 0);
+        goto done;
+    }
+    n = l->resplen - l->respoff;
+    if (n > p->requestSize)
+        n = p->requestSize;
+    if ((p->flags & VXI11_FLAG_TERMCHRSET)
+            && (t = memchr (l->resp + l->respoff, p->termChar, n))) {
+        n = t - (l->resp + l->respoff) + 1;
+        r->reason |= VXI11_REASON_CHR;
+    }
+    r->data.data_val = xmalloc (n > 0 ? n : 1);
+    memcpy (r->data.data_val, l->resp + l->respoff, n);
+    r->data.data_len = n;
+    l->respoff += n;
+    if (l->respoff == l->resplen) {
+        r->reason |= VXI11_REASON_END;
+        link_set_resp (l, NULL, 0, 0);
+    } else if (n == p->requestSize)
+        r->reason |= VXI11_REASON_REQCNT;
+done:
+    vlog (l, "device_read", r->error);
+    return TRUE;
+}
+
+bool_t
+device_readstb_1_svc (Device_GenericParms *p, Device_ReadStbResp *r,
+                      struct svc_req *rq)
+{
+    struct link *l;
+    unsigned char stb = 0;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &l)))
+        r->error = do_generic (l, OP_READSTB, p->io_timeout, &stb);
+    r->stb = stb;
+    vlog (l, "device_readstb", r->error);
+    return TRUE;
+}
+
+bool_t
+device_trigger_1_svc (Device_GenericParms *p, Device_Error *r,
+                      struct svc_req *rq)
+{
+    struct link *l;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &l)))
+        r->error = do_generic (l, OP_TRIGGER, p->io_timeout, NULL);
+    vlog (l, "device_trigger", r->error);
+    return TRUE;
+}
+
+bool_t
+device_clear_1_svc (Device_GenericParms *p, Device_Error *r,
+                    struct svc_req *rq)
+{
+    struct link *l;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &l))) {
+        link_set_resp (l, NULL, 0, 0);
+        r->error = do_generic (l, OP_CLEAR, p->io_timeout, NULL);
+    }
+    vlog (l, "device_clear", r->error);
+    return TRUE;
+}
+
+bool_t
+device_remote_1_svc (Device_GenericParms *p, Device_Error *r,
+                     struct svc_req *rq)
+{
+    struct link *l;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &l)))
+        r->error = do_generic (l, OP_REMOTE, p->io_timeout, NULL);
+    vlog (l, "device_remote", r->error);
+    return TRUE;
+}
+
+bool_t
+device_local_1_svc (Device_GenericParms *p, Device_Error *r,
+                    struct svc_req *rq)
+{
+    struct link *l;
+
+    memset (r, 0, sizeof (*r));
+    if (!(r->error = link_begin (rq, p->lid, p->flags, p->lock_timeout, &l)))
+        r->error = do_generic (l, OP_LOCAL, p->io_timeout, NULL);
+    vlog (l, "device_local", r->error);
+    return TRUE;
+}
+
+bool_t
+device_lock_1_svc (Device_LockParms *p, Device_Error *r, struct svc_req *rq)
+{
+    struct link *l;
+
+    memset (r, 0, sizeof (*r));
+    pthread_mutex_lock (&proxy_lock);
+    if (!(l = (struct link *)rpcserve_link_find (&links, p->lid, rq->rq_xprt)))
+        r->error = VXI11_ERR_LINKINVAL;
+    else
+        r->error = rpcserve_lock_wait (&links, &l->rl, p->flags,
+                                       p->lock_timeout, true);
+    pthread_mutex_unlock (&proxy_lock);
+    vlog (l, "device_lock", r->error);
+    return TRUE;
+}
+
+bool_t
+device_unlock_1_svc (Device_Link *lid, Device_Error *r, struct svc_req *rq)
+{
+    struct link *l;
+
+    memset (r, 0, sizeof (*r));
+    pthread_mutex_lock (&proxy_lock);
+    if (!(l = (struct link *)rpcserve_link_find (&links, *lid, rq->rq_xprt)))
+        r->error = VXI11_ERR_LINKINVAL;
+    else
+        r->error = rpcserve_lock_release (&links, &l->rl);
+    pthread_mutex_unlock (&proxy_lock);
+    vlog (l, "device_unlock", r->error);
+    return TRUE;
+}
+
+/* Service requests would need an interrupt channel per client, which we
+ * do not offer, so enabling them is accepted but has no effect.
+ */
+bool_t
+device_enable_srq_1_svc (Device_EnableSrqParms *p, Device_Error *r,
+                         struct svc_req *rq)
+{
+    struct link *l;
+
+    memset (r, 0, sizeof (*r));
+    pthread_mutex_lock (&proxy_lock);
+    if (!(l = (struct link *)rpcserve_link_find (&links, p->lid, rq->rq_xprt)))
+        r->error = VXI11_ERR_LINKINVAL;
+    pthread_mutex_unlock (&proxy_lock);
+    vlog (l, "device_enable_srq", r->error);
+    return TRUE;
+}
+
+/* Bus commands would affect every client of the gateway at once.
+ */
+bool_t
+device_docmd_1_svc (Device_DocmdParms *p, Device_DocmdResp *r,
+                    struct svc_req *rq)
+{
+    memset (r, 0, sizeof (*r));
+    r->error = VXI11_ERR_NOTSUPP;
+    return TRUE;
+}
+
+bool_t
+destroy_link_1_svc (Device_Link *lid, Device_Error *r, struct svc_req *rq)
+{
+    struct rpcserve_link *l;
+
+    memset (r, 0, sizeof (*r));
+    pthread_mutex_lock (&proxy_lock);
+    if (!(l = rpcserve_link_find (&links, *lid, rq->rq_xprt)))
+        r->error = VXI11_ERR_LINKINVAL;
+    else
+        rpcserve_link_destroy (&links, l);
+    pthread_mutex_unlock (&proxy_lock);
+    if (verbose)
+        fprintf (stderr, "%s: lid=%ld destroy_link = %d\n", prog,
+                 (long)*lid, (int)r->error);
+    return TRUE;
+}
+
+bool_t
+create_intr_chan_1_svc (Device_RemoteFunc *p, Device_Error *r,
+                        struct svc_req *rq)
+{
+    memset (r, 0, sizeof (*r));
+    r->error = VXI11_ERR_NOTSUPP;
+    return TRUE;
+}
+
+bool_t
+destroy_intr_chan_1_svc (void *p, Device_Error *r, struct svc_req *rq)
+{
+    memset (r, 0, sizeof (*r));
+    r->error = VXI11_ERR_NOTSUPP;
+    return TRUE;
+}
+
+/* An abort gets a link out of the queue for its device.  A call already
+ * made upstream runs to completion or its I/O timeout, since aborting it
+ * from here would use the upstream handle from a second thread.
+ */
+bool_t
+device_abort_1_svc (Device_Link *lid, Device_Error *r, struct svc_req *rq)
+{
+    struct link *l;
+
+    memset (r, 0, sizeof (*r));
+    pthread_mutex_lock (&proxy_lock);
+    if (!(l = (struct link *)rpcserve_link_find (&links, *lid, NULL)))
+        r->error = VXI11_ERR_LINKINVAL;
+    else {
+        l->aborts++;
+        pthread_cond_broadcast (&l->dev->cond);
+    }
+    pthread_mutex_unlock (&proxy_lock);
+    if (verbose)
+        fprintf (stderr, "%s: lid=%ld device_abort = %d\n", prog,
+                 (long)*lid, (int)r->error);
+    return TRUE;
+}
+
+static void
+log_disconnect (struct rpcserve_link *rl)
+{
+    vlog ((struct link *)rl, "disconnect", 0);
+}
+
+/* Destroy the links a connection created when it goes away.
+ */
+static void
+conn_cleanup (SVCXPRT *xprt)
+{
+    rpcserve_link_cleanup (&links, xprt, log_disconnect);
+}
+
+static void
+sigterm (int sig)
+{
+    done = 1;
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct in_addr addr = { .s_addr = htonl (INADDR_LOOPBACK) };
+    struct pollfd pfd[2];
+    struct sigaction sa;
+    bool doRegister = false;
+    bool nocoalesce = false;
+    char *cachehost = NULL;
+    struct pdev *dv;
+    char *upstream;
+    int c, i, fd;
+
+    prog = basename (argv[0]);
+    rpcserve_links_init (&links, &proxy_lock, link_release);
+    while ((c = GETOPT (argc, argv, options, longopts)) != EOF) {
+        switch (c) {
+            case 'd':
+                if (!(upstream = strchr (optarg, '='))
+                        || !strchr (upstream, ':')) {
+                    fprintf (stderr, "%s: device should be NAME=HOST:DEVICE\n",
+                             prog);
+                    exit (1);
+                }
+                *upstream++ = '\0';
+                (void)pdev_create (optarg, upstream);
+                break;
+            case 'p':
+                core_port = strtoul (optarg, NULL, 10);
+                break;
+            case 'a':
+                abort_port = strtoul (optarg, NULL, 10);
+                break;
+            case 'b':
+                if (!inet_aton (optarg, &addr)) {
+                    fprintf (stderr, "%s: bad address: %s\n", prog, optarg);
+                    exit (1);
+                }
+                break;
+            case 'm':
+                if ((max_recv = strtoul (optarg, NULL, 10)) == 0)
+                    usage ();
+                break;
+            case 'c':
+                cachehost = optarg;
+                break;
+            case 'H':
+                hold_msec = strtoul (optarg, NULL, 10);
+                break;
+            case 'o':
+                open_any = true;
+                break;
+            case 'q':
+                coalesce_add (optarg);
+                break;
+            case 'n':
+                nocoalesce = true;
+                break;
+            case 'r':
+                doRegister = true;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage ();
+        }
+    }
+    if (optind < argc)
+        usage ();
+    if (nocoalesce) {
+        free (coalesce);
+        coalesce = NULL;
+    } else if (coalesce == NULL)
+        coalesce = coalesce_dflt;
+    if (cachehost && !portcache_enabled ()) {
+        fprintf (stderr, "%s: --portcache needs VXI11_PORTCACHE set\n", prog);
+        exit (1);
+    }
+    if (pdevs == NULL && !open_any) {
+        fprintf (stderr, "%s: no devices (use --device or --open)\n", prog);
+        exit (1);
+    }
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction (SIGPIPE, &sa, NULL);
+    sa.sa_handler = sigterm;
+    sigaction (SIGINT, &sa, NULL);
+    sigaction (SIGTERM, &sa, NULL);
+
+    if ((pfd[0].fd = rpcserve_listen (&addr, &core_port)) < 0
+            || (pfd[1].fd = rpcserve_listen (&addr, &abort_port)) < 0) {
+        perror ("vxi11proxy: listen");
+        exit (1);
+    }
+    pfd[0].events = pfd[1].events = POLLIN;
+    if (doRegister) {
+        pmap_unset (DEVICE_CORE, DEVICE_CORE_VERSION);
+        if (!pmap_set (DEVICE_CORE, DEVICE_CORE_VERSION, IPPROTO_TCP,
+                       core_port)) {
+            fprintf (stderr, "%s: could not register with portmapper\n", prog);
+            exit (1);
+        }
+    }
+    if (cachehost) {
+        struct portcache_entry e;
+        char name[MAXHOSTNAMELEN];
+
+        e.core_port = core_port;
+        e.mtime = time (NULL);
+        for (dv = pdevs; dv != NULL; dv = dv->next) {
+            snprintf (name, sizeof (name), "%s:%s", cachehost, dv->name);
+            portcache_update (name, &e);
+        }
+    }
+    printf ("core %hu abort %hu\n", core_port, abort_port);
+    fflush (stdout);
+
+    while (!done) {
+        if (poll (pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror ("vxi11proxy: poll");
+            break;
+        }
+        for (i = 0; i < 2; i++) {
+            if ((pfd[i].revents & POLLIN)
+                    && (fd = accept (pfd[i].fd, NULL, NULL)) >= 0
+                    && rpcserve_spawn (fd, i == 0 ? core_progs : async_progs,
+                                       conn_cleanup) < 0)
+                fprintf (stderr, "%s: could not serve connection\n", prog);
+        }
+    }
+    if (doRegister)
+        pmap_unset (DEVICE_CORE, DEVICE_CORE_VERSION);
+    pthread_mutex_lock (&proxy_lock);
+    for (dv = pdevs; dv != NULL; dv = dv->next) {
+        if (verbose)
+            fprintf (stderr, "%s: %s calls %lu queries %lu coalesced %lu\n",
+                     prog, dv->name, dv->calls, dv->queried, dv->coalesced);
+        if (dv->v && !dv->busy) {
+            vxi11_close (dv->v);
+            vxi11_destroy (dv->v);
+        }
+    }
+    pthread_mutex_unlock (&proxy_lock);
+    exit (0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,772 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*
+ * hislip.c - HiSLIP (IVI-6.1) client
+ *
+ * A session is two TCP connections to the same server port: the
+ * synchronous channel carries Data/DataEnd/Trigger and the device clear
+ * handshake, the asynchronous channel carries status queries, locking,
+ * remote/local control, and unsolicited service requests.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/param.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hislip.h"
+
+#define HISLIP_MAGIC            0x48534c50
+#define HISLIP_VENDOR           (('G' << 8) | 'U')
+#define HISLIP_DFLT_TIMEOUT     25000
+#define HISLIP_MAXRECV          (1024*1024) /* advertised to the server */
+
+struct hislip_struct {
+    int             magic;
+    char            host[MAXHOSTNAMELEN];
+    int             sync_fd;
+    int             async_fd;
+    uint16_t        session_id;
+    bool            overlap_pref;   /* ask for overlapped mode */
+    bool            overlapped;     /* mode granted by server */
+    uint32_t        msgid;          /* MessageID of next message */
+    uint32_t        last_msgid;     /* MessageID of last message sent */
+    bool            rmt;            /* response delivered since last send */
+    uint64_t        max_msg;        /* largest payload server accepts */
+    bool            rx_active;      /* in the middle of a Data message */
+    bool            rx_end;         /* ... which is a DataEnd */
+    uint32_t        rx_msgid;       /* ... with this MessageID */
+    uint64_t        rx_remain;      /* ... with this much payload unread */
+    bool            srq;            /* AsyncServiceRequest received */
+    unsigned long   io_timeout;
+    unsigned long   lock_timeout;
+    int             srv_code;       /* from last Error/FatalError */
+    char            srv_msg[128];
+    char            errstr[256];
+};
+
+static struct {
+    int num;
+    char *desc;
+} errtab[] = {
+    { HISLIP_ERR_CONNECT,       "could not connect" },
+    { HISLIP_ERR_IO,            "connection lost" },
+    { HISLIP_ERR_TIMEOUT,       "I/O timeout" },
+    { HISLIP_ERR_PROTO,         "protocol error" },
+    { HISLIP_ERR_FATAL,         "fatal error" },
+    { HISLIP_ERR_SERVER,        "error" },
+    { HISLIP_ERR_LOCK,          "lock request failed" },
+    { HISLIP_ERR_INTERRUPTED,   "response interrupted" },
+    { HISLIP_ERR_NOTOPEN,       "session not open" },
+    { HISLIP_ERR_NOMEM,         "out of memory" },
+    { 0, NULL }
+};
+
+void
+hislip_encode_hdr(unsigned char *buf, struct hislip_hdr *hp)
+{
+    int i;
+
+    buf[0] = 'H';
+    buf[1] = 'S';
+    buf[2] = hp->type;
+    buf[3] = hp->control;
+    for (i = 0; i < 4; i++)
+        buf[4 + i] = hp->param >> (24 - 8*i);
+    for (i = 0; i < 8; i++)
+        buf[8 + i] = hp->length >> (56 - 8*i);
+}
+
+int
+hislip_decode_hdr(unsigned char *buf, struct hislip_hdr *hp)
+{
+    int i;
+
+    if (buf[0] != 'H' || buf[1] != 'S')
+        return -1;
+    hp->type = buf[2];
+    hp->control = buf[3];
+    hp->param = 0;
+    for (i = 0; i < 4; i++)
+        hp->param = (hp->param << 8) | buf[4 + i];
+    hp->length = 0;
+    for (i = 0; i < 8; i++)
+        hp->length = (hp->length << 8) | buf[8 + i];
+    return 0;
+}
+
+static void
+_encode64(unsigned char *buf, uint64_t val)
+{
+    int i;
+
+    for (i = 0; i < 8; i++)
+        buf[i] = val >> (56 - 8*i);
+}
+
+static uint64_t
+_decode64(unsigned char *buf)
+{
+    uint64_t val = 0;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        val = (val << 8) | buf[i];
+    return val;
+}
+
+/* Wait up to 'timeout' ms for 'fd' to become ready for 'events'.
+ */
+static int
+_wait(int fd, short events, unsigned long timeout)
+{
+    struct pollfd pfd = { .fd = fd, .events = events };
+    int n;
+
+    do {
+        n = poll(&pfd, 1, timeout);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return HISLIP_ERR_IO;
+    if (n == 0)
+        return HISLIP_ERR_TIMEOUT;
+    return 0;
+}
+
+static int
+_send_msg(hislip_t h, int fd, int type, int control, uint32_t param,
+          void *payload, uint64_t len)
+{
+    unsigned char hdr[HISLIP_HDRLEN];
+    struct hislip_hdr hd = { type, control, param, len };
+    struct iovec iov[2];
+    struct msghdr msg;
+    int res, i = 0, iovcnt = len > 0 ? 2 : 1;
+    ssize_t n;
+
+    hislip_encode_hdr(hdr, &hd);
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = HISLIP_HDRLEN;
+    iov[1].iov_base = payload;
+    iov[1].iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    while (i < iovcnt) {
+        if ((res = _wait(fd, POLLOUT, h->io_timeout)) != 0)
+            return res;
+        msg.msg_iov = &iov[i];
+        msg.msg_iovlen = iovcnt - i;
+        if ((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return HISLIP_ERR_IO;
+        }
+        while (i < iovcnt && n >= iov[i].iov_len) {
+            n -= iov[i].iov_len;
+            i++;
+        }
+        if (i < iovcnt) {
+            iov[i].iov_base = (char *)iov[i].iov_base + n;
+            iov[i].iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int
+_recv_all(hislip_t h, int fd, void *buf, uint64_t len, unsigned long timeout)
+{
+    ssize_t n;
+    int res;
+
+    while (len > 0) {
+        if ((res = _wait(fd, POLLIN, timeout)) != 0)
+            return res;
+        if ((n = recv(fd, buf, len, 0)) < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return HISLIP_ERR_IO;
+        }
+        if (n == 0)
+            return HISLIP_ERR_IO;
+        buf = (char *)buf + n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int
+_skip(hislip_t h, int fd, uint64_t len)
+{
+    char buf[1024];
+    int res;
+
+    while (len > 0) {
+        int try = len > sizeof(buf) ? sizeof(buf) : len;
+
+        if ((res = _recv_all(h, fd, buf, try, h->io_timeout)) != 0)
+            return res;
+        len -= try;
+    }
+    return 0;
+}
+
+/* Receive a message header.  Error and FatalError messages are consumed
+ * here and turned into HISLIP_ERR_SERVER and HISLIP_ERR_FATAL.
+ */
+static int
+_recv_hdr(hislip_t h, int fd, struct hislip_hdr *hp, unsigned long timeout)
+{
+    unsigned char buf[HISLIP_HDRLEN];
+    uint64_t len;
+    int res;
+
+    if ((res = _recv_all(h, fd, buf, HISLIP_HDRLEN, timeout)) != 0)
+        return res;
+    if (hislip_decode_hdr(buf, hp) < 0)
+        return HISLIP_ERR_PROTO;
+    if (hp->type == HISLIP_ERROR || hp->type == HISLIP_FATAL_ERROR) {
+        h->srv_code = hp->control;
+        len = hp->length < sizeof(h->srv_msg) - 1 ? hp->length
+                                                  : sizeof(h->srv_msg) - 1;
+        if ((res = _recv_all(h, fd, h->srv_msg, len, h->io_timeout)) != 0)
+            return res;
+        h->srv_msg[len] = '\0';
+        if ((res = _skip(h, fd, hp->length - len)) != 0)
+            return res;
+        return hp->type == HISLIP_ERROR ? HISLIP_ERR_SERVER : HISLIP_ERR_FATAL;
+    }
+    return 0;
+}
+
+/* Receive the async channel message of type 'expect', copying up to
+ * 'len' bytes of its payload to 'buf'.  Service requests that arrive
+ * in the meantime are remembered for hislip_wait_srq ().
+ */
+static int
+_async_recv(hislip_t h, int expect, struct hislip_hdr *hp, void *buf,
+            int len, unsigned long timeout)
+{
+    int res;
+
+    for (;;) {
+        if ((res = _recv_hdr(h, h->async_fd, hp, timeout)) != 0)
+            return res;
+        if (hp->type == expect) {
+            if (hp->length < len)
+                len = hp->length;
+            if ((res = _recv_all(h, h->async_fd, buf, len,
+                                 h->io_timeout)) != 0)
+                return res;
+            return _skip(h, h->async_fd, hp->length - len);
+        }
+        if ((res = _skip(h, h->async_fd, hp->length)) != 0)
+            return res;
+        if (hp->type == HISLIP_ASYNC_SERVICE_REQUEST)
+            h->srq = true;
+        else if (hp->type != HISLIP_ASYNC_INTERRUPTED)
+            return HISLIP_ERR_PROTO;
+    }
+}
+
+static int
+_connect(char *host, unsigned short port)
+{
+    struct addrinfo hints, *res, *r;
+    char service[16];
+    int fd = -1, one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0)
+        return -1;
+    for (r = res; r != NULL; r = r->ai_next) {
+        if ((fd = socket(r->ai_family, r->ai_socktype, r->ai_protocol)) < 0)
+            continue;
+        if (connect(fd, r->ai_addr, r->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0)
+        (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+hislip_t
+hislip_create(void)
+{
+    hislip_t h = malloc(sizeof(struct hislip_struct));
+
+    if (h) {
+        memset(h, 0, sizeof(struct hislip_struct));
+        h->magic = HISLIP_MAGIC;
+        h->sync_fd = -1;
+        h->async_fd = -1;
+        h->overlap_pref = false;
+        h->io_timeout = HISLIP_DFLT_TIMEOUT;
+        h->lock_timeout = HISLIP_DFLT_TIMEOUT;
+    }
+    return h;
+}
+
+void
+hislip_destroy(hislip_t h)
+{
+    assert(h->magic == HISLIP_MAGIC);
+    assert(h->sync_fd == -1);
+    assert(h->async_fd == -1);
+    memset(h, 0, sizeof(struct hislip_struct));
+    free(h);
+}
+
+int
+hislip_open(hislip_t h, char *host, unsigned short port, char *subaddr)
+{
+    struct hislip_hdr hd;
+    unsigned char buf[8];
+    int res;
+
+    assert(h->magic == HISLIP_MAGIC);
+    snprintf(h->host, sizeof(h->host), "%s", host);
+    if (port == 0)
+        port = HISLIP_PORT;
+
+    if ((h->sync_fd = _connect(host, port)) < 0) {
+        res = HISLIP_ERR_CONNECT;
+        goto err;
+    }
+    if ((res = _send_msg(h, h->sync_fd, HISLIP_INITIALIZE,
+                         h->overlap_pref ? HISLIP_CTL_OVERLAP : 0,
+                         (HISLIP_VERSION << 16) | HISLIP_VENDOR,
+                         subaddr, strlen(subaddr))) != 0)
+        goto err;
+    if ((res = _recv_hdr(h, h->sync_fd, &hd, h->io_timeout)) != 0)
+        goto err;
+    if (hd.type != HISLIP_INITIALIZE_RESPONSE) {
+        res = HISLIP_ERR_PROTO;
+        goto err;
+    }
+    if ((res = _skip(h, h->sync_fd, hd.length)) != 0)
+        goto err;
+    h->overlapped = (hd.control & HISLIP_CTL_OVERLAP) ? true : false;
+    h->session_id = hd.param & 0xffff;
+
+    if ((h->async_fd = _connect(host, port)) < 0) {
+        res = HISLIP_ERR_CONNECT;
+        goto err;
+    }
+    if ((res = _send_msg(h, h->async_fd, HISLIP_ASYNC_INITIALIZE, 0,
+                         h->session_id, NULL, 0)) != 0)
+        goto err;
+    if ((res = _async_recv(h, HISLIP_ASYNC_INITIALIZE_RESPONSE, &hd,
+                           NULL, 0, h->io_timeout)) != 0)
+        goto err;
+
+    _encode64(buf, HISLIP_MAXRECV);
+    if ((res = _send_msg(h, h->async_fd, HISLIP_ASYNC_MAX_MSG_SIZE, 0, 0,
+                         buf, sizeof(buf))) != 0)
+        goto err;
+    if ((res = _async_recv(h, HISLIP_ASYNC_MAX_MSG_SIZE_RESPONSE, &hd,
+                           buf, sizeof(buf), h->io_timeout)) != 0)
+        goto err;
+    if (hd.length != sizeof(buf)) {
+        res = HISLIP_ERR_PROTO;
+        goto err;
+    }
+    h->max_msg = _decode64(buf);
+    if (h->max_msg == 0)
+        h->max_msg = 256;
+    h->msgid = HISLIP_FIRST_MSGID;
+    h->last_msgid = HISLIP_FIRST_MSGID - 2;
+    h->rmt = false;
+    h->rx_active = false;
+    h->srq = false;
+    return 0;
+err:
+    hislip_close(h);
+    return res;
+}
+
+void
+hislip_close(hislip_t h)
+{
+    assert(h->magic == HISLIP_MAGIC);
+    if (h->async_fd >= 0)
+        (void)close(h->async_fd);
+    h->async_fd = -1;
+    if (h->sync_fd >= 0)
+        (void)close(h->sync_fd);
+    h->sync_fd = -1;
+}
+
+/* Send one message as Data ... DataEnd chunks no larger than the server
+ * will accept, all carrying the same MessageID.
+ */
+int
+hislip_write(hislip_t h, char *buf, int len)
+{
+    int control, res;
+    uint64_t try;
+
+    assert(h->magic == HISLIP_MAGIC);
+    if (h->sync_fd < 0)
+        return HISLIP_ERR_NOTOPEN;
+    control = (!h->overlapped && h->rmt) ? HISLIP_CTL_RMT : 0;
+    do {
+        try = len > h->max_msg ? h->max_msg : len;
+        res = _send_msg(h, h->sync_fd, try < len ? HISLIP_DATA
+                                                 : HISLIP_DATA_END,
+                        control, h->msgid, buf, try);
+        if (res != 0)
+            return res;
+        buf += try;
+        len -= try;
+    } while (len > 0);
+    h->rmt = false;
+    h->last_msgid = h->msgid;
+    h->msgid += 2;
+    return 0;
+}
+
+int
+hislip_writestr(hislip_t h, char *str)
+{
+    return hislip_write(h, str, strlen(str));
+}
+
+/* Read the response to the last message.  In synchronized mode, data
+ * belonging to older messages (whose responses the server abandoned
+ * when we sent a new one) is discarded.
+ */
+int
+hislip_read(hislip_t h, char *buf, int len, int *numreadp)
+{
+    struct hislip_hdr hd;
+    int res = 0, count = 0;
+    uint64_t try;
+
+    assert(h->magic == HISLIP_MAGIC);
+    if (h->sync_fd < 0)
+        return HISLIP_ERR_NOTOPEN;
+    while (len > 0) {
+        if (!h->rx_active) {
+            if ((res = _recv_hdr(h, h->sync_fd, &hd, h->io_timeout)) != 0)
+                break;
+            if (hd.type == HISLIP_INTERRUPTED) {
+                res = _skip(h, h->sync_fd, hd.length);
+                if (res == 0 && count > 0)
+                    res = HISLIP_ERR_INTERRUPTED;
+                if (res != 0)
+                    break;
+                continue;
+            }
+            if (hd.type != HISLIP_DATA && hd.type != HISLIP_DATA_END) {
+                (void)_skip(h, h->sync_fd, hd.length);
+                res = HISLIP_ERR_PROTO;
+                break;
+            }
+            h->rx_active = true;
+            h->rx_end = (hd.type == HISLIP_DATA_END);
+            h->rx_msgid = hd.param;
+            h->rx_remain = hd.length;
+        }
+        if (!h->overlapped && h->rx_msgid != h->last_msgid) {
+            if ((res = _skip(h, h->sync_fd, h->rx_remain)) != 0)
+                break;
+            h->rx_remain = 0;
+        } else {
+            try = h->rx_remain > len ? len : h->rx_remain;
+            if ((res = _recv_all(h, h->sync_fd, buf, try,
+                                 h->io_timeout)) != 0)
+                break;
+            buf += try;
+            len -= try;
+            count += try;
+            h->rx_remain -= try;
+        }
+        if (h->rx_remain == 0) {
+            h->rx_active = false;
+            if (h->rx_end && (h->overlapped || h->rx_msgid == h->last_msgid)) {
+                h->rmt = true;
+                break;
+            }
+        }
+    }
+    if (numreadp)
+        *numreadp = count;
+    return res;
+}
+
+int
+hislip_readstr(hislip_t h, char *str, int len)
+{
+    int res, count;
+
+    res = hislip_read(h, str, len - 1, &count);
+    if (res == 0) {
+        assert(count < len);
+        str[count] = '\0';
+    }
+    return res;
+}
+
+int
+hislip_readstb(hislip_t h, unsigned char *stbp)
+{
+    struct hislip_hdr hd;
+    int res;
+
+    assert(h->magic == HISLIP_MAGIC);
+    if (h->async_fd < 0)
+        return HISLIP_ERR_NOTOPEN;
+    if ((res = _send_msg(h, h->async_fd, HISLIP_ASYNC_STATUS_QUERY,
+                         h->rmt ? HISLIP_CTL_RMT : 0, h->last_msgid,
+                         NULL, 0)) != 0)
+        return res;
+    h->rmt = false;
+    if ((res = _async_recv(h, HISLIP_ASYNC_STATUS_RESPONSE, &hd, NULL, 0,
+                           h->io_timeout)) != 0)
+        return res;
+    if (stbp)
+        *stbp = hd.control;
+    return 0;
+}
+
+int
+hislip_trigger(hislip_t h)
+{
+    int res;
+
+    assert(h->magic == HISLIP_MAGIC);
+    if (h->sync_fd < 0)
+        return HISLIP_ERR_NOTOPEN;
+    if ((res = _send_msg(h, h->sync_fd, HISLIP_TRIGGER,
+                         (!h->overlapped && h->rmt) ? HISLIP_CTL_RMT : 0,
+                         h->msgid, NULL, 0)) != 0)
+        return res;
+    h->rmt = false;
+    h->last_msgid = h->msgid;
+    h->msgid += 2;
+    return 0;
+}
+
+/* Device clear handshake (IVI-6.1 6.12): AsyncDeviceClear and its
+ * acknowledge on the async channel, then DeviceClearComplete on the
+ * sync channel, discarding input until the server acknowledges that.
+ */
+int
+hislip_clear(hislip_t h)
+{
+    struct hislip_hdr hd;
+    int res;
+
+    assert(h->magic == HISLIP_MAGIC);
+    if (h->sync_fd < 0 || h->async_fd < 0)
+        return HISLIP_ERR_NOTOPEN;
+    if ((res = _send_msg(h, h->async_fd, HISLIP_ASYNC_DEVICE_CLEAR, 0, 0,
+                         NULL, 0)) != 0)
+        return res;
+    if ((res = _async_recv(h, HISLIP_ASYNC_DEVICE_CLEAR_ACK, &hd, NULL, 0,
+                           h->io_timeout)) != 0)
+        return res;
+    if (h->rx_active) {
+        if ((res = _skip(h, h->sync_fd, h->rx_remain)) != 0)
+            return res;
+        h->rx_active = false;
+    }
+    if ((res = _send_msg(h, h->sync_fd, HISLIP_DEVICE_CLEAR_COMPLETE,
+                         h->overlap_pref ? HISLIP_CTL_OVERLAP : 0, 0,
+                         NULL, 0)) != 0)
+        return res;
+    for (;;) {
+        if ((res = _recv_hdr(h, h->sync_fd, &hd, h->io_timeout)) != 0)
+            return res;
+        if ((res = _skip(h, h->sync_fd, hd.length)) != 0)
+            return res;
+        if (hd.type == HISLIP_DEVICE_CLEAR_ACKNOWLEDGE)
+            break;
+    }
+    h->overlapped = (hd.control & HISLIP_CTL_OVERLAP) ? true : false;
+    h->msgid = HISLIP_FIRST_MSGID;
+    h->last_msgid = HISLIP_FIRST_MSGID - 2;
+    h->rmt = false;
+    return 0;
+}
+
+static int
+_remote_local(hislip_t h, int request)
+{
+    struct hislip_hdr hd;
+    int res;
+
+    assert(h->magic == HISLIP_MAGIC);
+    if (h->async_fd < 0)
+        return HISLIP_ERR_NOTOPEN;
+    if ((res = _send_msg(h, h->async_fd, HISLIP_ASYNC_REMOTE_LOCAL_CONTROL,
+                         request, h->last_msgid, NULL, 0)) != 0)
+        return res;
+    return _async_recv(h, HISLIP_ASYNC_REMOTE_LOCAL_RESPONSE, &hd, NULL, 0,
+                       h->io_timeout);
+}
+
+int
+hislip_remote(hislip_t h)
+{
+    return _remote_local(h, 3); /* enable remote, go to remote */
+}
+
+int
+hislip_local(hislip_t h)
+{
+    return _remote_local(h, 2); /* disable remote, go to local */
+}
+
+int
+hislip_lock(hislip_t h, char *shared)
+{
+    struct hislip_hdr hd;
+    int res;
+
+    assert(h->magic == HISLIP_MAGIC);
+    if (h->async_fd < 0)
+        return HISLIP_ERR_NOTOPEN;
+    if ((res = _send_msg(h, h->async_fd, HISLIP_ASYNC_LOCK, 1,
+                         h->lock_timeout, shared,
+                         shared ? strlen(shared) : 0)) != 0)
+        return res;
+    if ((res = _async_recv(h, HISLIP_ASYNC_LOCK_RESPONSE, &hd, NULL, 0,
+                           h->lock_timeout + h->io_timeout)) != 0)
+        return res;
+    return (hd.control == 1 || hd.control == 2) ? 0 : HISLIP_ERR_LOCK;
+}
+
+int
+hislip_unlock(hislip_t h)
+{
+    struct hislip_hdr hd;
+    int res;
+
+    assert(h->magic == HISLIP_MAGIC);
+    if (h->async_fd < 0)
+        return HISLIP_ERR_NOTOPEN;
+    if ((res = _send_msg(h, h->async_fd, HISLIP_ASYNC_LOCK, 0,
+                         h->last_msgid, NULL, 0)) != 0)
+        return res;
+    if ((res = _async_recv(h, HISLIP_ASYNC_LOCK_RESPONSE, &hd, NULL, 0,
+                           h->io_timeout)) != 0)
+        return res;
+    return (hd.control == 1 || hd.control == 2) ? 0 : HISLIP_ERR_LOCK;
+}
+
+int
+hislip_wait_srq(hislip_t h, unsigned long timeout)
+{
+    struct hislip_hdr hd;
+
+    assert(h->magic == HISLIP_MAGIC);
+    if (h->async_fd < 0)
+        return HISLIP_ERR_NOTOPEN;
+    if (h->srq) {
+        h->srq = false;
+        return 0;
+    }
+    return _async_recv(h, HISLIP_ASYNC_SERVICE_REQUEST, &hd, NULL, 0,
+                       timeout);
+}
+
+void
+hislip_set_overlap(hislip_t h, bool doOverlap)
+{
+    assert(h->magic == HISLIP_MAGIC);
+    h->overlap_pref = doOverlap;
+}
+
+bool
+hislip_overlapped(hislip_t h)
+{
+    assert(h->magic == HISLIP_MAGIC);
+    return h->overlapped;
+}
+
+void
+hislip_set_iotimeout(hislip_t h, unsigned long timeout)
+{
+    assert(h->magic == HISLIP_MAGIC);
+    h->io_timeout = timeout;
+}
+
+void
+hislip_set_lock_timeout(hislip_t h, unsigned long timeout)
+{
+    assert(h->magic == HISLIP_MAGIC);
+    h->lock_timeout = timeout;
+}
+
+char *
+hislip_strerror(hislip_t h, int err)
+{
+    char *desc = "unknown error";
+    int i;
+
+    assert(h->magic == HISLIP_MAGIC);
+    for (i = 0; errtab[i].desc != NULL; i++) {
+        if (errtab[i].num == err) {
+            desc = errtab[i].desc;
+            break;
+        }
+    }
+    if (err == HISLIP_ERR_SERVER || err == HISLIP_ERR_FATAL)
+        snprintf(h->errstr, sizeof(h->errstr), "%s %d: %s", desc,
+                 h->srv_code, h->srv_msg);
+    else
+        snprintf(h->errstr, sizeof(h->errstr), "%s", desc);
+    return h->errstr;
+}
+
+void
+hislip_perror(hislip_t h, int err, char *str)
+{
+    fprintf(stderr, "%s (%s): %s\n", str, h->host, hislip_strerror(h, err));
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
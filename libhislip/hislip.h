@@ -0,0 +1,214 @@
+#ifndef _HISLIP_H
+#define _HISLIP_H
+
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+  
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+  
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+  
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+  
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation, 
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HISLIP_PORT             4880
+
+/* Message types (IVI-6.1 table 4) */
+#define HISLIP_INITIALIZE                   0
+#define HISLIP_INITIALIZE_RESPONSE          1
+#define HISLIP_FATAL_ERROR                  2
+#define HISLIP_ERROR                        3
+#define HISLIP_ASYNC_LOCK                   4
+#define HISLIP_ASYNC_LOCK_RESPONSE          5
+#define HISLIP_DATA                         6
+#define HISLIP_DATA_END                     7
+#define HISLIP_DEVICE_CLEAR_COMPLETE        8
+#define HISLIP_DEVICE_CLEAR_ACKNOWLEDGE     9
+#define HISLIP_ASYNC_REMOTE_LOCAL_CONTROL   10
+#define HISLIP_ASYNC_REMOTE_LOCAL_RESPONSE  11
+#define HISLIP_TRIGGER                      12
+#define HISLIP_INTERRUPTED                  13
+#define HISLIP_ASYNC_INTERRUPTED            14
+#define HISLIP_ASYNC_MAX_MSG_SIZE           15
+#define HISLIP_ASYNC_MAX_MSG_SIZE_RESPONSE  16
+#define HISLIP_ASYNC_INITIALIZE             17
+#define HISLIP_ASYNC_INITIALIZE_RESPONSE    18
+#define HISLIP_ASYNC_DEVICE_CLEAR           19
+#define HISLIP_ASYNC_SERVICE_REQUEST        20
+#define HISLIP_ASYNC_STATUS_QUERY           21
+#define HISLIP_ASYNC_STATUS_RESPONSE        22
+#define HISLIP_ASYNC_DEVICE_CLEAR_ACK       23
+
+/* Every message starts with this 16 byte header, followed by
+ * 'length' bytes of payload.  Multi-byte fields are big-endian.
+ */
+#define HISLIP_HDRLEN           16
+struct hislip_hdr {
+    uint8_t     type;           /* HISLIP_* message type */
+    uint8_t     control;        /* control code */
+    uint32_t    param;          /* message parameter */
+    uint64_t    length;         /* payload length */
+};
+
+#define HISLIP_VERSION          0x0100  /* protocol version 1.0 */
+#define HISLIP_FIRST_MSGID      0xffffff00
+#define HISLIP_CTL_RMT          0x01    /* Data/Trigger: RMT-delivered */
+#define HISLIP_CTL_OVERLAP      0x01    /* Initialize*, DeviceClear*: mode */
+
+/* Encode/decode the fixed header.  hislip_decode_hdr () returns 0 on
+ * success or -1 if the "HS" prologue is missing.
+ */
+void hislip_encode_hdr(unsigned char *buf, struct hislip_hdr *hp);
+int  hislip_decode_hdr(unsigned char *buf, struct hislip_hdr *hp);
+
+/* All functions below return 0 on success or one of these errors,
+ * which can be decoded with hislip_strerror ().
+ */
+#define HISLIP_ERR_CONNECT      (-1)    /* could not connect */
+#define HISLIP_ERR_IO           (-2)    /* socket error or EOF */
+#define HISLIP_ERR_TIMEOUT      (-3)    /* I/O timeout */
+#define HISLIP_ERR_PROTO        (-4)    /* unexpected message */
+#define HISLIP_ERR_FATAL        (-5)    /* server sent FatalError */
+#define HISLIP_ERR_SERVER       (-6)    /* server sent Error */
+#define HISLIP_ERR_LOCK         (-7)    /* lock request failed */
+#define HISLIP_ERR_INTERRUPTED  (-8)    /* response was discarded */
+#define HISLIP_ERR_NOTOPEN      (-9)    /* session not open */
+#define HISLIP_ERR_NOMEM        (-10)   /* out of memory */
+
+typedef struct hislip_struct *hislip_t;
+
+/* Create a HiSLIP session handle.
+ * Returns object or NULL on out of memory error.
+ */
+hislip_t hislip_create(void);
+
+/* Destroy a HiSLIP session handle.
+ * This function always succeeds.
+ */
+void hislip_destroy(hislip_t h);
+
+/* Open the synchronous and asynchronous channels to 'host' (an IP address
+ * or hostname) on 'port' (0 means 4880), and initialize a session with
+ * the device named by 'subaddr', e.g. "hislip0".
+ * The server picks synchronized or overlapped mode - see
+ * hislip_set_overlap () and hislip_overlapped ().
+ */
+int hislip_open(hislip_t h, char *host, unsigned short port, char *subaddr);
+
+/* Close a session opened with hislip_open ().
+ * This function always succeeds.
+ */
+void hislip_close(hislip_t h);
+
+/* Send 'len' bytes of 'buf' as one message (Data ... DataEnd).
+ * In overlapped mode several messages may be sent before their
+ * responses are read; in synchronized mode an unread response is
+ * discarded by the server (the next read returns HISLIP_ERR_INTERRUPTED).
+ */
+int hislip_write(hislip_t h, char *buf, int len);
+
+/* Write 'str' (null terminated) as one message.
+ */
+int hislip_writestr(hislip_t h, char *str);
+
+/* Read at most 'len' bytes of the next response into 'buf'.  The number
+ * of bytes read is returned in 'numreadp'.  The read stops at the end
+ * of the response message; if 'buf' fills first, the rest is returned
+ * by the next call.
+ */
+int hislip_read(hislip_t h, char *buf, int len, int *numreadp);
+
+/* Read at most 'len' - 1 bytes into 'buf', adding a terminating NULL.
+ */
+int hislip_readstr(hislip_t h, char *str, int len);
+
+/* Read the status byte (AsyncStatusQuery) into 'stbp'.
+ */
+int hislip_readstb(hislip_t h, unsigned char *stbp);
+
+/* Send a Trigger message (like GPIB GET).
+ */
+int hislip_trigger(hislip_t h);
+
+/* Device clear: discard pending input and output on both ends and
+ * reset the message ID sequence.
+ */
+int hislip_clear(hislip_t h);
+
+/* Enable remote / go to local (AsyncRemoteLocalControl 3 and 2).
+ */
+int hislip_remote(hislip_t h);
+int hislip_local(hislip_t h);
+
+/* Request a lock, waiting up to the lock timeout - see
+ * hislip_set_lock_timeout ().  If 'shared' is non-NULL, request the
+ * named shared lock, else an exclusive lock.
+ */
+int hislip_lock(hislip_t h, char *shared);
+
+/* Release a lock taken with hislip_lock ().
+ */
+int hislip_unlock(hislip_t h);
+
+/* Wait up to 'timeout' milliseconds for an AsyncServiceRequest on the
+ * async channel.  Returns 0 if SRQ was asserted (and clears it), or
+ * HISLIP_ERR_TIMEOUT.
+ */
+int hislip_wait_srq(hislip_t h, unsigned long timeout);
+
+/* Ask for overlapped mode at the next hislip_open () or hislip_clear ()
+ * (default false).  The server has the final say.
+ * This function always succeeds.
+ */
+void hislip_set_overlap(hislip_t h, bool doOverlap);
+
+/* Returns true if the session is in overlapped mode.
+ */
+bool hislip_overlapped(hislip_t h);
+
+/* Change the I/O timeout from the default of 25s to 'timeout' ms.
+ * This function always succeeds.
+ */
+void hislip_set_iotimeout(hislip_t h, unsigned long timeout);
+
+/* Change the lock timeout from the default of 25s to 'timeout' ms.
+ * This function always succeeds.
+ */
+void hislip_set_lock_timeout(hislip_t h, unsigned long timeout);
+
+/* Convert an error code returned from one of the above functions to a
+ * string.  Server Error/FatalError messages are included in the text.
+ * The string is statically allocated (per handle) and overwritten on
+ * the next hislip_strerror () or hislip_perror () call for that handle.
+ */
+char *hislip_strerror(hislip_t h, int err);
+
+/* Decode 'err' to an error string and print it using the following format:
+ *   fprintf(stderr, "%s (%s): %s\n", str, host, errstr);
+ */
+void hislip_perror(hislip_t h, int err, char *str);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _HISLIP_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -22,9 +22,11 @@
 #endif
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netdb.h>
 #include <stdlib.h>
 #include <libgen.h>
 #include <stdio.h>
+#define PORTMAP /* needed for clnttcp_create() proto on solaris 11 */
 #include <rpc/rpc.h>
 #include <arpa/inet.h>
 #include <ctype.h>
@@ -577,18 +579,50 @@ ics_fini(ics_t ics)
     free(ics);
 }
 
+/* Create a client for 'host' on a known TCP 'port', bypassing the
+ * portmapper.  Errors are left in rpc_createerr like clnt_create().
+ */
+static CLIENT *
+_clnt_create_port(char *host, unsigned short port)
+{
+    struct addrinfo hints, *res;
+    struct sockaddr_in sin;
+    int sock = RPC_ANYSOCK;
+    CLIENT *clnt;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+        rpc_createerr.cf_stat = RPC_UNKNOWNHOST;
+        return NULL;
+    }
+    memcpy(&sin, res->ai_addr, sizeof(sin));
+    freeaddrinfo(res);
+    sin.sin_port = htons(port);
+    clnt = clnttcp_create(&sin, ICSCONFIG, ICSCONFIG_VERSION, &sock, 0, 0);
+    return clnt;
+}
+
 int
 ics_init (char *host, ics_t *icsp)
 {
     ics_t new;
-    char *p;
+    char *cpy, *p;
 
     new = malloc(sizeof(struct ics_struct));
     assert (new != NULL);
     new->ics_magic = ICS_MAGIC;
     *icsp = new;
 
-    new->ics_clnt = clnt_create(host, ICSCONFIG, ICSCONFIG_VERSION, "tcp");
+    cpy = strdup(host);
+    assert (cpy != NULL);
+    if ((p = strchr(cpy, ':'))) {
+        *p++ = '\0';
+        new->ics_clnt = _clnt_create_port(cpy, strtoul(p, NULL, 10));
+    } else
+        new->ics_clnt = clnt_create(host, ICSCONFIG, ICSCONFIG_VERSION, "tcp");
+    free(cpy);
     if (new->ics_clnt == NULL)
         return ICS_ERROR_CREATE;
     return 0;
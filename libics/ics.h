@@ -118,6 +118,7 @@ int     ics_idn_string(ics_t ics, char **strp);
 int     ics_error_logger(ics_t ics, unsigned int **errp, int *countp);
 
 /* Initialize/finalize the ics module.
+ * 'host' may be given as host:port to skip the portmapper lookup.
  */
 int     ics_init (char *host, ics_t *icsp);
 void    ics_fini(ics_t ics);
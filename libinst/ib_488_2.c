@@ -166,7 +166,7 @@ inst_488_2_restore(struct instrument *gd)
     char buf[32768];
     int len;
 
-    if ((len = read_all(0, buf, sizeof(buf)) < 0)) {
+    if ((len = read_all(0, buf, sizeof(buf))) < 0) {
         fprintf(stderr, "%s: read error on stdin: %s\n",
                 prog, strerror(errno));
         exit(1);
@@ -29,8 +29,11 @@
 #include <stdarg.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
+#include <poll.h>
 #if HAVE_LINUX_GPIB
 #include <gpib/ib.h>
 #endif
@@ -44,9 +47,11 @@
 #include <libgen.h>
 #include <termios.h>
 #include <sys/time.h>
+#include <time.h>
 #include <fcntl.h>
 #include <math.h>
 #include <wordexp.h>
+#include <signal.h>
 
 #if HAVE_STDBOOL_H
 #include <stdbool.h>
@@ -56,30 +61,47 @@ typedef enum { false=0, true=1 } bool;
 
 #include "libutil/util.h"
 #include "libvxi11/vxi11_device.h"
+#include "libvxi11/vxi11_trace.h"
+#include "libhislip/hislip.h"
 #include "libutil/hprintf.h"
 
 #include "inst.h"
+#include "session.h"
 
-typedef enum { GPIB, VXI11, SERIAL, SOCKET } contype_t;
+typedef enum { GPIB, VXI11, HISLIP, SERIAL, SOCKET, SESSION } contype_t;
 
 #define INSTRUMENT_MAGIC 0x43435334
 struct instrument {
     int             magic;
     contype_t       contype;   /* type of connection */
     char           *name;      /* instrument name */
+    char           *bus;       /* bus shared with other instruments */
     int             verbose;   /* verbose flag (print telemetry on stderr) */
     spollfun_t      sf_fun;    /* app-specific serial poll function */
     int             sf_level;  /* serial poll recursion detection */
     unsigned long   sf_retry;  /* backoff factor for serial poll retry (uS) */
     int             d;         /* handle (GPIB) */
-    int             fd;        /* file descriptor (SOCKET, SERIAL) */
+    int             fd;        /* file descriptor (SOCKET, SERIAL, SESSION) */
     vxi11dev_t      vxi11_handle; /* handle (VXI11) */
+    hislip_t        hislip_handle; /* handle (HISLIP) */
     int             reos;
     int             eos;
     int             eot;
     struct timeval  timeout;
+    int             errexit;   /* exit on I/O error (else see inst_error) */
+    int             error;     /* I/O error since last inst_error () */
+    int             changed;   /* settings changed since inst_init () */
+    int             dflt_reos; /* settings made by inst_init () */
+    int             dflt_eos;
+    int             dflt_eot;
+    double          dflt_timeout;
 };
 
+#define CHANGED_REOS    0x1
+#define CHANGED_EOS     0x2
+#define CHANGED_EOT     0x4
+#define CHANGED_TIMEOUT 0x8
+
 typedef struct {
     int baud;
     speed_t bconst;
@@ -111,17 +133,66 @@ extern char *prog;
 
 static int _raw_serial(struct instrument *gd);
 static int _canon_serial(struct instrument *gd);
+static void _set_bus(struct instrument *gd, const char *addr);
+
+/* Handle an I/O error, already reported on stderr: exit, or if
+ * inst_set_errexit (gd, 0) was called, note it for inst_error ().
+ * Returns -1.
+ */
+static int
+_fail(struct instrument *gd)
+{
+    if (gd->errexit) {
+        inst_fini(gd);
+        exit(1);
+    }
+    gd->error = 1;
+    return -1;
+}
+
+/* Bracket a multi-operation sequence (e.g. write, read, serial poll)
+ * so that on VXI-11 a single device lock covers all of it.
+ */
+static int
+_begin(struct instrument *gd)
+{
+    int err;
+
+    if (gd->contype == VXI11) {
+        if ((err = vxi11_begin(gd->vxi11_handle))) {
+            vxi11_perror(gd->vxi11_handle, err, prog);
+            return _fail(gd);
+        }
+    }
+    return 0;
+}
+
+static int
+_end(struct instrument *gd)
+{
+    int err;
+
+    if (gd->contype == VXI11) {
+        if ((err = vxi11_end(gd->vxi11_handle))) {
+            vxi11_perror(gd->vxi11_handle, err, prog);
+            return _fail(gd);
+        }
+    }
+    return 0;
+}
 
 /* If a serial poll function is defined, call it with the instrument
- * status byte.
+ * status byte.  Returns 0, or -1 if the poll failed or the function
+ * reported a fatal error (see _fail ()).
  */
-static void
+static int
 _serial_poll(struct instrument *gd, char *str)
 {
     unsigned char sb;
     int err = 0;
     int loops = 0;
     int more;
+    int res = 0;
 
     gd->sf_level++;
     if (gd->sf_level == 1 && gd->sf_fun) {
@@ -129,7 +200,10 @@ _serial_poll(struct instrument *gd, char *str)
          * (The driver maintains a stack of them.)
          */
         do {
-            more = inst_rsp(gd, &sb);
+            if ((more = inst_rsp(gd, &sb)) < 0) {
+                res = -1;
+                break;
+            }
             err = gd->sf_fun(gd, sb, str);
             switch (err) {
                 case -1:    /* retry - device not ready (and we care) */
@@ -138,12 +212,139 @@ _serial_poll(struct instrument *gd, char *str)
                 case 0:     /* no error */
                     break;
                 default:    /* fatal error */
-                    inst_fini(gd);
-                    exit(err);
+                    if (gd->errexit) {
+                        inst_fini(gd);
+                        exit(err);
+                    }
+                    gd->error = 1;
+                    res = -1;
+                    break;
             }
-        } while (more || err == -1);
+        } while (res == 0 && (more || err == -1));
     }
     gd->sf_level--;
+    return res;
+}
+
+/* Set 'expire' to when a read starting now must be done by, given the
+ * timeout set with inst_set_timeout () (none if not set).
+ */
+static void
+_read_deadline(struct instrument *gd, struct timespec *expire)
+{
+    clock_gettime(CLOCK_MONOTONIC, expire);
+    expire->tv_sec += gd->timeout.tv_sec;
+    expire->tv_nsec += gd->timeout.tv_usec * 1000;
+    if (expire->tv_nsec >= 1000000000) {
+        expire->tv_sec++;
+        expire->tv_nsec -= 1000000000;
+    }
+}
+
+/* Wait for gd->fd to be readable, until 'expire' if a timeout is set.
+ * Returns 0, or -1 on error or timeout (errno set).
+ */
+static int
+_wait_readable(struct instrument *gd, struct timespec *expire)
+{
+    struct pollfd pfd = { .fd = gd->fd, .events = POLLIN };
+    struct timespec now;
+    long tmout = -1;
+    int n;
+
+    do {
+        if (timerisset(&gd->timeout)) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            tmout = (expire->tv_sec - now.tv_sec) * 1000
+                  + (expire->tv_nsec - now.tv_nsec) / 1000000;
+            if (tmout < 0)
+                tmout = 0;
+        }
+    } while ((n = poll(&pfd, 1, tmout)) < 0 && errno == EINTR);
+    if (n == 0) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return n < 0 ? -1 : 0;
+}
+
+/* Read from a socket, stopping after the eos character if reos is set.
+ * Data is peeked at first so that nothing past eos is consumed.  The
+ * timeout bounds the whole read, not each chunk, so a device trickling
+ * out bytes cannot stretch it.  Returns the count, 0 on EOF, or -1 on
+ * error or timeout (errno set).
+ */
+static int
+_socket_read(struct instrument *gd, char *buf, int len)
+{
+    struct timespec expire;
+    int n, count = 0;
+    char *p;
+
+    _read_deadline(gd, &expire);
+    while (count < len) {
+        if (_wait_readable(gd, &expire) < 0)
+            return -1;
+        if ((n = recv(gd->fd, buf + count, len - count, MSG_PEEK)) <= 0)
+            return n;
+        if (gd->reos && (p = memchr(buf + count, gd->eos, n)))
+            n = p - (buf + count) + 1;
+        if ((n = recv(gd->fd, buf + count, n, 0)) <= 0)
+            return n;
+        count += n;
+        if (gd->reos && buf[count - 1] == (char)gd->eos)
+            break;
+    }
+    return count;
+}
+
+/* Read from a serial port: one read () if reos is set (the line
+ * discipline returns a line at a time), else until 'len' bytes, within
+ * the timeout as for a socket.  Returns the count, 0 on EOF, or -1 on
+ * error or timeout (errno set).
+ */
+static int
+_serial_read(struct instrument *gd, char *buf, int len)
+{
+    struct timespec expire;
+    int n, count = 0;
+
+    _read_deadline(gd, &expire);
+    while (count < len) {
+        if (_wait_readable(gd, &expire) < 0)
+            return -1;
+        if ((n = read(gd->fd, buf + count, len - count)) < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return count > 0 && n == 0 ? count : n;
+        count += n;
+        if (gd->reos)
+            break;
+    }
+    return count;
+}
+
+/* Make a request of the instd(1) session process and wait for its reply,
+ * reading up to 'inlen' bytes of payload into 'in'.  Returns the result,
+ * or -1 if the session process has gone, e.g. exiting on an I/O error
+ * that it reported on our stderr (see _fail ()).
+ */
+static int
+_session_call(struct instrument *gd, int op, uint32_t arg, void *out,
+              int outlen, void *in, int inlen, uint32_t *argp)
+{
+    struct session_hdr h = { .op = op, .arg = arg, .len = outlen };
+
+    if (session_send(gd->fd, &h, out, NULL, 0) < 0
+            || session_recv(gd->fd, &h, NULL, 0) <= 0
+            || h.len > inlen
+            || read_all(gd->fd, in, h.len) < h.len) {
+        fprintf(stderr, "%s: lost instd session\n", prog);
+        return _fail(gd);
+    }
+    if (argp)
+        *argp = h.arg;
+    return h.op;
 }
 
 static int
@@ -158,58 +359,54 @@ _generic_read(struct instrument *gd, char *buf, int len)
                 ibrd(gd->d, buf + count, len - count);
                 if (ibsta & TIMO) {
                     fprintf(stderr, "%s: ibrd timeout\n", prog);
-                    inst_fini(gd);
-                    exit(1);
+                    return _fail(gd);
                 }
                 if (ibsta & ERR) {
                     fprintf(stderr, "%s: ibrd error %d\n", prog, iberr);
-                    inst_fini(gd);
-                    exit(1);
+                    return _fail(gd);
                 }
                 count += ibcnt;
             } while (count < len && !(ibsta & END));
             if (!(ibsta & END)) {
                 fprintf(stderr, "%s: read buffer too small\n", prog);
-                inst_fini(gd);
-                exit(1);
+                return _fail(gd);
             }
 #endif
             break;
         case VXI11:
             if ((err = vxi11_read(gd->vxi11_handle, buf, len, &count))) {
                 vxi11_perror(gd->vxi11_handle, err, prog);
-                inst_fini(gd);
-                exit(1);
+                return _fail(gd);
+            }
+            break;
+        case HISLIP:
+            if ((err = hislip_read(gd->hislip_handle, buf, len, &count))) {
+                hislip_perror(gd->hislip_handle, err, prog);
+                return _fail(gd);
             }
             break;
         case SERIAL:
-            /* FIXME: use timeout */
-            if (gd->reos)
-                count = read(gd->fd, buf, len);
-            else
-                count = read_all(gd->fd, buf, len);
-            if (count < 0) {
+            if ((count = _serial_read(gd, buf, len)) < 0) {
                 fprintf(stderr, "%s: read error: %s\n", prog, strerror(errno));
-                inst_fini(gd);
-                exit(1);
+                return _fail(gd);
             } else if (count == 0) {
                 fprintf(stderr, "%s: EOF on read: %s\n", prog, strerror(errno));
-                inst_fini(gd);
-                exit(1);
+                return _fail(gd);
             }
             break;
         case SOCKET:
-            /* FIXME: use timeout */
-            if ((count = read_all(gd->fd, buf, len) < 0)) {
+            if ((count = _socket_read(gd, buf, len)) < 0) {
                 fprintf(stderr, "%s: read error: %s\n", prog, strerror(errno));
-                inst_fini(gd);
-                exit(1);
+                return _fail(gd);
             } else if (count == 0) {
                 fprintf(stderr, "%s: EOF on read: %s\n", prog, strerror(errno));
-                inst_fini(gd);
-                exit(1);
+                return _fail(gd);
             }
             break;
+        case SESSION:
+            count = _session_call(gd, SESSION_READ, len, NULL, 0,
+                                  buf, len, NULL);
+            break;
     }
 
     return count;
@@ -221,10 +418,12 @@ inst_rd(struct instrument *gd, void *buf, int len)
     int count = 0;
 
     assert(gd->magic == INSTRUMENT_MAGIC);
-    count = _generic_read(gd, buf, len);
+    if ((count = _generic_read(gd, buf, len)) < 0)
+        return -1;
     if (gd->verbose)
         fprintf(stderr, "R: [%d bytes]\n", count);
-    _serial_poll(gd, "gpib_rd");
+    if (_serial_poll(gd, "gpib_rd") < 0)
+        return -1;
 
     return count;
 }
@@ -244,7 +443,10 @@ inst_rdstr(struct instrument *gd, char *buf, int len)
     int count = 0;
 
     assert(gd->magic == INSTRUMENT_MAGIC);
-    count = _generic_read(gd, buf, len - 1);
+    if ((count = _generic_read(gd, buf, len - 1)) < 0) {
+        buf[0] = '\0';
+        return;
+    }
     assert(count < len);
     buf[count] = '\0';
     _zap_trailing_terminators(buf);
@@ -266,7 +468,8 @@ inst_rdf(struct instrument *gd, char *fmt, ...)
     int n;
 
     assert(gd->magic == INSTRUMENT_MAGIC);
-    count = _generic_read(gd, buf, sizeof(buf) - 1);
+    if ((count = _generic_read(gd, buf, sizeof(buf) - 1)) < 0)
+        return -1;
     assert(count < sizeof(buf) - 1);
     buf[count] = '\0';
     _zap_trailing_terminators(buf);
@@ -285,12 +488,13 @@ inst_rdf(struct instrument *gd, char *fmt, ...)
         fprintf(stderr, "R: \"%s\"\n", cpy);
         free(cpy);
     }
-    _serial_poll(gd, "gpib_rdf");
+    if (_serial_poll(gd, "gpib_rdf") < 0)
+        return -1;
 
     return n;
 }
 
-static void
+static int
 _generic_write(struct instrument *gd, void *buf, int len)
 {
     int err;
@@ -301,13 +505,11 @@ _generic_write(struct instrument *gd, void *buf, int len)
             ibwrt(gd->d, buf, len);
             if (ibsta & TIMO) {
                 fprintf(stderr, "%s: ibwrt timeout\n", prog);
-                inst_fini(gd);
-                exit(1);
+                return _fail(gd);
             }
             if (ibsta & ERR) {
                 fprintf(stderr, "%s: ibwrt error %d\n", prog, iberr);
-                inst_fini(gd);
-                exit(1);
+                return _fail(gd);
             }
             assert(ibcnt == len);
 #endif
@@ -315,44 +517,73 @@ _generic_write(struct instrument *gd, void *buf, int len)
         case VXI11:
             if ((err = vxi11_write(gd->vxi11_handle, buf, len))) {
                 vxi11_perror(gd->vxi11_handle, err, prog);
-                inst_fini(gd);
-                exit(1);
+                return _fail(gd);
+            }
+            break;
+        case HISLIP:
+            if ((err = hislip_write(gd->hislip_handle, buf, len))) {
+                hislip_perror(gd->hislip_handle, err, prog);
+                return _fail(gd);
             }
             break;
         case SERIAL:
         case SOCKET:
             /* FIXME: use timeout */
-            if (write_all(gd->fd, buf, len) < 0) {
+            if (write_all(gd->fd, buf, len) < len) {
                 fprintf(stderr, "%s: write error: %s\n", prog, strerror(errno));
-                inst_fini(gd);
-                exit(1);
+                return _fail(gd);
+            }
+            /* no EOI on a socket or serial line: end the message with eos */
+            if (gd->reos
+                    && (len == 0 || ((char *)buf)[len - 1] != (char)gd->eos)) {
+                char c = gd->eos;
+
+                if (write_all(gd->fd, &c, 1) < 1) {
+                    fprintf(stderr, "%s: write error: %s\n", prog,
+                            strerror(errno));
+                    return _fail(gd);
+                }
             }
             break;
+        case SESSION:
+            if (_session_call(gd, SESSION_WRITE, 0, buf, len, NULL, 0,
+                              NULL) < 0)
+                return -1;
+            break;
     }
+    return 0;
 }
 
 void
 inst_wrt(struct instrument *gd, void *buf, int len)
 {
     assert(gd->magic == INSTRUMENT_MAGIC);
-    _generic_write(gd, buf, len);
-    if (gd->verbose)
-        fprintf(stderr, "T: [%d bytes]\n", len);
-    _serial_poll(gd, "gpib_wrt");
+    if (_begin(gd) < 0)
+        return;
+    if (_generic_write(gd, buf, len) == 0) {
+        if (gd->verbose)
+            fprintf(stderr, "T: [%d bytes]\n", len);
+        _serial_poll(gd, "gpib_wrt");
+    }
+    _end(gd);
 }
 
 void
 inst_wrtstr(struct instrument *gd, char *str)
 {
     assert(gd->magic == INSTRUMENT_MAGIC);
-    _generic_write(gd, str, strlen(str));
-    if (gd->verbose) {
-        char *cpy = xstrcpyprint(str);
+    if (_begin(gd) < 0)
+        return;
+    if (_generic_write(gd, str, strlen(str)) == 0) {
+        if (gd->verbose) {
+            char *cpy = xstrcpyprint(str);
 
-        fprintf(stderr, "T: \"%s\"\n", cpy);
-        free(cpy);
+            fprintf(stderr, "T: \"%s\"\n", cpy);
+            free(cpy);
+        }
+        _serial_poll(gd, "gpib_wrtstr");
     }
-    _serial_poll(gd, "gpib_wrtstr");
+    _end(gd);
 }
 
 void
@@ -365,15 +596,21 @@ inst_wrtf(struct instrument *gd, char *fmt, ...)
     va_start(ap, fmt);
     s = hvsprintf(fmt, ap);
     va_end(ap);
-    _generic_write(gd, s, strlen(s));
-    if (gd->verbose) {
-        char *cpy = xstrcpyprint(s);
+    if (_begin(gd) < 0) {
+        free(s);
+        return;
+    }
+    if (_generic_write(gd, s, strlen(s)) == 0) {
+        if (gd->verbose) {
+            char *cpy = xstrcpyprint(s);
 
-        fprintf(stderr, "T: \"%s\"\n", cpy);
-        free(cpy);
+            fprintf(stderr, "T: \"%s\"\n", cpy);
+            free(cpy);
+        }
+        _serial_poll(gd, "gpib_wrtf");
     }
     free(s);
-    _serial_poll(gd, "gpib_wrtf");
+    _end(gd);
 }
 
 int
@@ -382,14 +619,22 @@ inst_qry(struct instrument *gd, char *str, void *buf, int len)
     int count;
 
     assert(gd->magic == INSTRUMENT_MAGIC);
-    _generic_write(gd, str, strlen(str));
+    if (_begin(gd) < 0)
+        return -1;
+    if (_generic_write(gd, str, strlen(str)) < 0) {
+        _end(gd);
+        return -1;
+    }
     if (gd->verbose) {
         char *cpy = xstrcpyprint(str);
 
         fprintf(stderr, "T: \"%s\"\n", cpy);
         free(cpy);
     }
-    count = _generic_read(gd, buf, len);
+    if ((count = _generic_read(gd, buf, len)) < 0) {
+        _end(gd);
+        return -1;
+    }
     if (count < len && ((char *)buf)[count - 1] != '\0')
         ((char *)buf)[count++] = '\0';
     if (gd->verbose) {
@@ -402,7 +647,10 @@ inst_qry(struct instrument *gd, char *str, void *buf, int len)
             fprintf(stderr, "R: [%d bytes]\n", count);
         }
     }
-    _serial_poll(gd, "gpib_qry");
+    if (_serial_poll(gd, "gpib_qry") < 0)
+        count = -1;
+    if (_end(gd) < 0)
+        count = -1;
 
     return count;
 }
@@ -423,7 +671,8 @@ inst_qryint(struct instrument *gd, char *str)
 {
     char buf[16];
 
-    inst_qrystr(gd, str, buf, sizeof(buf));
+    if (inst_qrystr(gd, str, buf, sizeof(buf)) < 0)
+        return -1;
 
     return strtoul(buf, NULL, 10); /* 0 - 255 */
 }
@@ -440,20 +689,32 @@ inst_loc(struct instrument *gd)
             ibloc(gd->d);
             if ((ibsta & ERR)) {
                 fprintf(stderr, "%s: ibloc error %d\n", prog, iberr);
-                inst_fini(gd);
-                exit(1);
+                _fail(gd);
+                return;
             }
 #endif
             break;
         case VXI11:
             if ((err = vxi11_local(gd->vxi11_handle))) {
                 vxi11_perror(gd->vxi11_handle, err, prog);
-                exit(1);
+                _fail(gd);
+                return;
+            }
+            break;
+        case HISLIP:
+            if ((err = hislip_local(gd->hislip_handle))) {
+                hislip_perror(gd->hislip_handle, err, prog);
+                _fail(gd);
+                return;
             }
             break;
         case SERIAL:
         case SOCKET:
             break;
+        case SESSION:
+            if (_session_call(gd, SESSION_LOC, 0, NULL, 0, NULL, 0, NULL) < 0)
+                return;
+            break;
     }
     if (gd->verbose)
         fprintf(stderr, "T: [ibloc]\n");
@@ -472,25 +733,37 @@ inst_clr(struct instrument *gd, unsigned long usec)
             ibclr(gd->d);
             if ((ibsta & TIMO)) {
                 fprintf(stderr, "%s: ibclr timeout\n", prog);
-                inst_fini(gd);
-                exit(1);
+                _fail(gd);
+                return;
             }
             if ((ibsta & ERR)) {
                 fprintf(stderr, "%s: ibclr error %d\n", prog, iberr);
-                inst_fini(gd);
-                exit(1);
+                _fail(gd);
+                return;
             }
 #endif
             break;
         case VXI11:
             if ((err = vxi11_clear(gd->vxi11_handle))) {
                 vxi11_perror(gd->vxi11_handle, err, prog);
-                exit(1);
+                _fail(gd);
+                return;
+            }
+            break;
+        case HISLIP:
+            if ((err = hislip_clear(gd->hislip_handle))) {
+                hislip_perror(gd->hislip_handle, err, prog);
+                _fail(gd);
+                return;
             }
             break;
         case SERIAL:
         case SOCKET:
             break;
+        case SESSION:
+            if (_session_call(gd, SESSION_CLR, 0, NULL, 0, NULL, 0, NULL) < 0)
+                return;
+            break;
     }
     if (gd->verbose)
         fprintf(stderr, "T: [ibclr]\n");
@@ -510,20 +783,32 @@ inst_trg(struct instrument *gd)
             ibtrg(gd->d);
             if ((ibsta & ERR)) {
                 fprintf(stderr, "%s: ibtrg error %d\n", prog, iberr);
-                inst_fini(gd);
-                exit(1);
+                _fail(gd);
+                return;
             }
 #endif
             break;
         case VXI11:
             if ((err = vxi11_trigger(gd->vxi11_handle))) {
                 vxi11_perror(gd->vxi11_handle, err, prog);
-                inst_fini(gd);
-                exit(1);
+                _fail(gd);
+                return;
             }
+            break;
+        case HISLIP:
+            if ((err = hislip_trigger(gd->hislip_handle))) {
+                hislip_perror(gd->hislip_handle, err, prog);
+                _fail(gd);
+                return;
+            }
+            break;
         case SERIAL:
         case SOCKET:
             break;
+        case SESSION:
+            if (_session_call(gd, SESSION_TRG, 0, NULL, 0, NULL, 0, NULL) < 0)
+                return;
+            break;
     }
     if (gd->verbose)
         fprintf(stderr, "T: [ibtrg]\n");
@@ -531,12 +816,13 @@ inst_trg(struct instrument *gd)
 }
 
 /* A nonzero return value means call gpib_rsp() again to obtain more
- * status info.
+ * status info, or if negative, that the serial poll failed.
  */
 int
 inst_rsp(struct instrument *gd, unsigned char *status)
 {
     int err, res = 0;
+    uint32_t stb;
 
     assert(gd->magic == INSTRUMENT_MAGIC);
     switch(gd->contype) {
@@ -545,8 +831,8 @@ inst_rsp(struct instrument *gd, unsigned char *status)
             ibrsp(gd->d, (char *)status); /* NOTE: modifies ibcnt */
             if ((ibsta & ERR)) {
                 fprintf(stderr, "%s: ibrsp error %d\n", prog, iberr);
-                inst_fini(gd);
-                exit(1);
+                *status = 0;
+                return _fail(gd);
             }
             res = (ibsta & RQS);
 #endif
@@ -554,7 +840,15 @@ inst_rsp(struct instrument *gd, unsigned char *status)
         case VXI11:
             if ((err = vxi11_readstb(gd->vxi11_handle, status))) {
                 vxi11_perror(gd->vxi11_handle, err, prog);
-                exit(1);
+                *status = 0;
+                return _fail(gd);
+            }
+            break;
+        case HISLIP:
+            if ((err = hislip_readstb(gd->hislip_handle, status))) {
+                hislip_perror(gd->hislip_handle, err, prog);
+                *status = 0;
+                return _fail(gd);
             }
             break;
         case SERIAL:
@@ -562,6 +856,14 @@ inst_rsp(struct instrument *gd, unsigned char *status)
             /* FIXME */
             *status = 0;
             break;
+        case SESSION:
+            if ((res = _session_call(gd, SESSION_RSP, 0, NULL, 0, NULL, 0,
+                                     &stb)) < 0) {
+                *status = 0;
+                return -1;
+            }
+            *status = stb;
+            break;
     }
     if (gd->verbose)
         fprintf(stderr, "T: [ibrsp] R: 0x%x\n", (unsigned int)*status);
@@ -585,6 +887,8 @@ inst_set_reos(struct instrument *gd, int flag)
         case VXI11:
             vxi11_set_termcharset(gd->vxi11_handle, flag);
             break;
+        case HISLIP:    /* reads always stop at the end of a message */
+            break;
         case SERIAL:
             gd->reos = flag;
             if (flag)
@@ -593,9 +897,13 @@ inst_set_reos(struct instrument *gd, int flag)
                 _raw_serial(gd);
             break;
         case SOCKET:
-            gd->reos = flag;
+            break;
+        case SESSION:
+            _session_call(gd, SESSION_REOS, flag, NULL, 0, NULL, 0, NULL);
             break;
     }
+    gd->reos = flag;
+    gd->changed |= CHANGED_REOS;
 }
 
 void
@@ -615,11 +923,17 @@ inst_set_eot(struct instrument *gd, int flag)
         case VXI11:
             vxi11_set_endw(gd->vxi11_handle, flag);
             break;
+        case HISLIP:    /* writes always end with DataEnd */
+            break;
         case SERIAL:
         case SOCKET:
-            gd->eot = flag;
+            break;
+        case SESSION:
+            _session_call(gd, SESSION_EOT, flag, NULL, 0, NULL, 0, NULL);
             break;
     }
+    gd->eot = flag;
+    gd->changed |= CHANGED_EOT;
 }
 
 void
@@ -639,15 +953,21 @@ inst_set_eos(struct instrument *gd, int c)
         case VXI11:
             vxi11_set_termchar(gd->vxi11_handle, c);
             break;
+        case HISLIP:
+            break;
         case SERIAL:
             gd->eos = c;
             if (gd->reos)
                 _canon_serial(gd);
             break;
         case SOCKET:
-            gd->eos = c;
+            break;
+        case SESSION:
+            _session_call(gd, SESSION_EOS, c, NULL, 0, NULL, 0, NULL);
             break;
     }
+    gd->eos = c;
+    gd->changed |= CHANGED_EOS;
 }
 
 #if HAVE_LINUX_GPIB
@@ -702,8 +1022,7 @@ _ibtmo(struct instrument *gd, double sec)
     ibtmo(gd->d, val);
     if ((ibsta & ERR)) {
         fprintf(stderr, "%s: ibtmo failed: %d\n", prog, iberr);
-        inst_fini(gd);
-        exit(1);
+        _fail(gd);
     }
 }
 #endif
@@ -721,12 +1040,20 @@ inst_set_timeout(struct instrument *gd, double sec)
         case VXI11:
              vxi11_set_iotimeout(gd->vxi11_handle, sec * 1000.0);
              break;
+        case HISLIP:
+             hislip_set_iotimeout(gd->hislip_handle, sec * 1000.0);
+             break;
         case SERIAL:
         case SOCKET:
              gd->timeout.tv_sec = (time_t)floor(sec);
-             gd->timeout.tv_usec =  (suseconds_t)((sec - floor(sec)) / 1E6);
+             gd->timeout.tv_usec =  (suseconds_t)((sec - floor(sec)) * 1E6);
+             break;
+        case SESSION:
+             _session_call(gd, SESSION_TIMEOUT, sec * 1E6, NULL, 0, NULL, 0,
+                           NULL);
              break;
     }
+    gd->changed |= CHANGED_TIMEOUT;
 }
 
 void
@@ -736,9 +1063,33 @@ inst_set_verbose(struct instrument *gd, int flag)
     gd->verbose = flag;
 }
 
+int
+inst_set_errexit(struct instrument *gd, int flag)
+{
+    int old;
+
+    assert(gd->magic == INSTRUMENT_MAGIC);
+    old = gd->errexit;
+    gd->errexit = flag;
+    return old;
+}
+
+int
+inst_error(struct instrument *gd)
+{
+    int err;
+
+    assert(gd->magic == INSTRUMENT_MAGIC);
+    err = gd->error;
+    gd->error = 0;
+    return err;
+}
+
 static void
 _free_inst(struct instrument *gd)
 {
+    if (gd->bus)
+        free(gd->bus);
     memset(gd, 0, sizeof(*gd));
     free(gd);
 }
@@ -756,9 +1107,15 @@ inst_abort(struct instrument *gd)
             if (err) /* N.B. non-fatal */
                 vxi11_perror(gd->vxi11_handle, err, prog);
             break;
+        case HISLIP:    /* device clear via the async channel */
+            err = hislip_clear(gd->hislip_handle);
+            if (err) /* N.B. non-fatal */
+                hislip_perror(gd->hislip_handle, err, prog);
+            break;
         case GPIB:
         case SERIAL:
         case SOCKET:
+        case SESSION:   /* instd serves one request at a time */
             break;
     }
 }
@@ -780,8 +1137,16 @@ inst_fini(struct instrument *gd)
                 gd->vxi11_handle = NULL;
             }
             break;
+        case HISLIP:
+            if (gd->hislip_handle) {
+                hislip_close(gd->hislip_handle);
+                hislip_destroy(gd->hislip_handle);
+                gd->hislip_handle = NULL;
+            }
+            break;
         case SERIAL:
         case SOCKET:
+        case SESSION:
             if (gd->fd >= 0) {
                 (void)close(gd->fd);
                 gd->fd = -1;
@@ -800,15 +1165,21 @@ _new_inst(contype_t t)
     new->contype = t;
     new->d = -1;
     new->verbose = 0;
+    new->errexit = 1;
+    new->error = 0;
     new->sf_fun = NULL;
     new->sf_level = 0;
     new->sf_retry = 1;
     new->vxi11_handle = NULL;
+    new->hislip_handle = NULL;
     new->fd = -1;
+    new->bus = NULL;
     new->reos = 0;
     new->eot = 1;
     new->eos = '\n';
     timerclear(&new->timeout);
+    new->changed = 0;
+    new->dflt_timeout = 0;
 
     return new;
 }
@@ -827,6 +1198,7 @@ _init_gpib(int board, int pad, int sad, spollfun_t sf, unsigned long retry)
         new->d = handle;
         new->sf_fun = sf;
         new->sf_retry = retry;
+        new->dflt_timeout = 30;
     }
 #else
     fprintf(stderr, "%s: ibdev(%d,%d,0x%x) failed: no GPIB support\n",
@@ -839,12 +1211,31 @@ static struct instrument *
 _init_vxi(const char *name, spollfun_t sf, unsigned long retry)
 {
     struct instrument *gd = _new_inst(VXI11);
+    char *env;
     int err;
 
     gd->sf_fun = sf;
     gd->sf_retry = retry;
+    gd->dflt_timeout = 25;         /* libvxi11 default */
     gd->vxi11_handle = vxi11_create();
 
+    /* VXI11_TRACE in the environment: dump the libvxi11 trace ring on
+     * SIGUSR1 or a crash.
+     */
+    if (getenv("VXI11_TRACE"))
+        (void)vxi11_trace_handlers(SIGUSR1);
+    /* VXI11_LOCK=MSEC in the environment: hold the device lock over each
+     * _begin ()/_end () sequence, waiting up to MSEC for it, so that
+     * other clients of the instrument cannot interleave with ours.
+     */
+    if ((env = getenv("VXI11_LOCK")) && *env != '\0')
+        vxi11_set_lockpolicy(gd->vxi11_handle, true,
+                             strtoul(env, NULL, 10));
+    /* A connection per bus, so jobs on different buses of one gateway
+     * (see sched.h) do not wait for each other's RPCs.
+     */
+    _set_bus(gd, name);
+    vxi11_set_conngroup(gd->vxi11_handle, gd->bus);
     //vxi11_set_device_debug(true);
     err = vxi11_open(gd->vxi11_handle, (char *)name, false);
     if (err) {
@@ -857,6 +1248,40 @@ _init_vxi(const char *name, spollfun_t sf, unsigned long retry)
     return gd;
 }
 
+/* Open a HiSLIP session.  'host' may be "host" or "host:port";
+ * 'subaddr' is the device name, e.g. "hislip0".
+ */
+static struct instrument *
+_init_hislip(char *host, char *subaddr, spollfun_t sf, unsigned long retry)
+{
+    struct instrument *gd = _new_inst(HISLIP);
+    unsigned short port = 0;
+    char *p;
+    int err;
+
+    gd->sf_fun = sf;
+    gd->sf_retry = retry;
+    gd->dflt_timeout = 25;         /* libhislip default */
+    if ((p = strchr(host, ':'))) {
+        *p++ = '\0';
+        port = strtoul(p, NULL, 10);
+    }
+    if (!(gd->hislip_handle = hislip_create())) {
+        fprintf(stderr, "%s: out of memory\n", prog);
+        goto err;
+    }
+    if ((err = hislip_open(gd->hislip_handle, host, port, subaddr))) {
+        hislip_perror(gd->hislip_handle, err, prog);
+        goto err;
+    }
+    return gd;
+err:
+    if (gd->hislip_handle)
+        hislip_destroy(gd->hislip_handle);
+    _free_inst(gd);
+    return NULL;
+}
+
 static int
 _canon_serial(struct instrument *gd)
 {
@@ -1044,14 +1469,212 @@ err:
     return NULL;
 }
 
+/* Connect to a raw socket instrument, e.g. SCPI on port 5025.  There is
+ * no EOI on a socket, so reads end at the eos character by default.
+ */
 static struct instrument *
 _init_socket(char *host, char *port, spollfun_t sf, unsigned long retry)
 {
-    fprintf(stderr, "%s: tcp_init('%s','%s') failed: no socket support\n",
-            prog, host, port);
+    struct instrument *gd = _new_inst(SOCKET);
+    struct addrinfo hints, *res, *r;
+    int err, one = 1;
+
+    gd->sf_fun = sf;
+    gd->sf_retry = retry;
+    gd->reos = 1;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((err = getaddrinfo(host, port, &hints, &res))) {
+        fprintf(stderr, "%s: %s: %s\n", prog, host, gai_strerror(err));
+        goto err;
+    }
+    for (r = res; r != NULL; r = r->ai_next) {
+        if ((gd->fd = socket(r->ai_family, r->ai_socktype,
+                             r->ai_protocol)) < 0)
+            continue;
+        if (connect(gd->fd, r->ai_addr, r->ai_addrlen) == 0)
+            break;
+        close(gd->fd);
+        gd->fd = -1;
+    }
+    freeaddrinfo(res);
+    if (gd->fd < 0) {
+        fprintf(stderr, "%s: connect %s:%s: %s\n", prog, host, port,
+                strerror(errno));
+        goto err;
+    }
+    /* each command is a small write that waits for its response */
+    (void)setsockopt(gd->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return gd;
+err:
+    _free_inst(gd);
     return NULL;
 }
 
+/* Ask instd(1) for instrument 'addr'.  Returns -1 if instd is not in use
+ * or not running, so the caller connects directly, else 0 with the instrument in '*gdp',
+ * or NULL if instd could not open it (it said why on our stderr, which
+ * is passed to it for the messages of the session).
+ */
+static int
+_init_session(const char *addr, spollfun_t sf, unsigned long retry,
+              struct instrument **gdp)
+{
+    struct sockaddr_un sun;
+    struct session_hdr h;
+    struct instrument *gd;
+    int fd, errfd = STDERR_FILENO;
+    char *path, *buf, bus[256];
+    int plen = strlen(prog) + 1;
+
+    if (!(path = session_path()))
+        return -1;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        free(path);
+        return -1;
+    }
+    strcpy(sun.sun_path, path);
+    free(path);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+        goto nodaemon;
+    if (!session_peer_ok(fd)) {
+        fprintf(stderr, "%s: %s: instd runs as another user, ignoring it\n",
+                prog, sun.sun_path);
+        goto nodaemon;
+    }
+    h.op = SESSION_OPEN;
+    h.arg = 0;
+    h.len = plen + strlen(addr) + 1;
+    buf = xmalloc(h.len);
+    strcpy(buf, prog);
+    strcpy(buf + plen, addr);
+    if (session_send(fd, &h, buf, &errfd, 1) < 0) {
+        free(buf);
+        goto nodaemon;
+    }
+    free(buf);
+    if (session_recv(fd, &h, NULL, 0) <= 0 || h.len >= sizeof(bus)
+            || read_all(fd, bus, h.len) < h.len)
+        goto nodaemon;          /* e.g. instd is exiting */
+    if (h.op < 0) {
+        close(fd);
+        *gdp = NULL;
+        return 0;
+    }
+    bus[h.len] = '\0';
+    gd = _new_inst(SESSION);
+    gd->fd = fd;
+    gd->sf_fun = sf;
+    gd->sf_retry = retry;
+    gd->bus = xstrdup(bus);
+    *gdp = gd;
+    return 0;
+nodaemon:
+    close(fd);
+    return -1;
+}
+
+/* Name the bus that instrument 'gd' at 'addr' shares with others, over
+ * which only one transfer can happen at a time: the GPIB board, the
+ * gateway's GPIB interface (host:gpibN), or for a LAN instrument or a
+ * serial port, the host or device itself.
+ */
+static void
+_set_bus(struct instrument *gd, const char *addr)
+{
+    char *cpy = xstrdup(addr);
+    char *p, buf[64];
+    int board;
+
+    switch (gd->contype) {
+        case GPIB:
+            if (sscanf(addr, "%d:", &board) != 1 || !strchr(addr, ':'))
+                board = 0;
+            snprintf(buf, sizeof(buf), "gpib%d", board);
+            gd->bus = xstrdup(buf);
+            break;
+        case VXI11:                 /* host:gpibN,pad or host:inst0 */
+            if ((p = strchr(cpy, ':'))) {
+                if (!strncmp(p + 1, "gpib", 4))
+                    p += strcspn(p, ",");
+                *p = '\0';
+            }
+            gd->bus = xstrdup(cpy);
+            break;
+        case HISLIP:                /* hislip://host/dev */
+            p = cpy + strlen("hislip://");
+            p[strcspn(p, "/")] = '\0';
+            gd->bus = xstrdup(p);
+            break;
+        case SERIAL:                /* device[:flags] */
+        case SOCKET:                /* host:port */
+            cpy[strcspn(cpy, ":")] = '\0';
+            gd->bus = xstrdup(cpy);
+            break;
+        case SESSION:               /* named by instd */
+            break;
+    }
+    free(cpy);
+}
+
+const char *
+inst_bus(struct instrument *gd)
+{
+    assert(gd->magic == INSTRUMENT_MAGIC);
+    return gd->bus;
+}
+
+void
+inst_reset(struct instrument *gd)
+{
+    assert(gd->magic == INSTRUMENT_MAGIC);
+    if ((gd->changed & CHANGED_REOS) && gd->reos != gd->dflt_reos)
+        inst_set_reos(gd, gd->dflt_reos);
+    if ((gd->changed & CHANGED_EOS) && gd->eos != gd->dflt_eos)
+        inst_set_eos(gd, gd->dflt_eos);
+    if ((gd->changed & CHANGED_EOT) && gd->eot != gd->dflt_eot)
+        inst_set_eot(gd, gd->dflt_eot);
+    if ((gd->changed & CHANGED_TIMEOUT))
+        inst_set_timeout(gd, gd->dflt_timeout);
+    gd->changed = 0;
+}
+
+int
+inst_getattr(struct instrument *gd, const char *key, char *buf, int len)
+{
+    int n;
+
+    assert(gd->magic == INSTRUMENT_MAGIC);
+    if (gd->contype != SESSION || len < 1)
+        return -1;
+    n = _session_call(gd, SESSION_GETATTR, len - 1, (void *)key,
+                      strlen(key) + 1, buf, len - 1, NULL);
+    if (n >= 0)
+        buf[n] = '\0';
+    return n;
+}
+
+void
+inst_setattr(struct instrument *gd, const char *key, const char *val)
+{
+    int klen = strlen(key) + 1, vlen = strlen(val);
+    char *buf;
+
+    assert(gd->magic == INSTRUMENT_MAGIC);
+    if (gd->contype != SESSION)
+        return;
+    buf = xmalloc(klen + vlen);
+    memcpy(buf, key, klen);
+    memcpy(buf + klen, val, vlen);
+    _session_call(gd, SESSION_SETATTR, 0, buf, klen + vlen, NULL, 0, NULL);
+    free(buf);
+}
+
 struct instrument *
 inst_init(const char *addr, spollfun_t sf, unsigned long retry)
 {
@@ -1060,6 +1683,8 @@ inst_init(const char *addr, spollfun_t sf, unsigned long retry)
     struct stat sb;
     int board, pad, sad;
 
+    if (_init_session(addr, sf, retry, &gd) == 0)
+        return gd;
     cpy = xstrdup(addr);
     if (sscanf(addr, "%d:%d,%d", &board, &pad, &sad) == 3)
         gd = _init_gpib(board, pad, 0x60+sad, sf, retry);/* board:pad,sad */
@@ -1071,6 +1696,10 @@ inst_init(const char *addr, spollfun_t sf, unsigned long retry)
         gd = _init_gpib(0,     pad, 0,        sf, retry);/* pad */
     else if (stat(addr, &sb) == 0 && S_ISCHR(sb.st_mode))
         gd = _init_serial(addr, "9600,8n1", sf, retry);  /* device */
+    else if (!strncmp(cpy, "hislip://", 9) && (sfx = strchr(cpy + 9, '/'))) {
+        *sfx++ = '\0';
+        gd = _init_hislip(cpy + 9, sfx, sf, retry);  /* hislip://host/dev */
+    }
     else if ((sfx = strchr(cpy, ':'))) {
         *sfx++ = '\0';
         if (stat(cpy, &sb) == 0 && S_ISCHR(sb.st_mode))
@@ -1082,6 +1711,13 @@ inst_init(const char *addr, spollfun_t sf, unsigned long retry)
     } else
         fprintf(stderr, "%s: failed to determine address type\n", prog);
     free(cpy);
+    if (gd) {
+        if (!gd->bus)
+            _set_bus(gd, addr);
+        gd->dflt_reos = gd->reos;
+        gd->dflt_eos = gd->eos;
+        gd->dflt_eot = gd->eot;
+    }
     return gd;
 }
 
@@ -17,7 +17,8 @@ typedef int (*spollfun_t)(struct instrument *gd,
 struct instrument *inst_init(const char *addr, spollfun_t sf, unsigned long retry);
 void inst_fini(struct instrument *gd);
 
-/* Set the gpib timeout in seconds.
+/* Set the I/O timeout in seconds.  For serial and socket instruments
+ * it bounds each read; zero (the default for those) waits forever.
  */
 void inst_set_timeout(struct instrument *gd, double sec);
 
@@ -40,6 +41,19 @@ void inst_set_reos(struct instrument *gd, int flag);
  */
 void inst_set_eos(struct instrument *gd, int c);
 
+/* Set flag that determines whether an I/O error, reported on stderr,
+ * ends the program (the default).  If not, the call that failed returns
+ * -1 if it returns a count or value (inst_rd, inst_rdf, inst_qry*,
+ * inst_rsp), inst_rdstr returns an empty string, and inst_error ()
+ * reports it.  Returns the previous setting.
+ */
+int inst_set_errexit(struct instrument *gd, int flag);
+
+/* Return nonzero if an I/O error occurred since the last call, and
+ * clear it.
+ */
+int inst_error(struct instrument *gd);
+
 int inst_rd(struct instrument *gd, void *buf, int len);
 void inst_rdstr(struct instrument *gd, char *buf, int len);
 int inst_rdf(struct instrument *gd, char *fmt, ...);
@@ -57,7 +71,32 @@ void inst_clr(struct instrument *gd, unsigned long usec);
 void inst_trg(struct instrument *gd);
 int inst_rsp(struct instrument *gd, unsigned char *status);
 
-void inst_abort(struct instrument *gd); /* VXI only */
+/* Abort the operation in progress on a VXI-11 instrument (device_abort),
+ * or device clear a HiSLIP one (AsyncDeviceClear, then DeviceClearComplete
+ * on the sync channel, so not while another thread is using it).
+ * A no-op for other instruments.  Errors are reported but not fatal.
+ */
+void inst_abort(struct instrument *gd);
+
+/* Return the name of the bus the instrument is on, e.g. "gpib-gw:gpib0"
+ * for "gpib-gw:gpib0,5".  Instruments on the same bus cannot transfer
+ * at the same time (see sched.h).
+ */
+const char *inst_bus(struct instrument *gd);
+
+/* Undo the inst_set_* calls made since inst_init (), e.g. before handing
+ * an instrument that stays open to its next user.
+ */
+void inst_reset(struct instrument *gd);
+
+/* inst_init () gets the instrument from instd(1) if it is running, which
+ * can also keep short strings with it, e.g. a configuration that is slow
+ * to probe, for later runs until it is closed.  inst_getattr () returns
+ * the length of the value copied to 'buf', or -1 if none is kept
+ * (always without instd).
+ */
+int inst_getattr(struct instrument *gd, const char *key, char *buf, int len);
+void inst_setattr(struct instrument *gd, const char *key, const char *val);
 
 #endif /* !INST_INST_H */
 
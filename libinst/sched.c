@@ -0,0 +1,286 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* sched.c - run instrument I/O in parallel across buses */
+
+/* One mutex covers the scheduler: it is only held to move jobs between
+ * queues, never while a job runs.  Each bus has a queue sorted by
+ * priority and a worker thread that waits on the bus's condition
+ * variable for work.  The bus and priority of the job a thread is
+ * running are kept in thread local storage for inst_sched_yield ().
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+
+#include "libutil/util.h"
+
+#include "inst.h"
+#include "sched.h"
+
+#define SCHED_MAGIC 0x73636864
+
+struct bus;
+
+struct inst_job_struct {
+    struct instrument  *gd;
+    inst_jobfun_t       fun;
+    void               *arg;
+    int                 prio;
+    int                 result;
+    bool                done;
+    bool                detached;   /* nobody will wait for it */
+    inst_sched_t        sched;
+    struct inst_job_struct *next;
+};
+
+struct bus {
+    char               *name;
+    pthread_t           thread;
+    pthread_cond_t      cond;       /* signalled when a job is queued */
+    inst_job_t          queue;
+    inst_sched_t        sched;
+    struct bus         *next;
+};
+
+struct inst_sched_struct {
+    int                 magic;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;       /* signalled when a job is done */
+    struct bus         *buses;
+    int                 pending;    /* jobs queued or running */
+    bool                stop;
+};
+
+static __thread struct bus *_cur_bus = NULL;
+static __thread int _cur_prio;
+
+extern char *prog;
+
+inst_sched_t
+inst_sched_create(void)
+{
+    inst_sched_t s = xzmalloc(sizeof(struct inst_sched_struct));
+
+    s->magic = SCHED_MAGIC;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    return s;
+}
+
+/* Take the next job off the queue of 'b' and run it, with I/O errors
+ * returned rather than exiting from a worker thread.
+ * Call with the lock held; it is dropped while the job runs.
+ */
+static void
+_run_next(struct bus *b)
+{
+    inst_sched_t s = b->sched;
+    inst_job_t j = b->queue;
+    struct bus *saved_bus = _cur_bus;
+    int saved_prio = _cur_prio;
+    int errexit;
+
+    b->queue = j->next;
+    _cur_bus = b;
+    _cur_prio = j->prio;
+    pthread_mutex_unlock(&s->lock);
+    errexit = inst_set_errexit(j->gd, 0);
+    j->result = j->fun(j->gd, j->arg);
+    if (inst_error(j->gd) && j->result >= 0)
+        j->result = -1;
+    inst_set_errexit(j->gd, errexit);
+    pthread_mutex_lock(&s->lock);
+    _cur_bus = saved_bus;
+    _cur_prio = saved_prio;
+    s->pending--;
+    if (j->detached)
+        free(j);
+    else
+        j->done = true;
+    pthread_cond_broadcast(&s->cond);
+}
+
+static void *
+_worker(void *arg)
+{
+    struct bus *b = arg;
+    inst_sched_t s = b->sched;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (b->queue == NULL && !s->stop)
+            pthread_cond_wait(&b->cond, &s->lock);
+        if (b->queue == NULL)
+            break;
+        _run_next(b);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+/* Find the bus named 'name', starting a worker for it if it is new.
+ * Returns NULL if the worker could not be started.
+ * Call with the lock held.
+ */
+static struct bus *
+_bus_get(inst_sched_t s, const char *name)
+{
+    struct bus *b;
+    int err;
+
+    for (b = s->buses; b != NULL; b = b->next)
+        if (!strcmp(b->name, name))
+            return b;
+    b = xzmalloc(sizeof(struct bus));
+    b->name = xstrdup(name);
+    b->sched = s;
+    pthread_cond_init(&b->cond, NULL);
+    if ((err = pthread_create(&b->thread, NULL, _worker, b))) {
+        fprintf(stderr, "%s: %s: could not start worker: %s\n", prog, name,
+                strerror(err));
+        pthread_cond_destroy(&b->cond);
+        free(b->name);
+        free(b);
+        return NULL;
+    }
+    b->next = s->buses;
+    s->buses = b;
+    return b;
+}
+
+void
+inst_sched_submit(inst_sched_t s, struct instrument *gd, int prio,
+                  inst_jobfun_t fun, void *arg, inst_job_t *jobp)
+{
+    inst_job_t j = xzmalloc(sizeof(struct inst_job_struct)), *jp;
+    struct bus *b;
+
+    assert(s->magic == SCHED_MAGIC);
+    j->gd = gd;
+    j->fun = fun;
+    j->arg = arg;
+    j->prio = prio;
+    j->sched = s;
+    j->detached = (jobp == NULL);
+    pthread_mutex_lock(&s->lock);
+    if (!(b = _bus_get(s, inst_bus(gd)))) {
+        j->result = -1;             /* failed without running */
+        if (j->detached)
+            free(j);
+        else
+            j->done = true;
+        pthread_mutex_unlock(&s->lock);
+        if (jobp)
+            *jobp = j;
+        return;
+    }
+    for (jp = &b->queue; *jp != NULL; jp = &(*jp)->next)
+        if ((*jp)->prio < prio)
+            break;
+    j->next = *jp;
+    *jp = j;
+    s->pending++;
+    pthread_cond_signal(&b->cond);
+    pthread_mutex_unlock(&s->lock);
+    if (jobp)
+        *jobp = j;
+}
+
+int
+inst_job_wait(inst_job_t j)
+{
+    inst_sched_t s = j->sched;
+    int result;
+
+    assert(s->magic == SCHED_MAGIC);
+    pthread_mutex_lock(&s->lock);
+    while (!j->done)
+        pthread_cond_wait(&s->cond, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    result = j->result;
+    free(j);
+    return result;
+}
+
+void
+inst_sched_wait(inst_sched_t s)
+{
+    assert(s->magic == SCHED_MAGIC);
+    pthread_mutex_lock(&s->lock);
+    while (s->pending > 0)
+        pthread_cond_wait(&s->cond, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+int
+inst_sched_yield(void)
+{
+    struct bus *b = _cur_bus;
+    int n = 0;
+
+    if (b == NULL)
+        return 0;
+    pthread_mutex_lock(&b->sched->lock);
+    while (b->queue != NULL && b->queue->prio > _cur_prio) {
+        _run_next(b);
+        n++;
+    }
+    pthread_mutex_unlock(&b->sched->lock);
+    return n;
+}
+
+void
+inst_sched_destroy(inst_sched_t s)
+{
+    struct bus *b, *next;
+
+    assert(s->magic == SCHED_MAGIC);
+    pthread_mutex_lock(&s->lock);
+    s->stop = true;
+    for (b = s->buses; b != NULL; b = b->next)
+        pthread_cond_signal(&b->cond);
+    pthread_mutex_unlock(&s->lock);
+    for (b = s->buses; b != NULL; b = next) {
+        next = b->next;
+        pthread_join(b->thread, NULL);
+        pthread_cond_destroy(&b->cond);
+        free(b->name);
+        free(b);
+    }
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+    s->magic = 0;
+    free(s);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,74 @@
+#ifndef _INST_SCHED_H
+#define _INST_SCHED_H 1
+
+/* Run instrument I/O for several instruments at once, one bus at a time.
+ *
+ * A job is a function that does some I/O on one instrument.  Jobs for
+ * instruments on the same bus (see inst_bus ()) run one after another,
+ * highest priority first and in the order submitted within a priority,
+ * while jobs on different buses run in parallel.  Each bus has a worker
+ * thread of its own, started with its first job, so a sequence over
+ * many instruments takes as long as its busiest bus.  (Each bus on a
+ * VXI-11 gateway has a core connection of its own, see
+ * vxi11_set_conngroup (), so buses do not wait for each other's RPCs.)
+ *
+ * Jobs run with inst_set_errexit (gd, 0), so an I/O error does not end
+ * the program from a worker thread but is returned by the libinst call
+ * that failed, for the job to handle.  A job that returns with the error
+ * not cleared by inst_error () returns -1 to inst_job_wait ().
+ *
+ * A running job is never interrupted, since a GPIB transfer cannot be.
+ * A long job, such as a bulk readback in chunks, should call
+ * inst_sched_yield () between chunks to let urgent jobs on its bus go
+ * first.
+ *
+ * While jobs for an instrument are queued, use it only from jobs.
+ */
+
+#include "inst.h"
+
+typedef struct inst_sched_struct *inst_sched_t;
+typedef struct inst_job_struct *inst_job_t;
+
+typedef int (*inst_jobfun_t)(struct instrument *gd, void *arg);
+
+#define INST_PRIO_BULK      0       /* e.g. trace or buffer readback */
+#define INST_PRIO_NORMAL    10
+#define INST_PRIO_URGENT    20      /* e.g. control, interlock, abort */
+
+inst_sched_t inst_sched_create(void);
+
+/* Wait for every queued job to finish, then stop the workers.
+ * Jobs not yet waited for with inst_job_wait () may no longer be.
+ */
+void inst_sched_destroy(inst_sched_t s);
+
+/* Queue 'fun(gd, arg)' at priority 'prio'.  If 'jobp' is not NULL, a
+ * handle for inst_job_wait () is returned in it, else the job is
+ * forgotten when done.  If no worker can be started for the bus of 'gd',
+ * the job fails at once without running, with result -1.
+ */
+void inst_sched_submit(inst_sched_t s, struct instrument *gd, int prio,
+                       inst_jobfun_t fun, void *arg, inst_job_t *jobp);
+
+/* Wait for a job to finish and return what its function returned.
+ * The handle is freed.  Do not wait from a job for a job on its own bus.
+ */
+int inst_job_wait(inst_job_t job);
+
+/* Wait for every queued job to finish.
+ */
+void inst_sched_wait(inst_sched_t s);
+
+/* From within a job, run any jobs of higher priority waiting for its bus
+ * before returning.  Call only where the bus is free for another
+ * instrument, e.g. not between a query and reading its response.
+ * Returns the number of jobs run.  Outside a job, does nothing.
+ */
+int inst_sched_yield(void);
+
+#endif /* !_INST_SCHED_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
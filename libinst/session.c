@@ -0,0 +1,207 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* session.c - message framing for the instd(1) protocol */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE         /* struct ucred */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libutil/util.h"
+
+#include "session.h"
+
+#define SESSION_MAXFDS  2
+
+char *
+session_path(void)
+{
+    char *p;
+
+    if (!(p = getenv("GPIB_UTILS_SESSION")) || *p == '\0'
+                                            || !strcmp(p, "none"))
+        return NULL;
+    return xstrdup(p);
+}
+
+char *
+session_runtime_path(const char *name)
+{
+    struct stat sb;
+    char *p, buf[256];
+
+    if (!(p = getenv("XDG_RUNTIME_DIR")) || *p != '/')
+        return NULL;
+    if (stat(p, &sb) < 0 || !S_ISDIR(sb.st_mode) || sb.st_uid != getuid()
+                        || (sb.st_mode & 077))
+        return NULL;
+    if (snprintf(buf, sizeof(buf), "%s/%s", p, name) >= sizeof(buf))
+        return NULL;
+    return xstrdup(buf);
+}
+
+int
+session_peer_ok(int fd)
+{
+#ifdef SO_PEERCRED
+    struct ucred cr;
+    socklen_t len = sizeof(cr);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &len) < 0)
+        return 0;
+    return cr.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+
+    if (getpeereid(fd, &uid, &gid) < 0)
+        return 0;
+    return uid == getuid();
+#endif
+}
+
+/* Like write_all (), but a closed peer is an error, not SIGPIPE.
+ */
+static int
+_send_all(int fd, const char *buf, int count)
+{
+    int n, done = 0;
+
+    while (done < count) {
+        if ((n = send(fd, buf + done, count - done, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+int
+session_send(int fd, struct session_hdr *h, const void *buf,
+             int *fds, int nfds)
+{
+    union {
+        struct cmsghdr  cm;
+        char            space[CMSG_SPACE(sizeof(int) * SESSION_MAXFDS)];
+    } ctl;
+    struct iovec iov[2];
+    struct msghdr msg;
+    int n, len = sizeof(*h) + h->len;
+
+    iov[0].iov_base = h;
+    iov[0].iov_len = sizeof(*h);
+    iov[1].iov_base = (void *)buf;
+    iov[1].iov_len = h->len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = h->len > 0 ? 2 : 1;
+    if (nfds > 0) {
+        memset(&ctl, 0, sizeof(ctl));
+        msg.msg_control = ctl.space;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        ctl.cm.cmsg_level = SOL_SOCKET;
+        ctl.cm.cmsg_type = SCM_RIGHTS;
+        ctl.cm.cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(&ctl.cm), fds, sizeof(int) * nfds);
+    }
+    while ((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+    if (n < 0)
+        return -1;
+    if (n < sizeof(*h)) {
+        if (_send_all(fd, (char *)h + n, sizeof(*h) - n) < 0)
+            return -1;
+        n = sizeof(*h);
+    }
+    if (n < len && _send_all(fd, (char *)buf + n - sizeof(*h), len - n) < 0)
+        return -1;
+    return 0;
+}
+
+int
+session_recv(int fd, struct session_hdr *h, int *fds, int nfds)
+{
+    union {
+        struct cmsghdr  cm;
+        char            space[CMSG_SPACE(sizeof(int) * SESSION_MAXFDS)];
+    } ctl;
+    struct cmsghdr *cm;
+    struct iovec iov;
+    struct msghdr msg;
+    int i, n, got = 0;
+
+    for (i = 0; i < nfds; i++)
+        fds[i] = -1;
+    iov.iov_base = h;
+    iov.iov_len = sizeof(*h);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.space;
+    msg.msg_controllen = sizeof(ctl.space);
+    while ((n = recvmsg(fd, &msg, 0)) < 0 && errno == EINTR)
+        ;
+    if (n <= 0)
+        return n;
+    for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+            continue;
+        for (i = 0; i < (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++) {
+            int f;
+
+            memcpy(&f, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+            if (got < nfds)
+                fds[got++] = f;
+            else
+                close(f);
+        }
+    }
+    if (n < sizeof(*h)) {
+        if (read_all(fd, (char *)h + n, sizeof(*h) - n) < sizeof(*h) - n) {
+            errno = EPROTO;
+            goto err;
+        }
+    }
+    if (h->len > SESSION_MAXDATA) {
+        errno = EPROTO;
+        goto err;
+    }
+    return 1;
+err:
+    for (i = 0; i < got; i++) {
+        close(fds[i]);
+        fds[i] = -1;
+    }
+    return -1;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,73 @@
+#ifndef _INST_SESSION_H
+#define _INST_SESSION_H 1
+
+/* Protocol between libinst and instd(1), which keeps instruments open
+ * between runs of the tools.
+ *
+ * A client connects to the unix socket at session_path (), checks that
+ * instd runs as its user (as instd checks the client), sends SESSION_OPEN
+ * with its stderr attached, and from then on has the instrument to
+ * itself until it disconnects.  Each request is a header
+ * followed by 'len' bytes of payload and gets exactly one reply in the
+ * same form, with the result in 'op'.  Integers are in host byte order.
+ */
+
+#include <stdint.h>
+
+struct session_hdr {
+    int32_t     op;         /* SESSION_* in a request, result in a reply */
+    uint32_t    arg;
+    uint32_t    len;        /* bytes of payload that follow */
+};
+
+#define SESSION_MAXDATA     (16*1024*1024)
+
+enum {                      /* request: arg, payload -> reply: arg, payload */
+    SESSION_OPEN = 1,       /* -, "prog\0addr\0" -> -, bus (result -1: failed) */
+    SESSION_WRITE,          /* -, data -> - */
+    SESSION_READ,           /* max len, - -> -, data (result: count) */
+    SESSION_RSP,            /* - -> status byte (result: more) */
+    SESSION_CLR,
+    SESSION_LOC,
+    SESSION_TRG,
+    SESSION_TIMEOUT,        /* usec */
+    SESSION_REOS,           /* flag */
+    SESSION_EOS,            /* char */
+    SESSION_EOT,            /* flag */
+    SESSION_GETATTR,        /* -, "key\0" -> -, value (result -1: none) */
+    SESSION_SETATTR,        /* -, "key\0value" -> - */
+};
+
+/* Return the socket path from GPIB_UTILS_SESSION (caller frees), or NULL
+ * if it is unset or "none": the tools use instd only when asked to.
+ */
+char *session_path(void);
+
+/* Return "$XDG_RUNTIME_DIR/name" (caller frees), or NULL unless that
+ * directory is ours and closed to others, so no one else can have put
+ * a socket there.
+ */
+char *session_runtime_path(const char *name);
+
+/* Return nonzero if the process at the other end of unix socket 'fd'
+ * runs as our user.
+ */
+int session_peer_ok(int fd);
+
+/* Send a message with 'h->len' bytes of payload from 'buf', and 'nfds'
+ * file descriptors.  Returns 0 on success, -1 on error (errno set).
+ */
+int session_send(int fd, struct session_hdr *h, const void *buf,
+                 int *fds, int nfds);
+
+/* Receive a message header, and up to 'nfds' file descriptors (the rest
+ * of 'fds' is set to -1).  The payload is left for the caller to read.
+ * Returns 1 on success, 0 on EOF, -1 on error (errno set).
+ */
+int session_recv(int fd, struct session_hdr *h, int *fds, int nfds);
+
+#endif /* !_INST_SESSION_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,211 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* portcache.c - persistent cache of VXI-11 bootstrap parameters
+ *
+ * Opening a VXI-11 core channel normally costs a portmapper query on
+ * port 111 (a TCP connect plus a round trip) before the core channel
+ * itself can be connected.  Short lived programs pay this every time.
+ * Here we remember the core port per instrument ("host:device") in a
+ * small text file so the next invocation can connect directly.
+ * The cache is only a hint: callers must fall back to the portmapper
+ * and invalidate the entry if a cached port fails to work.
+ *
+ * The cache is off unless $VXI11_PORTCACHE names the file to keep it in
+ * ("none" or empty also leaves it off).
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <time.h>
+#include <string.h>
+
+#include "portcache.h"
+
+#define PORTCACHE_MAXAGE    (24*60*60)  /* seconds before entry is ignored */
+
+struct portcache_line {
+    char name[MAXHOSTNAMELEN];
+    struct portcache_entry e;
+};
+
+static char *
+_cache_path(char *buf, int len)
+{
+    char *env = getenv("VXI11_PORTCACHE");
+
+    if (!env || *env == '\0' || !strcmp(env, "none"))
+        return NULL;
+    snprintf(buf, len, "%s", env);
+    return buf;
+}
+
+int
+portcache_enabled(void)
+{
+    char path[MAXPATHLEN];
+
+    return _cache_path(path, sizeof(path)) ? 1 : 0;
+}
+
+/* Read the whole cache file into a malloc'ed array.
+ * Returns the number of entries, or -1 if the cache is disabled.
+ */
+static int
+_read_cache(char *path, struct portcache_line **linesp)
+{
+    struct portcache_line *lines = NULL, *new, l;
+    char buf[MAXHOSTNAMELEN + 80];
+    long mtime;
+    int n = 0;
+    FILE *f;
+
+    if ((f = fopen(path, "r"))) {
+        while (fgets(buf, sizeof(buf), f)) {
+            if (buf[0] == '#')
+                continue;
+            if (sscanf(buf, "%63s %hu %ld", l.name, &l.e.core_port,
+                       &mtime) != 3)
+                continue;
+            l.e.mtime = mtime;
+            if (!(new = realloc(lines, (n + 1) * sizeof(*lines))))
+                break;
+            lines = new;
+            lines[n++] = l;
+        }
+        fclose(f);
+    }
+    *linesp = lines;
+    return n;
+}
+
+/* Atomically replace the cache file (write temp file, then rename).
+ */
+static void
+_write_cache(char *path, struct portcache_line *lines, int n)
+{
+    char tmp[MAXPATHLEN + 8];
+    FILE *f;
+    int fd, i;
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    if ((fd = mkstemp(tmp)) < 0)
+        return;
+    if (!(f = fdopen(fd, "w"))) {
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    fprintf(f, "# host:device core_port mtime\n");
+    for (i = 0; i < n; i++)
+        fprintf(f, "%s %hu %ld\n", lines[i].name, lines[i].e.core_port,
+                (long)lines[i].e.mtime);
+    if (fclose(f) != 0 || rename(tmp, path) < 0)
+        unlink(tmp);
+}
+
+static int
+_find(struct portcache_line *lines, int n, char *name)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (!strcmp(lines[i].name, name))
+            return i;
+    return -1;
+}
+
+int
+portcache_lookup(char *name, struct portcache_entry *ep)
+{
+    struct portcache_line *lines;
+    char path[MAXPATHLEN];
+    int n, i, res = -1;
+
+    if (!_cache_path(path, sizeof(path)))
+        return -1;
+    n = _read_cache(path, &lines);
+    if ((i = _find(lines, n, name)) != -1
+            && lines[i].e.core_port != 0
+            && time(NULL) - lines[i].e.mtime < PORTCACHE_MAXAGE) {
+        *ep = lines[i].e;
+        res = 0;
+    }
+    free(lines);
+    return res;
+}
+
+void
+portcache_update(char *name, struct portcache_entry *ep)
+{
+    struct portcache_line *lines, *new;
+    char path[MAXPATHLEN];
+    time_t now = time(NULL);
+    int n, i;
+
+    if (strlen(name) >= MAXHOSTNAMELEN || strchr(name, ' ')
+                                       || strchr(name, '\n'))
+        return;
+    if (!_cache_path(path, sizeof(path)))
+        return;
+    n = _read_cache(path, &lines);
+    if ((i = _find(lines, n, name)) != -1) {
+        if (lines[i].e.core_port == ep->core_port
+                && now - lines[i].e.mtime < PORTCACHE_MAXAGE / 2)
+            goto done; /* unchanged and fresh - avoid rewriting the file */
+    } else {
+        if (!(new = realloc(lines, (n + 1) * sizeof(*lines))))
+            goto done;
+        lines = new;
+        i = n++;
+        snprintf(lines[i].name, sizeof(lines[i].name), "%s", name);
+    }
+    lines[i].e = *ep;
+    lines[i].e.mtime = now;
+    _write_cache(path, lines, n);
+done:
+    free(lines);
+}
+
+void
+portcache_invalidate(char *name)
+{
+    struct portcache_line *lines;
+    char path[MAXPATHLEN];
+    int n, i;
+
+    if (!_cache_path(path, sizeof(path)))
+        return;
+    n = _read_cache(path, &lines);
+    if ((i = _find(lines, n, name)) != -1) {
+        memmove(&lines[i], &lines[i + 1], (n - i - 1) * sizeof(*lines));
+        _write_cache(path, lines, n - 1);
+    }
+    free(lines);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
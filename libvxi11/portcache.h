@@ -0,0 +1,32 @@
+/* portcache.c - persistent cache of VXI-11 bootstrap parameters */
+
+struct portcache_entry {
+    unsigned short  core_port;      /* DEVICE_CORE tcp port (from portmap) */
+    time_t          mtime;          /* time entry was last validated */
+};
+
+/* Entries are keyed by instrument name, "host:device", since servers
+ * on one host may listen on different ports for different devices.
+ */
+
+/* Return 1 if the cache is enabled ($VXI11_PORTCACHE names a file), else 0.
+ */
+int           portcache_enabled(void);
+
+/* Look up 'name' in the on-disk cache.  Returns 0 and fills in 'ep'
+ * if a fresh entry exists, else -1.
+ */
+int           portcache_lookup(char *name, struct portcache_entry *ep);
+
+/* Add or replace the entry for 'name'.  The file is only rewritten if
+ * the entry has changed or is getting stale.  Errors are ignored.
+ */
+void          portcache_update(char *name, struct portcache_entry *ep);
+
+/* Remove the entry for 'name', e.g. after a cached port failed to connect.
+ */
+void          portcache_invalidate(char *name);
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
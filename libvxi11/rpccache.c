@@ -19,6 +19,24 @@
 
 /* rpccache.c - cache RPC connections for reuse */
 
+/* By default there is one connection per (host, port, prog, vers, proto),
+ * shared by every user.  Callers may instead allow a small pool of up
+ * to 'maxconn' connections for a key: each open creates a new connection
+ * until the pool is full, after which the least used one is shared.
+ * A caller may also name a 'group', which is part of the key, so that
+ * e.g. links to different buses behind one gateway never share.
+ *
+ * The cache list is protected by 'cache_lock', which is not held while
+ * connecting.  Each entry also has a 'call_lock' that callers take
+ * around an RPC with clnt_lock_cached (), so that threads sharing a
+ * connection do not interleave their calls on it.
+ *
+ * A connection that failed at the transport level is evicted with
+ * clnt_evict_cached (): it is no longer handed out or counted against
+ * 'maxconn', so the next open connects afresh, and it is destroyed when
+ * its last user closes it.
+ */
+
 #if HAVE_CONFIG_H
 #include <config.h>
 #endif
@@ -30,6 +48,7 @@
 #include <sys/param.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #define PORTMAP /* needed for clnttcp_create() proto on solaris 11 */
@@ -39,10 +58,10 @@
 #include <ctype.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <pthread.h>
 
 #include "rpccache.h"
-
-static int rpccache_debug = 0;
+#include "vxi11_trace.h"
 
 #define CLNT_CACHE_MAGIC 0x346abefa
 struct clnt_cache_struct {
@@ -52,6 +71,8 @@ struct clnt_cache_struct {
         struct clnt_create_parms {
             char host[MAXHOSTNAMELEN];
             char proto[MAXHOSTNAMELEN];
+            char group[MAXHOSTNAMELEN];
+            unsigned short port;    /* 0 = from the portmapper */
             u_long prog;
             u_long vers;
         } c;
@@ -66,49 +87,144 @@ struct clnt_cache_struct {
     } u;
     CLIENT *clnt;
     int usecount;
+    int dead;                   /* evicted - see clnt_evict_cached () */
+    pthread_mutex_t call_lock;
     struct clnt_cache_struct *next;
 };
 static struct clnt_cache_struct *clnt_cache = NULL;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
-CLIENT *
-clnt_create_cached(char *host, u_long prog, u_long vers, char *proto)
+/* Return the least used cached connection for the key if the pool
+ * already holds 'maxconn' of them, else NULL (caller should connect).
+ * Call with 'cache_lock' held.
+ */
+static CLIENT *
+_find_clnt_create(char *host, unsigned short port, u_long prog, u_long vers,
+                  char *proto, const char *group, int maxconn, int *countp)
 {
-    CLIENT *clnt;
-    struct clnt_cache_struct *cp, *new;
+    struct clnt_cache_struct *cp, *best = NULL;
+    int n = 0;
 
     for (cp = clnt_cache; cp != NULL; cp = cp->next) {
         assert(cp->magic == CLNT_CACHE_MAGIC);
-        if (cp->type == CLNT_CREATE
+        if (cp->type == CLNT_CREATE && !cp->dead
                 && !strcmp(cp->u.c.host, host) 
                 && !strcmp(cp->u.c.proto, proto) 
+                && !strcmp(cp->u.c.group, group ? group : "")
+                && cp->u.c.port == port
                 && cp->u.c.prog == prog && cp->u.c.vers == vers) {
-            cp->usecount++;
-            if (rpccache_debug)
-                fprintf(stderr, "DBG clnt_create_cached = %p (count=%d)\n", 
-                        cp->clnt, cp->usecount);
-            return cp->clnt;
+            if (!best || cp->usecount < best->usecount)
+                best = cp;
+            n++;
         }
     }
-    if ((clnt = clnt_create(host, prog, vers, proto))) {
-        if ((new = malloc(sizeof(struct clnt_cache_struct)))) {
-            new->magic = CLNT_CACHE_MAGIC;
-            new->type = CLNT_CREATE;
-            strncpy(new->u.c.host, host, MAXHOSTNAMELEN);
-            new->u.c.host[MAXHOSTNAMELEN - 1] = '\0';
-            strncpy(new->u.c.proto, proto, MAXHOSTNAMELEN);
-            new->u.c.proto[MAXHOSTNAMELEN - 1] = '\0';
-            new->u.c.prog = prog;
-            new->u.c.vers = vers;
-            new->clnt = clnt;
-            new->usecount = 1;
-            new->next = clnt_cache;
-            clnt_cache = new;
-            if (rpccache_debug)
-                fprintf(stderr, "DBG clnt_create_cached = %p (new)\n", clnt);
-        }
+    if (!best || n < maxconn)
+        return NULL;
+    *countp = ++best->usecount;
+    return best->clnt;
+}
+
+static void
+_add_clnt_create(CLIENT *clnt, char *host, unsigned short port, u_long prog,
+                 u_long vers, char *proto, const char *group)
+{
+    struct clnt_cache_struct *new;
+
+    if ((new = malloc(sizeof(struct clnt_cache_struct)))) {
+        new->magic = CLNT_CACHE_MAGIC;
+        new->type = CLNT_CREATE;
+        strncpy(new->u.c.host, host, MAXHOSTNAMELEN);
+        new->u.c.host[MAXHOSTNAMELEN - 1] = '\0';
+        strncpy(new->u.c.proto, proto, MAXHOSTNAMELEN);
+        new->u.c.proto[MAXHOSTNAMELEN - 1] = '\0';
+        snprintf(new->u.c.group, MAXHOSTNAMELEN, "%s", group ? group : "");
+        new->u.c.port = port;
+        new->u.c.prog = prog;
+        new->u.c.vers = vers;
+        new->clnt = clnt;
+        new->usecount = 1;
+        new->dead = 0;
+        pthread_mutex_init(&new->call_lock, NULL);
+        pthread_mutex_lock(&cache_lock);
+        new->next = clnt_cache;
+        clnt_cache = new;
+        pthread_mutex_unlock(&cache_lock);
+    }
+}
+
+CLIENT *
+clnt_create_cached(char *host, u_long prog, u_long vers, char *proto,
+                   const char *group, int maxconn)
+{
+    struct timespec t0;
+    CLIENT *clnt;
+    int count = 1;
+
+    vxi11_trace_begin(&t0);
+    pthread_mutex_lock(&cache_lock);
+    clnt = _find_clnt_create(host, 0, prog, vers, proto, group, maxconn,
+                             &count);
+    pthread_mutex_unlock(&cache_lock);
+    if (!clnt && (clnt = clnt_create(host, prog, vers, proto)))
+        _add_clnt_create(clnt, host, 0, prog, vers, proto, group);
+    vxi11_trace_end(&t0, VXI11_TR_CLNT_CREATE, 0, 0, 0, 0, 0, count,
+                    clnt ? 0 : -1);
+    return clnt;
+}
+
+/* Like clnt_create_cached(host, prog, vers, "tcp") but connect directly
+ * to 'port' instead of asking the portmapper.  The port is part of the
+ * key, so servers on different ports of one host never share a
+ * connection.  We create and
+ * connect the socket ourselves so TCP_NODELAY is in effect from the
+ * first RPC; clnttcp_create() then adopts the connected descriptor.
+ */
+CLIENT *
+clnt_create_port_cached(char *host, unsigned short port, u_long prog,
+                        u_long vers, const char *group, int maxconn)
+{
+    struct addrinfo hints, *res;
+    struct sockaddr_in sin;
+    struct timespec t0;
+    int sock = -1, one = 1, count = 1;
+    CLIENT *clnt = NULL;
+
+    vxi11_trace_begin(&t0);
+    pthread_mutex_lock(&cache_lock);
+    clnt = _find_clnt_create(host, port, prog, vers, "tcp", group, maxconn,
+                             &count);
+    pthread_mutex_unlock(&cache_lock);
+    if (clnt)
+        goto done;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+        rpc_createerr.cf_stat = RPC_UNKNOWNHOST;
+        goto done;
+    }
+    memcpy(&sin, res->ai_addr, sizeof(sin));
+    freeaddrinfo(res);
+    sin.sin_port = htons(port);
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        goto syserr;
+    (void)setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+        goto syserr;
+    if ((clnt = clnttcp_create(&sin, prog, vers, &sock, 0, 0))) {
+        clnt_control(clnt, CLSET_FD_CLOSE, NULL);
+        _add_clnt_create(clnt, host, port, prog, vers, "tcp", group);
     } else
-        if (rpccache_debug)
-            fprintf(stderr, "DBG clnt_create_cached = NULL\n");
+        close(sock);
+    goto done;
+syserr:
+    rpc_createerr.cf_stat = RPC_SYSTEMERROR;
+    rpc_createerr.cf_error.re_errno = errno;
+    if (sock >= 0)
+        close(sock);
+done:
+    vxi11_trace_end(&t0, VXI11_TR_CLNT_CREATE, 0, 0, port, 0, 0, count,
+                    clnt ? 0 : -1);
     return clnt;
 }
 
@@ -118,24 +234,29 @@ clnttcp_create_cached(struct sockaddr_in *addr, u_long prog, u_long vers,
 {
     CLIENT *clnt;
     struct clnt_cache_struct *cp, *new;
+    struct timespec t0;
     int savesock = *sockp;
+    int count;
 
+    vxi11_trace_begin(&t0);
+    pthread_mutex_lock(&cache_lock);
     for (cp = clnt_cache; cp != NULL; cp = cp->next) {
         assert(cp->magic == CLNT_CACHE_MAGIC);
-        if (cp->type == CLNTTCP_CREATE
+        if (cp->type == CLNTTCP_CREATE && !cp->dead
                 && cp->u.t.addr.sin_port        == addr->sin_port
                 && cp->u.t.addr.sin_addr.s_addr == addr->sin_addr.s_addr
                 && cp->u.t.sock == savesock
                 && cp->u.t.sendsz == sendsz && cp->u.t.recvsz == recvsz
                 && cp->u.t.prog == prog && cp->u.t.vers == vers) {
-            cp->usecount++;
-            if (rpccache_debug)
-                fprintf(stderr, "DBG clnttcp_create_cached (addr=%s:%d, ...) "
-                        " = %p (count=%d)\n", inet_ntoa(addr->sin_addr), 
-                        ntohs(addr->sin_port), cp->clnt, cp->usecount);
-            return cp->clnt;
+            clnt = cp->clnt;
+            count = ++cp->usecount;
+            pthread_mutex_unlock(&cache_lock);
+            vxi11_trace_end(&t0, VXI11_TR_CLNT_CREATE, 0, 0,
+                            ntohs(addr->sin_port), 0, 0, count, 0);
+            return clnt;
         }
     }
+    pthread_mutex_unlock(&cache_lock);
     if ((clnt = clnttcp_create(addr, prog, vers, sockp, sendsz, recvsz))) {
         if ((new = malloc(sizeof(struct clnt_cache_struct)))) {
             new->magic = CLNT_CACHE_MAGIC;
@@ -149,17 +270,16 @@ clnttcp_create_cached(struct sockaddr_in *addr, u_long prog, u_long vers,
             new->u.t.vers = vers;
             new->clnt = clnt;
             new->usecount = 1;
+            new->dead = 0;
+            pthread_mutex_init(&new->call_lock, NULL);
+            pthread_mutex_lock(&cache_lock);
             new->next = clnt_cache;
             clnt_cache = new;
-            if (rpccache_debug)
-                fprintf(stderr, "DBG clnttcp_create_cached (addr %s:%d, ...) "
-                        "= %p (new)\n", inet_ntoa(addr->sin_addr), 
-                        htons(addr->sin_port), clnt);
+            pthread_mutex_unlock(&cache_lock);
         }
-    } else
-        if (rpccache_debug)
-            fprintf(stderr, "DBG clnttcp_create_cached (addr %s:%d, ...) = "
-                    "NULL\n", inet_ntoa(addr->sin_addr), htons(addr->sin_port));
+    }
+    vxi11_trace_end(&t0, VXI11_TR_CLNT_CREATE, 0, 0, ntohs(addr->sin_port),
+                    0, 0, 1, clnt ? 0 : -1);
     return clnt;
 }
 
@@ -167,38 +287,88 @@ void
 clnt_destroy_cached(CLIENT *clnt)
 {
     struct clnt_cache_struct *cp, *prev = NULL;
+    struct timespec t0;
+    int count;
 
+    vxi11_trace_begin(&t0);
+    pthread_mutex_lock(&cache_lock);
     for (cp = clnt_cache; cp != NULL; cp = cp->next) {
         assert(cp->magic == CLNT_CACHE_MAGIC);
         if (cp->clnt == clnt) {
-                if (--cp->usecount == 0) {
-                    if (rpccache_debug)
-                        printf("DBG clnt_destroy_cached (%p) (last use)\n", 
-                                clnt);
-                    clnt_destroy(clnt);
+                if ((count = --cp->usecount) == 0) {
                     if (prev == NULL)
                         clnt_cache = cp->next;
                     else
                         prev->next = cp->next;
+                }
+                pthread_mutex_unlock(&cache_lock);
+                vxi11_trace_end(&t0, VXI11_TR_CLNT_DESTROY, 0, 0, 0, 0, 0,
+                                count, 0);
+                if (count == 0) {
+                    clnt_destroy(clnt);
+                    pthread_mutex_destroy(&cp->call_lock);
                     memset(cp, 0, sizeof(struct clnt_cache_struct));
                     free(cp);
-                } else
-                    if (rpccache_debug)
-                        printf("DBG clnt_destroy_cached (%p) (count=%d)\n", 
-                                cp->clnt, cp->usecount);
+                }
                 return;
         }
         prev = cp;
     }
-    if (rpccache_debug)
-        fprintf(stderr, "DBG clnt_destroy_cached (%p) (uncached)\n", clnt);
+    pthread_mutex_unlock(&cache_lock);
     clnt_destroy(clnt); /* non-cached */
+    vxi11_trace_end(&t0, VXI11_TR_CLNT_DESTROY, 0, 0, 0, 0, 0, 0, -1);
+}
+
+void
+clnt_evict_cached(CLIENT *clnt)
+{
+    struct clnt_cache_struct *cp;
+
+    pthread_mutex_lock(&cache_lock);
+    for (cp = clnt_cache; cp != NULL; cp = cp->next) {
+        assert(cp->magic == CLNT_CACHE_MAGIC);
+        if (cp->clnt == clnt) {
+            cp->dead = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static struct clnt_cache_struct *
+_find_clnt(CLIENT *clnt)
+{
+    struct clnt_cache_struct *cp;
+
+    pthread_mutex_lock(&cache_lock);
+    for (cp = clnt_cache; cp != NULL; cp = cp->next) {
+        assert(cp->magic == CLNT_CACHE_MAGIC);
+        if (cp->clnt == clnt)
+            break;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return cp;
 }
 
+/* The caller holds a reference on 'clnt', so its entry cannot be freed
+ * between _find_clnt () and taking or dropping the call lock.
+ */
 void
-set_rpccache_debug(int doDebug)
+clnt_lock_cached(CLIENT *clnt)
 {
-    rpccache_debug = doDebug;
+    struct clnt_cache_struct *cp = _find_clnt(clnt);
+
+    if (cp)
+        pthread_mutex_lock(&cp->call_lock);
+}
+
+void
+clnt_unlock_cached(CLIENT *clnt)
+{
+    struct clnt_cache_struct *cp = _find_clnt(clnt);
+
+    if (cp)
+        pthread_mutex_unlock(&cp->call_lock);
 }
 
 /*
@@ -1,7 +1,19 @@
 /* rpccache.c - cache RPC connections for reuse */
 
+/* The cache is thread safe.
+ */
+
+/* 'maxconn' is the number of connections the key may be spread over
+ * (1 = a single shared connection).  Connections are only shared by
+ * callers passing the same 'group' (NULL is the same as "").
+ */
 CLIENT *      clnt_create_cached(char *host, u_long prog, u_long vers, 
-                                 char *proto);
+                                 char *proto, const char *group,
+                                 int maxconn);
+
+CLIENT *      clnt_create_port_cached(char *host, unsigned short port,
+                                      u_long prog, u_long vers,
+                                      const char *group, int maxconn);
 
 CLIENT *      clnttcp_create_cached(struct sockaddr_in *addr, u_long prog, 
                                     u_long vers, int *sockp, u_int sendsz, 
@@ -9,7 +21,16 @@ CLIENT *      clnttcp_create_cached(struct sockaddr_in *addr, u_long prog,
 
 void          clnt_destroy_cached(CLIENT *clnt);
 
-void          set_rpccache_debug(int doDebug);
+/* Stop handing out a connection that has failed (it is destroyed when
+ * its last user calls clnt_destroy_cached ()).
+ */
+void          clnt_evict_cached(CLIENT *clnt);
+
+/* Serialize calls on a (possibly shared) cached connection.
+ * These are no-ops for a connection that is not cached.
+ */
+void          clnt_lock_cached(CLIENT *clnt);
+void          clnt_unlock_cached(CLIENT *clnt);
 
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
@@ -33,9 +33,11 @@
 typedef enum { false=0, true=1 } bool;
 #endif
 #include <unistd.h>
+#include <sys/time.h>
 #include <stdarg.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <rpc/rpc.h>
@@ -47,44 +49,77 @@ typedef enum { false=0, true=1 } bool;
 #include "vxi11.h"
 #include "vxi11_core.h"
 #include "rpccache.h"
+#include "vxi11_trace.h"
 
-static bool vxi11_core_debug = false;
+/* Room for RPC call header and record mark around a device_write payload */
+#define VXI11_RPC_OVERHEAD  128
 
 int
 vxi11_open_core_channel(char *host, CLIENT **corep)
 {
+    return vxi11_open_core_channel_pool(host, 0, NULL, 1, corep);
+}
+
+int
+vxi11_open_core_channel_port(char *host, unsigned short port, CLIENT **corep)
+{
+    return vxi11_open_core_channel_pool(host, port, NULL, 1, corep);
+}
+
+int
+vxi11_open_core_channel_pool(char *host, unsigned short port,
+                             const char *group, int maxconn, CLIENT **corep)
+{
+    struct timespec t0;
     CLIENT *core;
     int res = VXI11_CORE_CREATE;
 
-    core = clnt_create_cached(host, DEVICE_CORE, DEVICE_CORE_VERSION, "tcp");
+    vxi11_trace_begin(&t0);
+    if (port == 0)
+        core = clnt_create_cached(host, DEVICE_CORE, DEVICE_CORE_VERSION,
+                                  "tcp", group, maxconn);
+    else
+        core = clnt_create_port_cached(host, port, DEVICE_CORE,
+                                       DEVICE_CORE_VERSION, group, maxconn);
     if (core) {
         if (corep)
             *corep = core;
         res = 0;
     }
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_open_core_channel (host=%s, ...) = %d "
-                "core=%p\n", host, res, core);
+    vxi11_trace_end(&t0, VXI11_TR_OPEN_CORE, 0, 0, port, 0, 0, maxconn, res);
     return res;
 }
 
 void
 vxi11_close_core_channel(CLIENT *core)
 {
+    struct timespec t0;
+
+    vxi11_trace_begin(&t0);
     clnt_destroy_cached(core);
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_close_core_channel (core=%p)\n", core);
+    vxi11_trace_end(&t0, VXI11_TR_CLOSE_CORE, 0, 0, 0, 0, 0, 0, 0);
 }
 
 int 
 vxi11_open_abrt_channel(CLIENT *core, unsigned short abortPort, CLIENT **abrtp)
 {
     struct sockaddr_in sin;
+
+    clnt_control(core, CLGET_SERVER_ADDR, (char *)&sin);
+    return vxi11_open_abrt_channel_addr(&sin, abortPort, abrtp);
+}
+
+int
+vxi11_open_abrt_channel_addr(struct sockaddr_in *addr,
+                             unsigned short abortPort, CLIENT **abrtp)
+{
+    struct sockaddr_in sin = *addr;
+    struct timespec t0;
     int sock = RPC_ANYSOCK;
     CLIENT *abrt;
     int res = VXI11_ABRT_CREATE;
 
-    clnt_control(core, CLGET_SERVER_ADDR, (char *)&sin);
+    vxi11_trace_begin(&t0);
     sin.sin_port = htons(abortPort);
     if ((abrt = clnttcp_create_cached(&sin, DEVICE_ASYNC, 
                                        DEVICE_ASYNC_VERSION, &sock, 0, 0))) {
@@ -92,19 +127,93 @@ vxi11_open_abrt_channel(CLIENT *core, unsigned short abortPort, CLIENT **abrtp)
             *abrtp = abrt;
         res = 0;
     }
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_open_abrt_channel (core=%p "
-                "abortPort=%d, ...) = %d abrt=%p\n", 
-                core, abortPort, res, abrt);
+    vxi11_trace_end(&t0, VXI11_TR_OPEN_ABRT, 0, 0, abortPort, 0, 0, 0, res);
     return res;
 }
 
 void
 vxi11_close_abrt_channel(CLIENT *abrt)
 {
+    struct timespec t0;
+
+    vxi11_trace_begin(&t0);
     clnt_destroy_cached(abrt);
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_close_abrt_channel (abrt=%p)\n", abrt);
+    vxi11_trace_end(&t0, VXI11_TR_CLOSE_ABRT, 0, 0, 0, 0, 0, 0, 0);
+}
+
+int
+vxi11_tune_channel(CLIENT *clnt, int sockflags, unsigned long bufsize)
+{
+    struct timespec t0;
+    int fd, val, cur, res = 0;
+    socklen_t len;
+
+    vxi11_trace_begin(&t0);
+    if (!clnt_control(clnt, CLGET_FD, (char *)&fd))
+        return -1;
+    val = (sockflags & VXI11_SOCK_NODELAY) ? 1 : 0;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val)) < 0)
+        res = -1;
+    val = (sockflags & VXI11_SOCK_KEEPALIVE) ? 1 : 0;
+    if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val)) < 0)
+        res = -1;
+    /* Grow (never shrink) socket buffers so that a maximal write chunk,
+     * plus RPC and record marking overhead, fits in one send.
+     */
+    if (bufsize > 0) {
+        val = bufsize + VXI11_RPC_OVERHEAD;
+        len = sizeof(cur);
+        if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &cur, &len) == 0
+                && cur < val)
+            (void)setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val));
+        len = sizeof(cur);
+        if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &cur, &len) == 0
+                && cur < val)
+            (void)setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+    }
+    vxi11_trace_end(&t0, VXI11_TR_TUNE, 0, sockflags, 0, bufsize, 0, 0, res);
+    return res;
+}
+
+void
+vxi11_set_rpc_timeout(CLIENT *clnt, unsigned long timeout)
+{
+    struct timeval tv;
+
+    timerclear(&tv);
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    clnt_lock_cached(clnt);
+    clnt_control(clnt, CLSET_TIMEOUT, (caddr_t)&tv);
+    clnt_unlock_cached(clnt);
+}
+
+/* Last RPC failure seen by the calling thread - see vxi11_core_geterr ().
+ * The CLIENT's own error status cannot be used for this, as the CLIENT
+ * may be shared with other threads (rpccache.c).
+ */
+static __thread struct rpc_err core_rpcerr;
+
+/* Finish a call made while holding the CLIENT's call lock.
+ * After a transport error the connection is broken (or, after a timeout,
+ * may still deliver the late reply), so evict it from the cache: other
+ * users keep it until they close, but new opens get a fresh connection.
+ */
+static enum clnt_stat
+_call_done(CLIENT *clnt, enum clnt_stat stat)
+{
+    if (stat != RPC_SUCCESS)
+        clnt_geterr(clnt, &core_rpcerr);
+    if (stat == RPC_CANTSEND || stat == RPC_CANTRECV || stat == RPC_TIMEDOUT)
+        clnt_evict_cached(clnt);
+    clnt_unlock_cached(clnt);
+    return stat;
+}
+
+void
+vxi11_core_geterr(struct rpc_err *errp)
+{
+    *errp = core_rpcerr;
 }
 
 int
@@ -112,33 +221,29 @@ vxi11_create_link(CLIENT *core, int clientId, bool lockDevice,
                   unsigned long lock_timeout, char *device, long *lidp, 
                   unsigned short *abortPortp, unsigned long *maxRecvSizep)
 {
+    struct timespec t0;
     Create_LinkParms p;
-    Create_LinkResp *r;
+    Create_LinkResp r;
     int res = VXI11_CORE_RPCERR;
 
     p.clientId = clientId;
     p.lockDevice = lockDevice;
     p.lock_timeout = lock_timeout;
     p.device = device;
-    if ((r = create_link_1(&p, core))) {
+    memset(&r, 0, sizeof(r));
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, create_link_1(&p, &r, core)) == RPC_SUCCESS) {
         if (lidp)
-            *lidp = r->lid;
+            *lidp = r.lid;
         if (abortPortp)
-            *abortPortp = r->abortPort;
+            *abortPortp = r.abortPort;
         if (maxRecvSizep)
-            *maxRecvSizep = r->maxRecvSize;
-        res = r->error;
-    }
-    if (vxi11_core_debug) {
-        fprintf(stderr, "DBG vxi11_create_link (core=%p, clientId=%d, "
-                "lockDevice=%d, lock_timeout=%lu, device=%s, ...) = %d ",
-                core, clientId, lockDevice, lock_timeout, device, res);
-        if (r)
-            fprintf(stderr, "lid=%ld, abortPort=%d, maxRecvSize=%lu\n",
-                    r->lid, r->abortPort, r->maxRecvSize);
-        else
-            fprintf(stderr, "\n");
+            *maxRecvSizep = r.maxRecvSize;
+        res = r.error;
     }
+    vxi11_trace_end(&t0, VXI11_TR_CREATE_LINK, r.lid, 0, lock_timeout,
+                    0, r.maxRecvSize, r.abortPort, res);
     return res;
 }
 
@@ -147,8 +252,9 @@ vxi11_device_write(CLIENT *core, long lid, long flags,
                    unsigned long io_timeout, unsigned long lock_timeout,
                    char *data_val, int data_len, unsigned long *sizep)
 {
+    struct timespec t0;
     Device_WriteParms p;
-    Device_WriteResp *r;
+    Device_WriteResp r;
     int res = VXI11_CORE_RPCERR;
 
     p.lid = lid;
@@ -157,21 +263,16 @@ vxi11_device_write(CLIENT *core, long lid, long flags,
     p.flags = flags;
     p.data.data_val = data_val;
     p.data.data_len = data_len;
-    if ((r = device_write_1(&p, core))) {
+    memset(&r, 0, sizeof(r));
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, device_write_1(&p, &r, core)) == RPC_SUCCESS) {
         if (sizep)
-            *sizep = r->size;
-        res = r->error;
-    }
-    if (vxi11_core_debug) {
-        fprintf(stderr, "DBG vxi11_device_write (core=%p, lid=%ld, "
-                "flags=%ld io_timeout=%lu, lock_timeout=%lu, "
-                "..., data_len=%d, ...) = %d ",
-                core, lid, flags, io_timeout, lock_timeout, data_len, res);
-        if (r)
-            fprintf(stderr, "size=%lu\n", r->size);
-        else
-            fprintf(stderr, "\n");
+            *sizep = r.size;
+        res = r.error;
     }
+    vxi11_trace_end(&t0, VXI11_TR_WRITE, lid, flags, io_timeout, data_len,
+                    r.size, 0, res);
     return res;
 }
 
@@ -181,8 +282,9 @@ vxi11_device_read(CLIENT *core, long lid, long flags,
                   int termChar, int *reasonp, 
                   char *data_val, int *data_lenp, unsigned long requestSize)
 {
+    struct timespec t0;
     Device_ReadParms p;
-    Device_ReadResp *r;
+    Device_ReadResp r;
     int res = VXI11_CORE_RPCERR;
 
     p.lid = lid;
@@ -191,27 +293,21 @@ vxi11_device_read(CLIENT *core, long lid, long flags,
     p.lock_timeout = lock_timeout;
     p.flags = flags;
     p.termChar = termChar;
-    if ((r = device_read_1(&p, core))) {
+    memset(&r, 0, sizeof(r));
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, device_read_1(&p, &r, core)) == RPC_SUCCESS) {
         if (reasonp)
-            *reasonp = r->reason;
+            *reasonp = r.reason;
         if (data_lenp)
-            *data_lenp = r->data.data_len;
-        if (data_val && r->data.data_val)
-            memcpy(data_val, r->data.data_val, r->data.data_len);
-        res = r->error;
-    }
-    if (vxi11_core_debug) {
-        fprintf(stderr, "DBG vxi11_device_read (core=%p, lid=%ld, "
-                "flags=%ld io_timeout=%lu, lock_timeout=%lu, "
-                "termChar=0x%x, ..., requestSize=%lu) = %d ",
-                core, lid, flags, io_timeout, lock_timeout, termChar,
-                requestSize, res);
-        if (r) 
-            fprintf(stderr, "reason=%ld, data_len=%d\n",
-                    r->reason, r->data.data_len);
-        else
-            fprintf(stderr, "\n");
+            *data_lenp = r.data.data_len;
+        if (data_val && r.data.data_val)
+            memcpy(data_val, r.data.data_val, r.data.data_len);
+        res = r.error;
     }
+    vxi11_trace_end(&t0, VXI11_TR_READ, lid, flags, termChar, requestSize,
+                    r.data.data_len, r.reason, res);
+    xdr_free((xdrproc_t)xdr_Device_ReadResp, (char *)&r);
     return res;
 }
 
@@ -220,28 +316,25 @@ vxi11_device_readstb(CLIENT *core, long lid, long flags,
                      unsigned long io_timeout, unsigned long lock_timeout,
                      unsigned char *stbp)
 {
+    struct timespec t0;
     Device_GenericParms p;
-    Device_ReadStbResp *r;
+    Device_ReadStbResp r;
     int res = VXI11_CORE_RPCERR;
 
     p.lid = lid;
     p.flags = flags;
     p.lock_timeout = lock_timeout;
     p.io_timeout = io_timeout;
-    if ((r = device_readstb_1(&p, core))) {
+    memset(&r, 0, sizeof(r));
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, device_readstb_1(&p, &r, core)) == RPC_SUCCESS) {
         if (stbp)
-            *stbp = r->stb;
-        res = r->error;
-    }
-    if (vxi11_core_debug) {
-        fprintf(stderr, "DBG vxi11_device_readstb (core=%p, lid=%ld, "
-                "flags=%ld io_timeout=%lu, lock_timeout=%lu, ...) = %d ",
-                core, lid, flags, io_timeout, lock_timeout, res);
-        if (r)
-            fprintf(stderr, "stb=0x%x\n", r->stb);
-        else
-            fprintf(stderr, "\n");
+            *stbp = r.stb;
+        res = r.error;
     }
+    vxi11_trace_end(&t0, VXI11_TR_READSTB, lid, flags, io_timeout, 0, 0,
+                    r.stb, res);
     return res;
 }
 
@@ -249,20 +342,20 @@ int
 vxi11_device_trigger(CLIENT *core, long lid, long flags,
                      unsigned long io_timeout, unsigned long lock_timeout)
 {
+    struct timespec t0;
     Device_GenericParms p;
-    Device_Error *r;
+    Device_Error r;
     int res = VXI11_CORE_RPCERR;
 
     p.lid = lid;
     p.flags = flags;
     p.lock_timeout = lock_timeout;
     p.io_timeout = io_timeout;
-    if ((r = device_trigger_1(&p, core)))
-        res = r->error;
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_device_trigger (core=%p, lid=%ld, "
-                "flags=%ld io_timeout=%lu, lock_timeout=%lu) = %d\n",
-                core, lid, flags, io_timeout, lock_timeout, res);
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, device_trigger_1(&p, &r, core)) == RPC_SUCCESS)
+        res = r.error;
+    vxi11_trace_end(&t0, VXI11_TR_TRIGGER, lid, flags, io_timeout, 0, 0, 0, res);
     return res;
 }
 
@@ -270,20 +363,20 @@ int
 vxi11_device_clear(CLIENT *core, long lid, long flags, 
                      unsigned long io_timeout, unsigned long lock_timeout)
 {
+    struct timespec t0;
     Device_GenericParms p;
-    Device_Error *r;
+    Device_Error r;
     int res = VXI11_CORE_RPCERR;
 
     p.lid = lid;
     p.flags = flags;
     p.lock_timeout = lock_timeout;
     p.io_timeout = io_timeout;
-    if ((r = device_clear_1(&p, core)))
-        res = r->error;
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_device_clear (core=%p, lid=%ld, "
-                "flags=%ld io_timeout=%lu, lock_timeout=%lu) = %d\n",
-                core, lid, flags, io_timeout, lock_timeout, res);
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, device_clear_1(&p, &r, core)) == RPC_SUCCESS)
+        res = r.error;
+    vxi11_trace_end(&t0, VXI11_TR_CLEAR, lid, flags, io_timeout, 0, 0, 0, res);
     return res;
 }
 
@@ -291,20 +384,20 @@ int
 vxi11_device_remote(CLIENT *core, long lid, long flags,
                      unsigned long io_timeout, unsigned long lock_timeout)
 {
+    struct timespec t0;
     Device_GenericParms p;
-    Device_Error *r;
+    Device_Error r;
     int res = VXI11_CORE_RPCERR;
 
     p.lid = lid;
     p.flags = flags;
     p.lock_timeout = lock_timeout;
     p.io_timeout = io_timeout;
-    if ((r = device_remote_1(&p, core)))
-        res = r->error;
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_device_remote (core=%p, lid=%ld, "
-                "flags=%ld io_timeout=%lu, lock_timeout=%lu) = %d\n",
-                core, lid, flags, io_timeout, lock_timeout, res);
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, device_remote_1(&p, &r, core)) == RPC_SUCCESS)
+        res = r.error;
+    vxi11_trace_end(&t0, VXI11_TR_REMOTE, lid, flags, io_timeout, 0, 0, 0, res);
     return res;
 }
 
@@ -312,20 +405,20 @@ int
 vxi11_device_local(CLIENT *core, long lid, long flags,
                    unsigned long io_timeout, unsigned long lock_timeout)
 {
+    struct timespec t0;
     Device_GenericParms p;
-    Device_Error *r;
+    Device_Error r;
     int res = VXI11_CORE_RPCERR;
 
     p.lid = lid;
     p.flags = flags;
     p.lock_timeout = lock_timeout;
     p.io_timeout = io_timeout;
-    if ((r = device_local_1(&p, core)))
-        res = r->error;
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_device_local (core=%p, lid=%ld, "
-                "flags=%ld io_timeout=%lu, lock_timeout=%lu) = %d\n",
-                core, lid, flags, io_timeout, lock_timeout, res);
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, device_local_1(&p, &r, core)) == RPC_SUCCESS)
+        res = r.error;
+    vxi11_trace_end(&t0, VXI11_TR_LOCAL, lid, flags, io_timeout, 0, 0, 0, res);
     return res;
 }
 
@@ -333,33 +426,34 @@ int
 vxi11_device_lock(CLIENT *core, long lid, long flags, 
                   unsigned long lock_timeout)
 {
+    struct timespec t0;
     Device_LockParms p;
-    Device_Error *r;
+    Device_Error r;
     int res = VXI11_CORE_RPCERR;
 
     p.lid = lid;
     p.flags = flags;
     p.lock_timeout = lock_timeout;
-    if ((r = device_lock_1(&p, core)))
-        res = r->error;
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_device_lock (core=%p, lid=%ld, "
-                "flags=%ld lock_timeout=%lu) = %d\n",
-                core, lid, flags, lock_timeout, res);
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, device_lock_1(&p, &r, core)) == RPC_SUCCESS)
+        res = r.error;
+    vxi11_trace_end(&t0, VXI11_TR_LOCK, lid, flags, lock_timeout, 0, 0, 0, res);
     return res;
 }
 
 int
 vxi11_device_unlock(CLIENT *core, long lid)
 {
-    Device_Error *r;
+    struct timespec t0;
+    Device_Error r;
     int res = VXI11_CORE_RPCERR;
 
-    if ((r = device_unlock_1(&lid, core)))
-        res = r->error;
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_device_unlock (core=%p, lid=%ld) = %d\n",
-                core, lid, res);
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, device_unlock_1(&lid, &r, core)) == RPC_SUCCESS)
+        res = r.error;
+    vxi11_trace_end(&t0, VXI11_TR_UNLOCK, lid, 0, 0, 0, 0, 0, res);
     return res;
 }
 
@@ -367,20 +461,21 @@ int
 vxi11_device_enable_srq(CLIENT *core, long lid, bool enable, char *handle_val,
                         int handle_len)
 {
+    struct timespec t0;
     Device_EnableSrqParms p;
-    Device_Error *r;
+    Device_Error r;
     int res = VXI11_CORE_RPCERR;
 
     p.lid = lid;
     p.enable = enable;
     p.handle.handle_val = handle_val;
     p.handle.handle_len = handle_len; /* XXX max 40 */
-    if ((r = device_enable_srq_1(&p, core)))
-        res = r->error;
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_device_enable_srq (core=%p, lid=%ld "
-                "enable=%d, ..., handle_len=%d) = %d\n",
-                core, lid, enable, handle_len, res);
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, device_enable_srq_1(&p, &r, core)) == RPC_SUCCESS)
+        res = r.error;
+    vxi11_trace_end(&t0, VXI11_TR_ENABLE_SRQ, lid, 0, enable, handle_len, 0, 0,
+                    res);
     return res;
 }
 
@@ -389,11 +484,13 @@ vxi11_device_docmd(CLIENT *core, long lid, long flags,
                    unsigned long io_timeout, unsigned long lock_timeout,
                    long cmd, int network_order, long datasize, 
                    char *data_in_val, int data_in_len,
-                   char **data_out_valp, int *data_out_lenp)
+                   char *data_out_val, int data_out_size, int *data_out_lenp)
 {
+    struct timespec t0;
     Device_DocmdParms p;
-    Device_DocmdResp *r;
+    Device_DocmdResp r;
     int res = VXI11_CORE_RPCERR;
+    int len;
 
     p.lid = lid;
     p.flags = flags;
@@ -404,34 +501,37 @@ vxi11_device_docmd(CLIENT *core, long lid, long flags,
     p.datasize = datasize;
     p.data_in.data_in_val = data_in_val;
     p.data_in.data_in_len = data_in_len;
-    if ((r = device_docmd_1(&p, core))) {
-        if (data_out_valp)
-            *data_out_valp = r->data_out.data_out_val;
+    memset(&r, 0, sizeof(r));
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, device_docmd_1(&p, &r, core)) == RPC_SUCCESS) {
+        len = r.data_out.data_out_len;
+        if (len > data_out_size)
+            len = data_out_size;
+        if (data_out_val && r.data_out.data_out_val && len > 0)
+            memcpy(data_out_val, r.data_out.data_out_val, len);
         if (data_out_lenp)
-            *data_out_lenp = r->data_out.data_out_len;
-        res = r->error;
+            *data_out_lenp = r.data_out.data_out_len;
+        res = r.error;
     }
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_device_docmd (core=%p, lid=%ld, "
-                "flags=%ld, io_timeout=%lu, lock_timeout=%lu, cmd=%ld, "
-                "network_order=%d, datasize=%ld, ...,  data_in_len=%d, "
-                " ...) = %d\n",
-                core, lid, flags, io_timeout, lock_timeout, cmd,
-                network_order, datasize, data_in_len, res);
+    vxi11_trace_end(&t0, VXI11_TR_DOCMD, lid, flags, cmd, data_in_len,
+                    r.data_out.data_out_len, 0, res);
+    xdr_free((xdrproc_t)xdr_Device_DocmdResp, (char *)&r);
     return res;
 }
 
 int
 vxi11_destroy_link(CLIENT *core, long lid)
 {
-    Device_Error *r;
+    struct timespec t0;
+    Device_Error r;
     int res = VXI11_CORE_RPCERR;
 
-    if ((r = destroy_link_1(&lid, core)))
-        res = r->error;
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_destroy_link (core=%p, lid=%ld) = %d\n",
-                core, lid, res);
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, destroy_link_1(&lid, &r, core)) == RPC_SUCCESS)
+        res = r.error;
+    vxi11_trace_end(&t0, VXI11_TR_DESTROY_LINK, lid, 0, 0, 0, 0, 0, res);
     return res;
 }
 
@@ -440,8 +540,9 @@ vxi11_create_intr_chan(CLIENT *core, unsigned long hostAddr,
                        unsigned short hostPort, unsigned long progNum,
                        unsigned long progVers, int progFamily)
 {
+    struct timespec t0;
     Device_RemoteFunc p;
-    Device_Error *r;
+    Device_Error r;
     int res = VXI11_CORE_RPCERR;
 
     p.hostAddr = hostAddr;
@@ -449,52 +550,49 @@ vxi11_create_intr_chan(CLIENT *core, unsigned long hostAddr,
     p.progNum = progNum;
     p.progVers = progVers;
     p.progFamily = progFamily;
-    if ((r = create_intr_chan_1(&p, core)))
-        res = r->error;
-    if (vxi11_core_debug) {
-        struct in_addr addr;
-        addr.s_addr = htonl(hostAddr);
-        fprintf(stderr, "DBG vxi11_create_intr_chan (core=%p, "
-                "hostAddr=%s, hostPort=%d, progNum=%lu, progVers=%lu, "
-                "progFamily=%d) = %d\n", core, inet_ntoa(addr), 
-                hostPort, progNum, progVers, progFamily, res);
-    }
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, create_intr_chan_1(&p, &r, core)) == RPC_SUCCESS)
+        res = r.error;
+    vxi11_trace_end(&t0, VXI11_TR_CREATE_INTR, 0, 0, hostPort, 0, 0, hostAddr,
+                    res);
     return res;
 }
 
 int
 vxi11_destroy_intr_chan(CLIENT *core)
 {
-    Device_Error *r;
+    struct timespec t0;
+    Device_Error r;
     int res = VXI11_CORE_RPCERR;
 
-    if ((r = destroy_intr_chan_1(NULL, core)))
-        res = r->error;
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_destroy_intr_chan (core=%p) = %d\n", 
-                core, res);
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(core);
+    if (_call_done(core, destroy_intr_chan_1(NULL, &r, core)) == RPC_SUCCESS)
+        res = r.error;
+    vxi11_trace_end(&t0, VXI11_TR_DESTROY_INTR, 0, 0, 0, 0, 0, 0, res);
     return res;
 }
 
 int
 vxi11_device_abort(CLIENT *abrt, long lid)
 {
-    Device_Error *r;
+    struct timespec t0;
+    Device_Error r;
     int res = VXI11_CORE_RPCERR;
 
-    if ((r = device_abort_1(&lid, abrt)))
-        res = r->error;
-    if (vxi11_core_debug)
-        fprintf(stderr, "DBG vxi11_device_abort (abrt=%p, lid=%ld) = %d\n", 
-                abrt, lid, res);
+    vxi11_trace_begin(&t0);
+    clnt_lock_cached(abrt);
+    if (_call_done(abrt, device_abort_1(&lid, &r, abrt)) == RPC_SUCCESS)
+        res = r.error;
+    vxi11_trace_end(&t0, VXI11_TR_ABORT, lid, 0, 0, 0, 0, 0, res);
     return res;
 }
 
 void
 vxi11_set_core_debug(bool doDebug)
 {
-    vxi11_core_debug = doDebug;
-    set_rpccache_debug(doDebug);
+    vxi11_trace_set_echo(doDebug);
 }
 
 /*
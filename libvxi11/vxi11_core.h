@@ -20,7 +20,10 @@
    along with gpib-utils; if not, write to the Free Software Foundation, 
    Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
 
-/* All functions return: 0 on success, <0 on RPC error, >0 on VXI-11 error */
+/* All functions return: 0 on success, <0 on RPC error, >0 on VXI-11 error.
+ * They are reentrant: calls on the same channel from different threads
+ * are serialized, and calls on different channels run in parallel.
+ */
 #define VXI11_ABRT_CREATE   (-4)
 #define VXI11_CORE_CREATE   (-3)
 #define VXI11_ABRT_RPCERR   (-2)
@@ -36,6 +39,25 @@ extern "C" {
  */
 int vxi11_open_core_channel(char *host, CLIENT **corep);
 
+/* Open core channel on a known tcp 'port', skipping the portmapper query
+ * that vxi11_open_core_channel() makes.  Channels are shared with
+ * vxi11_open_core_channel() for the same host.
+ */
+int vxi11_open_core_channel_port(char *host, unsigned short port,
+                                 CLIENT **corep);
+
+/* Open core channel from a pool of up to 'maxconn' connections to 'host'
+ * (on 'port', or via the portmapper if 'port' is 0).  A new connection
+ * is made until the pool is full, then the least used one is shared, so
+ * links that each open their own channel can have RPCs in progress at
+ * the same time.  Each 'group' has a pool of its own (NULL is the same
+ * as "").  With 'maxconn' of 1 and no group this is
+ * vxi11_open_core_channel().
+ */
+int vxi11_open_core_channel_pool(char *host, unsigned short port,
+                                 const char *group, int maxconn,
+                                 CLIENT **corep);
+
 /* Close core channel opened with vxi11_open_core_channel().
  */
 void vxi11_close_core_channel(CLIENT *core);
@@ -47,11 +69,40 @@ void vxi11_close_core_channel(CLIENT *core);
 int vxi11_open_abrt_channel(CLIENT *core, unsigned short abortPort, 
                             CLIENT **abrtp);
 
+/* Open abort channel given the core channel's server address, as
+ * obtained with clnt_control(core, CLGET_SERVER_ADDR, ...).  Unlike
+ * vxi11_open_abrt_channel(), this does not touch the core channel
+ * handle, so it may be called while another thread is blocked in a
+ * core channel RPC.
+ */
+int vxi11_open_abrt_channel_addr(struct sockaddr_in *addr,
+                                 unsigned short abortPort, CLIENT **abrtp);
+
 /* Close abort channel opened with vxi11_open_abrt_channel().
  * It is best to close the abort channel before vxi11_destroy_link().
  */
 void vxi11_close_abrt_channel(CLIENT *abrt);
 
+/* Socket options for vxi11_tune_channel().
+ */
+#define VXI11_SOCK_NODELAY      0x01    /* disable Nagle (TCP_NODELAY) */
+#define VXI11_SOCK_KEEPALIVE    0x02    /* enable TCP keepalive probes */
+
+/* Apply 'sockflags' to the socket underlying a core or abort channel.
+ * If 'bufsize' is nonzero (e.g. maxRecvSize from vxi11_create_link()),
+ * grow the socket send and receive buffers to hold that much payload.
+ * Channels are shared per host, so the last caller's flags win.
+ * Returns 0 on success, -1 if any option could not be set.
+ */
+int vxi11_tune_channel(CLIENT *clnt, int sockflags, unsigned long bufsize);
+
+/* Set the RPC timeout of a core channel to 'timeout' milliseconds.
+ * Takes the channel's call lock, so it is safe while other threads
+ * sharing the channel are making calls (as with vxi11_tune_channel (),
+ * the last caller's timeout wins).
+ */
+void vxi11_set_rpc_timeout(CLIENT *clnt, unsigned long timeout);
+
 /* Establish an instrument link.  The 'clientId' parameter is generally
  * not used (set to zero).  If you wish to block until this command can
  * run with exclusive access to the instrument, set 'lockDevice' to true
@@ -164,11 +215,15 @@ int vxi11_device_unlock(CLIENT *core, long lid);
 int vxi11_device_enable_srq(CLIENT *core, long lid, bool enable, 
                         char *handle_val, int handle_len);
 
+/* Execute docmd 'cmd'.  Up to 'data_out_size' bytes of the result are
+ * copied to 'data_out_val', and the full result length is returned in
+ * 'data_out_lenp' if non-NULL.
+ */
 int vxi11_device_docmd(CLIENT *core, long lid, long flags, 
                    unsigned long io_timeout, unsigned long lock_timeout,
                    long cmd, int network_order, long datasize, 
                    char *data_in_val, int data_in_len,
-                   char **data_out_valp, int *data_out_lenp);
+                   char *data_out_val, int data_out_size, int *data_out_lenp);
 
 int vxi11_destroy_link(CLIENT *core, long lid);
 
@@ -180,6 +235,12 @@ int vxi11_destroy_intr_chan(CLIENT *core);
 
 int vxi11_device_abort(CLIENT *abrt, long lid);
 
+/* Get the status of the last RPC made by the calling thread with one of
+ * the above functions that returned VXI11_CORE_RPCERR or VXI11_ABRT_RPCERR.
+ * Use this rather than clnt_geterr (), since channels may be shared.
+ */
+void vxi11_core_geterr(struct rpc_err *errp);
+
 void vxi11_set_core_debug(bool doDebug);
 
 #ifdef __cplusplus
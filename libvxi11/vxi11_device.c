@@ -32,6 +32,7 @@ typedef enum { false=0, true=1 } bool;
 #include <stdarg.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <rpc/rpc.h>
@@ -41,11 +42,16 @@ typedef enum { false=0, true=1 } bool;
 #include <netdb.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <limits.h>
 #include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "vxi11.h"
 #include "vxi11_core.h"
 #include "vxi11_device.h"
+#include "portcache.h"
+#include "rpccache.h"
 
 /* Set to 1 to work around old ICS 8064 firmware (see comment below) */
 #define ICS8064_OLDFW_WORKAROUND 1
@@ -55,28 +61,80 @@ typedef enum { false=0, true=1 } bool;
 #define VXI11_DFLT_TERMCHARSET  false
 #define VXI11_DFLT_DOLOCKING    false
 #define VXI11_DFLT_DOENDW       true
+#define VXI11_DFLT_DOPORTCACHE  true
+#define VXI11_DFLT_SOCKFLAGS    VXI11_SOCK_NODELAY
+
+/* bounds on the first request size of vxi11_read_alloc () */
+#define VXI11_READ_ALLOC_MIN    256
+#define VXI11_READ_ALLOC_MAX    (1024*1024)
 
 #define VXI11_MAGIC             0x343422aa
 #define VXI11_NOLID             (-1)
 
 static bool vxi11_device_debug = false;
 
+/* Per host core connection limits - see vxi11_set_host_maxconn ().
+ */
+struct host_maxconn {
+    char            host[MAXHOSTNAMELEN];
+    int             maxconn;
+    struct host_maxconn *next;
+};
+static struct host_maxconn *host_maxconn = NULL;
+static pthread_mutex_t host_maxconn_lock = PTHREAD_MUTEX_INITIALIZER;
+
 struct vxi11_device_struct {
     int             vxi11_magic;
     char            vxi11_devname[MAXHOSTNAMELEN];
     CLIENT         *vxi11_core;
     CLIENT         *vxi11_abrt;
+    struct sockaddr_in vxi11_core_addr; /* for opening abrt channel */
     long            vxi11_lid;
     unsigned short  vxi11_abortPort;
     int             vxi11_termChar;
     bool            vxi11_termCharSet;
     bool            vxi11_doEndw;
     bool            vxi11_doLocking;
+    bool            vxi11_doPortcache;
+    int             vxi11_maxconn;      /* 0 = per host policy */
+    char            vxi11_conngroup[MAXHOSTNAMELEN];
+    int             vxi11_sockflags;
     unsigned long   vxi11_lock_timeout;
     unsigned long   vxi11_io_timeout;
     unsigned long   vxi11_maxRecvSize;
+    int             vxi11_read_hint;    /* size of last vxi11_read_alloc () */
     int             vxi11_clientId;
+    int             vxi11_txn_depth;    /* vxi11_begin () nesting */
+    bool            vxi11_txn_locked;   /* txn holds the device lock */
     char            vxi11_errstr[128];
+    struct rpc_err  vxi11_rpcerr;       /* last VXI11_*_RPCERR */
+    struct vxi11_stats vxi11_stats;
+    /* deadline watchdog - see vxi11_set_deadline () */
+    unsigned long   vxi11_deadline;     /* msec, 0 = disabled */
+    int             vxi11_wd_depth;     /* nested _wd_arm () calls */
+    bool            vxi11_wd_running;   /* thread has been started */
+    bool            vxi11_wd_stop;      /* ask thread to exit */
+    bool            vxi11_wd_armed;
+    bool            vxi11_wd_firing;    /* thread is sending device_abort */
+    bool            vxi11_wd_fired;
+    struct timespec vxi11_wd_expire;    /* CLOCK_MONOTONIC */
+    long            vxi11_wd_lid;       /* link to abort (snapshot) */
+    CLIENT         *vxi11_wd_abrt;      /* abort channel (snapshot) */
+    struct sockaddr_in vxi11_wd_addr;   /* ...or where to open one */
+    unsigned short  vxi11_wd_abortPort;
+    int             vxi11_wd_res;       /* result of the abort sent */
+    struct timeval  vxi11_wd_t1, vxi11_wd_t2;
+    struct rpc_err  vxi11_wd_rpcerr;
+    pthread_t       vxi11_wd_thread;
+    pthread_mutex_t vxi11_wd_lock;
+    pthread_cond_t  vxi11_wd_cond;
+    /* idle keepalive - see vxi11_set_keepalive () (also uses wd thread) */
+    unsigned long   vxi11_ka_idle;      /* msec, 0 = disabled */
+    int             vxi11_ka_inop;      /* operations using the channel */
+    bool            vxi11_ka_busy;      /* thread is using the channel */
+    bool            vxi11_ka_reopen;    /* link lost, thread reopening it */
+    bool            vxi11_ka_doAbort;   /* ...with an abort channel */
+    struct timespec vxi11_ka_last;      /* end of last operation */
 };
 
 struct errtab_struct {
@@ -114,6 +172,15 @@ vxi11_destroy(vxi11dev_t v)
     assert(v->vxi11_lid == VXI11_NOLID);
     assert(v->vxi11_abrt == NULL);
     assert(v->vxi11_core == NULL);
+    if (v->vxi11_wd_running) {
+        pthread_mutex_lock(&v->vxi11_wd_lock);
+        v->vxi11_wd_stop = true;
+        pthread_cond_signal(&v->vxi11_wd_cond);
+        pthread_mutex_unlock(&v->vxi11_wd_lock);
+        pthread_join(v->vxi11_wd_thread, NULL);
+    }
+    pthread_cond_destroy(&v->vxi11_wd_cond);
+    pthread_mutex_destroy(&v->vxi11_wd_lock);
     memset(v, 0, sizeof(struct vxi11_device_struct));
     free(v);
 }
@@ -122,6 +189,7 @@ vxi11dev_t
 vxi11_create(void)
 {
     vxi11dev_t v = malloc(sizeof(struct vxi11_device_struct));
+    pthread_condattr_t attr;
 
     if (v) {
         v->vxi11_magic        = VXI11_MAGIC;
@@ -134,10 +202,37 @@ vxi11_create(void)
         v->vxi11_termCharSet  = VXI11_DFLT_TERMCHARSET;
         v->vxi11_doEndw       = VXI11_DFLT_DOENDW;
         v->vxi11_doLocking    = VXI11_DFLT_DOLOCKING;
+        v->vxi11_doPortcache  = VXI11_DFLT_DOPORTCACHE;
+        v->vxi11_maxconn      = 0;
+        v->vxi11_conngroup[0] = '\0';
+        v->vxi11_sockflags    = VXI11_DFLT_SOCKFLAGS;
         v->vxi11_lock_timeout = 25000; // Default for rpcgen (see libvxi11/vxi11_clnt.c line 62 and 73)
         v->vxi11_io_timeout   = 25000;
         v->vxi11_maxRecvSize  = 0;
+        v->vxi11_read_hint    = 0;
         v->vxi11_clientId     = 0;
+        v->vxi11_txn_depth    = 0;
+        v->vxi11_txn_locked   = false;
+        memset(&v->vxi11_stats, 0, sizeof(v->vxi11_stats));
+        v->vxi11_deadline     = 0;
+        v->vxi11_wd_depth     = 0;
+        v->vxi11_wd_running   = false;
+        v->vxi11_wd_stop      = false;
+        v->vxi11_wd_armed     = false;
+        v->vxi11_wd_firing    = false;
+        v->vxi11_wd_fired     = false;
+        v->vxi11_wd_lid       = VXI11_NOLID;
+        v->vxi11_wd_abrt      = NULL;
+        v->vxi11_ka_idle      = 0;
+        v->vxi11_ka_inop      = 0;
+        v->vxi11_ka_busy      = false;
+        v->vxi11_ka_reopen    = false;
+        v->vxi11_ka_doAbort   = false;
+        pthread_mutex_init(&v->vxi11_wd_lock, NULL);
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&v->vxi11_wd_cond, &attr);
+        pthread_condattr_destroy(&attr);
     }
     return v;
 }
@@ -159,70 +254,556 @@ _find_after_colon(char *s)
     return (p ? p + 1 : s);
 }
 
-int
-vxi11_open(vxi11dev_t v, char *name, bool doAbort)
+static unsigned long
+_timersubms(struct timeval *a, struct timeval *b)
+{
+    struct timeval t;
+
+    t.tv_sec =  a->tv_sec  - b->tv_sec;
+    t.tv_usec = a->tv_usec - b->tv_usec;
+    if (t.tv_usec < 0) {
+        t.tv_sec--;
+        t.tv_usec += 1000000;    
+    }
+    return (t.tv_usec / 1000 + t.tv_sec * 1000);
+}
+
+static unsigned long
+_timersubus(struct timeval *a, struct timeval *b)
 {
-    char tmpbuf[MAXHOSTNAMELEN];
-    char *device, *hostname;
+    return (a->tv_sec - b->tv_sec) * 1000000 + (a->tv_usec - b->tv_usec);
+}
+
+/* Account for one RPC in the handle's statistics.  An RPC error is
+ * taken from 'rpcerr' if given, else from the calling thread's last call.
+ */
+static void
+_stats_rpc_err(vxi11dev_t v, int proc, int res,
+               struct timeval *t1, struct timeval *t2, struct rpc_err *rpcerr)
+{
+    struct vxi11_stats *sp = &v->vxi11_stats;
+    unsigned long usec = _timersubus(t2, t1);
+    int bucket = 0;
+
+    sp->rpcs[proc]++;
+    if (res != 0)
+        sp->errors[proc]++;
+    if (res == VXI11_ERR_IOTIMEOUT)
+        sp->timeouts++;
+    else if (res == VXI11_CORE_RPCERR || res == VXI11_ABRT_RPCERR) {
+        if (rpcerr)
+            v->vxi11_rpcerr = *rpcerr;
+        else
+            vxi11_core_geterr(&v->vxi11_rpcerr);
+        if (v->vxi11_rpcerr.re_status == RPC_TIMEDOUT)
+            sp->timeouts++;
+    }
+    while (usec > 1 && bucket < VXI11_STATS_BUCKETS - 1) {
+        usec >>= 1;
+        bucket++;
+    }
+    sp->latency[proc][bucket]++;
+}
+
+static void
+_stats_rpc(vxi11dev_t v, int proc, int res,
+           struct timeval *t1, struct timeval *t2)
+{
+    _stats_rpc_err(v, proc, res, t1, t2, NULL);
+}
+
+static int
+_create_link(vxi11dev_t v, char *device)
+{
+    struct timeval t1, t2;
     int res;
 
+    gettimeofday(&t1, NULL);
+    res = vxi11_create_link(v->vxi11_core, v->vxi11_clientId, 
+                            v->vxi11_doLocking, v->vxi11_lock_timeout, 
+                            device, &v->vxi11_lid, &v->vxi11_abortPort,
+                            &v->vxi11_maxRecvSize);
+    gettimeofday(&t2, NULL);
+    _stats_rpc(v, VXI11_PROC_CREATE_LINK, res, &t1, &t2);
+    return res;
+}
+
+/* Remember the core port of a working connection so the next
+ * vxi11_open () of this instrument can skip the portmapper.
+ */
+static void
+_update_portcache(vxi11dev_t v)
+{
+    struct portcache_entry pc;
+
+    pc.core_port = ntohs(v->vxi11_core_addr.sin_port);
+    portcache_update(v->vxi11_devname, &pc);
+}
+
+/* Look up the core connection limit for 'host': vxi11_set_host_maxconn ()
+ * first, then $VXI11_MAXCONN, a comma separated list of "host=n" and
+ * an optional bare "n" default.  Returns 1 (share) if neither says.
+ */
+static int
+_host_maxconn(char *host)
+{
+    struct host_maxconn *hp;
+    char *env, *cpy, *tok, *eq, *saveptr = NULL;
+    int n, dflt = 1, res = 0;
+
+    pthread_mutex_lock(&host_maxconn_lock);
+    for (hp = host_maxconn; hp != NULL; hp = hp->next)
+        if (!strcmp(hp->host, host))
+            break;
+    n = hp ? hp->maxconn : 0;
+    pthread_mutex_unlock(&host_maxconn_lock);
+    if (n > 0)
+        return n;
+    if (!(env = getenv("VXI11_MAXCONN")) || !(cpy = strdup(env)))
+        return dflt;
+    for (tok = strtok_r(cpy, ",", &saveptr); tok != NULL;
+                                tok = strtok_r(NULL, ",", &saveptr)) {
+        if ((eq = strchr(tok, '='))) {
+            *eq++ = '\0';
+            if (!strcmp(tok, host) && (n = strtoul(eq, NULL, 10)) > 0)
+                res = n;
+        } else if ((n = strtoul(tok, NULL, 10)) > 0)
+            dflt = n;
+    }
+    free(cpy);
+    return res > 0 ? res : dflt;
+}
+
+/* Keepalive bookkeeping.  Every operation that uses the core channel is
+ * bracketed by _ka_enter () and _ka_leave () (via _wd_arm () and
+ * _wd_disarm (), or directly), so the thread knows when the link is idle
+ * and never shares the channel with the caller.  These are no-ops until
+ * the thread has been started.
+ */
+static void
+_ka_enter(vxi11dev_t v)
+{
+    if (!v->vxi11_wd_running)
+        return;
+    pthread_mutex_lock(&v->vxi11_wd_lock);
+    while (v->vxi11_ka_busy)
+        pthread_cond_wait(&v->vxi11_wd_cond, &v->vxi11_wd_lock);
+    v->vxi11_ka_inop++;
+    pthread_mutex_unlock(&v->vxi11_wd_lock);
+}
+
+static void
+_ka_leave(vxi11dev_t v)
+{
+    if (!v->vxi11_wd_running)
+        return;
+    pthread_mutex_lock(&v->vxi11_wd_lock);
+    if (v->vxi11_ka_inop > 0 && --v->vxi11_ka_inop == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &v->vxi11_ka_last);
+        pthread_cond_broadcast(&v->vxi11_wd_cond);
+    }
+    pthread_mutex_unlock(&v->vxi11_wd_lock);
+}
+
+/* Bound how long unacknowledged data may sit on the core channel, so a
+ * peer that has gone away fails the next RPC (keepalive or not) within
+ * about one keepalive interval instead of after minutes of retransmits.
+ */
+static void
+_ka_tune(vxi11dev_t v)
+{
+#ifdef TCP_USER_TIMEOUT
+    unsigned int val = v->vxi11_ka_idle;
+    int fd;
+
+    if (v->vxi11_core != NULL
+            && clnt_control(v->vxi11_core, CLGET_FD, (char *)&fd))
+        (void)setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &val, sizeof(val));
+#endif
+}
+
+static void _close(vxi11dev_t v);
+
+static int
+_open(vxi11dev_t v, char *name, bool doAbort)
+{
+    char hostname[MAXHOSTNAMELEN];
+    char *device;
+    struct portcache_entry pc;
+    bool cached = false;
+    int res, maxconn;
+
     assert(v->vxi11_magic == VXI11_MAGIC);
     strncpy(v->vxi11_devname, name, MAXHOSTNAMELEN);
     v->vxi11_devname[MAXHOSTNAMELEN - 1] = '\0';
 
-    hostname = _find_before_colon(v->vxi11_devname, tmpbuf, sizeof(tmpbuf));
-    if ((res = vxi11_open_core_channel(hostname, &v->vxi11_core)) != 0)
-        goto err;
-
+    _find_before_colon(v->vxi11_devname, hostname, sizeof(hostname));
     device = _find_after_colon(v->vxi11_devname);
-    if ((res = vxi11_create_link(v->vxi11_core, v->vxi11_clientId, 
-                             v->vxi11_doLocking, v->vxi11_lock_timeout, 
-                             device, &v->vxi11_lid, &v->vxi11_abortPort,
-                             &v->vxi11_maxRecvSize)) != 0)
+    maxconn = v->vxi11_maxconn > 0 ? v->vxi11_maxconn
+                                   : _host_maxconn(hostname);
+
+    if (v->vxi11_doPortcache && portcache_lookup(v->vxi11_devname,
+                                                 &pc) == 0) {
+        if (vxi11_open_core_channel_pool(hostname, pc.core_port,
+                                         v->vxi11_conngroup, maxconn,
+                                         &v->vxi11_core) == 0)
+            cached = true;
+        else
+            portcache_invalidate(v->vxi11_devname);
+    }
+    if (!cached) {
+        if ((res = vxi11_open_core_channel_pool(hostname, 0,
+                                                v->vxi11_conngroup, maxconn,
+                                                &v->vxi11_core)) != 0)
+            goto err;
+    }
+    /* Set TCP_NODELAY etc. before create_link, the first RPC, on
+     * connections made via the portmapper too.
+     */
+    (void)vxi11_tune_channel(v->vxi11_core, v->vxi11_sockflags, 0);
+    res = _create_link(v, device);
+    if (res == VXI11_CORE_RPCERR && cached) {
+        /* Cached port accepted a connection but is not speaking VXI-11
+         * (e.g. gateway rebooted and ports moved) - retry via portmapper.
+         * Evict the connection first, or the retry would be handed the
+         * same one back from the cache.
+         */
+        portcache_invalidate(v->vxi11_devname);
+        clnt_evict_cached(v->vxi11_core);
+        vxi11_close_core_channel(v->vxi11_core);
+        v->vxi11_core = NULL;
+        if ((res = vxi11_open_core_channel_pool(hostname, 0,
+                                                v->vxi11_conngroup, maxconn,
+                                                &v->vxi11_core)) != 0)
+            goto err;
+        (void)vxi11_tune_channel(v->vxi11_core, v->vxi11_sockflags, 0);
+        res = _create_link(v, device);
+    }
+    if (res != 0)
         goto err;
+    clnt_control(v->vxi11_core, CLGET_SERVER_ADDR,
+                 (char *)&v->vxi11_core_addr);
+    if (v->vxi11_doPortcache)
+        _update_portcache(v);
+    (void)vxi11_tune_channel(v->vxi11_core, v->vxi11_sockflags,
+                             v->vxi11_maxRecvSize);
+    if (v->vxi11_ka_idle > 0)
+        _ka_tune(v);
     if (doAbort)  {
-        if ((res = vxi11_open_abrt_channel(v->vxi11_core, v->vxi11_abortPort, 
-                &v->vxi11_abrt)) != 0)
+        if ((res = vxi11_open_abrt_channel_addr(&v->vxi11_core_addr,
+                v->vxi11_abortPort, &v->vxi11_abrt)) != 0)
             goto err;
+        (void)vxi11_tune_channel(v->vxi11_abrt, v->vxi11_sockflags, 0);
     }
     return res;
 err:
-    vxi11_close(v);
+    _close(v);
     return res;
 }
 
-void
-vxi11_close(vxi11dev_t v)
+int
+vxi11_open(vxi11dev_t v, char *name, bool doAbort)
 {
+    int res;
+
     assert(v->vxi11_magic == VXI11_MAGIC);
+    _ka_enter(v);
+    v->vxi11_ka_reopen = false;
+    res = _open(v, name, doAbort);
+    _ka_leave(v);
+    return res;
+}
+
+static void
+_close(vxi11dev_t v)
+{
+    v->vxi11_txn_depth = 0;
+    v->vxi11_txn_locked = false;
     if (v->vxi11_abrt)
         vxi11_close_abrt_channel(v->vxi11_abrt);
     v->vxi11_abrt = NULL;
-    if (v->vxi11_lid != VXI11_NOLID)
-        (void)vxi11_destroy_link(v->vxi11_core, v->vxi11_lid);
+    if (v->vxi11_lid != VXI11_NOLID) {
+        struct timeval t1, t2;
+        int res;
+
+        gettimeofday(&t1, NULL);
+        res = vxi11_destroy_link(v->vxi11_core, v->vxi11_lid);
+        gettimeofday(&t2, NULL);
+        _stats_rpc(v, VXI11_PROC_DESTROY_LINK, res, &t1, &t2);
+    }
     v->vxi11_lid = VXI11_NOLID;
     if (v->vxi11_core)
         vxi11_close_core_channel(v->vxi11_core);
     v->vxi11_core = NULL;
 }
 
+void
+vxi11_close(vxi11dev_t v)
+{
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    _ka_enter(v);
+    v->vxi11_ka_reopen = false;
+    _close(v);
+    _ka_leave(v);
+}
 
-static unsigned long
-_timersubms(struct timeval *a, struct timeval *b)
+
+/* Deadline watchdog.
+ * While an operation is armed, a per-handle thread sleeps until its
+ * deadline.  If the operation is still running then, the thread sends
+ * device_abort on the abort channel (opening it if vxi11_open () did not)
+ * so the gateway fails the stuck call instead of us waiting out the
+ * RPC timeout.  _wd_disarm () waits for an abort in progress to finish
+ * and turns the failed result into VXI11_ERR_ABORT.
+ *
+ * The thread only touches the vxi11_wd_* fields, under vxi11_wd_lock:
+ * _wd_arm () snapshots the link and abort channel into them, and
+ * _wd_disarm () takes back an abort channel the thread opened and
+ * accounts for the abort in the handle's statistics.
+ */
+static void
+_wd_abort(vxi11dev_t v)
 {
-    struct timeval t;
+    CLIENT *abrt;
+    struct rpc_err rpcerr;
+    struct timeval t1, t2;
+    long lid;
+    int res;
 
-    t.tv_sec =  a->tv_sec  - b->tv_sec;
-    t.tv_usec = a->tv_usec - b->tv_usec;
-    if (t.tv_usec < 0) {
-        t.tv_sec--;
-        t.tv_usec += 1000000;    
+    pthread_mutex_lock(&v->vxi11_wd_lock);
+    abrt = v->vxi11_wd_abrt;
+    lid = v->vxi11_wd_lid;
+    pthread_mutex_unlock(&v->vxi11_wd_lock);
+
+    /* N.B. the core channel is busy - don't touch it */
+    gettimeofday(&t1, NULL);
+    if (abrt == NULL) {
+        if (vxi11_open_abrt_channel_addr(&v->vxi11_wd_addr,
+                                         v->vxi11_wd_abortPort, &abrt) != 0) {
+            abrt = NULL;
+            res = VXI11_ABRT_CREATE;
+            goto done;
+        }
+        (void)vxi11_tune_channel(abrt, v->vxi11_sockflags, 0);
     }
-    return (t.tv_usec / 1000 + t.tv_sec * 1000);
+    res = vxi11_device_abort(abrt, lid);
+    if (res == VXI11_CORE_RPCERR)       /* what device_abort returns */
+        vxi11_core_geterr(&rpcerr);
+done:
+    gettimeofday(&t2, NULL);
+    pthread_mutex_lock(&v->vxi11_wd_lock);
+    v->vxi11_wd_abrt = abrt;
+    v->vxi11_wd_res = res;
+    v->vxi11_wd_t1 = t1;
+    v->vxi11_wd_t2 = t2;
+    if (res == VXI11_CORE_RPCERR)
+        v->vxi11_wd_rpcerr = rpcerr;
+    pthread_mutex_unlock(&v->vxi11_wd_lock);
+}
+
+static bool
+_wd_expired(struct timespec *expire)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec > expire->tv_sec || (now.tv_sec == expire->tv_sec
+                                        && now.tv_nsec >= expire->tv_nsec));
+}
+
+/* Idle keepalive.
+ * The watchdog thread also sends device_readstb (without waiting for
+ * locks) on a link that has been idle for the keepalive interval, so a
+ * gateway comm_timeout never closes it.  If the probe fails at the RPC
+ * level, the channel is dead: the thread closes it and reopens the link
+ * now rather than leaving that to the next operation, retrying every
+ * interval until it succeeds.  Called with ka_busy set and the lock not
+ * held; operations wait in _ka_enter () meanwhile.
+ */
+static void
+_ka_probe(vxi11dev_t v)
+{
+    char name[MAXHOSTNAMELEN];
+    unsigned char stb;
+    int res;
+
+    if (!v->vxi11_ka_reopen) {
+        res = vxi11_device_readstb(v->vxi11_core, v->vxi11_lid, 0,
+                                   v->vxi11_io_timeout, 0, &stb);
+        v->vxi11_stats.keepalives++;
+        if (res != VXI11_CORE_RPCERR || v->vxi11_txn_depth > 0)
+            return;
+        v->vxi11_ka_reopen = true;
+        v->vxi11_ka_doAbort = (v->vxi11_abrt != NULL);
+        v->vxi11_lid = VXI11_NOLID;     /* no destroy_link on a dead channel */
+        clnt_evict_cached(v->vxi11_core); /* so _open gets a new connection */
+        _close(v);
+    }
+    snprintf(name, sizeof(name), "%s", v->vxi11_devname);
+    if (_open(v, name, v->vxi11_ka_doAbort) == 0) {
+        v->vxi11_ka_reopen = false;
+        v->vxi11_stats.reconnects++;
+    }
+}
+
+/* When is the next keepalive due?  Returns false if none is.
+ */
+static bool
+_ka_next(vxi11dev_t v, struct timespec *ts)
+{
+    if (v->vxi11_ka_idle == 0 || v->vxi11_ka_inop > 0)
+        return false;
+    if (!v->vxi11_ka_reopen && (v->vxi11_core == NULL
+                                || v->vxi11_lid == VXI11_NOLID))
+        return false;
+    *ts = v->vxi11_ka_last;
+    ts->tv_sec += v->vxi11_ka_idle / 1000;
+    ts->tv_nsec += (v->vxi11_ka_idle % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+    return true;
+}
+
+static void *
+_wd_thread(void *arg)
+{
+    vxi11dev_t v = arg;
+    struct timespec wake;
+    bool timed;
+
+    pthread_mutex_lock(&v->vxi11_wd_lock);
+    while (!v->vxi11_wd_stop) {
+        timed = _ka_next(v, &wake);
+        if (v->vxi11_wd_armed && !v->vxi11_wd_fired
+                              && _wd_expired(&v->vxi11_wd_expire)) {
+            v->vxi11_wd_firing = true;
+            pthread_mutex_unlock(&v->vxi11_wd_lock);
+            _wd_abort(v);
+            pthread_mutex_lock(&v->vxi11_wd_lock);
+            v->vxi11_wd_firing = false;
+            v->vxi11_wd_fired = true;
+            pthread_cond_broadcast(&v->vxi11_wd_cond);
+        } else if (timed && _wd_expired(&wake)) {
+            v->vxi11_ka_busy = true;
+            pthread_mutex_unlock(&v->vxi11_wd_lock);
+            _ka_probe(v);
+            pthread_mutex_lock(&v->vxi11_wd_lock);
+            v->vxi11_ka_busy = false;
+            clock_gettime(CLOCK_MONOTONIC, &v->vxi11_ka_last);
+            pthread_cond_broadcast(&v->vxi11_wd_cond);
+        } else {
+            if (v->vxi11_wd_armed && !v->vxi11_wd_fired && (!timed
+                    || v->vxi11_wd_expire.tv_sec < wake.tv_sec
+                    || (v->vxi11_wd_expire.tv_sec == wake.tv_sec
+                        && v->vxi11_wd_expire.tv_nsec < wake.tv_nsec))) {
+                wake = v->vxi11_wd_expire;
+                timed = true;
+            }
+            if (timed)
+                pthread_cond_timedwait(&v->vxi11_wd_cond, &v->vxi11_wd_lock,
+                                       &wake);
+            else
+                pthread_cond_wait(&v->vxi11_wd_cond, &v->vxi11_wd_lock);
+        }
+    }
+    pthread_mutex_unlock(&v->vxi11_wd_lock);
+    return NULL;
+}
+
+static int
+_wd_start(vxi11dev_t v)
+{
+    if (!v->vxi11_wd_running) {
+        if (pthread_create(&v->vxi11_wd_thread, NULL, _wd_thread, v) != 0)
+            return -1;
+        v->vxi11_wd_running = true;
+    }
+    return 0;
+}
+
+static int _wd_disarm(vxi11dev_t v, int res);
+
+/* Start an operation.  Returns VXI11_ERR_NOCHAN (or _LINKINVAL) if the
+ * link went away while waiting for a keepalive, else 0.
+ */
+static int
+_wd_arm(vxi11dev_t v)
+{
+    bool timed;
+
+    if (v->vxi11_wd_depth++ > 0)
+        return 0;
+    timed = (v->vxi11_deadline > 0 && _wd_start(v) == 0);
+    _ka_enter(v);
+    if (v->vxi11_core == NULL || v->vxi11_lid == VXI11_NOLID) {
+        _wd_disarm(v, 0);
+        return v->vxi11_core == NULL ? VXI11_ERR_NOCHAN
+                                     : VXI11_ERR_LINKINVAL;
+    }
+    if (!timed)
+        return 0;
+    pthread_mutex_lock(&v->vxi11_wd_lock);
+    clock_gettime(CLOCK_MONOTONIC, &v->vxi11_wd_expire);
+    v->vxi11_wd_expire.tv_sec += v->vxi11_deadline / 1000;
+    v->vxi11_wd_expire.tv_nsec += (v->vxi11_deadline % 1000) * 1000000;
+    if (v->vxi11_wd_expire.tv_nsec >= 1000000000) {
+        v->vxi11_wd_expire.tv_sec++;
+        v->vxi11_wd_expire.tv_nsec -= 1000000000;
+    }
+    v->vxi11_wd_lid = v->vxi11_lid;
+    v->vxi11_wd_abrt = v->vxi11_abrt;
+    v->vxi11_wd_addr = v->vxi11_core_addr;
+    v->vxi11_wd_abortPort = v->vxi11_abortPort;
+    v->vxi11_wd_armed = true;
+    v->vxi11_wd_fired = false;
+    pthread_cond_broadcast(&v->vxi11_wd_cond);
+    pthread_mutex_unlock(&v->vxi11_wd_lock);
+    return 0;
+}
+
+static int
+_wd_disarm(vxi11dev_t v, int res)
+{
+    bool fired;
+
+    if (--v->vxi11_wd_depth > 0)
+        return res;
+    _ka_leave(v);
+    if (!v->vxi11_wd_armed)
+        return res;
+    pthread_mutex_lock(&v->vxi11_wd_lock);
+    while (v->vxi11_wd_firing)
+        pthread_cond_wait(&v->vxi11_wd_cond, &v->vxi11_wd_lock);
+    v->vxi11_wd_armed = false;
+    fired = v->vxi11_wd_fired;
+    if (fired) {
+        if (v->vxi11_wd_res != VXI11_ABRT_CREATE)
+            _stats_rpc_err(v, VXI11_PROC_ABORT, v->vxi11_wd_res,
+                           &v->vxi11_wd_t1, &v->vxi11_wd_t2,
+                           v->vxi11_wd_res == VXI11_CORE_RPCERR
+                           ? &v->vxi11_wd_rpcerr : NULL);
+        if (v->vxi11_abrt == NULL)
+            v->vxi11_abrt = v->vxi11_wd_abrt;
+    }
+    v->vxi11_wd_abrt = NULL;
+    pthread_mutex_unlock(&v->vxi11_wd_lock);
+    return (fired && res != 0) ? VXI11_ERR_ABORT : res;
+}
+
+/* True if an operation must take (and drop) its own device lock, i.e.
+ * doLocking is set and no vxi11_begin () transaction is covering it.
+ */
+static bool
+_need_lock(vxi11dev_t v)
+{
+    return v->vxi11_doLocking && v->vxi11_txn_depth == 0;
 }
 
 /* Execute multiple write RPC's of maxRecvSize or less.  
- * If doLocking, take one lock covering multiple write RPC's.
+ * If doLocking, take one lock covering multiple write RPC's,
+ * unless a transaction already holds it.
  * Decrease io_timeout each time through the loop.
  * If doEndw, set ENDW flag on the last chunk.
  */
@@ -230,8 +811,9 @@ int
 vxi11_write(vxi11dev_t v, char *buf, int len)
 {
     long flags = 0;
-    unsigned long size, try, tmout;
+    unsigned long size, try, tmout, elapsed;
     int res = 0, lres;
+    bool locked;
     struct timeval t1, t2;
 
     assert(v->vxi11_magic == VXI11_MAGIC);
@@ -240,8 +822,11 @@ vxi11_write(vxi11dev_t v, char *buf, int len)
     if (v->vxi11_lid == VXI11_NOLID)
         return VXI11_ERR_LINKINVAL;
 
-    if (v->vxi11_doLocking && (lres = vxi11_lock(v)) != 0)
-        return lres;
+    if ((res = _wd_arm(v)) != 0)
+        return res;
+    if ((locked = _need_lock(v)) && (lres = vxi11_lock(v)) != 0)
+        return _wd_disarm(v, lres);
+    v->vxi11_stats.writes++;
     tmout = v->vxi11_io_timeout; 
     while (res == 0 && len > 0) {
         if (len > v->vxi11_maxRecvSize) {
@@ -255,23 +840,26 @@ vxi11_write(vxi11dev_t v, char *buf, int len)
         res = vxi11_device_write(v->vxi11_core, v->vxi11_lid, flags,
                                  tmout, 0, buf, try, &size);
         gettimeofday(&t2, NULL);
+        _stats_rpc(v, VXI11_PROC_WRITE, res, &t1, &t2);
+        v->vxi11_stats.write_chunks++;
         if (res == 0) {
 #if ICS8064_OLDFW_WORKAROUND
             if (size == 0)   /* ICS 8064 Rev X0.00 Ver 08.01.22 */
                 size = try;  /*  size = 0 on success, which violates B.6.21 */
 #endif
-            buf -= size;
+            v->vxi11_stats.bytes_written += size;
+            buf += size;
             len -= size;
-            tmout -= _timersubms(&t2, &t1);
-            if (len > 0 && tmout <= 0)
+            elapsed = _timersubms(&t2, &t1);
+            tmout = elapsed < tmout ? tmout - elapsed : 0;
+            if (len > 0 && tmout == 0)
                 res = VXI11_ERR_IOTIMEOUT;
         }
     }
-    if (v->vxi11_doLocking && (lres = vxi11_unlock(v)) != 0)
-        if (res == 0)
-            return lres;
+    if (locked && (lres = vxi11_unlock(v)) != 0 && res == 0)
+        res = lres;
 
-    return res;
+    return _wd_disarm(v, res);
 }
 
 int 
@@ -281,16 +869,17 @@ vxi11_writestr(vxi11dev_t v, char *str)
 }
 
 /* Execute multiple read RPC's.
- * If doLocking, take one lock covering multiple read RPC's.
+ * If doLocking, take one lock covering multiple read RPC's,
+ * unless a transaction already holds it.
  * Decrease io_timeout each time through the loop.
  */
 int 
 vxi11_read(vxi11dev_t v, char *buf, int len, int *numreadp)
 {
     int lres, res = 0;
+    bool locked;
     struct timeval t1, t2;
-    unsigned long tmout;
-    char *data;
+    unsigned long tmout, elapsed;
     int try;
     long flags = 0;
     int reason = 0;
@@ -304,8 +893,11 @@ vxi11_read(vxi11dev_t v, char *buf, int len, int *numreadp)
     if (v->vxi11_termCharSet)
         flags |= VXI11_FLAG_TERMCHRSET;
 
-    if (v->vxi11_doLocking && (lres = vxi11_lock(v)) != 0)
-            return lres;
+    if ((res = _wd_arm(v)) != 0)
+        return res;
+    if ((locked = _need_lock(v)) && (lres = vxi11_lock(v)) != 0)
+        return _wd_disarm(v, lres);
+    v->vxi11_stats.reads++;
     tmout = v->vxi11_io_timeout; 
     while (res == 0 && len > 0 && reason == 0) {
         gettimeofday(&t1, NULL);
@@ -313,22 +905,135 @@ vxi11_read(vxi11dev_t v, char *buf, int len, int *numreadp)
                                 tmout, 0, v->vxi11_termChar, &reason, 
                                 buf, &try, len);
         gettimeofday(&t2, NULL);
+        _stats_rpc(v, VXI11_PROC_READ, res, &t1, &t2);
         if (res == 0) {
+            v->vxi11_stats.bytes_read += try;
             count += try;
             len -= try;
             buf += try;
-            tmout -= _timersubms(&t2, &t1);
-            if (len > 0 && tmout <= 0)
+            elapsed = _timersubms(&t2, &t1);
+            tmout = elapsed < tmout ? tmout - elapsed : 0;
+            if (len > 0 && tmout == 0)
                 res = VXI11_ERR_IOTIMEOUT;
         }
     }
-    if (v->vxi11_doLocking && (lres = vxi11_unlock(v)) != 0)
-        if (res == 0)
-            return lres;
+    if (res == 0) {
+        if ((reason & VXI11_REASON_END))
+            v->vxi11_stats.reason_end++;
+        else if ((reason & VXI11_REASON_CHR))
+            v->vxi11_stats.reason_chr++;
+        else if ((reason & VXI11_REASON_REQCNT))
+            v->vxi11_stats.reason_reqcnt++;
+    }
+    if (locked && (lres = vxi11_unlock(v)) != 0 && res == 0)
+        res = lres;
 
     if (numreadp)
         *numreadp = count;
-    return res;
+    return _wd_disarm(v, res);
+}
+
+/* Pick the initial buffer size for vxi11_read_alloc ():  the size of
+ * the last response if there was one, else the device's maxRecvSize
+ * (a fair guess at its buffering), clamped to a sane range.
+ */
+static int
+_read_alloc_size(vxi11dev_t v)
+{
+    unsigned long size = v->vxi11_read_hint;
+
+    if (size == 0)
+        size = v->vxi11_maxRecvSize;
+    if (size < VXI11_READ_ALLOC_MIN)
+        size = VXI11_READ_ALLOC_MIN;
+    if (size > VXI11_READ_ALLOC_MAX)
+        size = VXI11_READ_ALLOC_MAX;
+    return size;
+}
+
+int
+vxi11_read_alloc(vxi11dev_t v, char **bufp, int *numreadp)
+{
+    int lres, res = 0;
+    bool locked;
+    struct timeval t1, t2;
+    unsigned long tmout, elapsed;
+    int try;
+    long flags = 0;
+    int reason = 0;
+    int count = 0;
+    int size;
+    char *buf, *new;
+
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    if (v->vxi11_core == NULL)
+        return VXI11_ERR_NOCHAN;
+    if (v->vxi11_lid == VXI11_NOLID)
+        return VXI11_ERR_LINKINVAL;
+    if (v->vxi11_termCharSet)
+        flags |= VXI11_FLAG_TERMCHRSET;
+    size = _read_alloc_size(v);
+    if (!(buf = malloc(size + 1)))
+        return VXI11_ERR_RESOURCES;
+
+    if ((res = _wd_arm(v)) != 0) {
+        free(buf);
+        return res;
+    }
+    if ((locked = _need_lock(v)) && (lres = vxi11_lock(v)) != 0) {
+        free(buf);
+        return _wd_disarm(v, lres);
+    }
+    v->vxi11_stats.reads++;
+    tmout = v->vxi11_io_timeout;
+    while (res == 0 && reason == 0) {
+        if (count == size) {
+            if (size > INT_MAX / 2 - 1) {
+                res = VXI11_ERR_RESOURCES;
+                break;
+            }
+            if (!(new = realloc(buf, size * 2 + 1))) {
+                res = VXI11_ERR_RESOURCES;
+                break;
+            }
+            buf = new;
+            size *= 2;
+        }
+        gettimeofday(&t1, NULL);
+        res = vxi11_device_read(v->vxi11_core, v->vxi11_lid, flags,
+                                tmout, 0, v->vxi11_termChar, &reason,
+                                buf + count, &try, size - count);
+        gettimeofday(&t2, NULL);
+        _stats_rpc(v, VXI11_PROC_READ, res, &t1, &t2);
+        if (res == 0) {
+            v->vxi11_stats.bytes_read += try;
+            count += try;
+            elapsed = _timersubms(&t2, &t1);
+            tmout = elapsed < tmout ? tmout - elapsed : 0;
+            if (reason == VXI11_REASON_REQCNT)
+                reason = 0;     /* buffer filled - grow and keep going */
+            if (reason == 0 && tmout == 0)
+                res = VXI11_ERR_IOTIMEOUT;
+        }
+    }
+    if (res == 0) {
+        if ((reason & VXI11_REASON_END))
+            v->vxi11_stats.reason_end++;
+        else if ((reason & VXI11_REASON_CHR))
+            v->vxi11_stats.reason_chr++;
+        v->vxi11_read_hint = count;
+    }
+    if (locked && (lres = vxi11_unlock(v)) != 0 && res == 0)
+        res = lres;
+
+    if (res == 0) {
+        buf[count] = '\0';
+        *bufp = buf;
+        if (numreadp)
+            *numreadp = count;
+    } else
+        free(buf);
+    return _wd_disarm(v, res);
 }
 
 int 
@@ -348,6 +1053,8 @@ int
 vxi11_readstb(vxi11dev_t v, unsigned char *stbp)
 {
     long flags = 0;
+    struct timeval t1, t2;
+    int res;
 
     assert(v->vxi11_magic == VXI11_MAGIC);
     if (v->vxi11_core == NULL)
@@ -356,15 +1063,23 @@ vxi11_readstb(vxi11dev_t v, unsigned char *stbp)
         return VXI11_ERR_LINKINVAL;
     if (v->vxi11_doLocking)
         flags |= VXI11_FLAG_WAITLOCK;
-    return vxi11_device_readstb(v->vxi11_core, v->vxi11_lid, flags,
-                                v->vxi11_io_timeout, v->vxi11_lock_timeout,
-                                stbp);
+    if ((res = _wd_arm(v)) != 0)
+        return res;
+    gettimeofday(&t1, NULL);
+    res = vxi11_device_readstb(v->vxi11_core, v->vxi11_lid, flags,
+                               v->vxi11_io_timeout, v->vxi11_lock_timeout,
+                               stbp);
+    gettimeofday(&t2, NULL);
+    _stats_rpc(v, VXI11_PROC_READSTB, res, &t1, &t2);
+    return _wd_disarm(v, res);
 }
 
 int 
 vxi11_trigger(vxi11dev_t v)
 {
     long flags = 0;
+    struct timeval t1, t2;
+    int res;
 
     assert(v->vxi11_magic == VXI11_MAGIC);
     if (v->vxi11_core == NULL)
@@ -373,14 +1088,22 @@ vxi11_trigger(vxi11dev_t v)
         return VXI11_ERR_LINKINVAL;
     if (v->vxi11_doLocking)
         flags |= VXI11_FLAG_WAITLOCK;
-    return vxi11_device_trigger(v->vxi11_core, v->vxi11_lid, flags,
+    if ((res = _wd_arm(v)) != 0)
+        return res;
+    gettimeofday(&t1, NULL);
+    res = vxi11_device_trigger(v->vxi11_core, v->vxi11_lid, flags,
                                 v->vxi11_io_timeout, v->vxi11_lock_timeout);
+    gettimeofday(&t2, NULL);
+    _stats_rpc(v, VXI11_PROC_TRIGGER, res, &t1, &t2);
+    return _wd_disarm(v, res);
 }
 
 int 
 vxi11_clear(vxi11dev_t v)
 {
     long flags = 0;
+    struct timeval t1, t2;
+    int res;
 
     assert(v->vxi11_magic == VXI11_MAGIC);
     if (v->vxi11_core == NULL)
@@ -389,14 +1112,22 @@ vxi11_clear(vxi11dev_t v)
         return VXI11_ERR_LINKINVAL;
     if (v->vxi11_doLocking)
         flags |= VXI11_FLAG_WAITLOCK;
-    return vxi11_device_clear(v->vxi11_core, v->vxi11_lid, flags,
+    if ((res = _wd_arm(v)) != 0)
+        return res;
+    gettimeofday(&t1, NULL);
+    res = vxi11_device_clear(v->vxi11_core, v->vxi11_lid, flags,
                               v->vxi11_io_timeout, v->vxi11_lock_timeout);
+    gettimeofday(&t2, NULL);
+    _stats_rpc(v, VXI11_PROC_CLEAR, res, &t1, &t2);
+    return _wd_disarm(v, res);
 }
 
 int 
 vxi11_remote(vxi11dev_t v)
 {
     long flags = 0;
+    struct timeval t1, t2;
+    int res;
 
     assert(v->vxi11_magic == VXI11_MAGIC);
     if (v->vxi11_core == NULL)
@@ -405,14 +1136,22 @@ vxi11_remote(vxi11dev_t v)
         return VXI11_ERR_LINKINVAL;
     if (v->vxi11_doLocking)
         flags |= VXI11_FLAG_WAITLOCK;
-    return vxi11_device_remote(v->vxi11_core, v->vxi11_lid, flags,
-                              v->vxi11_io_timeout, v->vxi11_lock_timeout);
+    if ((res = _wd_arm(v)) != 0)
+        return res;
+    gettimeofday(&t1, NULL);
+    res = vxi11_device_remote(v->vxi11_core, v->vxi11_lid, flags,
+                               v->vxi11_io_timeout, v->vxi11_lock_timeout);
+    gettimeofday(&t2, NULL);
+    _stats_rpc(v, VXI11_PROC_REMOTE, res, &t1, &t2);
+    return _wd_disarm(v, res);
 }
 
 int 
 vxi11_local(vxi11dev_t v)
 {
     long flags = 0;
+    struct timeval t1, t2;
+    int res;
 
     assert(v->vxi11_magic == VXI11_MAGIC);
     if (v->vxi11_core == NULL)
@@ -421,14 +1160,22 @@ vxi11_local(vxi11dev_t v)
         return VXI11_ERR_LINKINVAL;
     if (v->vxi11_doLocking)
         flags |= VXI11_FLAG_WAITLOCK;
-    return vxi11_device_local(v->vxi11_core, v->vxi11_lid, flags,
+    if ((res = _wd_arm(v)) != 0)
+        return res;
+    gettimeofday(&t1, NULL);
+    res = vxi11_device_local(v->vxi11_core, v->vxi11_lid, flags,
                               v->vxi11_io_timeout, v->vxi11_lock_timeout);
+    gettimeofday(&t2, NULL);
+    _stats_rpc(v, VXI11_PROC_LOCAL, res, &t1, &t2);
+    return _wd_disarm(v, res);
 }
 
 int 
 vxi11_lock(vxi11dev_t v)
 {
     long flags = 0;
+    struct timeval t1, t2;
+    int res;
 
     assert(v->vxi11_magic == VXI11_MAGIC);
     if (v->vxi11_core == NULL)
@@ -437,30 +1184,263 @@ vxi11_lock(vxi11dev_t v)
         return VXI11_ERR_LINKINVAL;
     if (v->vxi11_doLocking)
         flags |= VXI11_FLAG_WAITLOCK;
-    return vxi11_device_lock(v->vxi11_core, v->vxi11_lid, 
-                             flags, v->vxi11_lock_timeout);
+    if ((res = _wd_arm(v)) != 0)
+        return res;
+    gettimeofday(&t1, NULL);
+    res = vxi11_device_lock(v->vxi11_core, v->vxi11_lid, 
+                            flags, v->vxi11_lock_timeout);
+    gettimeofday(&t2, NULL);
+    _stats_rpc(v, VXI11_PROC_LOCK, res, &t1, &t2);
+    v->vxi11_stats.lock_wait_usec += _timersubus(&t2, &t1);
+    return _wd_disarm(v, res);
 }
 
 int 
 vxi11_unlock(vxi11dev_t v)
 {
+    struct timeval t1, t2;
+    int res;
+
     assert(v->vxi11_magic == VXI11_MAGIC);
     if (v->vxi11_core == NULL)
         return VXI11_ERR_NOCHAN;
     if (v->vxi11_lid == VXI11_NOLID)
         return VXI11_ERR_LINKINVAL;
-    return vxi11_device_unlock(v->vxi11_core, v->vxi11_lid);
+    if ((res = _wd_arm(v)) != 0)
+        return res;
+    gettimeofday(&t1, NULL);
+    res = vxi11_device_unlock(v->vxi11_core, v->vxi11_lid);
+    gettimeofday(&t2, NULL);
+    _stats_rpc(v, VXI11_PROC_UNLOCK, res, &t1, &t2);
+    return _wd_disarm(v, res);
+}
+
+int
+vxi11_begin(vxi11dev_t v)
+{
+    int res;
+
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    if (v->vxi11_txn_depth == 0 && v->vxi11_doLocking) {
+        if ((res = vxi11_lock(v)) != 0)
+            return res;
+        v->vxi11_txn_locked = true;
+    }
+    v->vxi11_txn_depth++;
+    return 0;
+}
+
+int
+vxi11_end(vxi11dev_t v)
+{
+    int res = 0;
+
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    if (v->vxi11_txn_depth == 0)
+        return VXI11_ERR_NOLOCK;
+    if (--v->vxi11_txn_depth == 0 && v->vxi11_txn_locked) {
+        v->vxi11_txn_locked = false;
+        res = vxi11_unlock(v);
+    }
+    return res;
 }
 
 int 
 vxi11_abort(vxi11dev_t v)
 {
+    struct timeval t1, t2;
+    int res;
+
     assert(v->vxi11_magic == VXI11_MAGIC);
+    _ka_enter(v);
     if (v->vxi11_abrt == NULL)
+        res = VXI11_ERR_NOCHAN;
+    else if (v->vxi11_lid == VXI11_NOLID)
+        res = VXI11_ERR_LINKINVAL;
+    else {
+        gettimeofday(&t1, NULL);
+        res = vxi11_device_abort(v->vxi11_abrt, v->vxi11_lid);
+        gettimeofday(&t2, NULL);
+        _stats_rpc(v, VXI11_PROC_ABORT, res, &t1, &t2);
+    }
+    _ka_leave(v);
+    return res;
+}
+
+/* Issue a GPIB device_docmd with 'len' bytes of 'in' (each 'datasize'
+ * bytes wide, big-endian).  Up to 'outlen' bytes of the reply are
+ * copied to 'out'.
+ */
+static int
+_docmd(vxi11dev_t v, long cmd, long datasize, unsigned char *in, int len,
+       unsigned char *out, int outlen)
+{
+    int data_out_len = 0;
+    long flags = 0;
+    struct timeval t1, t2;
+    int res;
+
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    if (v->vxi11_core == NULL)
         return VXI11_ERR_NOCHAN;
     if (v->vxi11_lid == VXI11_NOLID)
         return VXI11_ERR_LINKINVAL;
-    return vxi11_device_abort(v->vxi11_abrt, v->vxi11_lid);
+    if (v->vxi11_doLocking)
+        flags |= VXI11_FLAG_WAITLOCK;
+    if ((res = _wd_arm(v)) != 0)
+        return res;
+    gettimeofday(&t1, NULL);
+    res = vxi11_device_docmd(v->vxi11_core, v->vxi11_lid, flags,
+                             v->vxi11_io_timeout, v->vxi11_lock_timeout,
+                             cmd, 1, datasize, (char *)in, len,
+                             (char *)out, outlen, &data_out_len);
+    gettimeofday(&t2, NULL);
+    _stats_rpc(v, VXI11_PROC_DOCMD, res, &t1, &t2);
+    if (res == 0 && out && data_out_len < outlen)
+        res = VXI11_ERR_IOERROR;
+    return _wd_disarm(v, res);
+}
+
+static int
+_docmd_short(vxi11dev_t v, long cmd, int val, int *valp)
+{
+    unsigned char in[2], out[2];
+    int res;
+
+    in[0] = (val >> 8) & 0xff;
+    in[1] = val & 0xff;
+    res = _docmd(v, cmd, 2, in, 2, valp ? out : NULL, valp ? 2 : 0);
+    if (res == 0 && valp)
+        *valp = (out[0] << 8) | out[1];
+    return res;
+}
+
+static int
+_docmd_long(vxi11dev_t v, long cmd, int val)
+{
+    unsigned char in[4];
+
+    in[0] = (val >> 24) & 0xff;
+    in[1] = (val >> 16) & 0xff;
+    in[2] = (val >> 8) & 0xff;
+    in[3] = val & 0xff;
+    return _docmd(v, cmd, 4, in, 4, NULL, 0);
+}
+
+int
+vxi11_gpib_send_command(vxi11dev_t v, unsigned char *cmd, int len)
+{
+    return _docmd(v, VXI11_DOCMD_SEND_COMMAND, 1, cmd, len, NULL, 0);
+}
+
+int
+vxi11_gpib_bus_status(vxi11dev_t v, int what, int *valp)
+{
+    return _docmd_short(v, VXI11_DOCMD_BUS_STATUS, what, valp);
+}
+
+int
+vxi11_gpib_atn(vxi11dev_t v, bool enable)
+{
+    return _docmd_short(v, VXI11_DOCMD_ATN_CONTROL, enable ? 1 : 0, NULL);
+}
+
+int
+vxi11_gpib_ren(vxi11dev_t v, bool enable)
+{
+    return _docmd_short(v, VXI11_DOCMD_REN_CONTROL, enable ? 1 : 0, NULL);
+}
+
+int
+vxi11_gpib_ifc(vxi11dev_t v)
+{
+    return _docmd(v, VXI11_DOCMD_IFC_CONTROL, 0, NULL, 0, NULL, 0);
+}
+
+int
+vxi11_gpib_bus_address(vxi11dev_t v, int addr)
+{
+    return _docmd_long(v, VXI11_DOCMD_BUS_ADDRESS, addr);
+}
+
+int
+vxi11_gpib_pass_control(vxi11dev_t v, int addr)
+{
+    return _docmd_long(v, VXI11_DOCMD_PASS_CONTROL, addr);
+}
+
+int
+vxi11_gpib_trigger(vxi11dev_t v, int *pads, int *sads, int n)
+{
+    unsigned char *cmd;
+    int i, len = 0, res;
+
+    if (!(cmd = malloc(2 * n + 3)))
+        return VXI11_ERR_RESOURCES;
+    cmd[len++] = VXI11_GPIB_UNT;
+    cmd[len++] = VXI11_GPIB_UNL;
+    for (i = 0; i < n; i++) {
+        cmd[len++] = VXI11_GPIB_MLA(pads[i]);
+        if (sads && sads[i] >= 0)
+            cmd[len++] = VXI11_GPIB_MSA(sads[i]);
+    }
+    cmd[len++] = VXI11_GPIB_GET;
+    res = vxi11_gpib_send_command(v, cmd, len);
+    free(cmd);
+    return res;
+}
+
+int
+vxi11_gpib_sweep(vxi11dev_t v, int *pads, int *sads, int n,
+                 unsigned char *stbs, unsigned long *rqsp, bool always)
+{
+    unsigned char cmd[3];
+    unsigned long rqs = 0;
+    int i, srq, addr, count, len, res, eres;
+
+    if (n < 0 || n > 31)
+        return VXI11_ERR_PARAMETER;
+    memset(stbs, 0, n);
+    if ((res = vxi11_begin(v)) != 0)
+        return res;
+    if (!always) {
+        if ((res = vxi11_gpib_bus_status(v, VXI11_DOCMD_STAT_SRQ, &srq)) != 0
+                || !srq)
+            goto done;
+    }
+    if ((res = vxi11_gpib_bus_status(v, VXI11_DOCMD_STAT_BUSADDR,
+                                     &addr)) != 0)
+        goto done;
+    /* Once SPE may have gone out, always finish with SPD/UNT, even
+     * on error, so the bus is not left in serial poll mode.
+     */
+    cmd[0] = VXI11_GPIB_UNL;
+    cmd[1] = VXI11_GPIB_MLA(addr);
+    cmd[2] = VXI11_GPIB_SPE;
+    res = vxi11_gpib_send_command(v, cmd, 3);
+    for (i = 0; i < n && res == 0; i++) {
+        len = 0;
+        cmd[len++] = VXI11_GPIB_MTA(pads[i]);
+        if (sads && sads[i] >= 0)
+            cmd[len++] = VXI11_GPIB_MSA(sads[i]);
+        if ((res = vxi11_gpib_send_command(v, cmd, len)) == 0
+                && (res = vxi11_read(v, (char *)&stbs[i], 1, &count)) == 0) {
+            if (count != 1)
+                res = VXI11_ERR_IOERROR;
+            else if (stbs[i] & 0x40)
+                rqs |= 1UL << i;
+        }
+    }
+    cmd[0] = VXI11_GPIB_SPD;
+    cmd[1] = VXI11_GPIB_UNT;
+    if ((eres = vxi11_gpib_send_command(v, cmd, 2)) != 0 && res == 0)
+        res = eres;
+done:
+    if ((eres = vxi11_end(v)) != 0 && res == 0)
+        res = eres;
+    if (rqsp)
+        *rqsp = rqs;
+    return res;
 }
 
 void
@@ -468,13 +1448,36 @@ vxi11_set_iotimeout(vxi11dev_t v, unsigned long timeout)
 {
     assert(v->vxi11_magic == VXI11_MAGIC);
     v->vxi11_io_timeout = timeout;
-    if (v->vxi11_core != NULL) {
-        struct timeval io_timeout;
-        timerclear(&io_timeout);
-        io_timeout.tv_sec = timeout / 1000;
-        io_timeout.tv_usec = (timeout % 1000) * 1000;
-        clnt_control(v->vxi11_core, CLSET_TIMEOUT, (caddr_t)&io_timeout);
+    _ka_enter(v);
+    if (v->vxi11_core != NULL)
+        vxi11_set_rpc_timeout(v->vxi11_core, timeout);
+    _ka_leave(v);
+}
+
+void
+vxi11_set_deadline(vxi11dev_t v, unsigned long timeout)
+{
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    v->vxi11_deadline = timeout;
+}
+
+int
+vxi11_set_keepalive(vxi11dev_t v, unsigned long idle)
+{
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    if (idle > 0 && _wd_start(v) < 0)
+        return VXI11_ERR_RESOURCES;
+    if (v->vxi11_wd_running) {
+        pthread_mutex_lock(&v->vxi11_wd_lock);
+        v->vxi11_ka_idle = idle;
+        clock_gettime(CLOCK_MONOTONIC, &v->vxi11_ka_last);
+        pthread_cond_broadcast(&v->vxi11_wd_cond);
+        pthread_mutex_unlock(&v->vxi11_wd_lock);
     }
+    _ka_enter(v);
+    _ka_tune(v);
+    _ka_leave(v);
+    return 0;
 }
 
 void
@@ -506,10 +1509,101 @@ vxi11_set_endw(vxi11dev_t v, bool doEndw)
     v->vxi11_doEndw = doEndw;
 }
 
+void
+vxi11_set_nodelay(vxi11dev_t v, bool doNodelay)
+{
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    if (doNodelay)
+        v->vxi11_sockflags |= VXI11_SOCK_NODELAY;
+    else
+        v->vxi11_sockflags &= ~VXI11_SOCK_NODELAY;
+    _ka_enter(v);
+    if (v->vxi11_core != NULL)
+        (void)vxi11_tune_channel(v->vxi11_core, v->vxi11_sockflags, 0);
+    if (v->vxi11_abrt != NULL)
+        (void)vxi11_tune_channel(v->vxi11_abrt, v->vxi11_sockflags, 0);
+    _ka_leave(v);
+}
+
+void
+vxi11_set_tcp_keepalive(vxi11dev_t v, bool doKeepalive)
+{
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    if (doKeepalive)
+        v->vxi11_sockflags |= VXI11_SOCK_KEEPALIVE;
+    else
+        v->vxi11_sockflags &= ~VXI11_SOCK_KEEPALIVE;
+    _ka_enter(v);
+    if (v->vxi11_core != NULL)
+        (void)vxi11_tune_channel(v->vxi11_core, v->vxi11_sockflags, 0);
+    if (v->vxi11_abrt != NULL)
+        (void)vxi11_tune_channel(v->vxi11_abrt, v->vxi11_sockflags, 0);
+    _ka_leave(v);
+}
+
+void
+vxi11_set_portcache(vxi11dev_t v, bool doPortcache)
+{
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    v->vxi11_doPortcache = doPortcache;
+}
+
+void
+vxi11_set_maxconn(vxi11dev_t v, int maxconn)
+{
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    v->vxi11_maxconn = maxconn;
+}
+
+void
+vxi11_set_conngroup(vxi11dev_t v, const char *group)
+{
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    snprintf(v->vxi11_conngroup, sizeof(v->vxi11_conngroup), "%s",
+             group ? group : "");
+}
+
+int
+vxi11_set_host_maxconn(char *host, int maxconn)
+{
+    struct host_maxconn *hp;
+
+    pthread_mutex_lock(&host_maxconn_lock);
+    for (hp = host_maxconn; hp != NULL; hp = hp->next)
+        if (!strcmp(hp->host, host))
+            break;
+    if (!hp) {
+        if (!(hp = malloc(sizeof(struct host_maxconn)))) {
+            pthread_mutex_unlock(&host_maxconn_lock);
+            return -1;
+        }
+        snprintf(hp->host, sizeof(hp->host), "%s", host);
+        hp->next = host_maxconn;
+        host_maxconn = hp;
+    }
+    hp->maxconn = maxconn > 0 ? maxconn : 1;
+    pthread_mutex_unlock(&host_maxconn_lock);
+    return 0;
+}
+
+void
+vxi11_get_stats(vxi11dev_t v, struct vxi11_stats *stats)
+{
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    *stats = v->vxi11_stats;
+}
+
+void
+vxi11_clear_stats(vxi11dev_t v)
+{
+    assert(v->vxi11_magic == VXI11_MAGIC);
+    memset(&v->vxi11_stats, 0, sizeof(v->vxi11_stats));
+}
+
 void vxi11_set_device_debug(bool doDebug)
 {
     vxi11_set_core_debug(doDebug);
-    vxi11_device_debug = 1;
+    vxi11_device_debug = doDebug;
 }
 
 static char *
@@ -535,6 +1629,31 @@ vxi11_perror(vxi11dev_t v, int err, char *str)
     fprintf(stderr, "%s (%s): %s\n", str, v->vxi11_devname, errstr);
 }
 
+/* Like clnt_sperror (), but for the error saved in the handle, since
+ * the CLIENT's own error status may belong to another thread's call.
+ */
+static char *
+_sperror(vxi11dev_t v, char *s)
+{
+    struct rpc_err *e = &v->vxi11_rpcerr;
+    int n;
+
+    n = snprintf(v->vxi11_errstr, sizeof(v->vxi11_errstr), "%s: %s", s,
+                 clnt_sperrno(e->re_status));
+    switch (e->re_status) {
+        case RPC_CANTSEND:
+        case RPC_CANTRECV:
+        case RPC_SYSTEMERROR:
+            if (n < sizeof(v->vxi11_errstr))
+                snprintf(v->vxi11_errstr + n, sizeof(v->vxi11_errstr) - n,
+                         "; errno = %s", strerror(e->re_errno));
+            break;
+        default:
+            break;
+    }
+    return v->vxi11_errstr;
+}
+
 char * 
 vxi11_strerror(vxi11dev_t v, int err)
 {
@@ -548,11 +1667,9 @@ vxi11_strerror(vxi11dev_t v, int err)
             desc = clnt_spcreateerror("abrt");
             break;
         case VXI11_CORE_RPCERR:
-            desc = clnt_sperror(v->vxi11_core, "core");
-            break;
+            return _sperror(v, "core");
         case VXI11_ABRT_RPCERR:
-            desc = clnt_sperror(v->vxi11_abrt, "abrt");
-            break;
+            return _sperror(v, "abrt");
         default:
             desc = _lookup_err(err);
             break;
@@ -26,6 +26,11 @@ extern "C" {
 
 typedef struct vxi11_device_struct *vxi11dev_t;
 
+/* A handle must be used by one thread at a time, but different threads
+ * may each drive their own handle concurrently, even when the handles
+ * share a core channel to the same host.
+ */
+
 /* Create a vxi11 device handle.
  * Returns object or NULL on out of memory error.
  */
@@ -41,6 +46,8 @@ void vxi11_destroy(vxi11dev_t v);
  * "hostname:device", e.g. "myscope:inst0" or "gateway:gpib0,15".
  * If 'doAbort' is true, also open the abort channel, which allows
  * vxi11_abort () to be called on the handle.
+ * The core port may be remembered on disk so later opens of the same
+ * instrument can skip the portmapper - see vxi11_set_portcache ().
  * Returns 0 on success or an error code which can be decoded with
  * vxi11_strerror ().
  */
@@ -80,6 +87,17 @@ int vxi11_writestr(vxi11dev_t v, char *str);
  */
 int vxi11_read(vxi11dev_t v, char *buf, int len, int *numreadp);
 
+/* Read a response of unknown length from the open vxi11 device handle
+ * into a buffer allocated by the library.  The first request is sized from
+ * the previous response on this handle (or the device's maxRecvSize), and
+ * the buffer is doubled whenever it fills before END or termChar arrives.
+ * On success, '*bufp' is NUL terminated (not counted in '*numreadp') and
+ * must be freed by the caller.  Termination, locking and timeout are as
+ * for vxi11_read ().  Returns 0 on success or an error code which can be
+ * decoded with vxi11_strerror ().
+ */
+int vxi11_read_alloc(vxi11dev_t v, char **bufp, int *numreadp);
+
 /* Read at most 'len' - 1 bytes into 'buf' from the open vxi11 device handle,
  * adding a terminating NULL.
  */
@@ -132,6 +150,23 @@ int vxi11_lock(vxi11dev_t v);
  */
 int vxi11_unlock(vxi11dev_t v);
 
+/* Begin a transaction on an open vxi11 device handle.  If locking is
+ * enabled (see vxi11_set_lockpolicy ()), take the VXI11 lock once here
+ * instead of around each vxi11_write () and vxi11_read (), so that e.g.
+ * a write/read/readstb query costs one lock/unlock pair in total.
+ * Transactions nest; only the outermost begin/end touch the lock.
+ * Returns 0 on success or an error code which can be decoded with
+ * vxi11_strerror ().
+ */
+int vxi11_begin(vxi11dev_t v);
+
+/* End a transaction started with vxi11_begin (), releasing the lock
+ * if this is the outermost one.
+ * Returns 0 on success or an error code which can be decoded with
+ * vxi11_strerror ().
+ */
+int vxi11_end(vxi11dev_t v);
+
 /* Abort any outstanding requests on an open vxi11 device handle.
  * Requires that device was opened with 'doAbort' true.
  * Returns 0 on success or an error code which can be decoded with
@@ -139,12 +174,113 @@ int vxi11_unlock(vxi11dev_t v);
  */
 int vxi11_abort(vxi11dev_t v);
 
+/* GPIB interface operations (VXI-11.2 device_docmd).
+ * These act on the bus as a whole, so the handle must be opened to a
+ * gateway's interface device, e.g. "gateway:gpib0", not an instrument.
+ * VXI locking is employed if so configured - see vxi11_set_lockpolicy ().
+ * Each returns 0 on success or an error code which can be decoded with
+ * vxi11_strerror () (VXI11_ERR_NOTSUPP if the gateway lacks docmd).
+ */
+
+/* GPIB command bytes for vxi11_gpib_send_command ().
+ */
+#define VXI11_GPIB_GTL      0x01        /* go to local */
+#define VXI11_GPIB_SDC      0x04        /* selected device clear */
+#define VXI11_GPIB_GET      0x08        /* group execute trigger */
+#define VXI11_GPIB_LLO      0x11        /* local lockout */
+#define VXI11_GPIB_DCL      0x14        /* device clear (all) */
+#define VXI11_GPIB_SPE      0x18        /* serial poll enable */
+#define VXI11_GPIB_SPD      0x19        /* serial poll disable */
+#define VXI11_GPIB_UNL      0x3f        /* unlisten */
+#define VXI11_GPIB_UNT      0x5f        /* untalk */
+#define VXI11_GPIB_MLA(a)   (0x20 | ((a) & 0x1f))   /* listen address */
+#define VXI11_GPIB_MTA(a)   (0x40 | ((a) & 0x1f))   /* talk address */
+#define VXI11_GPIB_MSA(a)   (0x60 | ((a) & 0x1f))   /* secondary address */
+
+/* Send 'len' command bytes with ATN asserted.
+ */
+int vxi11_gpib_send_command(vxi11dev_t v, unsigned char *cmd, int len);
+
+/* Query the bus: 'what' is one of VXI11_DOCMD_STAT_REMOTE, _SRQ, _NDAC,
+ * _SYS_CTRLR, _CTRLR_CHRG, _TALKER, _LISTENER (each returns 0 or 1 in
+ * 'valp') or _BUSADDR (returns the interface's own address).
+ */
+int vxi11_gpib_bus_status(vxi11dev_t v, int what, int *valp);
+
+/* Assert or release ATN.
+ */
+int vxi11_gpib_atn(vxi11dev_t v, bool enable);
+
+/* Assert or release REN (remote enable).
+ */
+int vxi11_gpib_ren(vxi11dev_t v, bool enable);
+
+/* Pulse IFC (interface clear).
+ */
+int vxi11_gpib_ifc(vxi11dev_t v);
+
+/* Set the interface's own GPIB address to 'addr' (0-30).
+ */
+int vxi11_gpib_bus_address(vxi11dev_t v, int addr);
+
+/* Pass control to the device at 'addr'.
+ */
+int vxi11_gpib_pass_control(vxi11dev_t v, int addr);
+
+/* Trigger 'n' devices at once with one group execute trigger: the
+ * command sequence UNT UNL, the listen address of each device (plus
+ * its secondary address if 'sads' is non-NULL and sads[i] >= 0), GET
+ * goes out in a single device_docmd instead of one device_trigger per
+ * instrument link.
+ */
+int vxi11_gpib_trigger(vxi11dev_t v, int *pads, int *sads, int n);
+
+/* Find which of 'n' devices on the bus are requesting service.
+ * Bus status is read first; if SRQ is not asserted, no device is polled
+ * and 'stbs' is zeroed (one RPC), unless 'always' is true.  Otherwise
+ * each device is serial polled through the interface link inside one
+ * transaction (UNL, own listen address, SPE; then per device its talk
+ * address and a one byte read; then SPD, UNT), its status byte stored
+ * in stbs[i] and bit i of 'rqsp' set if RQS (0x40) is set.  Secondary
+ * addresses are used where 'sads' is non-NULL and sads[i] >= 0.
+ * VXI-11.2 has no parallel poll operation, so none is attempted.
+ * N.B. an absent device costs the I/O timeout (vxi11_set_iotimeout ()).
+ * Returns 0 on success, VXI11_ERR_PARAMETER if 'n' exceeds 31, or an
+ * error code which can be decoded with vxi11_strerror ().
+ */
+int vxi11_gpib_sweep(vxi11dev_t v, int *pads, int *sads, int n,
+                     unsigned char *stbs, unsigned long *rqsp, bool always);
+
 /* Change the I/O timeout on a vxi11 device handle from the default of
  * 25s to 'timeout' milliseconds.
  * This function always succeeds.
  */
 void vxi11_set_iotimeout(vxi11dev_t v, unsigned long timeout);
 
+/* Set a deadline of 'timeout' milliseconds on each operation of a vxi11
+ * device handle (default 0 = none).  If an operation is still running
+ * when its deadline passes, device_abort is sent on the abort channel,
+ * which is opened at that point if vxi11_open () did not open it, and
+ * the operation fails with VXI11_ERR_ABORT.  This lets a stuck gateway
+ * cost the deadline rather than the full I/O or RPC timeout.  The
+ * deadline is enforced by a thread started on first use.
+ * This function always succeeds.
+ */
+void vxi11_set_deadline(vxi11dev_t v, unsigned long timeout);
+
+/* Keep an idle link open: whenever no operation has used the link for
+ * 'idle' milliseconds (default 0 = never), send device_readstb without
+ * waiting for locks.  Set 'idle' a little below the gateway's idle
+ * channel timeout, e.g. the ICS comm_timeout (ics_get_comm_timeout ()).
+ * If the keepalive finds the channel dead, the link is reopened in the
+ * background (retrying each interval; operations return VXI11_ERR_NOCHAN
+ * until it succeeds), except inside a vxi11_begin () transaction.
+ * Unacknowledged data on the core channel also times out after 'idle'.
+ * The keepalive runs on the vxi11_set_deadline () thread.
+ * Returns 0 on success or VXI11_ERR_RESOURCES if the thread can't start.
+ */
+int vxi11_set_keepalive(vxi11dev_t v, unsigned long idle);
+
 /* Change the lock policy on a vxi11 device handle.
  * By default, blocking VXI locks are not taken implicitly by the above
  * functions.  By setting 'doLocking' true, the functions will block if
@@ -173,6 +309,119 @@ void vxi11_set_termcharset(vxi11dev_t v, bool termCharSet);
  */
 void vxi11_set_endw(vxi11dev_t v, bool doEndw);
 
+/* Enable/disable TCP_NODELAY on the core and abort channels (enabled by
+ * default).  With Nagle's algorithm active, a small RPC such as
+ * vxi11_readstb () issued right after a vxi11_write () can stall for a
+ * delayed-ACK interval (~40ms).  Socket buffers are always sized from
+ * the maxRecvSize negotiated at vxi11_open ().
+ * N.B. this and vxi11_set_tcp_keepalive () set options on the connection,
+ * not the link.  Links to one host share a connection unless allowed more
+ * by vxi11_set_maxconn () or vxi11_set_conngroup (), so the last setting
+ * made on any of them wins.
+ * This function always succeeds.
+ */
+void vxi11_set_nodelay(vxi11dev_t v, bool doNodelay);
+
+/* Enable/disable TCP keepalive probes on the core and abort channels
+ * (disabled by default).  This lets a dead peer be noticed on an idle
+ * link, subject to the system tcp_keepalive_* settings.
+ * This function always succeeds.
+ */
+void vxi11_set_tcp_keepalive(vxi11dev_t v, bool doKeepalive);
+
+/* Enable/disable the persistent cache of core ports used by vxi11_open ()
+ * (enabled by default, but only in effect if the VXI11_PORTCACHE
+ * environment variable names the file to keep it in).  Ports are cached
+ * per "host:device".  A cached port that fails to connect or respond is
+ * dropped and the portmapper is used.
+ * This function always succeeds.
+ */
+void vxi11_set_portcache(vxi11dev_t v, bool doPortcache);
+
+/* Allow up to 'maxconn' core connections to the handle's host (default 0:
+ * use the host policy below).  Links to the same host normally share
+ * one core connection, so an RPC on one link (e.g. a slow read on
+ * gpib0,9) holds up every other link (gpib0,16) until it completes.
+ * With 'maxconn' > 1, vxi11_open () gives the link its own connection
+ * until 'maxconn' are open to the host, then shares the least used one.
+ * The gateway must allow that many connections; 1 restores sharing.
+ * Takes effect at the next vxi11_open ().
+ * This function always succeeds.
+ */
+void vxi11_set_maxconn(vxi11dev_t v, int maxconn);
+
+/* Share core connections only with handles to the same host in the same
+ * 'group' (default "", NULL restores it).  Each group has connections,
+ * and a connection limit, of its own: libinst puts each gateway GPIB
+ * interface in a group, so that a slow read on gpib0 does not hold up
+ * gpib1.  Takes effect at the next vxi11_open ().
+ * This function always succeeds.
+ */
+void vxi11_set_conngroup(vxi11dev_t v, const char *group);
+
+/* Set the core connection limit for every handle opened to 'host' that
+ * has not called vxi11_set_maxconn ().  If this is not called for a host,
+ * the VXI11_MAXCONN environment variable is consulted, e.g.
+ * "gpib-gw=4,scope=2" or "4" for all hosts; otherwise the limit is 1.
+ * Returns 0 on success, -1 on out of memory.
+ */
+int vxi11_set_host_maxconn(char *host, int maxconn);
+
+/* RPC procedures counted by the statistics below.
+ */
+enum {
+    VXI11_PROC_CREATE_LINK,
+    VXI11_PROC_DESTROY_LINK,
+    VXI11_PROC_WRITE,
+    VXI11_PROC_READ,
+    VXI11_PROC_READSTB,
+    VXI11_PROC_TRIGGER,
+    VXI11_PROC_CLEAR,
+    VXI11_PROC_REMOTE,
+    VXI11_PROC_LOCAL,
+    VXI11_PROC_LOCK,
+    VXI11_PROC_UNLOCK,
+    VXI11_PROC_ABORT,
+    VXI11_PROC_DOCMD,
+    VXI11_NPROCS
+};
+
+/* Latency histogram buckets: bucket i counts RPCs that took between
+ * 2^i and 2^(i+1) microseconds (bucket 0 also holds <1us, the last
+ * bucket holds everything slower).
+ */
+#define VXI11_STATS_BUCKETS 24
+
+struct vxi11_stats {
+    unsigned long       rpcs[VXI11_NPROCS];     /* RPCs issued */
+    unsigned long       errors[VXI11_NPROCS];   /* RPCs returning an error */
+    unsigned long       latency[VXI11_NPROCS][VXI11_STATS_BUCKETS];
+    unsigned long       timeouts;       /* I/O or RPC timeouts (any proc) */
+    unsigned long       writes;         /* vxi11_write () calls */
+    unsigned long       write_chunks;   /* device_write RPCs they took */
+    unsigned long long  bytes_written;
+    unsigned long       reads;          /* vxi11_read () calls */
+    unsigned long long  bytes_read;
+    unsigned long       reason_end;     /* device_read terminated by END */
+    unsigned long       reason_chr;     /* ... by termChar */
+    unsigned long       reason_reqcnt;  /* ... by request count */
+    unsigned long long  lock_wait_usec; /* time spent in vxi11_lock () */
+    unsigned long       keepalives;     /* vxi11_set_keepalive () probes */
+    unsigned long       reconnects;     /* links reopened after a probe */
+};
+
+/* Copy the statistics accumulated on a vxi11 device handle since
+ * vxi11_create () or the last vxi11_clear_stats () into 'stats'.
+ * Counting is always on and costs two gettimeofday () calls per RPC.
+ * This function always succeeds.
+ */
+void vxi11_get_stats(vxi11dev_t v, struct vxi11_stats *stats);
+
+/* Zero the statistics on a vxi11 device handle.
+ * This function always succeeds.
+ */
+void vxi11_clear_stats(vxi11dev_t v);
+
 /* Enable/disable debugging on stderr.
  */
 void vxi11_set_device_debug(bool doDebug);
@@ -0,0 +1,478 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* vxi11_discover.c - parallel discovery of VXI-11 instruments
+ *
+ * A probe walks one host through these steps, each an asynchronous
+ * call on the shared RPC engine:
+ *
+ *   PMAPPROC_GETPORT on port 111 (skipped if the port was given)
+ *   create_link for every device name, pipelined on one connection
+ *   device_write "*IDN?", then device_read, per link (optional)
+ *   destroy_link per link
+ *
+ * A probe is finished when it has no calls outstanding.  Every call is
+ * given the time remaining until the probe's deadline as its RPC
+ * timeout, so a dead or slow host cannot hold up the sweep for longer.
+ *
+ * The portcache holds one port per "host:device".  When targets give
+ * several ports for a host, a device name may be found on more than one
+ * of them; the name is then ambiguous, so its entry is removed rather
+ * than left to whichever port answered last.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <rpc/rpc.h>
+#include <rpc/pmap_prot.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/param.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "vxi11.h"
+#include "vxi11_core.h"
+#include "vxi11_rpc.h"
+#include "vxi11_discover.h"
+#include "portcache.h"
+
+#define IDN_QUERY       "*IDN?"
+#define IDN_MAXLEN      256
+
+struct discover;
+struct probe;
+
+struct link {
+    struct probe       *probe;
+    char               *device;
+    Create_LinkResp     cl;
+    Device_WriteResp    wr;
+    Device_ReadResp     rd;
+    Device_Error        dl;
+    char               *idn;
+};
+
+struct probe {
+    struct discover    *d;
+    struct vxi11_target *t;
+    struct sockaddr_in  addr;
+    vxi11_conn_t        conn;
+    unsigned long       port;           /* DEVICE_CORE port */
+    uint64_t            deadline;       /* CLOCK_MONOTONIC msec */
+    int                 outstanding;    /* calls in flight */
+    bool                failed;         /* host level failure reported */
+    struct link        *links;
+};
+
+struct cached {
+    char               *name;           /* host:device */
+    unsigned long       port;
+    bool                ambiguous;      /* found on another port too */
+};
+
+struct discover {
+    vxi11_rpc_t         r;
+    char              **devices;
+    int                 ndevices;
+    unsigned long       timeout;
+    unsigned long       io_timeout;
+    int                 flags;
+    vxi11_found_cb_t    cb;
+    void               *arg;
+    int                 active;         /* probes in flight */
+    struct cached      *cached;         /* portcache entries made so far */
+    int                 ncached;
+};
+
+static uint64_t
+_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* RPC timeout for the next call of a probe: what is left of its budget.
+ */
+static unsigned long
+_remaining(struct probe *p)
+{
+    uint64_t now = _now();
+
+    return p->deadline > now ? p->deadline - now : 1;
+}
+
+static void
+_report(struct probe *p, struct link *l, enum clnt_stat stat, int error)
+{
+    struct vxi11_found f;
+
+    memset(&f, 0, sizeof(f));
+    f.host = p->t->host;
+    f.core_port = p->port;
+    f.stat = stat;
+    f.error = error;
+    if (l) {
+        f.device = l->device;
+        f.abort_port = l->cl.abortPort;
+        f.maxRecvSize = l->cl.maxRecvSize;
+        f.idn = l->idn;
+    }
+    p->d->cb(&f, p->d->arg);
+}
+
+/* Report a failure of the whole host, once.
+ */
+static void
+_report_host(struct probe *p, enum clnt_stat stat)
+{
+    if (!p->failed) {
+        p->failed = true;
+        _report(p, NULL, stat, 0);
+    }
+}
+
+static void
+_probe_done(struct probe *p)
+{
+    if (p->conn)
+        vxi11_rpc_disconnect(p->conn);
+    free(p->links);
+    p->d->active--;
+    free(p);
+}
+
+/* Account for a completed call and retire the probe if it was the last.
+ */
+static void
+_call_done(struct probe *p)
+{
+    if (--p->outstanding == 0)
+        _probe_done(p);
+}
+
+/* Issue a call on the probe's connection.  A call that cannot be queued
+ * is completed at once, so 'cb' runs exactly once either way.
+ */
+static void
+_call(struct probe *p, unsigned long proc, void *in, void *out,
+      vxi11_rpc_cb_t cb, void *arg)
+{
+    enum clnt_stat stat;
+
+    p->outstanding++;
+    if ((stat = vxi11_rpc_core_call(p->conn, proc, in, out, _remaining(p),
+                                    cb, arg)) != RPC_SUCCESS)
+        cb(stat, arg);
+}
+
+static void
+_destroy_cb(enum clnt_stat stat, void *arg)
+{
+    struct link *l = arg;
+
+    _call_done(l->probe);
+}
+
+/* The link is finished with - report it and tear it down.  If the probe
+ * has run out of time or lost its connection, skip destroy_link: the
+ * server drops the link when the connection is closed.
+ */
+static void
+_finish_link(struct link *l, enum clnt_stat stat, int error)
+{
+    struct probe *p = l->probe;
+    Device_Link lid = l->cl.lid;
+
+    _report(p, l, stat, error);
+    free(l->idn);
+    l->idn = NULL;
+    if (vxi11_rpc_connected(p->conn) && _now() < p->deadline) {
+        memset(&l->dl, 0, sizeof(l->dl));
+        _call(p, destroy_link, &lid, &l->dl, _destroy_cb, l);
+    }
+}
+
+static void
+_read_cb(enum clnt_stat stat, void *arg)
+{
+    struct link *l = arg;
+    struct probe *p = l->probe;
+    int len;
+
+    if (stat == RPC_SUCCESS && l->rd.error == 0) {
+        len = l->rd.data.data_len;
+        while (len > 0 && isspace((unsigned char)l->rd.data.data_val[len - 1]))
+            len--;
+        if ((l->idn = malloc(len + 1))) {
+            memcpy(l->idn, l->rd.data.data_val, len);
+            l->idn[len] = '\0';
+        }
+    }
+    _finish_link(l, stat, stat == RPC_SUCCESS ? l->rd.error : 0);
+    if (stat == RPC_SUCCESS)
+        xdr_free((xdrproc_t)xdr_Device_ReadResp, (char *)&l->rd);
+    _call_done(p);
+}
+
+static void
+_write_cb(enum clnt_stat stat, void *arg)
+{
+    struct link *l = arg;
+    struct probe *p = l->probe;
+    Device_ReadParms rp;
+
+    if (stat != RPC_SUCCESS || l->wr.error != 0)
+        _finish_link(l, stat, stat == RPC_SUCCESS ? l->wr.error : 0);
+    else {
+        memset(&rp, 0, sizeof(rp));
+        rp.lid = l->cl.lid;
+        rp.requestSize = IDN_MAXLEN;
+        rp.io_timeout = p->d->io_timeout;
+        rp.flags = VXI11_FLAG_TERMCHRSET;
+        rp.termChar = '\n';
+        memset(&l->rd, 0, sizeof(l->rd));
+        _call(p, device_read, &rp, &l->rd, _read_cb, l);
+    }
+    _call_done(p);
+}
+
+/* Record the core port of device 'name' in the portcache, unless the
+ * name was found on another port earlier in the sweep.
+ */
+static void
+_cache_port(struct probe *p, char *name)
+{
+    struct discover *d = p->d;
+    struct portcache_entry pc;
+    struct cached *new;
+    int i;
+
+    for (i = 0; i < d->ncached; i++) {
+        if (!strcmp(d->cached[i].name, name)) {
+            if (d->cached[i].port != p->port && !d->cached[i].ambiguous) {
+                d->cached[i].ambiguous = true;
+                portcache_invalidate(name);
+            }
+            return;
+        }
+    }
+    if (!(new = realloc(d->cached, (d->ncached + 1) * sizeof(*new))))
+        return;
+    d->cached = new;
+    if (!(new[d->ncached].name = strdup(name)))
+        return;
+    new[d->ncached].port = p->port;
+    new[d->ncached].ambiguous = false;
+    d->ncached++;
+    memset(&pc, 0, sizeof(pc));
+    pc.core_port = p->port;
+    portcache_update(name, &pc);
+}
+
+static void
+_create_cb(enum clnt_stat stat, void *arg)
+{
+    struct link *l = arg;
+    struct probe *p = l->probe;
+    Device_WriteParms wp;
+    char name[MAXHOSTNAMELEN];
+
+    if (stat != RPC_SUCCESS)
+        _report_host(p, stat);          /* e.g. connection refused */
+    else if (l->cl.error != 0)
+        _report(p, l, stat, l->cl.error);
+    else {
+        if ((p->d->flags & VXI11_DISCOVER_PORTCACHE)) {
+            snprintf(name, sizeof(name), "%s:%s", p->t->host, l->device);
+            _cache_port(p, name);
+        }
+        if ((p->d->flags & VXI11_DISCOVER_IDN)) {
+            memset(&wp, 0, sizeof(wp));
+            wp.lid = l->cl.lid;
+            wp.io_timeout = p->d->io_timeout;
+            wp.flags = VXI11_FLAG_ENDW;
+            wp.data.data_val = IDN_QUERY;
+            wp.data.data_len = strlen(IDN_QUERY);
+            memset(&l->wr, 0, sizeof(l->wr));
+            _call(p, device_write, &wp, &l->wr, _write_cb, l);
+        } else
+            _finish_link(l, stat, 0);
+    }
+    _call_done(p);
+}
+
+/* Connect to DEVICE_CORE and create a link to every device name at once.
+ */
+static void
+_probe_core(struct probe *p)
+{
+    struct discover *d = p->d;
+    Create_LinkParms cp;
+    int i;
+
+    p->addr.sin_port = htons(p->port);
+    if (vxi11_rpc_connect(d->r, &p->addr, DEVICE_CORE, DEVICE_CORE_VERSION,
+                          &p->conn) < 0) {
+        _report_host(p, RPC_SYSTEMERROR);
+        return;
+    }
+    if (!(p->links = calloc(d->ndevices, sizeof(struct link)))) {
+        _report_host(p, RPC_SYSTEMERROR);
+        return;
+    }
+    memset(&cp, 0, sizeof(cp));
+    for (i = 0; i < d->ndevices; i++) {
+        p->links[i].probe = p;
+        p->links[i].device = d->devices[i];
+        cp.device = d->devices[i];
+        _call(p, create_link, &cp, &p->links[i].cl, _create_cb, &p->links[i]);
+    }
+}
+
+static void
+_pmap_cb(enum clnt_stat stat, void *arg)
+{
+    struct probe *p = arg;
+
+    vxi11_rpc_disconnect(p->conn);
+    p->conn = NULL;
+    if (stat != RPC_SUCCESS)
+        _report_host(p, stat);
+    else if (p->port == 0 || p->port > 0xffff)
+        _report_host(p, RPC_PROGNOTREGISTERED);
+    else
+        _probe_core(p);
+    _call_done(p);
+}
+
+static void
+_probe_pmap(struct probe *p)
+{
+    struct pmap pm;
+    enum clnt_stat stat;
+
+    p->addr.sin_port = htons(PMAPPORT);
+    if (vxi11_rpc_connect(p->d->r, &p->addr, PMAPPROG, PMAPVERS,
+                          &p->conn) < 0) {
+        _report_host(p, RPC_SYSTEMERROR);
+        return;
+    }
+    pm.pm_prog = DEVICE_CORE;
+    pm.pm_vers = DEVICE_CORE_VERSION;
+    pm.pm_prot = IPPROTO_TCP;
+    pm.pm_port = 0;
+    p->outstanding++;
+    if ((stat = vxi11_rpc_call(p->conn, PMAPPROC_GETPORT,
+                               (xdrproc_t)xdr_pmap, &pm,
+                               (xdrproc_t)xdr_u_long, &p->port,
+                               _remaining(p), _pmap_cb, p)) != RPC_SUCCESS)
+        _pmap_cb(stat, p);
+}
+
+static void
+_probe_start(struct discover *d, struct vxi11_target *t)
+{
+    struct hostent *hp;
+    struct probe *p;
+
+    if (!(p = malloc(sizeof(struct probe)))) {
+        struct vxi11_found f = { t->host, t->port, NULL, RPC_SYSTEMERROR };
+
+        d->cb(&f, d->arg);
+        return;
+    }
+    memset(p, 0, sizeof(struct probe));
+    p->d = d;
+    p->t = t;
+    p->port = t->port;
+    p->deadline = _now() + d->timeout;
+    d->active++;
+
+    p->outstanding++;           /* hold the probe open while starting */
+    if (!(hp = gethostbyname(t->host)) || hp->h_addrtype != AF_INET)
+        _report_host(p, RPC_UNKNOWNHOST);
+    else {
+        p->addr.sin_family = AF_INET;
+        memcpy(&p->addr.sin_addr, hp->h_addr, sizeof(p->addr.sin_addr));
+        if (p->port == 0)
+            _probe_pmap(p);
+        else
+            _probe_core(p);
+    }
+    _call_done(p);
+}
+
+int
+vxi11_discover(struct vxi11_target *targets, int ntargets,
+               char **devices, int ndevices, int maxprobes,
+               unsigned long timeout, unsigned long io_timeout,
+               int flags, vxi11_found_cb_t cb, void *arg)
+{
+    struct discover d;
+    int i, next = 0, res = 0;
+
+    if (ntargets < 0 || ndevices <= 0 || maxprobes <= 0 || !cb) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&d, 0, sizeof(d));
+    if (!(d.r = vxi11_rpc_create()))
+        return -1;
+    d.devices = devices;
+    d.ndevices = ndevices;
+    d.timeout = timeout;
+    d.io_timeout = io_timeout;
+    d.flags = flags;
+    d.cb = cb;
+    d.arg = arg;
+    for (;;) {
+        while (next < ntargets && d.active < maxprobes)
+            _probe_start(&d, &targets[next++]);
+        if (d.active == 0)
+            break;
+        if (vxi11_rpc_run(d.r, -1) < 0 && errno != EINTR) {
+            res = -1;
+            break;
+        }
+    }
+    vxi11_rpc_destroy(d.r);     /* completes any stragglers after an error */
+    for (i = 0; i < d.ncached; i++)
+        free(d.cached[i].name);
+    free(d.cached);
+    return res;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,92 @@
+#ifndef _VXI11_DISCOVER_H
+#define _VXI11_DISCOVER_H
+
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* Parallel discovery of VXI-11 instruments.
+ *
+ * Each target host is probed by asking its portmapper for the DEVICE_CORE
+ * port (unless a port is given), calling create_link on every device name
+ * at once, and optionally sending "*IDN?" on each link that was created.
+ * Many hosts are probed concurrently from one thread using the event
+ * driven RPC engine (vxi11_rpc.h), and each probe has its own deadline,
+ * so a sweep takes about as long as the slowest host, not the sum.
+ *
+ * Requires <rpc/rpc.h>.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct vxi11_target {
+    char           *host;           /* hostname or IP address */
+    unsigned short  port;           /* DEVICE_CORE port, 0 = ask portmap */
+};
+
+/* One result, passed to the callback.  'device' is NULL if the host
+ * failed before any link could be created (e.g. unknown host, no
+ * portmapper, DEVICE_CORE not registered, connection refused).
+ * If 'stat' is not RPC_SUCCESS, the probe failed for that reason;
+ * otherwise 'error' is the VXI-11 error from create_link or *IDN?.
+ * Strings are only valid during the callback.
+ */
+struct vxi11_found {
+    char           *host;
+    unsigned short  core_port;      /* 0 if not known */
+    char           *device;
+    enum clnt_stat  stat;
+    int             error;
+    unsigned short  abort_port;     /* from create_link */
+    unsigned long   maxRecvSize;    /* from create_link */
+    char           *idn;            /* *IDN? response, or NULL */
+};
+
+typedef void (*vxi11_found_cb_t)(struct vxi11_found *f, void *arg);
+
+/* flags */
+#define VXI11_DISCOVER_IDN          0x01    /* query *IDN? on each link */
+#define VXI11_DISCOVER_PORTCACHE    0x02    /* record devices found in the
+                                               portcache for vxi11_open (),
+                                               except any found on more
+                                               than one port of a host */
+
+/* Probe 'ntargets' hosts for each of 'ndevices' device names (e.g.
+ * "inst0", "gpib0,5"), with at most 'maxprobes' hosts in flight at once.
+ * Each host gets 'timeout' msec from the start of its probe to finish;
+ * *IDN? is sent with a VXI-11 io_timeout of 'io_timeout' msec.  'cb' is
+ * called once for each device name on a host that answered, or once
+ * for the host if it did not.  Returns 0 when every target has been
+ * probed, or -1 on an internal error (errno set).
+ */
+int vxi11_discover(struct vxi11_target *targets, int ntargets,
+                   char **devices, int ndevices, int maxprobes,
+                   unsigned long timeout, unsigned long io_timeout,
+                   int flags, vxi11_found_cb_t cb, void *arg);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _VXI11_DISCOVER_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,743 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*
+ * vxi11_rpc.c - event driven ONC RPC client engine
+ *
+ * Calls are encoded straight into a per-connection transmit buffer
+ * (record mark, RFC 5531 call header with AUTH_NONE, then the arguments
+ * via the rpcgen XDR routines), and replies are reassembled from record
+ * fragments and matched to calls by XID.  Nothing blocks except
+ * epoll_wait () in vxi11_rpc_run ().
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <rpc/rpc.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+
+#include "vxi11.h"
+#include "vxi11_rpc.h"
+#include "vxi11_trace.h"
+
+#define RPC_MAGIC           0x52504345
+#define RPC_MAXEVENTS       64
+#define RPC_MAXRECORD       (16*1024*1024)  /* largest reply accepted */
+#define RPC_CALLHDR         (4 + 10*4)      /* record mark + call header */
+#define RPC_LASTFRAG        0x80000000U
+
+struct vxi11_call {
+    struct vxi11_call  *next;
+    uint32_t            xid;
+    unsigned long       proc;
+    xdrproc_t           outproc;
+    void               *out;
+    uint32_t            inlen;          /* bytes sent (for trace) */
+    uint64_t            deadline;       /* CLOCK_MONOTONIC msec */
+    struct timespec     t0;
+    vxi11_rpc_cb_t      cb;
+    void               *arg;
+};
+
+struct vxi11_conn_struct {
+    struct vxi11_conn_struct *next;
+    vxi11_rpc_t         rpc;
+    int                 fd;
+    bool                connecting;
+    bool                failed;
+    bool                closed;
+    uint32_t            events;         /* epoll events registered */
+    unsigned long       prog;
+    unsigned long       vers;
+    struct vxi11_call  *calls;          /* outstanding calls */
+    char               *tx;             /* encoded calls not yet sent */
+    uint32_t            tx_len;
+    uint32_t            tx_size;
+    char               *rx;             /* raw bytes from the socket */
+    uint32_t            rx_off;         /* ...consumed up to here */
+    uint32_t            rx_len;
+    uint32_t            rx_size;
+    char               *rec;            /* reply reassembled from fragments */
+    uint32_t            rec_len;
+    uint32_t            rec_size;
+};
+
+struct vxi11_rpc_struct {
+    int                 magic;
+    int                 epfd;
+    uint32_t            xid;
+    int                 ncalls;         /* outstanding calls */
+    int                 ncompleted;     /* calls completed (ever) */
+    int                 depth;          /* vxi11_rpc_run () nesting */
+    struct vxi11_conn_struct *conns;
+    struct vxi11_conn_struct *zombies;  /* closed during run, free later */
+};
+
+struct sync_result {
+    bool                done;
+    enum clnt_stat      stat;
+};
+
+/* XDR routines for each VXI-11 procedure, indexed by procedure number.
+ * DEVICE_ASYNC's only procedure (device_abort = 1) does not collide
+ * with a DEVICE_CORE one.
+ */
+static struct {
+    xdrproc_t in;
+    xdrproc_t out;
+} vxi11_procs[] = {
+    [device_abort]      = { (xdrproc_t)xdr_Device_Link,
+                            (xdrproc_t)xdr_Device_Error },
+    [create_link]       = { (xdrproc_t)xdr_Create_LinkParms,
+                            (xdrproc_t)xdr_Create_LinkResp },
+    [device_write]      = { (xdrproc_t)xdr_Device_WriteParms,
+                            (xdrproc_t)xdr_Device_WriteResp },
+    [device_read]       = { (xdrproc_t)xdr_Device_ReadParms,
+                            (xdrproc_t)xdr_Device_ReadResp },
+    [device_readstb]    = { (xdrproc_t)xdr_Device_GenericParms,
+                            (xdrproc_t)xdr_Device_ReadStbResp },
+    [device_trigger]    = { (xdrproc_t)xdr_Device_GenericParms,
+                            (xdrproc_t)xdr_Device_Error },
+    [device_clear]      = { (xdrproc_t)xdr_Device_GenericParms,
+                            (xdrproc_t)xdr_Device_Error },
+    [device_remote]     = { (xdrproc_t)xdr_Device_GenericParms,
+                            (xdrproc_t)xdr_Device_Error },
+    [device_local]      = { (xdrproc_t)xdr_Device_GenericParms,
+                            (xdrproc_t)xdr_Device_Error },
+    [device_lock]       = { (xdrproc_t)xdr_Device_LockParms,
+                            (xdrproc_t)xdr_Device_Error },
+    [device_unlock]     = { (xdrproc_t)xdr_Device_Link,
+                            (xdrproc_t)xdr_Device_Error },
+    [device_enable_srq] = { (xdrproc_t)xdr_Device_EnableSrqParms,
+                            (xdrproc_t)xdr_Device_Error },
+    [device_docmd]      = { (xdrproc_t)xdr_Device_DocmdParms,
+                            (xdrproc_t)xdr_Device_DocmdResp },
+    [destroy_link]      = { (xdrproc_t)xdr_Device_Link,
+                            (xdrproc_t)xdr_Device_Error },
+    [create_intr_chan]  = { (xdrproc_t)xdr_Device_RemoteFunc,
+                            (xdrproc_t)xdr_Device_Error },
+    [destroy_intr_chan] = { (xdrproc_t)xdr_void,
+                            (xdrproc_t)xdr_Device_Error },
+};
+#define VXI11_NPROCS_TAB (sizeof(vxi11_procs)/sizeof(vxi11_procs[0]))
+
+static uint64_t
+_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Ensure room for 'need' more bytes in a buffer.
+ */
+static int
+_grow(char **bufp, uint32_t *sizep, uint32_t len, uint32_t need)
+{
+    uint32_t size = *sizep ? *sizep : 4096;
+    char *new;
+
+    if (len + need <= *sizep)
+        return 0;
+    while (size < len + need)
+        size *= 2;
+    if (!(new = realloc(*bufp, size)))
+        return -1;
+    *bufp = new;
+    *sizep = size;
+    return 0;
+}
+
+/* Register interest in output only while there is something to send
+ * (or a connect to complete).
+ */
+static void
+_update_events(vxi11_conn_t c)
+{
+    struct epoll_event ev;
+    uint32_t events = EPOLLIN;
+
+    if (c->connecting || c->tx_len > 0)
+        events |= EPOLLOUT;
+    if (events != c->events) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.ptr = c;
+        if (epoll_ctl(c->rpc->epfd, EPOLL_CTL_MOD, c->fd, &ev) == 0)
+            c->events = events;
+    }
+}
+
+static void
+_complete(vxi11_rpc_t r, struct vxi11_call *call, enum clnt_stat stat,
+          uint32_t outlen)
+{
+    r->ncalls--;
+    r->ncompleted++;
+    vxi11_trace_end(&call->t0, VXI11_TR_RPC_CALL, 0, 0, call->proc,
+                    call->inlen, outlen, call->xid, stat);
+    call->cb(stat, call->arg);
+    free(call);
+}
+
+/* Complete every call on a list (already unlinked from its connection).
+ */
+static void
+_complete_list(vxi11_rpc_t r, struct vxi11_call *list, enum clnt_stat stat)
+{
+    struct vxi11_call *call;
+
+    while ((call = list)) {
+        list = call->next;
+        _complete(r, call, stat, 0);
+    }
+}
+
+/* Take a connection out of service after an error.
+ */
+static void
+_fail(vxi11_conn_t c, enum clnt_stat stat)
+{
+    struct vxi11_call *calls = c->calls;
+
+    if (c->failed)
+        return;
+    c->failed = true;
+    c->connecting = false;
+    (void)epoll_ctl(c->rpc->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    c->events = 0;
+    c->tx_len = 0;
+    c->calls = NULL;
+    _complete_list(c->rpc, calls, stat);
+}
+
+static struct vxi11_call *
+_unlink_call(vxi11_conn_t c, uint32_t xid)
+{
+    struct vxi11_call **cp, *call;
+
+    for (cp = &c->calls; *cp != NULL; cp = &(*cp)->next) {
+        if ((*cp)->xid == xid) {
+            call = *cp;
+            *cp = call->next;
+            return call;
+        }
+    }
+    return NULL;
+}
+
+static enum clnt_stat
+_reply_stat(struct rpc_msg *msg)
+{
+    if (msg->rm_reply.rp_stat == MSG_ACCEPTED) {
+        switch (msg->acpted_rply.ar_stat) {
+            case SUCCESS:
+                return RPC_SUCCESS;
+            case PROG_UNAVAIL:
+                return RPC_PROGUNAVAIL;
+            case PROG_MISMATCH:
+                return RPC_PROGVERSMISMATCH;
+            case PROC_UNAVAIL:
+                return RPC_PROCUNAVAIL;
+            case GARBAGE_ARGS:
+                return RPC_CANTDECODEARGS;
+            default:
+                return RPC_SYSTEMERROR;
+        }
+    }
+    if (msg->rjcted_rply.rj_stat == RPC_MISMATCH)
+        return RPC_VERSMISMATCH;
+    return RPC_AUTHERROR;
+}
+
+/* Decode the complete reply record in c->rec and finish its call.
+ * Replies for unknown XIDs (e.g. calls that already timed out) are dropped.
+ */
+static void
+_dispatch(vxi11_conn_t c)
+{
+    struct vxi11_call *call;
+    struct rpc_msg msg;
+    enum clnt_stat stat;
+    uint32_t xid, len = c->rec_len;
+    XDR xdrs;
+
+    c->rec_len = 0;
+    if (len < 4)
+        return;
+    memcpy(&xid, c->rec, 4);
+    if (!(call = _unlink_call(c, ntohl(xid))))
+        return;
+    memset(&msg, 0, sizeof(msg));
+    msg.acpted_rply.ar_verf = _null_auth;
+    msg.acpted_rply.ar_results.where = call->out;
+    msg.acpted_rply.ar_results.proc = call->outproc;
+    xdrmem_create(&xdrs, c->rec, len, XDR_DECODE);
+    if (!xdr_replymsg(&xdrs, &msg) || msg.rm_direction != REPLY)
+        stat = RPC_CANTDECODERES;
+    else
+        stat = _reply_stat(&msg);
+    xdr_destroy(&xdrs);
+    _complete(c->rpc, call, stat, len);
+}
+
+/* Pull complete fragments out of the receive buffer, dispatching each
+ * reply as its last fragment arrives.  Consumed bytes are skipped by
+ * advancing rx_off; _handle_input () moves any partial fragment left
+ * over to the front once, before the next read.  A callback may close
+ * the connection (or run the engine), so check after each dispatch and
+ * keep the offsets in the connection.
+ */
+static void
+_process_rx(vxi11_conn_t c)
+{
+    uint32_t mark, fraglen;
+
+    while (!c->closed && !c->failed && c->rx_len - c->rx_off >= 4) {
+        memcpy(&mark, c->rx + c->rx_off, 4);
+        mark = ntohl(mark);
+        fraglen = mark & ~RPC_LASTFRAG;
+        if (c->rec_len + fraglen > RPC_MAXRECORD) {
+            _fail(c, RPC_CANTDECODERES);
+            return;
+        }
+        if (c->rx_len - c->rx_off < 4 + fraglen)
+            break;
+        if (_grow(&c->rec, &c->rec_size, c->rec_len, fraglen) < 0) {
+            _fail(c, RPC_SYSTEMERROR);
+            return;
+        }
+        memcpy(c->rec + c->rec_len, c->rx + c->rx_off + 4, fraglen);
+        c->rec_len += fraglen;
+        c->rx_off += 4 + fraglen;
+        if (c->rx_off == c->rx_len)
+            c->rx_off = c->rx_len = 0;
+        if (mark & RPC_LASTFRAG)
+            _dispatch(c);
+    }
+}
+
+static void
+_handle_input(vxi11_conn_t c)
+{
+    uint32_t need = 65536, mark;
+    ssize_t n;
+
+    for (;;) {
+        if (c->rx_off > 0) {
+            c->rx_len -= c->rx_off;
+            memmove(c->rx, c->rx + c->rx_off, c->rx_len);
+            c->rx_off = 0;
+        }
+        /* make room for the whole of the current fragment if known */
+        if (c->rx_len >= 4) {
+            memcpy(&mark, c->rx, 4);
+            mark = ntohl(mark) & ~RPC_LASTFRAG;
+            if (mark <= RPC_MAXRECORD && 4 + mark > c->rx_len
+                                      && 4 + mark - c->rx_len > need)
+                need = 4 + mark - c->rx_len;
+        }
+        if (_grow(&c->rx, &c->rx_size, c->rx_len, need) < 0) {
+            _fail(c, RPC_SYSTEMERROR);
+            return;
+        }
+        n = read(c->fd, c->rx + c->rx_len, c->rx_size - c->rx_len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0) {
+            _fail(c, RPC_CANTRECV);
+            return;
+        }
+        c->rx_len += n;
+        _process_rx(c);
+        if (c->closed || c->failed)
+            return;
+    }
+}
+
+static void
+_handle_output(vxi11_conn_t c)
+{
+    socklen_t len = sizeof(int);
+    int err = 0;
+    ssize_t n;
+
+    if (c->connecting) {
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0
+                || err != 0) {
+            _fail(c, RPC_CANTSEND);
+            return;
+        }
+        c->connecting = false;
+    }
+    while (c->tx_len > 0) {
+        n = send(c->fd, c->tx, c->tx_len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0) {
+            _fail(c, RPC_CANTSEND);
+            return;
+        }
+        c->tx_len -= n;
+        memmove(c->tx, c->tx + n, c->tx_len);
+    }
+    _update_events(c);
+}
+
+/* Complete calls whose deadline has passed.  Returns msec until the
+ * next deadline, or -1 if there are no calls.
+ */
+static long
+_expire(vxi11_rpc_t r)
+{
+    struct vxi11_call **cp, *call, *expired = NULL;
+    uint64_t now = _now(), next = 0;
+    vxi11_conn_t c;
+
+    for (c = r->conns; c != NULL; c = c->next) {
+        for (cp = &c->calls; *cp != NULL; ) {
+            call = *cp;
+            if (call->deadline <= now) {
+                *cp = call->next;
+                call->next = expired;
+                expired = call;
+            } else {
+                if (next == 0 || call->deadline < next)
+                    next = call->deadline;
+                cp = &call->next;
+            }
+        }
+    }
+    _complete_list(r, expired, RPC_TIMEDOUT);
+    if (expired)
+        return 0;   /* callbacks may have queued calls - recompute */
+    if (next == 0)
+        return -1;
+    return next - now < LONG_MAX ? (long)(next - now) : LONG_MAX;
+}
+
+static void
+_free_conn(vxi11_conn_t c)
+{
+    free(c->tx);
+    free(c->rx);
+    free(c->rec);
+    free(c);
+}
+
+vxi11_rpc_t
+vxi11_rpc_create(void)
+{
+    vxi11_rpc_t r = malloc(sizeof(struct vxi11_rpc_struct));
+
+    if (r) {
+        memset(r, 0, sizeof(struct vxi11_rpc_struct));
+        r->magic = RPC_MAGIC;
+        if ((r->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+            free(r);
+            return NULL;
+        }
+        r->xid = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+    }
+    return r;
+}
+
+void
+vxi11_rpc_destroy(vxi11_rpc_t r)
+{
+    vxi11_conn_t c;
+
+    assert(r->magic == RPC_MAGIC);
+    assert(r->depth == 0);
+    while ((c = r->conns))
+        vxi11_rpc_disconnect(c);
+    (void)close(r->epfd);
+    memset(r, 0, sizeof(struct vxi11_rpc_struct));
+    free(r);
+}
+
+int
+vxi11_rpc_fd(vxi11_rpc_t r)
+{
+    assert(r->magic == RPC_MAGIC);
+    return r->epfd;
+}
+
+int
+vxi11_rpc_connect(vxi11_rpc_t r, struct sockaddr_in *addr,
+                  unsigned long prog, unsigned long vers, vxi11_conn_t *connp)
+{
+    struct epoll_event ev;
+    struct timespec t0;
+    vxi11_conn_t c;
+    int one = 1, saved_errno;
+
+    assert(r->magic == RPC_MAGIC);
+    vxi11_trace_begin(&t0);
+    if (!(c = malloc(sizeof(struct vxi11_conn_struct)))) {
+        errno = ENOMEM;
+        goto err;
+    }
+    memset(c, 0, sizeof(struct vxi11_conn_struct));
+    c->rpc = r;
+    c->prog = prog;
+    c->vers = vers;
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0)
+        goto err;
+    (void)setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        if (errno != EINPROGRESS)
+            goto err;
+        c->connecting = true;
+    }
+    c->events = EPOLLIN | (c->connecting ? EPOLLOUT : 0);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = c->events;
+    ev.data.ptr = c;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+        goto err;
+    c->next = r->conns;
+    r->conns = c;
+    *connp = c;
+    vxi11_trace_end(&t0, VXI11_TR_RPC_CONNECT, 0, 0, ntohs(addr->sin_port),
+                    0, 0, 0, 0);
+    return 0;
+err:
+    saved_errno = errno;
+    if (c) {
+        if (c->fd >= 0)
+            (void)close(c->fd);
+        free(c);
+    }
+    vxi11_trace_end(&t0, VXI11_TR_RPC_CONNECT, 0, 0, ntohs(addr->sin_port),
+                    0, 0, 0, saved_errno);
+    errno = saved_errno;
+    return -1;
+}
+
+void
+vxi11_rpc_disconnect(vxi11_conn_t c)
+{
+    vxi11_rpc_t r = c->rpc;
+    vxi11_conn_t *cp;
+
+    assert(r->magic == RPC_MAGIC);
+    if (c->closed)
+        return;
+    c->closed = true;       /* a callback run by _fail () may disconnect c */
+    _fail(c, RPC_CANTRECV);
+    (void)close(c->fd);
+    c->fd = -1;
+    for (cp = &r->conns; *cp != NULL; cp = &(*cp)->next) {
+        if (*cp == c) {
+            *cp = c->next;
+            break;
+        }
+    }
+    if (r->depth > 0) {         /* epoll results may still refer to c */
+        c->next = r->zombies;
+        r->zombies = c;
+    } else
+        _free_conn(c);
+}
+
+bool
+vxi11_rpc_connected(vxi11_conn_t c)
+{
+    return !c->failed && !c->closed;
+}
+
+static void
+_sync_cb(enum clnt_stat stat, void *arg)
+{
+    struct sync_result *sr = arg;
+
+    sr->stat = stat;
+    sr->done = true;
+}
+
+enum clnt_stat
+vxi11_rpc_call(vxi11_conn_t c, unsigned long proc, xdrproc_t inproc,
+               void *in, xdrproc_t outproc, void *out, unsigned long timeout,
+               vxi11_rpc_cb_t cb, void *arg)
+{
+    vxi11_rpc_t r = c->rpc;
+    struct sync_result sr = { false, RPC_SUCCESS };
+    struct vxi11_call *call;
+    uint32_t len, mark;
+    XDR xdrs;
+    bool ok;
+
+    assert(r->magic == RPC_MAGIC);
+    if (c->failed || c->closed)
+        return RPC_CANTSEND;
+    if (!(call = malloc(sizeof(struct vxi11_call))))
+        return RPC_SYSTEMERROR;
+    memset(call, 0, sizeof(struct vxi11_call));
+    vxi11_trace_begin(&call->t0);
+    if (cb) {
+        call->cb = cb;
+        call->arg = arg;
+    } else {
+        call->cb = _sync_cb;
+        call->arg = &sr;
+    }
+    call->xid = r->xid++;
+    call->proc = proc;
+    call->outproc = outproc;
+    call->out = out;
+    call->deadline = _now() + timeout;
+
+    /* encode record mark + call header + args at the end of tx */
+    len = RPC_CALLHDR + xdr_sizeof(inproc, in);
+    if (_grow(&c->tx, &c->tx_size, c->tx_len, len) < 0) {
+        free(call);
+        return RPC_SYSTEMERROR;
+    }
+    xdrmem_create(&xdrs, c->tx + c->tx_len + 4, len - 4, XDR_ENCODE);
+    ok = xdr_u_int32_t(&xdrs, &call->xid);
+    mark = CALL;
+    ok = ok && xdr_u_int32_t(&xdrs, &mark);
+    mark = RPC_MSG_VERSION;
+    ok = ok && xdr_u_int32_t(&xdrs, &mark);
+    mark = c->prog;
+    ok = ok && xdr_u_int32_t(&xdrs, &mark);
+    mark = c->vers;
+    ok = ok && xdr_u_int32_t(&xdrs, &mark);
+    mark = proc;
+    ok = ok && xdr_u_int32_t(&xdrs, &mark);
+    ok = ok && xdr_opaque_auth(&xdrs, &_null_auth);     /* cred */
+    ok = ok && xdr_opaque_auth(&xdrs, &_null_auth);     /* verf */
+    ok = ok && inproc(&xdrs, in);
+    len = xdr_getpos(&xdrs);
+    xdr_destroy(&xdrs);
+    if (!ok) {
+        free(call);
+        return RPC_CANTENCODEARGS;
+    }
+    mark = htonl(RPC_LASTFRAG | len);
+    memcpy(c->tx + c->tx_len, &mark, 4);
+    c->tx_len += 4 + len;
+    call->inlen = 4 + len;
+
+    call->next = c->calls;
+    c->calls = call;
+    r->ncalls++;
+
+    /* send now if the socket is idle rather than waiting for EPOLLOUT */
+    if (!c->connecting && c->tx_len == 4 + len)
+        _handle_output(c);
+    else
+        _update_events(c);
+
+    if (cb)
+        return RPC_SUCCESS;
+    while (!sr.done) {
+        if (vxi11_rpc_run(r, -1) < 0 && errno != EINTR) {
+            /* call is still queued and refers to 'sr' - fail it */
+            _fail(c, RPC_SYSTEMERROR);
+        }
+    }
+    return sr.stat;
+}
+
+enum clnt_stat
+vxi11_rpc_core_call(vxi11_conn_t c, unsigned long proc, void *in, void *out,
+                    unsigned long timeout, vxi11_rpc_cb_t cb, void *arg)
+{
+    if (proc >= VXI11_NPROCS_TAB || !vxi11_procs[proc].in)
+        return RPC_PROCUNAVAIL;
+    return vxi11_rpc_call(c, proc, vxi11_procs[proc].in, in,
+                          vxi11_procs[proc].out, out, timeout, cb, arg);
+}
+
+int
+vxi11_rpc_run(vxi11_rpc_t r, int timeout)
+{
+    struct epoll_event ev[RPC_MAXEVENTS];
+    int i, n, completed = r->ncompleted;
+    long wait;
+    vxi11_conn_t c;
+
+    assert(r->magic == RPC_MAGIC);
+    r->depth++;
+    wait = _expire(r);
+    if (wait < 0 || (timeout >= 0 && timeout < wait))
+        wait = timeout;
+    if (wait > INT_MAX)
+        wait = INT_MAX;
+    if (r->ncompleted != completed)
+        wait = 0;
+    n = epoll_wait(r->epfd, ev, RPC_MAXEVENTS, (int)wait);
+    for (i = 0; i < n; i++) {
+        c = ev[i].data.ptr;
+        if ((ev[i].events & (EPOLLOUT | EPOLLERR)) && !c->failed
+                                                   && !c->closed)
+            _handle_output(c);
+        if ((ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !c->failed
+                                                             && !c->closed)
+            _handle_input(c);
+    }
+    (void)_expire(r);
+    if (--r->depth == 0) {
+        while ((c = r->zombies)) {
+            r->zombies = c->next;
+            _free_conn(c);
+        }
+    }
+    if (n < 0)
+        return -1;
+    return r->ncompleted - completed;
+}
+
+int
+vxi11_rpc_pending(vxi11_rpc_t r)
+{
+    assert(r->magic == RPC_MAGIC);
+    return r->ncalls;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,138 @@
+#ifndef _VXI11_RPC_H
+#define _VXI11_RPC_H
+
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* Event driven ONC RPC client engine.
+ *
+ * Unlike the rpcgen stubs used by vxi11_core.c, which block the caller
+ * until the reply to a single call arrives, an engine multiplexes any
+ * number of outstanding calls over any number of TCP connections using
+ * one epoll descriptor.  Calls are matched to replies by XID, so several
+ * calls may be in flight on one connection (e.g. to different links on
+ * a gateway) and one thread can drive many gateways.
+ *
+ * An engine is not thread safe; use it from one thread, or serialize.
+ * Requires <rpc/rpc.h> and <netinet/in.h>.
+ *
+ * vxi11_discover () uses an engine to probe many hosts at once.  The
+ * vxi11_device API does not: its calls block by design, one at a time
+ * per handle, and its connections are shared between handles and threads
+ * through rpccache.c, so the blocking rpcgen stubs under a per-connection
+ * call lock already give it everything the engine would, without moving
+ * the connection cache, keepalive and watchdog onto a second transport.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct vxi11_rpc_struct *vxi11_rpc_t;
+typedef struct vxi11_conn_struct *vxi11_conn_t;
+
+/* Completion callback.  'stat' is RPC_SUCCESS if the reply was decoded
+ * into the caller's result structure, else the reason the call failed,
+ * e.g. RPC_TIMEDOUT or RPC_CANTRECV (see clnt_sperrno ()).
+ */
+typedef void (*vxi11_rpc_cb_t)(enum clnt_stat stat, void *arg);
+
+/* Create an engine.  Returns NULL on out of memory or epoll error.
+ */
+vxi11_rpc_t vxi11_rpc_create(void);
+
+/* Destroy an engine, disconnecting any remaining connections.
+ * Outstanding calls complete with RPC_CANTRECV.
+ */
+void vxi11_rpc_destroy(vxi11_rpc_t r);
+
+/* Return the engine's epoll descriptor, which becomes readable when
+ * vxi11_rpc_run () has work to do, for embedding in another event loop.
+ */
+int vxi11_rpc_fd(vxi11_rpc_t r);
+
+/* Start a non-blocking TCP connection to program 'prog' version 'vers'
+ * at 'addr'.  Calls may be queued immediately; they are sent once the
+ * connection completes.  Returns 0 on success, -1 on error (errno set).
+ */
+int vxi11_rpc_connect(vxi11_rpc_t r, struct sockaddr_in *addr,
+                      unsigned long prog, unsigned long vers,
+                      vxi11_conn_t *connp);
+
+/* Close a connection.  Outstanding calls complete with RPC_CANTRECV.
+ * May be called from a completion callback.
+ */
+void vxi11_rpc_disconnect(vxi11_conn_t c);
+
+/* Returns false once a connection has failed (connect or I/O error).
+ * Its outstanding calls will have completed with an error, and new calls
+ * are refused; the connection should be disconnected.
+ */
+bool vxi11_rpc_connected(vxi11_conn_t c);
+
+/* Call procedure 'proc', encoding 'in' with 'inproc'.  The reply is
+ * decoded into 'out' with 'outproc'.  'out' must be zeroed beforehand
+ * and stay valid until the call completes; free what XDR allocated in
+ * it with xdr_free (outproc, out) afterwards.  If no reply arrives
+ * within 'timeout' milliseconds the call completes with RPC_TIMEDOUT.
+ *
+ * If 'cb' is non-NULL the call is asynchronous: RPC_SUCCESS means it was
+ * queued, and 'cb' is called from vxi11_rpc_run () when it completes.
+ * ('cb' runs before vxi11_rpc_call () returns if sending fails at once.)
+ * If 'cb' is NULL, the engine runs until the call completes (servicing
+ * other calls as well) and the final status is returned.
+ */
+enum clnt_stat vxi11_rpc_call(vxi11_conn_t c, unsigned long proc,
+                              xdrproc_t inproc, void *in,
+                              xdrproc_t outproc, void *out,
+                              unsigned long timeout,
+                              vxi11_rpc_cb_t cb, void *arg);
+
+/* Like vxi11_rpc_call (), for a DEVICE_CORE procedure (create_link,
+ * device_write, ... destroy_intr_chan) or, on a DEVICE_ASYNC connection,
+ * device_abort.  The XDR routines are chosen to match the procedure,
+ * e.g. device_read takes a Device_ReadParms and returns Device_ReadResp.
+ * Returns RPC_PROCUNAVAIL for an unknown procedure.
+ * N.B. 'timeout' should allow for the VXI-11 io_timeout and lock_timeout.
+ */
+enum clnt_stat vxi11_rpc_core_call(vxi11_conn_t c, unsigned long proc,
+                                   void *in, void *out,
+                                   unsigned long timeout,
+                                   vxi11_rpc_cb_t cb, void *arg);
+
+/* Wait up to 'timeout' milliseconds (-1 = forever) for socket events,
+ * then send queued calls, receive replies, expire timed out calls, and
+ * run completion callbacks.  Returns the number of calls completed,
+ * or -1 on error (errno set).
+ */
+int vxi11_rpc_run(vxi11_rpc_t r, int timeout);
+
+/* Returns the number of calls outstanding on the engine.
+ */
+int vxi11_rpc_pending(vxi11_rpc_t r);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _VXI11_RPC_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
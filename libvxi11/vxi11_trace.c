@@ -0,0 +1,330 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+  
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+  
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+  
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+  
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation, 
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*
+ * vxi11_trace.c - in-memory ring of binary trace records
+ *
+ * Formatting a debug line per RPC is too slow to leave on, and the
+ * output is lost with the process.  Instead each operation stores a
+ * fixed-size record in a static ring, which is formatted only when
+ * somebody asks: vxi11_trace_dump (), a signal, or a fatal signal.
+ *
+ * Writers claim a slot with an atomic increment and commit it by storing
+ * its sequence number last, so a reader (possibly a signal handler that
+ * interrupted a writer) can tell a complete record from one that is being
+ * written or has been overwritten, and skip it.  Formatting uses no stdio
+ * or floating point, only integer conversions into a local buffer.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "vxi11_trace.h"
+
+static struct vxi11_trace_rec ring[VXI11_TRACE_SIZE];
+static volatile unsigned long ring_seq[VXI11_TRACE_SIZE]; /* index + 1 of
+                                           the committed record, 0 = busy */
+static unsigned long ring_next = 0;     /* total records ever written */
+static volatile int trace_echo = 0; /* read without locking */
+static int trace_sig = 0;
+
+static const struct {
+    char *name;
+    char *arg;
+    char *result;
+} opinfo[VXI11_TR_NOPS] = {
+    [VXI11_TR_OPEN_CORE]    = { "open_core",    "port",         "maxconn" },
+    [VXI11_TR_CLOSE_CORE]   = { "close_core",   NULL,           NULL },
+    [VXI11_TR_OPEN_ABRT]    = { "open_abrt",    "port",         NULL },
+    [VXI11_TR_CLOSE_ABRT]   = { "close_abrt",   NULL,           NULL },
+    [VXI11_TR_TUNE]         = { "tune",         NULL,           NULL },
+    [VXI11_TR_CREATE_LINK]  = { "create_link",  "lock_timeout", "abortPort" },
+    [VXI11_TR_WRITE]        = { "write",        "io_timeout",   NULL },
+    [VXI11_TR_READ]         = { "read",         "termChar",     "reason" },
+    [VXI11_TR_READSTB]      = { "readstb",      "io_timeout",   "stb" },
+    [VXI11_TR_TRIGGER]      = { "trigger",      "io_timeout",   NULL },
+    [VXI11_TR_CLEAR]        = { "clear",        "io_timeout",   NULL },
+    [VXI11_TR_REMOTE]       = { "remote",       "io_timeout",   NULL },
+    [VXI11_TR_LOCAL]        = { "local",        "io_timeout",   NULL },
+    [VXI11_TR_LOCK]         = { "lock",         "lock_timeout", NULL },
+    [VXI11_TR_UNLOCK]       = { "unlock",       NULL,           NULL },
+    [VXI11_TR_ENABLE_SRQ]   = { "enable_srq",   "enable",       NULL },
+    [VXI11_TR_DOCMD]        = { "docmd",        "cmd",          NULL },
+    [VXI11_TR_DESTROY_LINK] = { "destroy_link", NULL,           NULL },
+    [VXI11_TR_CREATE_INTR]  = { "create_intr",  "hostPort",     "hostAddr" },
+    [VXI11_TR_DESTROY_INTR] = { "destroy_intr", NULL,           NULL },
+    [VXI11_TR_ABORT]        = { "abort",        NULL,           NULL },
+    [VXI11_TR_CLNT_CREATE]  = { "clnt_create",  "port",         "usecount" },
+    [VXI11_TR_CLNT_DESTROY] = { "clnt_destroy", NULL,           "usecount" },
+    [VXI11_TR_RPC_CONNECT]  = { "rpc_connect",  "port",         NULL },
+    [VXI11_TR_RPC_CALL]     = { "rpc_call",     "proc",         "xid" },
+};
+
+static uint64_t
+_nsec(struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+void
+vxi11_trace_begin(struct timespec *t0)
+{
+    clock_gettime(CLOCK_MONOTONIC, t0);
+}
+
+/* Async-signal-safe string building: append to 'b', truncating at its
+ * size (less one for the NUL).
+ */
+struct fmtbuf {
+    char *buf;
+    int len;
+    int n;
+};
+
+static void
+_puts(struct fmtbuf *b, const char *s, int width)
+{
+    for (; *s && b->n < b->len - 1; width--)
+        b->buf[b->n++] = *s++;
+    for (; width > 0 && b->n < b->len - 1; width--)
+        b->buf[b->n++] = ' ';
+}
+
+static void
+_putu(struct fmtbuf *b, uint64_t val, int base, int width)
+{
+    char tmp[24];
+    int i = sizeof(tmp) - 1;
+
+    tmp[i] = '\0';
+    do {
+        tmp[--i] = "0123456789abcdef"[val % base];
+        val /= base;
+    } while (val > 0 && i > 0);
+    while ((int)sizeof(tmp) - 1 - i < width && i > 0)
+        tmp[--i] = '0';
+    _puts(b, &tmp[i], 0);
+}
+
+static void
+_putd(struct fmtbuf *b, int64_t val)
+{
+    if (val < 0) {
+        _puts(b, "-", 0);
+        _putu(b, -(uint64_t)val, 10, 0);
+    } else
+        _putu(b, val, 10, 0);
+}
+
+/* Format 'r' as a line, with 't' (wall clock nsec) as its start time.
+ */
+static int
+_format(struct vxi11_trace_rec *r, uint64_t t, char *buf, int len)
+{
+    char *name = r->op < VXI11_TR_NOPS ? opinfo[r->op].name : "?";
+    char *arg = r->op < VXI11_TR_NOPS ? opinfo[r->op].arg : NULL;
+    char *result = r->op < VXI11_TR_NOPS ? opinfo[r->op].result : NULL;
+    struct fmtbuf b = { buf, len, 0 };
+
+    _putu(&b, t / 1000000000, 10, 0);
+    _puts(&b, ".", 0);
+    _putu(&b, (t % 1000000000) / 1000, 10, 6);
+    _puts(&b, " ", 0);
+    _puts(&b, name, 12);
+    _puts(&b, " lid=", 0);
+    _putd(&b, r->lid);
+    _puts(&b, " flags=0x", 0);
+    _putu(&b, (uint32_t)r->flags, 16, 0);
+    if (arg) {
+        _puts(&b, " ", 0);
+        _puts(&b, arg, 0);
+        _puts(&b, "=", 0);
+        _putu(&b, r->arg, 10, 0);
+    }
+    if (r->in || r->out) {
+        _puts(&b, " in=", 0);
+        _putu(&b, r->in, 10, 0);
+        _puts(&b, " out=", 0);
+        _putu(&b, r->out, 10, 0);
+    }
+    if (result) {
+        _puts(&b, " ", 0);
+        _puts(&b, result, 0);
+        _puts(&b, "=", 0);
+        _putu(&b, r->result, 10, 0);
+    }
+    _puts(&b, " = ", 0);
+    _putd(&b, r->err);
+    _puts(&b, " (", 0);
+    _putu(&b, r->usec, 10, 0);
+    _puts(&b, "us)\n", 0);
+    buf[b.n] = '\0';
+    return b.n;
+}
+
+/* Copy the record 'i' (a ring_next value) to 'rec'.  Returns 0, or -1
+ * if it is not committed, i.e. being written or already overwritten.
+ */
+static int
+_read_rec(unsigned long i, struct vxi11_trace_rec *rec)
+{
+    int slot = i & (VXI11_TRACE_SIZE - 1);
+
+    if (ring_seq[slot] != i + 1)
+        return -1;
+    __sync_synchronize();
+    *rec = ring[slot];
+    __sync_synchronize();
+    return ring_seq[slot] == i + 1 ? 0 : -1;
+}
+
+void
+vxi11_trace_end(struct timespec *t0, int op, long lid, long flags,
+                unsigned long arg, unsigned long in, unsigned long out,
+                unsigned long result, int err)
+{
+    struct vxi11_trace_rec *r;
+    struct timespec t1;
+    unsigned long i;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    i = __sync_fetch_and_add(&ring_next, 1);
+    ring_seq[i & (VXI11_TRACE_SIZE - 1)] = 0;
+    __sync_synchronize();
+    r = &ring[i & (VXI11_TRACE_SIZE - 1)];
+    r->start = _nsec(t0);
+    r->usec = (_nsec(&t1) - r->start) / 1000;
+    r->op = op;
+    r->err = err;
+    r->lid = lid;
+    r->flags = flags;
+    r->arg = arg;
+    r->in = in;
+    r->out = out;
+    r->result = result;
+    __sync_synchronize();
+    ring_seq[i & (VXI11_TRACE_SIZE - 1)] = i + 1;
+    if (trace_echo) {
+        struct vxi11_trace_rec rec = *r;
+        struct timespec now;
+        char buf[256];
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        _format(&rec, _nsec(&now) - (uint64_t)rec.usec * 1000,
+                buf, sizeof(buf));
+        fprintf(stderr, "DBG %s", buf);
+    }
+}
+
+int
+vxi11_trace_get(struct vxi11_trace_rec *recs, int max)
+{
+    unsigned long next = ring_next;
+    unsigned long first = next > VXI11_TRACE_SIZE ? next - VXI11_TRACE_SIZE : 0;
+    int n = 0;
+
+    if (next - first > (unsigned long)max)
+        first = next - max;
+    for (; first < next; first++)
+        if (_read_rec(first, &recs[n]) == 0)
+            n++;
+    return n;
+}
+
+/* Records are printed with wall clock times, converted from the
+ * monotonic timestamps using the current offset between the two clocks.
+ * Records being written while we run are skipped.
+ */
+void
+vxi11_trace_dump(int fd)
+{
+    unsigned long next = ring_next;
+    unsigned long i = next > VXI11_TRACE_SIZE ? next - VXI11_TRACE_SIZE : 0;
+    struct vxi11_trace_rec rec;
+    struct timespec mono, real;
+    int64_t offset;
+    char buf[256];
+    struct fmtbuf b = { buf, sizeof(buf), 0 };
+    int n;
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    offset = (int64_t)(_nsec(&real) - _nsec(&mono));
+    _puts(&b, "vxi11 trace: ", 0);
+    _putu(&b, next - i, 10, 0);
+    _puts(&b, " records (", 0);
+    _putu(&b, i, 10, 0);
+    _puts(&b, " dropped)\n", 0);
+    (void)write(fd, buf, b.n);
+    for (; i < next; i++) {
+        if (_read_rec(i, &rec) < 0)
+            continue;
+        n = _format(&rec, rec.start + offset, buf, sizeof(buf));
+        (void)write(fd, buf, n);
+    }
+}
+
+static void
+_sig_handler(int sig)
+{
+    vxi11_trace_dump(STDERR_FILENO);
+    if (sig != trace_sig)
+        raise(sig); /* SA_RESETHAND restored the default action */
+}
+
+int
+vxi11_trace_handlers(int sig)
+{
+    static int fatal[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    struct sigaction sa;
+    int i;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _sig_handler;
+    sigemptyset(&sa.sa_mask);
+    if (sig != 0) {
+        sa.sa_flags = SA_RESTART;
+        if (sigaction(sig, &sa, NULL) < 0)
+            return -1;
+        trace_sig = sig;
+    }
+    sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+    for (i = 0; i < sizeof(fatal) / sizeof(fatal[0]); i++)
+        if (fatal[i] != sig && sigaction(fatal[i], &sa, NULL) < 0)
+            return -1;
+    return 0;
+}
+
+void
+vxi11_trace_set_echo(int doEcho)
+{
+    __sync_lock_test_and_set(&trace_echo, doEcho);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,121 @@
+#ifndef _VXI11_TRACE_H
+#define _VXI11_TRACE_H
+
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+  
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+  
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+  
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+  
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation, 
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Every core/abort channel operation and RPC connection cache event is
+ * recorded in a fixed-size in-memory ring.  Recording is always on and
+ * costs a clock_gettime () and a few stores per operation; the ring
+ * is only formatted when dumped.
+ */
+#define VXI11_TRACE_SIZE    1024    /* records kept (power of 2) */
+
+enum {
+    VXI11_TR_OPEN_CORE,             /* arg=port (0=portmap) result=maxconn */
+    VXI11_TR_CLOSE_CORE,
+    VXI11_TR_OPEN_ABRT,             /* arg=port */
+    VXI11_TR_CLOSE_ABRT,
+    VXI11_TR_TUNE,                  /* flags=sockflags in=bufsize */
+    VXI11_TR_CREATE_LINK,           /* arg=lock_timeout out=maxRecvSize 
+                                       result=abortPort */
+    VXI11_TR_WRITE,                 /* arg=io_timeout out=size */
+    VXI11_TR_READ,                  /* arg=termChar result=reason */
+    VXI11_TR_READSTB,               /* arg=io_timeout result=stb */
+    VXI11_TR_TRIGGER,               /* arg=io_timeout */
+    VXI11_TR_CLEAR,                 /* arg=io_timeout */
+    VXI11_TR_REMOTE,                /* arg=io_timeout */
+    VXI11_TR_LOCAL,                 /* arg=io_timeout */
+    VXI11_TR_LOCK,                  /* arg=lock_timeout */
+    VXI11_TR_UNLOCK,
+    VXI11_TR_ENABLE_SRQ,            /* arg=enable in=handle_len */
+    VXI11_TR_DOCMD,                 /* arg=cmd in=data_in_len 
+                                       out=data_out_len */
+    VXI11_TR_DESTROY_LINK,
+    VXI11_TR_CREATE_INTR,           /* arg=hostPort result=hostAddr */
+    VXI11_TR_DESTROY_INTR,
+    VXI11_TR_ABORT,
+    VXI11_TR_CLNT_CREATE,           /* arg=port result=usecount (1=new) */
+    VXI11_TR_CLNT_DESTROY,          /* result=usecount remaining
+                                       (err=-1 if not cached) */
+    VXI11_TR_RPC_CONNECT,           /* arg=port (err=errno) */
+    VXI11_TR_RPC_CALL,              /* arg=proc result=xid (err=clnt_stat) */
+    VXI11_TR_NOPS
+};
+
+struct vxi11_trace_rec {
+    uint64_t    start;              /* CLOCK_MONOTONIC nsec at entry */
+    uint32_t    usec;               /* duration */
+    uint16_t    op;                 /* VXI11_TR_* */
+    int16_t     err;                /* return code of the operation */
+    int32_t     lid;
+    int32_t     flags;
+    uint32_t    arg;                /* op specific - see above */
+    uint32_t    in;                 /* bytes sent/requested */
+    uint32_t    out;                /* bytes received */
+    uint32_t    result;             /* op specific - see above */
+};
+
+/* Copy up to 'max' of the most recent trace records, oldest first,
+ * into 'recs', leaving out any being written.  Returns the number copied.
+ */
+int vxi11_trace_get(struct vxi11_trace_rec *recs, int max);
+
+/* Format the ring, oldest first, to file descriptor 'fd'.
+ * Uses only integer formatting and write (2), so it may be called from
+ * a signal handler.  Records being written meanwhile are left out.
+ */
+void vxi11_trace_dump(int fd);
+
+/* Dump the ring to stderr when signal 'sig' (e.g. SIGUSR1) arrives,
+ * or when the process is killed by SIGSEGV, SIGBUS, SIGFPE, SIGILL or
+ * SIGABRT.  Pass 'sig' of 0 to install only the fatal signal handlers.
+ * Returns 0 on success, -1 on failure.
+ */
+int vxi11_trace_handlers(int sig);
+
+/* Copy each record to stderr as it is recorded (used by the
+ * vxi11_set_*_debug () functions).
+ */
+void vxi11_trace_set_echo(int doEcho);
+
+/* Record an operation.  Call vxi11_trace_begin () before and
+ * vxi11_trace_end () after it.  For use within libvxi11.
+ */
+void vxi11_trace_begin(struct timespec *t0);
+void vxi11_trace_end(struct timespec *t0, int op, long lid, long flags,
+                     unsigned long arg, unsigned long in, unsigned long out,
+                     unsigned long result, int err);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _VXI11_TRACE_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
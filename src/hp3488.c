@@ -474,6 +474,15 @@ _probe_model_config(struct instrument *gd)
     modeltab_t *cp;
     char tmpstr[128];
 
+    /* instd(1) may have kept what an earlier run found */
+    if (inst_getattr(gd, "hp3488.config", tmpstr, sizeof(tmpstr)) > 0) {
+        if (_parse_model_config(tmpstr) == 0)
+            return;
+        /* drop the slots parsed before the bad one, then probe */
+        hostlist_destroy(valid_targets);
+        valid_targets = hostlist_create("");
+        memset(slot_config, 0, sizeof(slot_config));
+    }
     for (slot = 1; slot <= 5; slot++) {
         model = _ctype(gd, slot);
         if (model == 44471) {
@@ -488,6 +497,9 @@ _probe_model_config(struct instrument *gd)
         slot_config[slot - 1] = model;
     }
     hostlist_sort(valid_targets);
+    sprintf(tmpstr, "%d,%d,%d,%d,%d", slot_config[0], slot_config[1],
+            slot_config[2], slot_config[3], slot_config[4]);
+    inst_setattr(gd, "hp3488.config", tmpstr);
 }
 
 static void
@@ -0,0 +1,639 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* instd - keep instruments open between runs of the gpib-utils tools */
+
+/* Each instrument address gets a session process, forked on first use,
+ * that opens the instrument with libinst and keeps it open until unused
+ * for the idle time.  The main process accepts clients of our own user,
+ * waits, without blocking the others, for their SESSION_OPEN and passes
+ * the connection, with the client's stderr, to the session process over
+ * a socketpair.  A session process serves its clients one at a time, so
+ * each has the instrument to itself, drops one that goes quiet for the
+ * client timeout, and exits if libinst does on an I/O error, with the
+ * message on the client's stderr; the next client gets a new session.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#if HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+
+#include "libutil/util.h"
+#include "libinst/inst.h"
+#include "libinst/session.h"
+
+#define DFLT_IDLE       300     /* sec a session stays open unused */
+#define DFLT_CLIENT     300     /* sec a client may hold a session idle */
+#define OPEN_TIMEOUT    5       /* sec for a client to send SESSION_OPEN */
+#define IO_TIMEOUT      5       /* sec for the rest of a message, or a reply */
+
+char *prog = "instd";
+const char *options = "S:t:T:v";
+
+#if HAVE_GETOPT_LONG
+#define GETOPT(ac,av,opt,lopt) getopt_long(ac,av,opt,lopt,NULL)
+static struct option longopts[] = {
+    {"socket",          required_argument, 0, 'S'},
+    {"idle-timeout",    required_argument, 0, 't'},
+    {"client-timeout",  required_argument, 0, 'T'},
+    {"verbose",         no_argument,       0, 'v'},
+    {0, 0, 0, 0},
+};
+#else
+#define GETOPT(ac,av,opt,lopt) getopt(ac,av,opt)
+#endif
+
+struct attr {
+    char               *key;
+    char               *val;
+    struct attr        *next;
+};
+
+struct client {
+    int                 fd;         /* waiting for its SESSION_OPEN */
+    time_t              expire;
+    struct client      *next;
+};
+
+struct session {
+    char               *addr;
+    pid_t               pid;
+    int                 ctl;        /* socketpair to the session process */
+    struct session     *next;
+};
+
+static struct session *sessions = NULL;
+static struct client *clients = NULL;
+static int lfd = -1;
+static int idle = DFLT_IDLE;
+static int client_idle = DFLT_CLIENT;
+static int verbose = 0;
+static volatile sig_atomic_t done = 0;
+
+void
+usage (void)
+{
+    fprintf (stderr, "%s", "Usage: instd [OPTIONS]\n"
+        "    -S,--socket PATH        listen on PATH (see instd(1))\n"
+        "    -t,--idle-timeout SEC   close instruments unused for SEC (300)\n"
+        "    -T,--client-timeout SEC drop a tool idle for SEC (300)\n"
+        "    -v,--verbose            log sessions on stderr\n");
+    exit (1);
+}
+
+static time_t
+uptime (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static int
+reply (int fd, int result, uint32_t arg, const void *buf, int len)
+{
+    struct session_hdr h = { .op = result, .arg = arg, .len = len };
+
+    return session_send (fd, &h, buf, NULL, 0);
+}
+
+static struct attr *
+attr_find (struct attr *a, const char *key)
+{
+    for (; a != NULL; a = a->next)
+        if (!strcmp (a->key, key))
+            return a;
+    return NULL;
+}
+
+/* Carry out request 'h' with payload 'buf' (NUL terminated) and reply.
+ */
+static int
+dispatch (struct instrument *gd, struct session_hdr *h, char *buf, int fd,
+          struct attr **attrs)
+{
+    unsigned char stb;
+    struct attr *a;
+    char *rbuf;
+    int n, klen;
+
+    switch (h->op) {
+        case SESSION_WRITE:
+            inst_wrt (gd, buf, h->len);
+            break;
+        case SESSION_READ:
+            if (h->arg > SESSION_MAXDATA)
+                return reply (fd, -1, 0, NULL, 0);
+            rbuf = xmalloc (h->arg + 1);
+            n = inst_rd (gd, rbuf, h->arg);
+            n = reply (fd, n, 0, rbuf, n);
+            free (rbuf);
+            return n;
+        case SESSION_RSP:
+            n = inst_rsp (gd, &stb);
+            return reply (fd, n, stb, NULL, 0);
+        case SESSION_CLR:
+            inst_clr (gd, 0);
+            break;
+        case SESSION_LOC:
+            inst_loc (gd);
+            break;
+        case SESSION_TRG:
+            inst_trg (gd);
+            break;
+        case SESSION_TIMEOUT:
+            inst_set_timeout (gd, h->arg * 1E-6);
+            break;
+        case SESSION_REOS:
+            inst_set_reos (gd, h->arg);
+            break;
+        case SESSION_EOS:
+            inst_set_eos (gd, h->arg);
+            break;
+        case SESSION_EOT:
+            inst_set_eot (gd, h->arg);
+            break;
+        case SESSION_GETATTR:
+            if (!(a = attr_find (*attrs, buf)) || strlen (a->val) > h->arg)
+                return reply (fd, -1, 0, NULL, 0);
+            n = strlen (a->val);
+            return reply (fd, n, 0, a->val, n);
+        case SESSION_SETATTR:
+            if ((klen = strlen (buf)) == h->len)
+                return reply (fd, -1, 0, NULL, 0);
+            if ((a = attr_find (*attrs, buf)))
+                free (a->val);
+            else {
+                a = xzmalloc (sizeof (*a));
+                a->key = xstrdup (buf);
+                a->next = *attrs;
+                *attrs = a;
+            }
+            a->val = xstrdup (buf + klen + 1);
+            break;
+        default:
+            return reply (fd, -1, 0, NULL, 0);
+    }
+    return reply (fd, 0, 0, NULL, 0);
+}
+
+/* Serve client 'fd' until it disconnects or is idle for the client
+ * timeout, opening the instrument first if need be.  Returns -1 if it
+ * could not be opened.
+ */
+static int
+serve (struct instrument **gdp, const char *addr, int fd, struct attr **attrs)
+{
+    struct timeval tv = { .tv_sec = IO_TIMEOUT };
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    struct session_hdr h;
+    const char *bus;
+    char *buf = NULL;
+    int n, size = 0;
+
+    if (!*gdp && !(*gdp = inst_init (addr, NULL, 0))) {
+        (void)reply (fd, -1, 0, NULL, 0);
+        return -1;
+    }
+    /* a client that stops reading or writing mid-message is dropped */
+    (void)setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    (void)setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+    inst_reset (*gdp);
+    bus = inst_bus (*gdp);
+    if (reply (fd, 0, 0, bus, strlen (bus)) < 0)
+        return 0;
+    for (;;) {
+        n = poll (&pfd, 1, client_idle > 0 ? client_idle * 1000 : -1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0)
+            fprintf (stderr, "%s: %s: idle for %d sec, instd closed it\n",
+                     prog, addr, client_idle);
+        if (n <= 0 || session_recv (fd, &h, NULL, 0) <= 0)
+            break;
+        if (h.len + 1 > size)
+            buf = xrealloc (buf, size = h.len + 1);
+        if (read_all (fd, buf, h.len) < h.len)
+            break;
+        buf[h.len] = '\0';
+        if (dispatch (*gdp, &h, buf, fd, attrs) < 0)
+            break;
+    }
+    free (buf);
+    return 0;
+}
+
+/* Session process for instrument 'addr': take clients from 'ctl' until
+ * instd exits or none has come for the idle time.
+ */
+static void
+session_main (int ctl, const char *addr)
+{
+    struct pollfd pfd = { .fd = ctl, .events = POLLIN };
+    struct instrument *gd = NULL;
+    struct attr *attrs = NULL;
+    struct session_hdr h;
+    int n, fds[2], saved = dup (STDERR_FILENO);
+    char *buf;
+
+    for (;;) {
+        if ((n = poll (&pfd, 1, idle > 0 ? idle * 1000 : -1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (n == 0 || session_recv (ctl, &h, fds, 2) <= 0)
+            break;
+        buf = xmalloc (h.len + 1);
+        if (read_all (ctl, buf, h.len) < h.len)
+            break;
+        buf[h.len] = '\0';
+        if (fds[0] >= 0 && fds[1] >= 0) {
+            dup2 (fds[1], STDERR_FILENO);
+            prog = buf;             /* "prog\0addr\0" from the client */
+            n = serve (&gd, addr, fds[0], &attrs);
+            fflush (stderr);
+            dup2 (saved, STDERR_FILENO);
+            prog = "instd";
+        } else
+            n = 0;
+        if (fds[0] >= 0)
+            close (fds[0]);
+        if (fds[1] >= 0)
+            close (fds[1]);
+        free (buf);
+        if (n < 0)
+            break;
+    }
+    if (gd)
+        inst_fini (gd);
+    exit (0);
+}
+
+/* Fork a session process for 'addr'.  The client being handed over,
+ * 'cfd' and 'errfd', is closed in the child, which gets it over 'ctl'.
+ */
+static struct session *
+session_start (const char *addr, int cfd, int errfd)
+{
+    struct session *s, *t;
+    struct client *c;
+    int sv[2];
+    pid_t pid;
+
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        fprintf (stderr, "%s: socketpair: %s\n", prog, strerror (errno));
+        return NULL;
+    }
+    switch ((pid = fork ())) {
+        case -1:
+            fprintf (stderr, "%s: fork: %s\n", prog, strerror (errno));
+            close (sv[0]);
+            close (sv[1]);
+            return NULL;
+        case 0:
+            close (sv[0]);
+            close (lfd);
+            close (cfd);
+            close (errfd);
+            for (t = sessions; t != NULL; t = t->next)
+                close (t->ctl);
+            for (c = clients; c != NULL; c = c->next)
+                close (c->fd);
+            signal (SIGTERM, SIG_DFL);
+            signal (SIGINT, SIG_DFL);
+            signal (SIGHUP, SIG_DFL);
+            session_main (sv[1], addr);
+            /*NOTREACHED*/
+    }
+    close (sv[1]);
+    s = xzmalloc (sizeof (*s));
+    s->addr = xstrdup (addr);
+    s->pid = pid;
+    s->ctl = sv[0];
+    s->next = sessions;
+    sessions = s;
+    if (verbose)
+        fprintf (stderr, "%s: %s: opened by pid %d\n", prog, addr, (int)pid);
+    return s;
+}
+
+static void
+session_drop (struct session *s)
+{
+    struct session **sp;
+
+    for (sp = &sessions; *sp != s; sp = &(*sp)->next)
+        ;
+    *sp = s->next;
+    if (verbose)
+        fprintf (stderr, "%s: %s: closed\n", prog, s->addr);
+    close (s->ctl);
+    free (s->addr);
+    free (s);
+}
+
+/* Accept a new client, if it runs as our user, and wait for its
+ * SESSION_OPEN.
+ */
+static void
+accept_client (void)
+{
+    struct client *c;
+    int cfd;
+
+    if ((cfd = accept (lfd, NULL, NULL)) < 0)
+        return;
+    if (!session_peer_ok (cfd)) {
+        if (verbose)
+            fprintf (stderr, "%s: refused a client of another user\n", prog);
+        close (cfd);
+        return;
+    }
+    c = xzmalloc (sizeof (*c));
+    c->fd = cfd;
+    c->expire = uptime () + OPEN_TIMEOUT;
+    c->next = clients;
+    clients = c;
+}
+
+/* Return 1 if all of the SESSION_OPEN from 'fd' has arrived, so reading
+ * it will not block, 0 if not yet, or -1 if it is not one.  The client
+ * sends it with a single sendmsg (), so it is in one piece.
+ */
+static int
+client_ready (int fd)
+{
+    struct session_hdr h;
+    char *buf;
+    int n, len;
+
+    n = recv (fd, &h, sizeof (h), MSG_PEEK | MSG_DONTWAIT);
+    if (n < sizeof (h))
+        return n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)
+               ? -1 : 0;
+    if (h.op != SESSION_OPEN || h.len > SESSION_MAXDATA)
+        return -1;
+    len = sizeof (h) + h.len;
+    buf = xmalloc (len);
+    n = recv (fd, buf, len, MSG_PEEK | MSG_DONTWAIT);
+    free (buf);
+    return n == len;
+}
+
+/* Read client 'cfd's SESSION_OPEN and pass it to the session process for
+ * its instrument, starting one if need be.
+ */
+static void
+client_open (int cfd)
+{
+    struct session_hdr h;
+    struct session *s;
+    int fds[2], tries;
+    char *buf = NULL, *addr;
+
+    if (session_recv (cfd, &h, &fds[1], 1) <= 0)
+        goto done;
+    buf = xmalloc (h.len + 1);
+    if (h.op != SESSION_OPEN || fds[1] < 0
+                             || read_all (cfd, buf, h.len) < h.len)
+        goto done;
+    buf[h.len] = '\0';
+    addr = buf + strlen (buf) + 1;
+    if (addr >= buf + h.len) {
+        (void)reply (cfd, -1, 0, NULL, 0);
+        goto done;
+    }
+    if (verbose)
+        fprintf (stderr, "%s: %s: used by %s\n", prog, addr,
+                 *buf ? buf : "a client");
+    fds[0] = cfd;
+    for (tries = 0; tries < 2; tries++) {
+        for (s = sessions; s != NULL; s = s->next)
+            if (!strcmp (s->addr, addr))
+                break;
+        if (!s && !(s = session_start (addr, cfd, fds[1])))
+            break;
+        if (session_send (s->ctl, &h, buf, fds, 2) == 0)
+            break;
+        session_drop (s);           /* exited since we last looked */
+    }
+done:
+    if (buf)
+        free (buf);
+    if (fds[1] >= 0)
+        close (fds[1]);
+    close (cfd);
+}
+
+/* Listen on 'path', unless another instd already is.
+ */
+static int
+listen_unix (const char *path)
+{
+    struct sockaddr_un sun;
+    mode_t old;
+    int fd;
+
+    memset (&sun, 0, sizeof (sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen (path) >= sizeof (sun.sun_path)) {
+        fprintf (stderr, "%s: %s: path too long\n", prog, path);
+        exit (1);
+    }
+    strcpy (sun.sun_path, path);
+    if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf (stderr, "%s: socket: %s\n", prog, strerror (errno));
+        exit (1);
+    }
+    if (connect (fd, (struct sockaddr *)&sun, sizeof (sun)) == 0) {
+        if (session_peer_ok (fd))
+            fprintf (stderr, "%s: already running on %s\n", prog, path);
+        else
+            fprintf (stderr, "%s: %s: in use by another user\n", prog, path);
+        exit (1);
+    }
+    (void)unlink (path);            /* left by an instd that died */
+    old = umask (077);
+    if (bind (fd, (struct sockaddr *)&sun, sizeof (sun)) < 0) {
+        fprintf (stderr, "%s: bind %s: %s\n", prog, path, strerror (errno));
+        exit (1);
+    }
+    umask (old);
+    if (listen (fd, 16) < 0) {
+        fprintf (stderr, "%s: listen: %s\n", prog, strerror (errno));
+        exit (1);
+    }
+    return fd;
+}
+
+static void
+sigterm (int sig)
+{
+    done = 1;
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct session *s, *next;
+    struct client *cl, **clp;
+    struct pollfd *pfd = NULL;
+    struct sigaction sa;
+    char *path = NULL;
+    int c, i, n, nc, ms, tmout;
+    time_t now;
+
+    while ((c = GETOPT (argc, argv, options, longopts)) != EOF) {
+        switch (c) {
+            case 'S':   /* --socket */
+                path = xstrdup (optarg);
+                break;
+            case 't':   /* --idle-timeout */
+                idle = strtoul (optarg, NULL, 10);
+                break;
+            case 'T':   /* --client-timeout */
+                client_idle = strtoul (optarg, NULL, 10);
+                break;
+            case 'v':   /* --verbose */
+                verbose = 1;
+                break;
+            default:
+                usage ();
+        }
+    }
+    if (optind < argc)
+        usage ();
+    if (!path && !(path = session_path ())
+              && !(path = session_runtime_path ("instd.sock"))) {
+        fprintf (stderr, "%s: XDG_RUNTIME_DIR is not a private directory: "
+                 "use --socket\n", prog);
+        exit (1);
+    }
+    /* the sessions open instruments directly */
+    unsetenv ("GPIB_UTILS_SESSION");
+
+    lfd = listen_unix (path);
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = sigterm;
+    sigaction (SIGTERM, &sa, NULL);
+    sigaction (SIGINT, &sa, NULL);
+    sigaction (SIGHUP, &sa, NULL);
+    signal (SIGPIPE, SIG_IGN);
+    if (verbose)
+        fprintf (stderr, "%s: listening on %s\n", prog, path);
+
+    while (!done) {
+        nc = 0;
+        for (cl = clients; cl != NULL; cl = cl->next)
+            nc++;
+        n = 1 + nc;
+        for (s = sessions; s != NULL; s = s->next)
+            n++;
+        pfd = xrealloc (pfd, n * sizeof (*pfd));
+        pfd[0].fd = lfd;
+        pfd[0].events = POLLIN;
+        tmout = -1;
+        now = uptime ();
+        for (i = 1, cl = clients; cl != NULL; i++, cl = cl->next) {
+            pfd[i].fd = cl->fd;
+            pfd[i].events = POLLIN;
+            ms = cl->expire > now ? (cl->expire - now) * 1000 : 0;
+            if (tmout < 0 || ms < tmout)
+                tmout = ms;
+        }
+        for (s = sessions; s != NULL; i++, s = s->next) {
+            pfd[i].fd = s->ctl;     /* readable only at EOF */
+            pfd[i].events = POLLIN;
+        }
+        if (poll (pfd, n, tmout) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf (stderr, "%s: poll: %s\n", prog, strerror (errno));
+            break;
+        }
+        for (i = 1 + nc, s = sessions; s != NULL; i++, s = next) {
+            next = s->next;
+            if (pfd[i].revents)
+                session_drop (s);
+        }
+        while (waitpid (-1, NULL, WNOHANG) > 0)
+            ;
+        /* clients last, as handing them over changes the sessions */
+        now = uptime ();
+        for (i = 1, clp = &clients; (cl = *clp) != NULL; i++) {
+            n = pfd[i].revents ? client_ready (cl->fd) : 0;
+            if (n == 0 && (pfd[i].revents & (POLLHUP | POLLERR)))
+                n = -1;
+            if (n == 0 && now >= cl->expire) {
+                if (verbose)
+                    fprintf (stderr, "%s: client sent no request in %d sec\n",
+                             prog, OPEN_TIMEOUT);
+                n = -1;
+            }
+            if (n == 0) {
+                clp = &cl->next;
+                continue;
+            }
+            *clp = cl->next;
+            if (n > 0)
+                client_open (cl->fd);
+            else
+                close (cl->fd);
+            free (cl);
+        }
+        if (pfd[0].revents & POLLIN)
+            accept_client ();
+    }
+    /* sessions exit once their current client is done */
+    while ((cl = clients)) {
+        clients = cl->next;
+        close (cl->fd);
+        free (cl);
+    }
+    while (sessions)
+        session_drop (sessions);
+    close (lfd);
+    (void)unlink (path);
+    free (path);
+    free (pfd);
+    exit (0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
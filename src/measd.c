@@ -0,0 +1,735 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* measd - serve cached instrument readings to any number of readers */
+
+/* The main thread polls the listening socket, the readers and a wakeup
+ * pipe.  Readings are refreshed by jobs on the libinst scheduler, so
+ * instruments on different buses are queried in parallel, and a job
+ * that finishes writes its reading to the pipe for the main thread to
+ * answer the readers waiting for it.  A reader that joins a refresh
+ * begun before the oldest value it accepts waits for the next one.
+ * 'lock' covers the cached values and the pending and failed flags,
+ * which the jobs update.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#if HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+
+#include "libutil/util.h"
+#include "libini/ini.h"
+#include "libinst/inst.h"
+#include "libinst/sched.h"
+#include "libinst/session.h"
+#include "libinst/configfile.h"
+
+#define DFLT_MAXAGE     1.0     /* sec a value stays fresh */
+#define MAX_VALUE       256
+#define MAX_LINE        512
+
+char *prog = "measd";
+const char *options = "S:ga:lv";
+
+#if HAVE_GETOPT_LONG
+#define GETOPT(ac,av,opt,lopt) getopt_long(ac,av,opt,lopt,NULL)
+static struct option longopts[] = {
+    {"socket",          required_argument, 0, 'S'},
+    {"get",             no_argument,       0, 'g'},
+    {"max-age",         required_argument, 0, 'a'},
+    {"list",            no_argument,       0, 'l'},
+    {"verbose",         no_argument,       0, 'v'},
+    {0, 0, 0, 0},
+};
+#else
+#define GETOPT(ac,av,opt,lopt) getopt(ac,av,opt)
+#endif
+
+struct source {                 /* an instrument readings come from */
+    char               *name;       /* gpib-utils.conf name or address */
+    bool                byaddr;
+    struct instrument  *gd;
+    struct source      *next;
+};
+
+struct reading {
+    char               *name;
+    struct source      *src;
+    char               *query;
+    double              max_age;
+    double              period;     /* refresh unasked, 0 = on demand */
+    double              due;        /* next periodic refresh */
+    char                value[MAX_VALUE];
+    double              stamp;      /* when value was queried, 0 = never */
+    bool                pending;    /* refresh queued or running */
+    bool                failed;     /* last refresh got an I/O error */
+    unsigned long       requests;
+    unsigned long       queries;
+    struct reading     *next;
+};
+
+struct client {
+    int                 fd;
+    char                buf[MAX_LINE];
+    int                 len;
+    struct reading     *wait;       /* waiting for its refresh */
+    double              oldest;     /* ... queried no earlier than this */
+    bool                dead;
+    struct client      *next;
+};
+
+static struct source *sources = NULL;
+static struct reading *readings = NULL;
+static struct client *clients = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static inst_sched_t sched;
+static int wake[2];
+static int verbose = 0;
+static volatile sig_atomic_t done = 0;
+
+void
+usage (void)
+{
+    fprintf (stderr, "%s", "Usage: measd [OPTIONS] CONFIG\n"
+        "       measd [OPTIONS] --get NAME ...\n"
+        "    -S,--socket PATH     socket (see measd(1))\n"
+        "    -g,--get             print readings from the running measd\n"
+        "    -a,--max-age SEC     with --get, accept values up to SEC old\n"
+        "    -l,--list            print all cached readings\n"
+        "    -v,--verbose         log queries, and counts on exit\n");
+    exit (1);
+}
+
+static int
+connect_unix (const char *path, struct sockaddr_un *sun)
+{
+    int fd;
+
+    memset (sun, 0, sizeof (*sun));
+    sun->sun_family = AF_UNIX;
+    if (strlen (path) >= sizeof (sun->sun_path)) {
+        fprintf (stderr, "%s: %s: path too long\n", prog, path);
+        exit (1);
+    }
+    strcpy (sun->sun_path, path);
+    if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf (stderr, "%s: socket: %s\n", prog, strerror (errno));
+        exit (1);
+    }
+    if (connect (fd, (struct sockaddr *)sun, sizeof (*sun)) < 0) {
+        close (fd);
+        return -1;
+    }
+    if (!session_peer_ok (fd)) {
+        fprintf (stderr, "%s: %s: in use by another user\n", prog, path);
+        exit (1);
+    }
+    return fd;
+}
+
+/* --get and --list: ask the running measd.
+ */
+static int
+query_measd (const char *path, char **names, int n, const char *age)
+{
+    struct sockaddr_un sun;
+    char line[MAX_LINE], *name, *stamp, *val;
+    int i, fd, exit_val = 0;
+    FILE *f;
+
+    if ((fd = connect_unix (path, &sun)) < 0) {
+        fprintf (stderr, "%s: %s: %s\n", prog, path, strerror (errno));
+        exit (1);
+    }
+    if (!(f = fdopen (fd, "r"))) {
+        fprintf (stderr, "%s: out of memory\n", prog);
+        exit (1);
+    }
+    if (n == 0)
+        dprintf (fd, "list\n");
+    for (i = 0; i < n; i++)
+        dprintf (fd, "get %s%s%s\n", names[i], age ? " " : "", age ? age : "");
+    for (i = 0; n == 0 || i < n; i++) {
+        if (!fgets (line, sizeof (line), f)) {
+            fprintf (stderr, "%s: lost connection\n", prog);
+            exit (1);
+        }
+        line[strcspn (line, "\n")] = '\0';
+        if (n == 0 && !strcmp (line, "end"))
+            break;
+        name = strtok (line, " ");
+        if (name && !strcmp (name, "err")) {
+            fprintf (stderr, "%s: %s\n", prog, line + 4);
+            exit_val = 1;
+            continue;
+        }
+        name = strtok (NULL, " ");
+        stamp = strtok (NULL, " ");
+        val = strtok (NULL, "");
+        if (!name || !stamp) {
+            fprintf (stderr, "%s: protocol error\n", prog);
+            exit (1);
+        }
+        if (n == 0)
+            printf ("%-20s %s (%.1fs ago)\n", name, val ? val : "",
+                    gettime () - strtod (stamp, NULL));
+        else
+            printf ("%s\n", val ? val : "");
+    }
+    fclose (f);
+    return exit_val;
+}
+
+static struct reading *
+reading_find (const char *name)
+{
+    struct reading *r;
+
+    for (r = readings; r != NULL; r = r->next)
+        if (!strcmp (r->name, name))
+            return r;
+    return NULL;
+}
+
+static struct source *
+source_get (const char *name, bool byaddr)
+{
+    struct source *s;
+
+    for (s = sources; s != NULL; s = s->next)
+        if (!strcmp (s->name, name) && s->byaddr == byaddr)
+            return s;
+    s = xzmalloc (sizeof (*s));
+    s->name = xstrdup (name);
+    s->byaddr = byaddr;
+    s->next = sources;
+    sources = s;
+    return s;
+}
+
+/* Each section of the config file is a reading.
+ */
+static int
+parse_cb (void *user, const char *section, const char *name,
+          const char *value)
+{
+    const char *path = user;
+    struct reading *r = reading_find (section);
+    char *end;
+
+    if (!r) {
+        r = xzmalloc (sizeof (*r));
+        r->name = xstrdup (section);
+        r->max_age = DFLT_MAXAGE;
+        r->next = readings;
+        readings = r;
+    }
+    if (!strcmp (name, "instrument"))
+        r->src = source_get (value, false);
+    else if (!strcmp (name, "address"))
+        r->src = source_get (value, true);
+    else if (!strcmp (name, "query")) {
+        free (r->query);
+        r->query = xstrdup (value);
+    } else if (!strcmp (name, "max-age") || !strcmp (name, "period")) {
+        double d = strtod (value, &end);
+
+        if (*end != '\0' || end == value || d < 0) {
+            fprintf (stderr, "%s: [%s]: bad %s: %s\n", path, section, name,
+                     value);
+            return 0;
+        }
+        if (!strcmp (name, "period"))
+            r->period = d;
+        else
+            r->max_age = d;
+    } else {
+        fprintf (stderr, "%s: [%s]: unknown attribute %s\n", path, section,
+                 name);
+        return 0;
+    }
+    return 1;
+}
+
+static void
+load_config (const char *path)
+{
+    struct reading *r;
+    int rc;
+
+    rc = ini_parse (path, parse_cb, (void *)path);
+    if (rc == -1) {
+        fprintf (stderr, "%s: %s: %s\n", prog, path, strerror (errno));
+        exit (1);
+    } else if (rc == -2) {
+        fprintf (stderr, "%s: %s: out of memory\n", prog, path);
+        exit (1);
+    } else if (rc > 0) {
+        fprintf (stderr, "%s: %s line %d: parse error\n", prog, path, rc);
+        exit (1);
+    }
+    if (!readings) {
+        fprintf (stderr, "%s: %s: no readings\n", prog, path);
+        exit (1);
+    }
+    for (r = readings; r != NULL; r = r->next) {
+        if (!r->src || !r->query) {
+            fprintf (stderr, "%s: %s: [%s] needs instrument and query\n",
+                     prog, path, r->name);
+            exit (1);
+        }
+    }
+}
+
+/* Open every instrument, named in gpib-utils.conf or by address.
+ */
+static void
+open_sources (void)
+{
+    struct cf_file *cf = cf_create_default ();
+    const struct cf_instrument *cfi;
+    struct source *s;
+
+    for (s = sources; s != NULL; s = s->next) {
+        cfi = NULL;
+        if (!s->byaddr && !(cf && (cfi = cf_lookup (cf, s->name)))) {
+            fprintf (stderr, "%s: no config file entry for [%s]\n", prog,
+                     s->name);
+            exit (1);
+        }
+        if (!(s->gd = inst_init (cfi ? cfi->addr : s->name, NULL, 0))) {
+            fprintf (stderr, "%s: %s: failed to initialize instrument\n",
+                     prog, s->name);
+            exit (1);
+        }
+        if (cfi && (cfi->flags & GPIB_FLAG_REOS))
+            inst_set_reos (s->gd, 1);
+    }
+    if (cf)
+        cf_destroy (cf);
+}
+
+/* Scheduler job: query a reading and let the main thread know.  An I/O
+ * error, which libinst has reported on stderr, leaves the cached value
+ * as it was, and the instrument is cleared so that a response left from
+ * the failed query does not answer the next one.
+ */
+static int
+refresh (struct instrument *gd, void *arg)
+{
+    struct reading *r = arg;
+    char buf[MAX_VALUE];
+    double t = gettime ();
+    bool failed;
+
+    if ((failed = inst_qrystr (gd, r->query, buf, sizeof (buf)) < 0))
+        inst_clr (gd, 0);
+    if (verbose)
+        fprintf (stderr, "%s: %s: %s -> %s\n", prog, r->name, r->query,
+                 failed ? "I/O error" : buf);
+    pthread_mutex_lock (&lock);
+    if (!failed) {
+        strcpy (r->value, buf);
+        r->stamp = t;
+    }
+    r->failed = failed;
+    r->pending = false;
+    pthread_mutex_unlock (&lock);
+    if (write (wake[1], &r, sizeof (r)) < 0)
+        fprintf (stderr, "%s: wakeup: %s\n", prog, strerror (errno));
+    return 0;
+}
+
+/* Queue a refresh of 'r' unless one is.  Call with the lock held.
+ */
+static void
+refresh_submit (struct reading *r, int prio)
+{
+    if (!r->pending) {
+        r->pending = true;
+        r->queries++;
+        inst_sched_submit (sched, r->src->gd, prio, refresh, r, NULL);
+    }
+}
+
+static void
+client_send (struct client *c, const char *fmt, ...)
+{
+    char buf[MAX_LINE + MAX_VALUE];
+    va_list ap;
+    int n;
+
+    va_start (ap, fmt);
+    n = vsnprintf (buf, sizeof (buf), fmt, ap);
+    va_end (ap);
+    if (n >= sizeof (buf))
+        n = sizeof (buf) - 1;
+    /* a reader that does not read its answers is dropped, not waited for */
+    if (send (c->fd, buf, n, MSG_DONTWAIT | MSG_NOSIGNAL) != n)
+        c->dead = true;
+}
+
+/* Send the cached value of 'r'.  Call with the lock held.
+ */
+static void
+client_value (struct client *c, struct reading *r)
+{
+    client_send (c, "ok %s %.3f %s\n", r->name, r->stamp, r->value);
+}
+
+static void
+client_request (struct client *c, char *line)
+{
+    char *cmd, *name, *age, *end, *saveptr;
+    struct reading *r;
+    double max_age;
+
+    if (!(cmd = strtok_r (line, " \t\r", &saveptr)))
+        return;
+    if (!strcmp (cmd, "list")) {
+        pthread_mutex_lock (&lock);
+        for (r = readings; r != NULL; r = r->next)
+            if (r->stamp > 0)
+                client_value (c, r);
+        pthread_mutex_unlock (&lock);
+        client_send (c, "end\n");
+    } else if (!strcmp (cmd, "get")
+                && (name = strtok_r (NULL, " \t\r", &saveptr))) {
+        if (!(r = reading_find (name))) {
+            client_send (c, "err %s: unknown reading\n", name);
+            return;
+        }
+        max_age = r->max_age;
+        if ((age = strtok_r (NULL, " \t\r", &saveptr))) {
+            max_age = strtod (age, &end);
+            if (*end != '\0' || max_age < 0) {
+                client_send (c, "err %s: bad max age\n", name);
+                return;
+            }
+        }
+        pthread_mutex_lock (&lock);
+        r->requests++;
+        if (r->stamp > 0 && gettime () - r->stamp <= max_age)
+            client_value (c, r);
+        else {
+            refresh_submit (r, INST_PRIO_URGENT);
+            c->wait = r;
+            c->oldest = gettime () - max_age;
+        }
+        pthread_mutex_unlock (&lock);
+    } else
+        client_send (c, "err %s: unknown command\n", cmd);
+}
+
+/* Handle buffered requests in order, stopping at one that has to wait.
+ */
+static void
+client_process (struct client *c)
+{
+    char *nl;
+    int n;
+
+    while (!c->wait && !c->dead && (nl = memchr (c->buf, '\n', c->len))) {
+        *nl = '\0';
+        n = nl - c->buf + 1;
+        client_request (c, c->buf);
+        memmove (c->buf, c->buf + n, c->len - n);
+        c->len -= n;
+    }
+}
+
+static void
+client_read (struct client *c)
+{
+    int n;
+
+    if (c->len == sizeof (c->buf)) {    /* line too long */
+        c->dead = true;
+        return;
+    }
+    n = read (c->fd, c->buf + c->len, sizeof (c->buf) - c->len);
+    if (n <= 0) {
+        if (n == 0 || errno != EINTR)
+            c->dead = true;
+        return;
+    }
+    c->len += n;
+    client_process (c);
+}
+
+/* Answer the readers waiting for 'r', which has been refreshed, or
+ * failed to be.  Readers for which the refresh began too early wait for
+ * another.
+ */
+static void
+refreshed (struct reading *r)
+{
+    struct client *c;
+
+    for (c = clients; c != NULL; c = c->next) {
+        if (c->wait != r)
+            continue;
+        pthread_mutex_lock (&lock);
+        if (r->failed)
+            client_send (c, "err %s: I/O error\n", r->name);
+        else if (r->stamp < c->oldest) {
+            refresh_submit (r, INST_PRIO_URGENT);
+            pthread_mutex_unlock (&lock);
+            continue;
+        } else
+            client_value (c, r);
+        pthread_mutex_unlock (&lock);
+        c->wait = NULL;
+        client_process (c);
+    }
+}
+
+/* Queue periodic refreshes that are due, and return the msec until the
+ * next one, or -1 if there is none.
+ */
+static int
+refresh_periodic (void)
+{
+    double now = gettime (), next = 0;
+    struct reading *r;
+
+    pthread_mutex_lock (&lock);
+    for (r = readings; r != NULL; r = r->next) {
+        if (r->period == 0)
+            continue;
+        if (now >= r->due) {
+            refresh_submit (r, INST_PRIO_NORMAL);
+            r->due = now + r->period;
+        }
+        if (next == 0 || r->due < next)
+            next = r->due;
+    }
+    pthread_mutex_unlock (&lock);
+    return next == 0 ? -1 : (int)((next - now) * 1000) + 1;
+}
+
+static int
+listen_unix (const char *path)
+{
+    struct sockaddr_un sun;
+    mode_t old;
+    int fd;
+
+    if ((fd = connect_unix (path, &sun)) >= 0) {
+        fprintf (stderr, "%s: already running on %s\n", prog, path);
+        exit (1);
+    }
+    if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf (stderr, "%s: socket: %s\n", prog, strerror (errno));
+        exit (1);
+    }
+    (void)unlink (path);            /* left by a measd that died */
+    old = umask (077);
+    if (bind (fd, (struct sockaddr *)&sun, sizeof (sun)) < 0) {
+        fprintf (stderr, "%s: bind %s: %s\n", prog, path, strerror (errno));
+        exit (1);
+    }
+    umask (old);
+    if (listen (fd, 64) < 0) {
+        fprintf (stderr, "%s: listen: %s\n", prog, strerror (errno));
+        exit (1);
+    }
+    return fd;
+}
+
+static void
+sigterm (int sig)
+{
+    done = 1;
+}
+
+static void
+serve (const char *path)
+{
+    struct client *c, **cp;
+    struct pollfd *pfd = NULL;
+    struct reading *r;
+    struct sigaction sa;
+    int i, n, fd, lfd, tmout;
+
+    lfd = listen_unix (path);
+    if (pipe (wake) < 0) {
+        fprintf (stderr, "%s: pipe: %s\n", prog, strerror (errno));
+        exit (1);
+    }
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = sigterm;
+    sigaction (SIGTERM, &sa, NULL);
+    sigaction (SIGINT, &sa, NULL);
+    sigaction (SIGHUP, &sa, NULL);
+    signal (SIGPIPE, SIG_IGN);
+
+    while (!done) {
+        tmout = refresh_periodic ();
+        n = 2;
+        for (c = clients; c != NULL; c = c->next)
+            n++;
+        pfd = xrealloc (pfd, n * sizeof (*pfd));
+        pfd[0].fd = lfd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = wake[0];
+        pfd[1].events = POLLIN;
+        for (i = 2, c = clients; c != NULL; i++, c = c->next) {
+            pfd[i].fd = c->fd;
+            pfd[i].events = POLLIN;
+        }
+        if (poll (pfd, n, tmout) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf (stderr, "%s: poll: %s\n", prog, strerror (errno));
+            break;
+        }
+        for (i = 2, c = clients; c != NULL; i++, c = c->next)
+            if (pfd[i].revents)
+                client_read (c);
+        if (pfd[1].revents & POLLIN) {
+            if (read (wake[0], &r, sizeof (r)) == sizeof (r))
+                refreshed (r);
+        }
+        for (cp = &clients; *cp != NULL; ) {
+            c = *cp;
+            if (c->dead) {
+                *cp = c->next;
+                close (c->fd);
+                free (c);
+            } else
+                cp = &c->next;
+        }
+        if ((pfd[0].revents & POLLIN) && (fd = accept (lfd, NULL, NULL)) >= 0) {
+            if (!session_peer_ok (fd)) {
+                if (verbose)
+                    fprintf (stderr, "%s: refused a reader of another user\n",
+                             prog);
+                close (fd);
+                continue;
+            }
+            c = xzmalloc (sizeof (*c));
+            c->fd = fd;
+            c->next = clients;
+            clients = c;
+        }
+    }
+    while ((c = clients)) {
+        clients = c->next;
+        close (c->fd);
+        free (c);
+    }
+    free (pfd);
+    close (lfd);
+    (void)unlink (path);
+}
+
+int
+main (int argc, char *argv[])
+{
+    char *path = NULL, *age = NULL;
+    bool get = false, list = false;
+    struct reading *r;
+    struct source *s;
+    int c;
+
+    while ((c = GETOPT (argc, argv, options, longopts)) != EOF) {
+        switch (c) {
+            case 'S':   /* --socket */
+                path = xstrdup (optarg);
+                break;
+            case 'g':   /* --get */
+                get = true;
+                break;
+            case 'a':   /* --max-age */
+                age = optarg;
+                break;
+            case 'l':   /* --list */
+                list = true;
+                break;
+            case 'v':   /* --verbose */
+                verbose = 1;
+                break;
+            default:
+                usage ();
+        }
+    }
+    if (!path && !(path = session_runtime_path ("measd.sock"))) {
+        fprintf (stderr, "%s: XDG_RUNTIME_DIR is not a private directory: "
+                 "use --socket\n", prog);
+        exit (1);
+    }
+    if (list) {
+        if (get || optind < argc)
+            usage ();
+        exit (query_measd (path, NULL, 0, NULL));
+    }
+    if (get) {
+        if (optind == argc)
+            usage ();
+        exit (query_measd (path, argv + optind, argc - optind, age));
+    }
+    if (optind != argc - 1 || age)
+        usage ();
+
+    load_config (argv[optind]);
+    /* keep links of our own rather than hold instd(1) sessions forever */
+    unsetenv ("GPIB_UTILS_SESSION");
+    open_sources ();
+    sched = inst_sched_create ();
+    if (verbose)
+        fprintf (stderr, "%s: listening on %s\n", prog, path);
+    serve (path);
+    inst_sched_destroy (sched);
+
+    for (s = sources; s != NULL; s = s->next)
+        inst_fini (s->gd);
+    if (verbose) {
+        for (r = readings; r != NULL; r = r->next)
+            fprintf (stderr, "%s: %s: %lu requests, %lu queries\n", prog,
+                     r->name, r->requests, r->queries);
+    }
+    free (path);
+    exit (0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
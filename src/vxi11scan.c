@@ -0,0 +1,405 @@
+/* This file is part of gpib-utils.
+   For details, see http://sourceforge.net/projects/gpib-utils.
+
+   Copyright (C) 2001-2011 Jim Garlick <garlick.jim@gmail.com>
+
+   gpib-utils is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   gpib-utils is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gpib-utils; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/* vxi11scan - find VXI-11 instruments on a range of hosts */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include <time.h>
+#if HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+#include <rpc/rpc.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+
+#include "libutil/util.h"
+#include "liblsd/hostlist.h"
+#include "libvxi11/vxi11_device.h"
+#include "libvxi11/vxi11_discover.h"
+
+#define DFLT_TIMEOUT    5000    /* msec per host */
+#define DFLT_IOTIMEOUT  1000    /* msec per *IDN? read/write */
+#define DFLT_PROBES     256     /* hosts in flight */
+#define DFLT_DEVICE     "inst0"
+
+char *prog = "";
+const char *options = "d:p:t:i:n:o:NCv";
+
+#if HAVE_GETOPT_LONG
+#define GETOPT(ac,av,opt,lopt) getopt_long(ac,av,opt,lopt,NULL)
+static struct option longopts[] = {
+    {"device",          required_argument, 0, 'd'},
+    {"port",            required_argument, 0, 'p'},
+    {"timeout",         required_argument, 0, 't'},
+    {"io-timeout",      required_argument, 0, 'i'},
+    {"probes",          required_argument, 0, 'n'},
+    {"output",          required_argument, 0, 'o'},
+    {"no-idn",          no_argument,       0, 'N'},
+    {"no-portcache",    no_argument,       0, 'C'},
+    {"verbose",         no_argument,       0, 'v'},
+    {0, 0, 0, 0},
+};
+#else
+#define GETOPT(ac,av,opt,lopt) getopt(ac,av,opt)
+#endif
+
+static vxi11dev_t errv;         /* only used for vxi11_strerror () */
+static int found = 0;
+
+/* Results file (-o): one line per device found, see vxi11scan(1).
+ * 'answered' holds the host:device names whose host answered this run,
+ * whose old lines are replaced by 'results'.  With -p, servers on other
+ * ports of a host may have the same device names, so a name is only
+ * answered for the port it was found on, "host:device port".
+ */
+struct scan_state {
+    bool    verbose;
+    bool    ports;      /* -p given */
+    char    **answered;
+    int     nanswered;
+    char    **results;
+    int     nresults;
+};
+
+void usage (void)
+{
+    fprintf (stderr, "%s", "Usage: vxi11scan [OPTIONS] HOSTLIST ...\n"
+        "    -d,--device NAME      device name, e.g. gpib0,1-30 (inst0)\n"
+        "    -p,--port PORTS       core port(s), e.g. 9100-9110 (portmap)\n"
+        "    -t,--timeout MSEC     per host deadline (5000)\n"
+        "    -i,--io-timeout MSEC  *IDN? I/O timeout (1000)\n"
+        "    -n,--probes N         hosts probed in parallel (256)\n"
+        "    -o,--output FILE      merge devices found into results FILE\n"
+        "    -N,--no-idn           do not query *IDN?\n"
+        "    -C,--no-portcache     do not update the portcache\n"
+        "    -v,--verbose          report hosts/devices that failed\n");
+    exit (1);
+}
+
+/* Append to a growable array of pointers or targets.
+ */
+static void *
+grow (void *base, int n, size_t size)
+{
+    if (!(base = realloc (base, (n + 1) * size))) {
+        fprintf (stderr, "%s: out of memory\n", prog);
+        exit (1);
+    }
+    return base;
+}
+
+/* Parse "a", "a-b", or a comma separated list of those.
+ */
+static int
+parse_range (char *s, unsigned long **valp, int n)
+{
+    char *cpy, *tok, *saveptr, *end;
+    unsigned long lo, hi;
+
+    if (!(cpy = strdup (s))) {
+        fprintf (stderr, "%s: out of memory\n", prog);
+        exit (1);
+    }
+    for (tok = strtok_r (cpy, ",", &saveptr); tok != NULL;
+                        tok = strtok_r (NULL, ",", &saveptr)) {
+        lo = hi = strtoul (tok, &end, 10);
+        if (*end == '-')
+            hi = strtoul (end + 1, &end, 10);
+        if (*end != '\0' || end == tok || hi < lo || hi > 65535)
+            return -1;
+        for (; lo <= hi; lo++) {
+            *valp = grow (*valp, n, sizeof (**valp));
+            (*valp)[n++] = lo;
+        }
+    }
+    free (cpy);
+    return n;
+}
+
+/* Add a device name, expanding a trailing ",a-b" range of GPIB addresses,
+ * e.g. "gpib0,1-30" becomes "gpib0,1" ... "gpib0,30".
+ */
+static int
+add_device (char *s, char ***devp, int n)
+{
+    char *p = strrchr (s, ',');
+    unsigned long lo, hi;
+    char *end, buf[64];
+
+    if (p && strchr (p, '-')) {
+        lo = strtoul (p + 1, &end, 10);
+        if (*end != '-')
+            return -1;
+        hi = strtoul (end + 1, &end, 10);
+        if (*end != '\0' || hi < lo || hi > 30)
+            return -1;
+        for (; lo <= hi; lo++) {
+            snprintf (buf, sizeof (buf), "%.*s,%lu", (int)(p - s), s, lo);
+            *devp = grow (*devp, n, sizeof (**devp));
+            (*devp)[n++] = xstrdup (buf);
+        }
+    } else {
+        *devp = grow (*devp, n, sizeof (**devp));
+        (*devp)[n++] = xstrdup (s);
+    }
+    return n;
+}
+
+/* Format a results file line for a device found.  Newlines in the *IDN?
+ * response would break the file, so they become spaces.
+ */
+static char *
+result_line (struct vxi11_found *f)
+{
+    char buf[1024], *p;
+
+    snprintf (buf, sizeof (buf), "%s:%s %hu %hu %lu %ld %s", f->host,
+              f->device, f->core_port, f->abort_port, f->maxRecvSize,
+              (long)time (NULL), f->idn ? f->idn : "");
+    for (p = buf; *p; p++)
+        if (*p == '\n' || *p == '\r')
+            *p = ' ';
+    return xstrdup (buf);
+}
+
+static void
+report (struct vxi11_found *f, void *arg)
+{
+    struct scan_state *st = arg;
+    bool verbose = st->verbose;
+    char name[256];
+
+    if (f->stat == RPC_SUCCESS) {
+        if (st->ports)
+            snprintf (name, sizeof (name), "%s:%s %hu", f->host, f->device,
+                      f->core_port);
+        else
+            snprintf (name, sizeof (name), "%s:%s", f->host, f->device);
+        st->answered = grow (st->answered, st->nanswered,
+                             sizeof (*st->answered));
+        st->answered[st->nanswered++] = xstrdup (name);
+    }
+
+    if (f->stat != RPC_SUCCESS) {
+        if (verbose && f->core_port != 0)
+            fprintf (stderr, "%s: %s port %hu: %s\n", prog, f->host,
+                     f->core_port, clnt_sperrno (f->stat));
+        else if (verbose)
+            fprintf (stderr, "%s: %s: %s\n", prog, f->host,
+                     clnt_sperrno (f->stat));
+    } else if (f->error != 0) {
+        if (verbose)
+            fprintf (stderr, "%s: %s:%s: %s\n", prog, f->host, f->device,
+                     vxi11_strerror (errv, f->error));
+    } else {
+        printf ("%s:%s", f->host, f->device);
+        if (verbose)
+            printf (" port=%hu abort=%hu maxrecv=%lu", f->core_port,
+                    f->abort_port, f->maxRecvSize);
+        else if (st->ports)
+            printf (" port=%hu", f->core_port);
+        if (f->idn && *f->idn)
+            printf (" %s", f->idn);
+        printf ("\n");
+        fflush (stdout);
+        found++;
+        st->results = grow (st->results, st->nresults, sizeof (*st->results));
+        st->results[st->nresults++] = result_line (f);
+    }
+}
+
+/* Does results file 'line' belong to a host:device (and with -p, port)
+ * answered this run?
+ */
+static bool
+answered (struct scan_state *st, char *line)
+{
+    size_t len = strcspn (line, " ");
+    int i;
+
+    if (st->ports && line[len] == ' ')
+        len += 1 + strcspn (line + len + 1, " \n");
+    for (i = 0; i < st->nanswered; i++)
+        if (strlen (st->answered[i]) == len
+                && !strncmp (st->answered[i], line, len))
+            return true;
+    return false;
+}
+
+/* Merge this run's results into 'path'.  Lines for devices on hosts that
+ * did not answer are kept, since those hosts may only be down for now.
+ * The file is replaced atomically, so readers never see it half written.
+ */
+static void
+save_results (struct scan_state *st, char *path)
+{
+    char *tmp, buf[1024];
+    FILE *in, *out;
+    int fd, i;
+
+    tmp = xmalloc (strlen (path) + 8);
+    sprintf (tmp, "%s.XXXXXX", path);
+    if ((fd = mkstemp (tmp)) < 0 || !(out = fdopen (fd, "w"))) {
+        fprintf (stderr, "%s: %s: %s\n", prog, tmp, strerror (errno));
+        exit (1);
+    }
+    if ((in = fopen (path, "r"))) {
+        while (fgets (buf, sizeof (buf), in))
+            if (!answered (st, buf))
+                fputs (buf, out);
+        fclose (in);
+    }
+    for (i = 0; i < st->nresults; i++)
+        fprintf (out, "%s\n", st->results[i]);
+    if (fclose (out) != 0 || rename (tmp, path) < 0) {
+        fprintf (stderr, "%s: %s: %s\n", prog, path, strerror (errno));
+        unlink (tmp);
+        exit (1);
+    }
+    free (tmp);
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct vxi11_target *targets = NULL;
+    unsigned long *ports = NULL;
+    char **devices = NULL;
+    int nports = 0, ndevices = 0, ntargets = 0;
+    unsigned long timeout = DFLT_TIMEOUT, io_timeout = DFLT_IOTIMEOUT;
+    int probes = DFLT_PROBES, flags = VXI11_DISCOVER_IDN
+                                    | VXI11_DISCOVER_PORTCACHE;
+    struct scan_state st;
+    char *output = NULL;
+    hostlist_t hl;
+    hostlist_iterator_t itr;
+    char *host;
+    int c, i;
+
+    prog = basename (argv[0]);
+    memset (&st, 0, sizeof (st));
+    while ((c = GETOPT (argc, argv, options, longopts)) != EOF) {
+        switch (c) {
+            case 'd':
+                if ((ndevices = add_device (optarg, &devices, ndevices)) < 0) {
+                    fprintf (stderr, "%s: bad device: %s\n", prog, optarg);
+                    exit (1);
+                }
+                break;
+            case 'p':
+                if ((nports = parse_range (optarg, &ports, nports)) < 0) {
+                    fprintf (stderr, "%s: bad port range: %s\n", prog, optarg);
+                    exit (1);
+                }
+                st.ports = true;
+                break;
+            case 't':
+                timeout = strtoul (optarg, NULL, 10);
+                break;
+            case 'i':
+                io_timeout = strtoul (optarg, NULL, 10);
+                break;
+            case 'n':
+                if ((probes = strtoul (optarg, NULL, 10)) == 0)
+                    usage ();
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'N':
+                flags &= ~VXI11_DISCOVER_IDN;
+                break;
+            case 'C':
+                flags &= ~VXI11_DISCOVER_PORTCACHE;
+                break;
+            case 'v':
+                st.verbose = true;
+                break;
+            default:
+                usage ();
+        }
+    }
+    if (optind == argc)
+        usage ();
+    if (ndevices == 0)
+        ndevices = add_device (DFLT_DEVICE, &devices, ndevices);
+
+    for (; optind < argc; optind++) {
+        if (!(hl = hostlist_create (argv[optind]))
+                || !(itr = hostlist_iterator_create (hl))) {
+            fprintf (stderr, "%s: bad hostlist: %s\n", prog, argv[optind]);
+            exit (1);
+        }
+        while ((host = hostlist_next (itr))) {
+            for (i = 0; i < (nports > 0 ? nports : 1); i++) {
+                targets = grow (targets, ntargets, sizeof (*targets));
+                targets[ntargets].host = xstrdup (host);
+                targets[ntargets].port = nports > 0 ? ports[i] : 0;
+                ntargets++;
+            }
+            free (host);
+        }
+        hostlist_iterator_destroy (itr);
+        hostlist_destroy (hl);
+    }
+
+    if (!(errv = vxi11_create ())) {
+        fprintf (stderr, "%s: out of memory\n", prog);
+        exit (1);
+    }
+    if (vxi11_discover (targets, ntargets, devices, ndevices, probes,
+                        timeout, io_timeout, flags, report, &st) < 0) {
+        perror ("vxi11_discover");
+        exit (1);
+    }
+    if (output)
+        save_results (&st, output);
+    vxi11_destroy (errv);
+
+    for (i = 0; i < ntargets; i++)
+        free (targets[i].host);
+    free (targets);
+    for (i = 0; i < ndevices; i++)
+        free (devices[i]);
+    free (devices);
+    free (ports);
+    for (i = 0; i < st.nanswered; i++)
+        free (st.answered[i]);
+    free (st.answered);
+    for (i = 0; i < st.nresults; i++)
+        free (st.results[i]);
+    free (st.results);
+
+    exit (found > 0 ? 0 : 1);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,320 @@
+/* hislipd.c - stand-in HiSLIP instrument for testing libhislip */
+
+/* Serves one session at a time on 127.0.0.1.  With no -p option an
+ * ephemeral port is used; the port is printed on stdout as "port N".
+ * Commands (DataEnd terminated):
+ *   *IDN?      identification string
+ *   TRG?       number of Trigger messages received
+ *   SRQ        send AsyncServiceRequest, set RQS in the status byte
+ *   other...?  echoed back (anything containing '?')
+ * Overlapped mode is granted if the client asks for it.
+ * The server's maximum message size is small (4096) so that clients
+ * have to split large writes.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+
+#include <hislip.h>
+
+#define SRV_MAXMSG  4096
+
+static char *prog = "hislipd";
+
+struct session {
+    int         sfd;            /* sync channel */
+    int         afd;            /* async channel */
+    bool        overlapped;
+    uint64_t    client_max;     /* largest payload client accepts */
+    char       *cmd;            /* command being accumulated */
+    int         cmdlen;
+    unsigned char stb;
+    int         triggers;
+    bool        locked;
+};
+
+static int
+read_all (int fd, void *buf, int len)
+{
+    int n, done = 0;
+
+    while (done < len) {
+        if ((n = read (fd, (char *)buf + done, len - done)) <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+static int
+send_msg (int fd, int type, int control, uint32_t param, void *data,
+         uint64_t len)
+{
+    unsigned char hdr[HISLIP_HDRLEN];
+    struct hislip_hdr hd = { type, control, param, len };
+
+    hislip_encode_hdr (hdr, &hd);
+    if (write (fd, hdr, sizeof (hdr)) != sizeof (hdr))
+        return -1;
+    if (len > 0 && write (fd, data, len) != len)
+        return -1;
+    return 0;
+}
+
+static int
+recv_msg (int fd, struct hislip_hdr *hp, char **datap)
+{
+    unsigned char hdr[HISLIP_HDRLEN];
+    char *data;
+
+    if (read_all (fd, hdr, sizeof (hdr)) < 0
+            || hislip_decode_hdr (hdr, hp) < 0)
+        return -1;
+    if (!(data = malloc (hp->length + 1)))
+        return -1;
+    if (read_all (fd, data, hp->length) < 0) {
+        free (data);
+        return -1;
+    }
+    data[hp->length] = '\0';
+    *datap = data;
+    return 0;
+}
+
+/* Send a response in chunks the client can accept.
+ */
+static int
+respond (struct session *s, uint32_t msgid, char *buf, int len)
+{
+    int try;
+
+    do {
+        try = len > s->client_max ? s->client_max : len;
+        if (send_msg (s->sfd, try < len ? HISLIP_DATA : HISLIP_DATA_END, 0,
+                     msgid, buf, try) < 0)
+            return -1;
+        buf += try;
+        len -= try;
+    } while (len > 0);
+    return 0;
+}
+
+static int
+command (struct session *s, uint32_t msgid)
+{
+    char buf[64];
+
+    if (s->cmdlen == 5 && !strncmp (s->cmd, "*IDN?", 5)) {
+        snprintf (buf, sizeof (buf), "GPIB-UTILS,HISLIPD,0,1\n");
+        return respond (s, msgid, buf, strlen (buf));
+    }
+    if (s->cmdlen == 4 && !strncmp (s->cmd, "TRG?", 4)) {
+        snprintf (buf, sizeof (buf), "%d\n", s->triggers);
+        return respond (s, msgid, buf, strlen (buf));
+    }
+    if (s->cmdlen == 3 && !strncmp (s->cmd, "SRQ", 3)) {
+        s->stb |= 0x40;
+        return send_msg (s->afd, HISLIP_ASYNC_SERVICE_REQUEST, 0, 0, NULL, 0);
+    }
+    if (memchr (s->cmd, '?', s->cmdlen))
+        return respond (s, msgid, s->cmd, s->cmdlen);
+    return 0;
+}
+
+static int
+sync_msg (struct session *s)
+{
+    struct hislip_hdr hd;
+    char *data, *new;
+    int res = 0;
+
+    if (recv_msg (s->sfd, &hd, &data) < 0)
+        return -1;
+    switch (hd.type) {
+        case HISLIP_DATA:
+        case HISLIP_DATA_END:
+            if (!(new = realloc (s->cmd, s->cmdlen + hd.length + 1))) {
+                res = -1;
+                break;
+            }
+            s->cmd = new;
+            memcpy (s->cmd + s->cmdlen, data, hd.length);
+            s->cmdlen += hd.length;
+            if (hd.type == HISLIP_DATA_END) {
+                res = command (s, hd.param);
+                s->cmdlen = 0;
+            }
+            break;
+        case HISLIP_TRIGGER:
+            s->triggers++;
+            break;
+        case HISLIP_DEVICE_CLEAR_COMPLETE:
+            s->overlapped = (hd.control & HISLIP_CTL_OVERLAP);
+            s->cmdlen = 0;
+            s->stb = 0;
+            res = send_msg (s->sfd, HISLIP_DEVICE_CLEAR_ACKNOWLEDGE,
+                           s->overlapped, 0, NULL, 0);
+            break;
+        default:
+            res = send_msg (s->sfd, HISLIP_ERROR, 0, 0, "unexpected", 10);
+            break;
+    }
+    free (data);
+    return res;
+}
+
+static int
+async_msg (struct session *s)
+{
+    struct hislip_hdr hd;
+    unsigned char buf[8];
+    char *data;
+    int i, res = 0, control;
+
+    if (recv_msg (s->afd, &hd, &data) < 0)
+        return -1;
+    switch (hd.type) {
+        case HISLIP_ASYNC_MAX_MSG_SIZE:
+            for (i = 0, s->client_max = 0; i < 8 && i < hd.length; i++)
+                s->client_max = (s->client_max << 8) | (unsigned char)data[i];
+            for (i = 0; i < 8; i++)
+                buf[i] = (uint64_t)SRV_MAXMSG >> (56 - 8*i);
+            res = send_msg (s->afd, HISLIP_ASYNC_MAX_MSG_SIZE_RESPONSE, 0, 0,
+                           buf, sizeof (buf));
+            break;
+        case HISLIP_ASYNC_STATUS_QUERY:
+            res = send_msg (s->afd, HISLIP_ASYNC_STATUS_RESPONSE, s->stb, 0,
+                           NULL, 0);
+            s->stb &= ~0x40;
+            break;
+        case HISLIP_ASYNC_DEVICE_CLEAR:
+            res = send_msg (s->afd, HISLIP_ASYNC_DEVICE_CLEAR_ACK,
+                           s->overlapped, 0, NULL, 0);
+            break;
+        case HISLIP_ASYNC_LOCK:
+            if (hd.control == 1) {              /* request */
+                control = s->locked ? 0 : (hd.length > 0 ? 2 : 1);
+                s->locked = true;
+            } else {                            /* release */
+                control = s->locked ? 1 : 3;
+                s->locked = false;
+            }
+            res = send_msg (s->afd, HISLIP_ASYNC_LOCK_RESPONSE, control, 0,
+                           NULL, 0);
+            break;
+        case HISLIP_ASYNC_REMOTE_LOCAL_CONTROL:
+            res = send_msg (s->afd, HISLIP_ASYNC_REMOTE_LOCAL_RESPONSE, 0, 0,
+                           NULL, 0);
+            break;
+        default:
+            res = send_msg (s->afd, HISLIP_ERROR, 0, 0, "unexpected", 10);
+            break;
+    }
+    free (data);
+    return res;
+}
+
+static void
+serve (int lfd)
+{
+    struct session s;
+    struct hislip_hdr hd;
+    struct pollfd pfd[2];
+    char *data;
+
+    memset (&s, 0, sizeof (s));
+    s.afd = -1;
+    s.client_max = 256;
+    if ((s.sfd = accept (lfd, NULL, NULL)) < 0)
+        return;
+    if (recv_msg (s.sfd, &hd, &data) < 0 || hd.type != HISLIP_INITIALIZE)
+        goto done;
+    free (data);
+    s.overlapped = (hd.control & HISLIP_CTL_OVERLAP);
+    if (send_msg (s.sfd, HISLIP_INITIALIZE_RESPONSE, s.overlapped,
+                 (HISLIP_VERSION << 16) | 1, NULL, 0) < 0)
+        goto done;
+    if ((s.afd = accept (lfd, NULL, NULL)) < 0)
+        goto done;
+    if (recv_msg (s.afd, &hd, &data) < 0 || hd.type != HISLIP_ASYNC_INITIALIZE)
+        goto done;
+    free (data);
+    if (send_msg (s.afd, HISLIP_ASYNC_INITIALIZE_RESPONSE, 0, 0, NULL, 0) < 0)
+        goto done;
+    for (;;) {
+        pfd[0].fd = s.sfd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = s.afd;
+        pfd[1].events = POLLIN;
+        if (poll (pfd, 2, -1) < 0)
+            break;
+        if ((pfd[1].revents & (POLLIN | POLLHUP)) && async_msg (&s) < 0)
+            break;
+        if ((pfd[0].revents & (POLLIN | POLLHUP)) && sync_msg (&s) < 0)
+            break;
+    }
+done:
+    if (s.afd >= 0)
+        close (s.afd);
+    close (s.sfd);
+    free (s.cmd);
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof (sin);
+    int c, lfd, one = 1, port = 0;
+
+    while ((c = getopt (argc, argv, "p:")) != EOF) {
+        switch (c) {
+            case 'p':
+                port = strtoul (optarg, NULL, 10);
+                break;
+            default:
+                fprintf (stderr, "Usage: %s [-p port]\n", prog);
+                exit (1);
+        }
+    }
+    if ((lfd = socket (AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror ("socket");
+        exit (1);
+    }
+    setsockopt (lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+    memset (&sin, 0, sizeof (sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons (port);
+    sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    if (bind (lfd, (struct sockaddr *)&sin, sizeof (sin)) < 0
+            || listen (lfd, 5) < 0
+            || getsockname (lfd, (struct sockaddr *)&sin, &len) < 0) {
+        perror ("bind");
+        exit (1);
+    }
+    printf ("port %d\n", ntohs (sin.sin_port));
+    fflush (stdout);
+    for (;;)
+        serve (lfd);
+    /*NOTREACHED*/
+    return 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,322 @@
+#!/bin/sh
+# temu.sh - run the tools and test programs against the emulators
+
+# Starts ../emu/vxi11d and ../emu/vxi11proxy on ports of their own, which
+# the clients find in a private VXI11_PORTCACHE, so no portmapper is
+# needed, and runs the checks below against their devices.
+
+srcdir=${srcdir:-.}
+emu=../emu
+bin=../src
+
+tmp=`mktemp -d ${TMPDIR:-/tmp}/temu.XXXXXX` || exit 1
+VXI11_PORTCACHE=$tmp/portcache
+GPIB_UTILS_CONF=$tmp/gpib-utils.conf
+export VXI11_PORTCACHE GPIB_UTILS_CONF
+unset GPIB_UTILS_SESSION VXI11_MAXCONN
+
+failures=0
+pids=
+
+cleanup ()
+{
+    [ -n "$pids" ] && kill $pids 2>/dev/null
+    wait
+    rm -rf $tmp
+}
+trap cleanup 0
+trap 'exit 1' 1 2 15
+
+fail ()
+{
+    echo "temu: $*" >&2
+    failures=`expr $failures + 1`
+}
+
+# Wait up to ten seconds for a command to succeed; $1 says what failed.
+wait_until ()
+{
+    what=$1
+    shift
+    n=0
+    until "$@"; do
+        n=`expr $n + 1`
+        if [ $n -gt 100 ]; then
+            echo "temu: $what" >&2
+            exit 1
+        fi
+        sleep 0.1
+    done
+}
+
+# Wait for a server to record device $1 in the portcache.
+wait_for ()
+{
+    wait_until "$1 was not served" grep -qs "^127.0.0.1:$1 " $VXI11_PORTCACHE
+}
+
+# Run a command, killing it if it takes more than ten seconds, e.g. one
+# waiting for a response on a serial line, which has no timeout.
+limit ()
+{
+    "$@" &
+    cmd=$!
+    (sleep 10; kill $cmd 2>/dev/null) &
+    dog=$!
+    wait $cmd
+    rc=$?
+    kill $dog 2>/dev/null
+    return $rc
+}
+
+# Compare the output of a check with what is expected on stdin.
+expect ()
+{
+    cat >$tmp/expected
+    if ! cmp -s $tmp/expected $tmp/out; then
+        fail "$1: unexpected output"
+        diff $tmp/expected $tmp/out >&2
+    fi
+}
+
+cards=44471,44477,0,44476,44474
+$emu/vxi11d -c 127.0.0.1 \
+    -d inst0=generic -d inst1=generic -d inst2=generic -d inst3=generic \
+    -d dmm=scpi:$srcdir/../emu/scpi-dmm.ini -d sw=hp3488:$cards \
+    -d bad=generic -f 'bad=read:locked/3' \
+    -d slow=generic -f 'slow=read:delay=100' \
+    -d once=generic -f 'once=write:locked#2' \
+    -d flaky=generic -f 'flaky=read:locked#2' \
+    -s dmm=0 -t dmm=$tmp/dmmpty >$tmp/vxi11d.out 2>$tmp/vxi11d.err &
+pids="$pids $!"
+wait_for slow
+coreport=`awk '$1 == "core" { print $2 }' $tmp/vxi11d.out`
+dmmport=`awk '$1 == "socket" { print $3 }' $tmp/vxi11d.out`
+$emu/vxi11proxy -v -c 127.0.0.1 -d p0=127.0.0.1:slow 2>$tmp/proxy.err &
+proxy=$!
+pids="$pids $proxy"
+wait_for p0
+# a second server on the same host, at another port
+$emu/vxi11d -c 127.0.0.1 -d far0=generic >/dev/null 2>$tmp/vxi11d2.err &
+pids="$pids $!"
+wait_for far0
+# a third with a device of the same name as the first, not in the portcache
+$emu/vxi11d -d inst0=generic >$tmp/vxi11d3.out 2>$tmp/vxi11d3.err &
+pids="$pids $!"
+wait_until "the third vxi11d did not start" grep -qs "^core " $tmp/vxi11d3.out
+
+# threads sharing one core channel
+./tthread 50 127.0.0.1:inst0 127.0.0.1:inst1 127.0.0.1:inst2 127.0.0.1:inst3 \
+    || fail "tthread failed"
+
+./tsched 20 127.0.0.1:inst0 127.0.0.1:inst1 127.0.0.1:inst2 127.0.0.1:inst3 \
+    || fail "tsched failed"
+
+# links to two servers on one host, opened one after the other
+./tsched 2 127.0.0.1:inst0 127.0.0.1:far0 >/dev/null \
+    || fail "tsched on two servers on one host failed"
+
+# query round trips with no delayed ACK stall
+./tlatency 127.0.0.1:inst0 50 >/dev/null || fail "tlatency failed"
+
+# calls pipelined on four connections, each reply checked
+./trpc 127.0.0.1:$coreport 4 20 GPIB-UTILS,EMU-GENERIC,0,1.0 >/dev/null \
+    || fail "trpc failed"
+
+# one device name on two ports of a host: a line for each in the results
+# file, and none in the portcache, which could hold only one of them
+port3=`awk '$1 == "core" { print $2 }' $tmp/vxi11d3.out`
+VXI11_PORTCACHE=$tmp/scancache $bin/vxi11scan -p $coreport,$port3 \
+    -o $tmp/scan 127.0.0.1 | sort >$tmp/out
+sort >$tmp/sorted <<EOF
+127.0.0.1:inst0 port=$coreport GPIB-UTILS,EMU-GENERIC,0,1.0
+127.0.0.1:inst0 port=$port3 GPIB-UTILS,EMU-GENERIC,0,1.0
+EOF
+expect "vxi11scan on two ports" <$tmp/sorted
+if [ `wc -l <$tmp/scan` -ne 2 ] \
+        || grep -q "^127.0.0.1:inst0 " $tmp/scancache 2>/dev/null; then
+    fail "vxi11scan on two ports: results or portcache"
+    cat $tmp/scan >&2
+fi
+
+# every third read is refused: the jobs get the errors, the program goes on
+./tsched 9 127.0.0.1:bad >$tmp/out 2>$tmp/err
+if [ $? -ne 1 ] || ! grep -q ", 3 errors$" $tmp/out; then
+    fail "tsched with faults"
+    cat $tmp/out $tmp/err >&2
+fi
+
+cat >$GPIB_UTILS_CONF <<EOF
+[dmm]
+address = 127.0.0.1:dmm
+EOF
+$bin/ibquery dmm query '*IDN?' write 'CONF:CURR 2' query 'CONF?' \
+    write 'VOLT:NPLC 1' query 'VOLT:NPLC?' query 'SYST:ERR?' \
+    write 'BOGUS' query 'SYST:ERR?' >$tmp/out
+expect "scpi model" <<EOF
+GPIB-UTILS,EMU-DMM,0,1.0
+"CURR" 2
+1
++0,"No error"
+-113,"Undefined header"
+EOF
+
+# the same device through its raw socket and pty front ends, which have
+# no EOI, so the end of each message is marked with eos
+cat >$GPIB_UTILS_CONF <<EOF
+[sock]
+address = 127.0.0.1:$dmmport
+flags = reos
+[pty]
+address = $tmp/dmmpty
+flags = reos
+EOF
+for front in sock pty; do
+    limit $bin/ibquery $front query '*IDN?' write 'CONF:CURR 3' query 'CONF?' \
+        >$tmp/out
+    expect "scpi model on $front" <<EOF
+GPIB-UTILS,EMU-DMM,0,1.0
+"CURR" 3
+EOF
+done
+
+# two runs through one instd session, the second refused a write: its
+# error comes back on its own stderr, and the next run gets a new session
+$bin/instd -S $tmp/instd.sock -v 2>$tmp/instd.err &
+pids="$pids $!"
+wait_until "instd did not start" test -S $tmp/instd.sock
+cat >$GPIB_UTILS_CONF <<EOF
+[dmm]
+address = 127.0.0.1:dmm
+[once]
+address = 127.0.0.1:once
+EOF
+(
+    GPIB_UTILS_SESSION=$tmp/instd.sock
+    export GPIB_UTILS_SESSION
+    $bin/ibquery dmm query '*IDN?' write 'CONF:CURR 4'
+    $bin/ibquery dmm query 'CONF?'
+    $bin/ibquery once query 'A?'
+    $bin/ibquery once query 'B?' 2>$tmp/err && echo "B? did not fail"
+    $bin/ibquery once query 'C?'
+) >$tmp/out
+expect "instd sessions" <<EOF
+GPIB-UTILS,EMU-DMM,0,1.0
+"CURR" 4
+A?
+C?
+EOF
+if ! grep -q "device locked" $tmp/err; then
+    fail "instd did not pass back the error"
+    cat $tmp/err >&2
+fi
+if [ `grep -c "127.0.0.1:dmm: opened" $tmp/instd.err` -ne 1 ] \
+        || [ `grep -c "127.0.0.1:once: opened" $tmp/instd.err` -ne 2 ]; then
+    fail "instd sessions opened"
+    cat $tmp/instd.err >&2
+fi
+
+# measd: a get within max-age is answered from the cache, one with -a 0
+# is read again; a reading that fails is an error for the reader and
+# keeps its old value
+cat >$tmp/measd.conf <<EOF
+[dmm.idn]
+address = 127.0.0.1:dmm
+query = *IDN?
+max-age = 100
+
+[flaky.val]
+address = 127.0.0.1:flaky
+query = VAL?
+EOF
+$bin/measd -v -S $tmp/measd.sock $tmp/measd.conf 2>$tmp/measd.err &
+pids="$pids $!"
+wait_until "measd did not start" test -S $tmp/measd.sock
+measd="$bin/measd -S $tmp/measd.sock"
+($measd -g dmm.idn && $measd -g dmm.idn && $measd -g -a 0 dmm.idn \
+    && $measd -g flaky.val) >$tmp/out
+expect "measd get" <<EOF
+GPIB-UTILS,EMU-DMM,0,1.0
+GPIB-UTILS,EMU-DMM,0,1.0
+GPIB-UTILS,EMU-DMM,0,1.0
+VAL?
+EOF
+if [ `grep -c "dmm.idn: \*IDN? -> " $tmp/measd.err` -ne 2 ]; then
+    fail "measd did not answer from its cache"
+    cat $tmp/measd.err >&2
+fi
+if $measd -g -a 0 flaky.val >/dev/null 2>$tmp/err \
+        || ! grep -q "flaky.val: I/O error" $tmp/err; then
+    fail "measd did not report the failed reading"
+    cat $tmp/err >&2
+fi
+$measd -l | awk '{ print $1, $2 }' | sort >$tmp/out
+expect "measd list" <<EOF
+dmm.idn GPIB-UTILS,EMU-DMM,0,1.0
+flaky.val VAL?
+EOF
+
+# 44476 and 44477 cards report 44471 until probed by closing relays
+$bin/hp3488 -a 127.0.0.1:sw -x 2>/dev/null | awk '{ print $1, $2 }' >$tmp/out
+expect "hp3488 probe" <<EOF
+1: 44471
+2: 44477
+3: 0
+4: 44476
+5: 44474
+EOF
+sw="$bin/hp3488 -a 127.0.0.1:sw -C $cards"
+($sw -1 101,205 && $sw -q 101,102,205 && $sw -0 101 && $sw -q 101) >$tmp/out
+expect "hp3488 relays" <<EOF
+101: 1
+102: 0
+205: 1
+101: 0
+EOF
+
+# icsconfig against icsconfigd: a read, a set and a commit, which saves
+# the state file; a restart on the same port loads it back, and reload
+# goes back to it after another set
+$emu/icsconfigd -s $tmp/ics.state >$tmp/ics.out 2>$tmp/ics.err &
+icsd=$!
+pids="$pids $icsd"
+wait_until "icsconfigd did not start" grep -qs "^port " $tmp/ics.out
+icsport=`awk '$1 == "port" { print $2 }' $tmp/ics.out`
+ics="$bin/icsconfig 127.0.0.1:$icsport"
+($ics get hostname && $ics set hostname=labgw \
+    && $ics commit) >$tmp/out
+expect "icsconfig set and commit" <<EOF
+hostname            ics1
+current config written
+EOF
+grep -q "^hostname = labgw$" $tmp/ics.state 2>/dev/null \
+    || fail "icsconfigd did not save its state"
+kill $icsd
+wait $icsd
+$emu/icsconfigd -p $icsport -s $tmp/ics.state >$tmp/ics.out 2>$tmp/ics.err &
+pids="$pids $!"
+wait_until "icsconfigd did not restart" grep -qs "^port " $tmp/ics.out
+($ics get hostname && $ics set hostname=other \
+    && $ics reload && $ics get hostname) >$tmp/out
+expect "icsconfig after restart" <<EOF
+hostname            labgw
+config reloaded from flash
+hostname            labgw
+EOF
+
+# four links at once on their own connections, asking the same thing
+VXI11_MAXCONN=4 ./tthread 5 127.0.0.1:p0 127.0.0.1:p0 127.0.0.1:p0 \
+    127.0.0.1:p0 || fail "tthread through vxi11proxy failed"
+kill $proxy
+wait $proxy
+if ! grep -q "coalesced [1-9]" $tmp/proxy.err; then
+    fail "vxi11proxy coalesced nothing"
+    tail -1 $tmp/proxy.err >&2
+fi
+
+if [ $failures -gt 0 ]; then
+    echo "temu: $failures failures"
+    exit 1
+fi
+echo "temu: all checks passed"
+exit 0
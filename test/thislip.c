@@ -0,0 +1,189 @@
+/* thislip.c - exercise libhislip against the hislipd stand-in server */
+
+/* With no arguments, starts ./hislipd on an ephemeral port and runs
+ * every test in synchronized then overlapped mode.  Given host[:port],
+ * runs against that server instead (which must behave like hislipd).
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+
+#include <hislip.h>
+
+static int failures = 0;
+
+#define CHECK(h, expr) do {                                             \
+    int _e = (expr);                                                    \
+    if (_e != 0) {                                                      \
+        hislip_perror (h, _e, #expr);                                   \
+        failures++;                                                     \
+        return;                                                         \
+    }                                                                   \
+} while (0)
+
+#define EXPECT(cond, what) do {                                         \
+    if (!(cond)) {                                                      \
+        fprintf (stderr, "thislip: %s: %s\n", (what), #cond);           \
+        failures++;                                                     \
+        return;                                                         \
+    }                                                                   \
+} while (0)
+
+static pid_t
+start_server (unsigned short *portp)
+{
+    int fd[2];
+    pid_t pid;
+    char buf[64];
+    FILE *f;
+
+    if (pipe (fd) < 0) {
+        perror ("pipe");
+        exit (1);
+    }
+    switch ((pid = fork ())) {
+        case -1:
+            perror ("fork");
+            exit (1);
+        case 0:
+            close (fd[0]);
+            dup2 (fd[1], 1);
+            execl ("./hislipd", "hislipd", NULL);
+            perror ("./hislipd");
+            exit (1);
+    }
+    close (fd[1]);
+    if (!(f = fdopen (fd[0], "r")) || !fgets (buf, sizeof (buf), f)
+            || sscanf (buf, "port %hu", portp) != 1) {
+        fprintf (stderr, "thislip: hislipd did not start\n");
+        kill (pid, SIGTERM);
+        exit (1);
+    }
+    fclose (f);
+    return pid;
+}
+
+static void
+run (char *host, unsigned short port, bool overlap)
+{
+    char *big, *buf, *mode = overlap ? "overlapped" : "sync";
+    unsigned char stb;
+    int i, n, len = 10000;
+    hislip_t h;
+
+    printf ("%s\n", mode);
+    if (!(h = hislip_create ()) || !(big = malloc (len))
+            || !(buf = malloc (len + 1))) {
+        fprintf (stderr, "out of memory\n");
+        exit (1);
+    }
+    hislip_set_overlap (h, overlap);
+    hislip_set_iotimeout (h, 5000);
+    CHECK (h, hislip_open (h, host, port, "hislip0"));
+    EXPECT (hislip_overlapped (h) == overlap, mode);
+
+    /* identification */
+    CHECK (h, hislip_writestr (h, "*IDN?"));
+    CHECK (h, hislip_readstr (h, buf, len + 1));
+    EXPECT (!strcmp (buf, "GPIB-UTILS,HISLIPD,0,1\n"), "*IDN?");
+
+    /* message larger than the server's max, response split by server */
+    for (i = 0; i < len - 1; i++)
+        big[i] = 'a' + i % 26;
+    big[len - 1] = '?';
+    CHECK (h, hislip_write (h, big, len));
+    CHECK (h, hislip_read (h, buf, len, &n));
+    EXPECT (n == len && !memcmp (buf, big, len), "large echo");
+
+    /* in sync mode an unread response is abandoned; in overlapped
+     * mode responses queue up in order
+     */
+    CHECK (h, hislip_writestr (h, "A?"));
+    CHECK (h, hislip_writestr (h, "B?"));
+    if (overlap) {
+        CHECK (h, hislip_readstr (h, buf, len + 1));
+        EXPECT (!strcmp (buf, "A?"), "pipelined query 1");
+    }
+    CHECK (h, hislip_readstr (h, buf, len + 1));
+    EXPECT (!strcmp (buf, "B?"), "pipelined query 2");
+
+    /* service request */
+    CHECK (h, hislip_writestr (h, "SRQ"));
+    CHECK (h, hislip_wait_srq (h, 5000));
+    CHECK (h, hislip_readstb (h, &stb));
+    EXPECT (stb & 0x40, "readstb RQS");
+    CHECK (h, hislip_readstb (h, &stb));
+    EXPECT (!(stb & 0x40), "readstb RQS clear");
+
+    /* trigger */
+    CHECK (h, hislip_trigger (h));
+    CHECK (h, hislip_trigger (h));
+    CHECK (h, hislip_writestr (h, "TRG?"));
+    CHECK (h, hislip_readstr (h, buf, len + 1));
+    EXPECT (!strcmp (buf, "2\n"), "trigger count");
+
+    /* locking, remote/local */
+    CHECK (h, hislip_lock (h, NULL));
+    CHECK (h, hislip_unlock (h));
+    CHECK (h, hislip_remote (h));
+    CHECK (h, hislip_local (h));
+
+    /* device clear discards the unread response */
+    CHECK (h, hislip_writestr (h, "C?"));
+    CHECK (h, hislip_clear (h));
+    EXPECT (hislip_overlapped (h) == overlap, "mode after clear");
+    CHECK (h, hislip_writestr (h, "D?"));
+    CHECK (h, hislip_readstr (h, buf, len + 1));
+    EXPECT (!strcmp (buf, "D?"), "query after clear");
+
+    hislip_close (h);
+    hislip_destroy (h);
+    free (big);
+    free (buf);
+}
+
+int
+main (int argc, char *argv[])
+{
+    unsigned short port = 0;
+    char *host = "127.0.0.1", *p;
+    pid_t pid = 0;
+
+    if (argc > 2) {
+        fprintf (stderr, "Usage: thislip [host[:port]]\n");
+        exit (1);
+    }
+    if (argc == 2) {
+        host = argv[1];
+        if ((p = strchr (host, ':'))) {
+            *p++ = '\0';
+            port = strtoul (p, NULL, 10);
+        }
+    } else
+        pid = start_server (&port);
+    run (host, port, false);
+    run (host, port, true);
+    if (pid > 0) {
+        kill (pid, SIGTERM);
+        waitpid (pid, NULL, 0);
+    }
+    if (failures > 0)
+        fprintf (stderr, "thislip: %d failures\n", failures);
+    return failures > 0 ? 1 : 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
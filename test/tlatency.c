@@ -0,0 +1,156 @@
+/* tlatency.c - measure small message round trip latency over vxi11 */
+
+/* Times a write / readstb / read sequence (the pattern libinst uses for
+ * every query when a serial poll function is registered), first with
+ * TCP_NODELAY disabled, then enabled, and prints a summary of each,
+ * followed by the handle's RPC statistics.  Exits 1 if an RPC failed or
+ * timed out, a read did not end with END, or the median with TCP_NODELAY
+ * is MAX_MEDIAN_MS or more, as when small messages wait on a delayed ACK
+ * (about 40ms on Linux).
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+
+#include <vxi11_device.h>
+
+#define MAX_MEDIAN_MS   20
+
+void
+usage (void)
+{
+    fprintf (stderr, "Usage: tlatency hostname:inst0 [iterations]\n");
+    exit (1);
+}
+
+static double
+now (void)
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1E-6;
+}
+
+static int
+cmpdouble (const void *a, const void *b)
+{
+    double x = *(double *)a, y = *(double *)b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Return the median time in msec.
+ */
+static double
+run (vxi11dev_t v, bool nodelay, double *t, int n)
+{
+    unsigned char stb;
+    char buf[80];
+    double sum = 0, t0;
+    int i, err;
+
+    vxi11_set_nodelay (v, nodelay);
+    for (i = 0; i < n; i++) {
+        t0 = now ();
+        if ((err = vxi11_write (v, "*IDN?", 5)) != 0
+                || (err = vxi11_readstb (v, &stb)) != 0
+                || (err = vxi11_readstr (v, buf, sizeof (buf))) != 0) {
+            vxi11_perror (v, err, "tlatency");
+            exit (1);
+        }
+        t[i] = now () - t0;
+        sum += t[i];
+    }
+    qsort (t, n, sizeof (double), cmpdouble);
+    printf ("nodelay=%d: n=%d mean=%.3fms min=%.3fms median=%.3fms "
+            "p99=%.3fms max=%.3fms\n", nodelay, n, sum / n * 1E3,
+            t[0] * 1E3, t[n / 2] * 1E3, t[(n * 99) / 100] * 1E3,
+            t[n - 1] * 1E3);
+    return t[n / 2] * 1E3;
+}
+
+/* Return the count of RPC errors, timeouts and reads not ended by END.
+ */
+static unsigned long
+stats (vxi11dev_t v)
+{
+    static char *names[VXI11_NPROCS] = { "create_link", "destroy_link",
+        "write", "read", "readstb", "trigger", "clear", "remote", "local",
+        "lock", "unlock", "abort", "docmd" };
+    struct vxi11_stats s;
+    unsigned long errors = 0;
+    int i, b;
+
+    vxi11_get_stats (v, &s);
+    for (i = 0; i < VXI11_NPROCS; i++) {
+        if (s.rpcs[i] == 0)
+            continue;
+        printf ("%-12s rpcs=%lu errors=%lu usec:", names[i], s.rpcs[i],
+                s.errors[i]);
+        errors += s.errors[i];
+        for (b = 0; b < VXI11_STATS_BUCKETS; b++)
+            if (s.latency[i][b] > 0)
+                printf (" %lu:%lu", 1UL << b, s.latency[i][b]);
+        printf ("\n");
+    }
+    printf ("writes=%lu chunks=%lu bytes=%llu reads=%lu bytes=%llu "
+            "end=%lu chr=%lu reqcnt=%lu timeouts=%lu\n",
+            s.writes, s.write_chunks, s.bytes_written, s.reads, s.bytes_read,
+            s.reason_end, s.reason_chr, s.reason_reqcnt, s.timeouts);
+    if (s.reason_end < s.reads)
+        errors += s.reads - s.reason_end;
+    return errors + s.timeouts;
+}
+
+int
+main (int argc, char *argv[])
+{
+    vxi11dev_t v;
+    int err, n = 100;
+    unsigned long errors;
+    double *t, median;
+
+    if (argc != 2 && argc != 3)
+        usage ();
+    if (argc == 3 && (n = strtoul (argv[2], NULL, 10)) == 0)
+        usage ();
+    if (!(v = vxi11_create ()) || !(t = malloc (n * sizeof (double)))) {
+        fprintf (stderr, "out of memory");
+        exit (1);
+    }
+    if ((err = vxi11_open (v, argv[1], false)) != 0) {
+        vxi11_perror (v, err, "vxi11_open");
+        exit (1);
+    }
+    run (v, false, t, n);
+    median = run (v, true, t, n);
+    errors = stats (v);
+    vxi11_close (v);
+    vxi11_destroy (v);
+    free (t);
+    if (errors > 0) {
+        fprintf (stderr, "tlatency: %lu errors\n", errors);
+        exit (1);
+    }
+    if (median >= MAX_MEDIAN_MS) {
+        fprintf (stderr, "tlatency: median %.3fms with nodelay, "
+                 "expected under %dms\n", median, MAX_MEDIAN_MS);
+        exit (1);
+    }
+    return 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,301 @@
+/* trpc.c - exercise the event driven RPC engine against a vxi11 device */
+
+/* Opens 'links' connections to host (using the portmapper unless a port
+ * is given), creates an inst0 link on each, then times device_readstb
+ * round trips issued one at a time and issued all at once, and finally
+ * a pipelined *IDN? write/read per link.  Every response is checked: the
+ * device errors must be 0, and each *IDN? reply must be the expected one
+ * if given, else the same as the first link's.  Exits 1 on a mismatch.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+#include <rpc/rpc.h>
+#include <rpc/pmap_clnt.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+
+#include <vxi11.h>
+#include <vxi11_rpc.h>
+
+#define TIMEOUT 10000
+
+struct link {
+    vxi11_conn_t        conn;
+    long                lid;
+    Device_ReadStbResp  stb;
+    Device_WriteResp    wr;
+    Device_ReadResp     rd;
+    enum clnt_stat      stat;
+};
+
+void
+usage (void)
+{
+    fprintf (stderr, "Usage: trpc hostname[:port] [links] [iterations] "
+                     "[idn]\n");
+    exit (1);
+}
+
+static double
+now (void)
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1E-6;
+}
+
+static void
+done (enum clnt_stat stat, void *arg)
+{
+    struct link *l = arg;
+
+    if (stat != RPC_SUCCESS) {
+        fprintf (stderr, "trpc: %s\n", clnt_sperrno (stat));
+        exit (1);
+    }
+    l->stat = stat;
+}
+
+static void
+drain (vxi11_rpc_t r)
+{
+    while (vxi11_rpc_pending (r) > 0) {
+        if (vxi11_rpc_run (r, -1) < 0) {
+            perror ("vxi11_rpc_run");
+            exit (1);
+        }
+    }
+}
+
+static void
+open_links (vxi11_rpc_t r, struct sockaddr_in *sin, struct link *l, int n)
+{
+    Create_LinkParms parms;
+    Create_LinkResp *resp;
+    int i;
+
+    if (!(resp = calloc (n, sizeof (*resp)))) {
+        fprintf (stderr, "out of memory\n");
+        exit (1);
+    }
+    memset (&parms, 0, sizeof (parms));
+    parms.lock_timeout = TIMEOUT;
+    parms.device = "inst0";
+    for (i = 0; i < n; i++) {
+        if (vxi11_rpc_connect (r, sin, DEVICE_CORE, DEVICE_CORE_VERSION,
+                               &l[i].conn) < 0) {
+            perror ("vxi11_rpc_connect");
+            exit (1);
+        }
+        if (vxi11_rpc_core_call (l[i].conn, create_link, &parms, &resp[i],
+                                 TIMEOUT, done, &l[i]) != RPC_SUCCESS) {
+            fprintf (stderr, "trpc: create_link failed\n");
+            exit (1);
+        }
+    }
+    drain (r);
+    for (i = 0; i < n; i++) {
+        if (resp[i].error != 0) {
+            fprintf (stderr, "trpc: create_link: error %ld\n",
+                     (long)resp[i].error);
+            exit (1);
+        }
+        l[i].lid = resp[i].lid;
+    }
+    free (resp);
+}
+
+static int
+readstb (vxi11_rpc_t r, struct link *l, int n, int iter, bool pipelined)
+{
+    Device_GenericParms parms;
+    double t0 = now (), t;
+    int i, j, errors = 0;
+
+    memset (&parms, 0, sizeof (parms));
+    parms.io_timeout = TIMEOUT;
+    parms.lock_timeout = TIMEOUT;
+    for (j = 0; j < iter; j++) {
+        for (i = 0; i < n; i++) {
+            parms.lid = l[i].lid;
+            memset (&l[i].stb, 0, sizeof (l[i].stb));
+            if (vxi11_rpc_core_call (l[i].conn, device_readstb, &parms,
+                                     &l[i].stb, TIMEOUT,
+                                     pipelined ? done : NULL,
+                                     &l[i]) != RPC_SUCCESS) {
+                fprintf (stderr, "trpc: device_readstb failed\n");
+                exit (1);
+            }
+        }
+        drain (r);
+        for (i = 0; i < n; i++) {
+            if (l[i].stb.error != 0) {
+                fprintf (stderr, "trpc: link %d: device_readstb: error %ld\n",
+                         i, (long)l[i].stb.error);
+                errors++;
+            }
+        }
+    }
+    t = now () - t0;
+    printf ("readstb %s: %d calls in %.3fs (%.0f/s)\n",
+            pipelined ? "pipelined" : "one at a time", n * iter, t,
+            n * iter / t);
+    return errors;
+}
+
+/* Return the length of reply 'rd' without its line terminator.
+ */
+static int
+reply_len (Device_ReadResp *rd)
+{
+    int len = rd->data.data_len;
+
+    while (len > 0 && (rd->data.data_val[len - 1] == '\n'
+                    || rd->data.data_val[len - 1] == '\r'))
+        len--;
+    return len;
+}
+
+static int
+query (vxi11_rpc_t r, struct link *l, int n, char *idn)
+{
+    Device_WriteParms wparms;
+    Device_ReadParms rparms;
+    char *want = idn;
+    int wantlen = idn ? strlen (idn) : -1;
+    int i, len, errors = 0;
+
+    memset (&wparms, 0, sizeof (wparms));
+    wparms.io_timeout = TIMEOUT;
+    wparms.flags = VXI11_FLAG_ENDW;
+    wparms.data.data_val = "*IDN?";
+    wparms.data.data_len = 5;
+    memset (&rparms, 0, sizeof (rparms));
+    rparms.io_timeout = TIMEOUT;
+    rparms.requestSize = 256;
+    /* the links share one device: stop each read after one reply */
+    rparms.flags = VXI11_FLAG_TERMCHRSET;
+    rparms.termChar = '\n';
+    for (i = 0; i < n; i++) {
+        wparms.lid = rparms.lid = l[i].lid;
+        memset (&l[i].wr, 0, sizeof (l[i].wr));
+        memset (&l[i].rd, 0, sizeof (l[i].rd));
+        if (vxi11_rpc_core_call (l[i].conn, device_write, &wparms, &l[i].wr,
+                                 TIMEOUT, done, &l[i]) != RPC_SUCCESS
+                || vxi11_rpc_core_call (l[i].conn, device_read, &rparms,
+                                        &l[i].rd, TIMEOUT, done, &l[i])
+                                        != RPC_SUCCESS) {
+            fprintf (stderr, "trpc: query failed\n");
+            exit (1);
+        }
+    }
+    drain (r);
+    for (i = 0; i < n; i++) {
+        len = reply_len (&l[i].rd);
+        printf ("link %d: %.*s\n", i, len, l[i].rd.data.data_val);
+        if (l[i].wr.error != 0 || l[i].wr.size != wparms.data.data_len) {
+            fprintf (stderr, "trpc: link %d: device_write: error %ld, "
+                     "%lu bytes\n", i, (long)l[i].wr.error,
+                     (unsigned long)l[i].wr.size);
+            errors++;
+        } else if (l[i].rd.error != 0
+                   || !(l[i].rd.reason & (VXI11_REASON_END
+                                          | VXI11_REASON_CHR))) {
+            fprintf (stderr, "trpc: link %d: device_read: error %ld, "
+                     "reason %ld\n", i, (long)l[i].rd.error,
+                     (long)l[i].rd.reason);
+            errors++;
+        } else if (wantlen < 0) {           /* the first good reply */
+            want = l[i].rd.data.data_val;
+            wantlen = len;
+        } else if (len != wantlen
+                   || memcmp (l[i].rd.data.data_val, want, len) != 0) {
+            fprintf (stderr, "trpc: link %d: expected %.*s\n", i, wantlen,
+                     want);
+            errors++;
+        }
+    }
+    for (i = 0; i < n; i++)
+        xdr_free ((xdrproc_t)xdr_Device_ReadResp, (char *)&l[i].rd);
+    return errors;
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct sockaddr_in sin;
+    struct hostent *hp;
+    struct link *l;
+    Device_Link lid;
+    Device_Error err;
+    vxi11_rpc_t r;
+    int i, n = 4, iter = 100, errors = 0;
+    unsigned short port = 0;
+    char *p, *idn = NULL;
+
+    if (argc < 2 || argc > 5)
+        usage ();
+    if ((p = strchr (argv[1], ':'))) {
+        *p++ = '\0';
+        port = strtoul (p, NULL, 10);
+    }
+    if (argc > 2 && (n = strtoul (argv[2], NULL, 10)) == 0)
+        usage ();
+    if (argc > 3 && (iter = strtoul (argv[3], NULL, 10)) == 0)
+        usage ();
+    if (argc > 4)
+        idn = argv[4];
+    if (!(hp = gethostbyname (argv[1]))) {
+        fprintf (stderr, "trpc: unknown host %s\n", argv[1]);
+        exit (1);
+    }
+    memset (&sin, 0, sizeof (sin));
+    sin.sin_family = AF_INET;
+    memcpy (&sin.sin_addr, hp->h_addr, sizeof (sin.sin_addr));
+    if (port == 0 && (port = pmap_getport (&sin, DEVICE_CORE,
+                                           DEVICE_CORE_VERSION,
+                                           IPPROTO_TCP)) == 0) {
+        fprintf (stderr, "trpc: portmapper query failed\n");
+        exit (1);
+    }
+    sin.sin_port = htons (port);
+    if (!(r = vxi11_rpc_create ()) || !(l = calloc (n, sizeof (*l)))) {
+        fprintf (stderr, "out of memory\n");
+        exit (1);
+    }
+    open_links (r, &sin, l, n);
+    errors += readstb (r, l, n, iter, false);
+    errors += readstb (r, l, n, iter, true);
+    errors += query (r, l, n, idn);
+    for (i = 0; i < n; i++) {
+        lid = l[i].lid;
+        memset (&err, 0, sizeof (err));
+        (void)vxi11_rpc_core_call (l[i].conn, destroy_link, &lid, &err,
+                                   TIMEOUT, NULL, NULL);
+        vxi11_rpc_disconnect (l[i].conn);
+    }
+    vxi11_rpc_destroy (r);
+    free (l);
+    if (errors > 0) {
+        fprintf (stderr, "trpc: %d errors\n", errors);
+        exit (1);
+    }
+    return 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
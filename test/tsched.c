@@ -0,0 +1,125 @@
+/* tsched.c - run queries on several instruments with the libinst scheduler */
+
+/* Each instrument gets 'iterations' bulk priority *IDN? jobs, then one
+ * urgent job, all queued at once.  Every response must match the first
+ * one, and each urgent job must run before the last bulk job on its bus.
+ * The elapsed time should follow the busiest bus, not the number of
+ * instruments.  Buses on one VXI-11 host only run in parallel if their
+ * links have core channels of their own, e.g. with VXI11_MAXCONN=4.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "libinst/inst.h"
+#include "libinst/sched.h"
+
+char *prog = "tsched";
+
+struct target {
+    struct instrument  *gd;
+    char                idn[256];
+    int                 done;       /* bulk jobs done */
+    int                 urgent_at;  /* bulk jobs done when urgent ran */
+    int                 errors;
+};
+
+void
+usage (void)
+{
+    fprintf (stderr, "Usage: tsched iterations addr ...\n");
+    exit (1);
+}
+
+static int
+bulk (struct instrument *gd, void *arg)
+{
+    struct target *t = arg;
+    char buf[256];
+
+    if (inst_qrystr (gd, "*IDN?", buf, sizeof (buf)) < 0) {
+        inst_error (gd);
+        inst_clr (gd, 0);           /* drop a response the error left */
+        t->errors++;
+        t->done++;
+        return -1;
+    }
+    if (t->idn[0] == '\0')
+        strcpy (t->idn, buf);
+    else if (strcmp (t->idn, buf) != 0) {
+        fprintf (stderr, "tsched: response mismatch: %s\n", buf);
+        t->errors++;
+    }
+    t->done++;
+    return 0;
+}
+
+static int
+urgent (struct instrument *gd, void *arg)
+{
+    struct target *t = arg;
+    unsigned char stb;
+
+    inst_rsp (gd, &stb);
+    t->urgent_at = t->done;
+    return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct target *t;
+    struct timeval t1, t2;
+    inst_sched_t s;
+    int i, j, n, iter, errors = 0;
+
+    if (argc < 3 || (iter = strtoul (argv[1], NULL, 10)) == 0)
+        usage ();
+    n = argc - 2;
+    if (!(t = calloc (n, sizeof (*t)))) {
+        fprintf (stderr, "out of memory\n");
+        exit (1);
+    }
+    for (i = 0; i < n; i++) {
+        if (!(t[i].gd = inst_init (argv[i + 2], NULL, 0)))
+            exit (1);
+        printf ("%s: bus %s\n", argv[i + 2], inst_bus (t[i].gd));
+    }
+    s = inst_sched_create ();
+    gettimeofday (&t1, NULL);
+    for (j = 0; j < iter; j++)
+        for (i = 0; i < n; i++)
+            inst_sched_submit (s, t[i].gd, INST_PRIO_BULK, bulk, &t[i], NULL);
+    for (i = 0; i < n; i++)
+        inst_sched_submit (s, t[i].gd, INST_PRIO_URGENT, urgent, &t[i], NULL);
+    inst_sched_wait (s);
+    gettimeofday (&t2, NULL);
+    inst_sched_destroy (s);
+    for (i = 0; i < n; i++) {
+        if (t[i].done != iter) {
+            fprintf (stderr, "tsched: %s: %d jobs did not run\n",
+                     argv[i + 2], iter - t[i].done);
+            t[i].errors += iter - t[i].done;
+        }
+        if (iter > 1 && t[i].urgent_at == iter) {
+            fprintf (stderr, "tsched: %s: urgent job ran last\n", argv[i + 2]);
+            t[i].errors++;
+        }
+        errors += t[i].errors;
+        inst_fini (t[i].gd);
+    }
+    printf ("%d instruments x %d queries: %.3fs, %d errors\n", n, iter,
+            (t2.tv_sec - t1.tv_sec) + (t2.tv_usec - t1.tv_usec) * 1E-6,
+            errors);
+    free (t);
+    return errors > 0 ? 1 : 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,117 @@
+/* tthread.c - drive vxi11 links from several threads at once */
+
+/* One thread per device name opens its own handle and repeats *IDN?
+ * and a serial poll, checking that every response matches the first one
+ * it read.  Links to the same host (e.g. gpib0,1 and gpib0,2 on one
+ * gateway) share a core channel unless VXI11_MAXCONN says otherwise,
+ * so this exercises both shared and separate channels.  Don't name one
+ * instrument twice: its output queue would be shared by the threads.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#if HAVE_STDBOOL_H
+#include <stdbool.h>
+#else
+typedef enum { false=0, true=1 } bool;
+#endif
+
+#include <vxi11_device.h>
+
+struct worker {
+    pthread_t   t;
+    char        *name;
+    int         iter;
+    int         errors;
+};
+
+void
+usage (void)
+{
+    fprintf (stderr, "Usage: tthread iterations hostname:inst0 ...\n");
+    exit (1);
+}
+
+static void *
+worker (void *arg)
+{
+    struct worker *w = arg;
+    char idn[256], buf[256];
+    unsigned char stb;
+    vxi11dev_t v;
+    int i, err;
+
+    if (!(v = vxi11_create ())) {
+        fprintf (stderr, "out of memory\n");
+        exit (1);
+    }
+    if ((err = vxi11_open (v, w->name, false)) != 0) {
+        vxi11_perror (v, err, "vxi11_open");
+        w->errors++;
+        goto done;
+    }
+    for (i = 0; i < w->iter; i++) {
+        /* changes the shared channel's RPC timeout under other threads */
+        vxi11_set_iotimeout (v, 5000 + (i % 2) * 1000);
+        if ((err = vxi11_writestr (v, "*IDN?")) != 0
+                || (err = vxi11_readstr (v, buf, sizeof (buf))) != 0) {
+            vxi11_perror (v, err, "*IDN?");
+            w->errors++;
+            break;
+        }
+        if ((err = vxi11_readstb (v, &stb)) != 0) {
+            vxi11_perror (v, err, "vxi11_readstb");
+            w->errors++;
+            break;
+        }
+        if (i == 0)
+            strcpy (idn, buf);
+        else if (strcmp (idn, buf) != 0) {
+            fprintf (stderr, "tthread: response mismatch: %s", buf);
+            w->errors++;
+        }
+    }
+    vxi11_close (v);
+done:
+    vxi11_destroy (v);
+    return NULL;
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct worker *w;
+    int i, n, iter, errors = 0;
+
+    if (argc < 3 || (iter = strtoul (argv[1], NULL, 10)) == 0)
+        usage ();
+    n = argc - 2;
+    if (!(w = calloc (n, sizeof (*w)))) {
+        fprintf (stderr, "out of memory\n");
+        exit (1);
+    }
+    for (i = 0; i < n; i++) {
+        w[i].name = argv[i + 2];
+        w[i].iter = iter;
+        if (pthread_create (&w[i].t, NULL, worker, &w[i]) != 0) {
+            perror ("pthread_create");
+            exit (1);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        pthread_join (w[i].t, NULL);
+        errors += w[i].errors;
+    }
+    printf ("%d threads x %d queries: %d errors\n", n, iter, errors);
+    free (w);
+    return errors > 0 ? 1 : 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,154 @@
+/* ttrace.c - exercise the libvxi11 trace ring */
+
+/* Records operations directly with vxi11_trace_begin ()/vxi11_trace_end (),
+ * reads them back with vxi11_trace_get () and vxi11_trace_dump (), then
+ * overruns the ring and checks that only the newest VXI11_TRACE_SIZE
+ * records are kept, oldest first.  The lid of each record is its index.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vxi11_trace.h>
+
+static int failures = 0;
+
+#define EXPECT(cond, what) do {                                         \
+    if (!(cond)) {                                                      \
+        fprintf (stderr, "ttrace: %s: %s\n", (what), #cond);            \
+        failures++;                                                     \
+        return;                                                         \
+    }                                                                   \
+} while (0)
+
+static int recorded = 0;
+
+static void
+record (int op, unsigned long arg, unsigned long in, unsigned long out,
+        unsigned long result, int err, long delay_ms)
+{
+    struct timespec t0, d = { 0, delay_ms * 1000000 };
+
+    vxi11_trace_begin (&t0);
+    if (delay_ms > 0)
+        nanosleep (&d, NULL);
+    vxi11_trace_end (&t0, op, recorded++, 0x10, arg, in, out, result, err);
+}
+
+/* Dump the ring to a temporary file and read it back into 'lines'.
+ * Returns the number of lines.
+ */
+static int
+dump (char lines[][256], int max)
+{
+    FILE *f;
+    int n = 0;
+
+    if (!(f = tmpfile ())) {
+        perror ("tmpfile");
+        exit (1);
+    }
+    vxi11_trace_dump (fileno (f));
+    rewind (f);
+    while (n < max && fgets (lines[n], 256, f))
+        n++;
+    fclose (f);
+    return n;
+}
+
+static void
+test_records (void)
+{
+    struct vxi11_trace_rec recs[4];
+    char lines[4][256];
+
+    EXPECT (vxi11_trace_get (recs, 4) == 0, "empty ring");
+    record (VXI11_TR_WRITE, 1000, 5, 0, 0, 0, 0);
+    record (VXI11_TR_READ, '\n', 0, 6, 4, 0, 20);
+    record (VXI11_TR_LOCK, 500, 0, 0, 0, 11, 0);
+
+    EXPECT (vxi11_trace_get (recs, 4) == 3, "get three records");
+    EXPECT (recs[0].op == VXI11_TR_WRITE && recs[0].lid == 0
+            && recs[0].flags == 0x10 && recs[0].arg == 1000
+            && recs[0].in == 5 && recs[0].out == 0 && recs[0].err == 0,
+            "write record");
+    EXPECT (recs[1].op == VXI11_TR_READ && recs[1].lid == 1
+            && recs[1].arg == '\n' && recs[1].out == 6
+            && recs[1].result == 4, "read record");
+    EXPECT (recs[1].usec >= 20000 && recs[1].usec < 10000000,
+            "read record duration");
+    EXPECT (recs[1].start > recs[0].start, "read record start");
+    EXPECT (recs[2].op == VXI11_TR_LOCK && recs[2].lid == 2
+            && recs[2].err == 11, "lock record");
+
+    EXPECT (vxi11_trace_get (recs, 2) == 2, "get newest two");
+    EXPECT (recs[0].lid == 1 && recs[1].lid == 2, "newest two records");
+
+    EXPECT (dump (lines, 4) == 4, "dump line count");
+    EXPECT (strcmp (lines[0], "vxi11 trace: 3 records (0 dropped)\n") == 0,
+            "dump header");
+    EXPECT (strstr (lines[1], " write        lid=0 flags=0x10"
+                    " io_timeout=1000 in=5 out=0 = 0 (") != NULL,
+            "dump write line");
+    EXPECT (strstr (lines[2], " read         lid=1 flags=0x10 termChar=10"
+                    " in=0 out=6 reason=4 = 0 (") != NULL,
+            "dump read line");
+    EXPECT (strstr (lines[3], " lock         lid=2 flags=0x10"
+                    " lock_timeout=500 = 11 (") != NULL,
+            "dump lock line");
+}
+
+static void
+test_wrap (void)
+{
+    static struct vxi11_trace_rec recs[VXI11_TRACE_SIZE + 1];
+    static char lines[VXI11_TRACE_SIZE + 2][256];
+    char want[64];
+    int i, n, first;
+
+    while (recorded < VXI11_TRACE_SIZE + 100)
+        record (VXI11_TR_RPC_CALL, 0, 0, 0, recorded, 0, 0);
+    first = recorded - VXI11_TRACE_SIZE;
+
+    n = vxi11_trace_get (recs, VXI11_TRACE_SIZE + 1);
+    EXPECT (n == VXI11_TRACE_SIZE, "get full ring");
+    for (i = 0; i < n; i++)
+        EXPECT (recs[i].lid == first + i, "full ring in order");
+
+    EXPECT (vxi11_trace_get (recs, 5) == 5, "get newest five");
+    for (i = 0; i < 5; i++)
+        EXPECT (recs[i].lid == recorded - 5 + i, "newest five in order");
+
+    n = dump (lines, VXI11_TRACE_SIZE + 2);
+    EXPECT (n == VXI11_TRACE_SIZE + 1, "dump full ring line count");
+    snprintf (want, sizeof (want), "vxi11 trace: %d records (%d dropped)\n",
+              VXI11_TRACE_SIZE, first);
+    EXPECT (strcmp (lines[0], want) == 0, "dump full ring header");
+    snprintf (want, sizeof (want), " lid=%d ", first);
+    EXPECT (strstr (lines[1], want) != NULL, "dump oldest kept record");
+    snprintf (want, sizeof (want), " lid=%d ", recorded - 1);
+    EXPECT (strstr (lines[n - 1], want) != NULL, "dump newest record");
+}
+
+int
+main (int argc, char *argv[])
+{
+    if (argc > 1) {
+        fprintf (stderr, "Usage: ttrace\n");
+        exit (1);
+    }
+    test_records ();
+    test_wrap ();
+    if (failures > 0)
+        fprintf (stderr, "ttrace: %d failures\n", failures);
+    return failures > 0 ? 1 : 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */